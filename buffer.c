@@ -95,6 +95,7 @@
 #include "evthread-internal.h"
 #include "evbuffer-internal.h"
 #include "bufferevent-internal.h"
+#include "event-internal.h"
 
 /* some systems do not have MAP_FAILED */
 #ifndef MAP_FAILED
@@ -116,6 +117,32 @@
 #define SENDFILE_IS_SOLARIS	1
 #endif
 
+/* huge-page chain support */
+#if defined(EVENT__HAVE_MMAP) && defined(MADV_HUGEPAGE) && \
+    (defined(MAP_ANONYMOUS) || defined(MAP_ANON))
+#define USE_HUGEPAGE_CHAINS	1
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/* ring buffers backed by one memory object mapped twice in a row */
+#if defined(EVENT__HAVE_MMAP) && defined(EVENT__HAVE_MEMFD_CREATE) && \
+    defined(MAP_FIXED) && (defined(MAP_ANONYMOUS) || defined(MAP_ANON))
+#define USE_MIRRORED_RING	1
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/* Size and alignment of the mappings behind huge-page chains. */
+#define EVBUFFER_HUGE_CHUNK_SIZE	(2*1024*1024)
+/* With EVBUFFER_FLAG_HUGEPAGES, a chain this large, or any chain added to a
+ * buffer that already holds this much, comes from a huge-page mapping. */
+#define EVBUFFER_HUGE_CHAIN_THRESHOLD	(256*1024)
+/* Number of unused huge chunks we keep around for reuse. */
+#define EVBUFFER_HUGE_POOL_MAX		16
+
 /* Mask of user-selectable callback flags. */
 #define EVBUFFER_CB_USER_FLAGS	    0xffff
 /* Mask of all internal-use-only flags. */
@@ -127,7 +154,9 @@
 /* evbuffer_chain support */
 #define CHAIN_SPACE_PTR(ch) ((ch)->buffer + (ch)->misalign + (ch)->off)
 #define CHAIN_SPACE_LEN(ch) ((ch)->flags & EVBUFFER_IMMUTABLE ? \
-	    0 : (ch)->buffer_len - ((ch)->misalign + (ch)->off))
+	    0 : (ch)->flags & EVBUFFER_RING_MIRRORED ? \
+	    (ch)->buffer_len - (ch)->off : \
+	    (ch)->buffer_len - ((ch)->misalign + (ch)->off))
 
 #define CHAIN_PINNED(ch)  (((ch)->flags & EVBUFFER_MEM_PINNED_ANY) != 0)
 #define CHAIN_PINNED_R(ch)  (((ch)->flags & EVBUFFER_MEM_PINNED_R) != 0)
@@ -152,6 +181,128 @@ static int evbuffer_ptr_subtract(struct evbuffer *buf, struct evbuffer_ptr *pos,
 static int evbuffer_file_segment_materialize(struct evbuffer_file_segment *seg);
 static inline void evbuffer_chain_incref(struct evbuffer_chain *chain);
 
+#ifdef USE_HUGEPAGE_CHAINS
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+static void *evbuffer_huge_pool_lock_ = NULL;
+#endif
+/* Unused EVBUFFER_HUGE_CHUNK_SIZE mappings, ready to be reused. */
+static void *evbuffer_huge_pool_[EVBUFFER_HUGE_POOL_MAX];
+static int evbuffer_huge_pool_n_ = 0;
+
+/* Return a mapping of 'len' bytes aligned on EVBUFFER_HUGE_CHUNK_SIZE, so
+ * that the kernel can back it with huge pages. */
+static void *
+evbuffer_huge_chunk_alloc(size_t len)
+{
+	char *mem, *aligned;
+	size_t slop;
+
+	if (len == EVBUFFER_HUGE_CHUNK_SIZE) {
+		mem = NULL;
+		EVLOCK_LOCK(evbuffer_huge_pool_lock_, 0);
+		if (evbuffer_huge_pool_n_)
+			mem = evbuffer_huge_pool_[--evbuffer_huge_pool_n_];
+		EVLOCK_UNLOCK(evbuffer_huge_pool_lock_, 0);
+		if (mem)
+			return mem;
+	}
+
+	/* Map an extra chunk's worth, and trim off whatever lies outside the
+	 * aligned region. */
+	mem = mmap(NULL, len + EVBUFFER_HUGE_CHUNK_SIZE, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+	aligned = (char *)(((ev_uintptr_t)mem + EVBUFFER_HUGE_CHUNK_SIZE - 1) &
+	    ~(ev_uintptr_t)(EVBUFFER_HUGE_CHUNK_SIZE - 1));
+	slop = aligned - mem;
+	if (slop)
+		munmap(mem, slop);
+	munmap(aligned + len, EVBUFFER_HUGE_CHUNK_SIZE - slop);
+
+	/* This is only advice; the kernel may not have huge pages to give. */
+	(void)madvise(aligned, len, MADV_HUGEPAGE);
+	return aligned;
+}
+
+static void
+evbuffer_huge_chunk_free(void *mem, size_t len)
+{
+	if (len == EVBUFFER_HUGE_CHUNK_SIZE) {
+		EVLOCK_LOCK(evbuffer_huge_pool_lock_, 0);
+		if (evbuffer_huge_pool_n_ < EVBUFFER_HUGE_POOL_MAX) {
+			evbuffer_huge_pool_[evbuffer_huge_pool_n_++] = mem;
+			mem = NULL;
+		}
+		EVLOCK_UNLOCK(evbuffer_huge_pool_lock_, 0);
+		if (!mem)
+			return;
+	}
+	if (munmap(mem, len) == -1)
+		event_warn("%s: munmap failed", __func__);
+}
+
+static struct evbuffer_chain *
+evbuffer_chain_new_huge(size_t size)
+{
+	struct evbuffer_chain *chain;
+	size_t to_alloc;
+
+	if (size > EVBUFFER_CHAIN_MAX - EVBUFFER_CHAIN_SIZE -
+	    EVBUFFER_HUGE_CHUNK_SIZE)
+		return (NULL);
+	to_alloc = (size + EVBUFFER_CHAIN_SIZE + EVBUFFER_HUGE_CHUNK_SIZE - 1) &
+	    ~(size_t)(EVBUFFER_HUGE_CHUNK_SIZE - 1);
+
+	if ((chain = evbuffer_huge_chunk_alloc(to_alloc)) == NULL)
+		return (NULL);
+
+	memset(chain, 0, EVBUFFER_CHAIN_SIZE);
+	chain->buffer_len = to_alloc - EVBUFFER_CHAIN_SIZE;
+	chain->buffer = EVBUFFER_CHAIN_EXTRA(unsigned char, chain);
+	chain->flags = EVBUFFER_HUGEPAGE;
+	chain->refcnt = 1;
+
+	return (chain);
+}
+
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+int
+evbuffer_global_setup_locks_(const int enable_locks)
+{
+	EVTHREAD_SETUP_GLOBAL_LOCK(evbuffer_huge_pool_lock_, 0);
+	return 0;
+}
+#endif
+
+void
+evbuffer_free_globals_(void)
+{
+	while (evbuffer_huge_pool_n_)
+		munmap(evbuffer_huge_pool_[--evbuffer_huge_pool_n_],
+		    EVBUFFER_HUGE_CHUNK_SIZE);
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+	if (evbuffer_huge_pool_lock_ != NULL) {
+		EVTHREAD_FREE_LOCK(evbuffer_huge_pool_lock_, 0);
+		evbuffer_huge_pool_lock_ = NULL;
+	}
+#endif
+}
+#else
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+int
+evbuffer_global_setup_locks_(const int enable_locks)
+{
+	return 0;
+}
+#endif
+
+void
+evbuffer_free_globals_(void)
+{
+}
+#endif
+
 static struct evbuffer_chain *
 evbuffer_chain_new(size_t size)
 {
@@ -191,6 +342,23 @@ evbuffer_chain_new(size_t size)
 	return (chain);
 }
 
+/* Allocate a chain to hold 'size' more bytes of data in 'buf'. */
+static struct evbuffer_chain *
+evbuffer_chain_new_membuf(struct evbuffer *buf, size_t size)
+{
+#ifdef USE_HUGEPAGE_CHAINS
+	if ((buf->flags & EVBUFFER_FLAG_HUGEPAGES) &&
+	    (size >= EVBUFFER_HUGE_CHAIN_THRESHOLD ||
+		buf->total_len >= EVBUFFER_HUGE_CHAIN_THRESHOLD)) {
+		struct evbuffer_chain *chain = evbuffer_chain_new_huge(size);
+		if (chain)
+			return (chain);
+		/* Fall back to the heap. */
+	}
+#endif
+	return evbuffer_chain_new(size);
+}
+
 static inline void
 evbuffer_chain_free(struct evbuffer_chain *chain)
 {
@@ -248,6 +416,17 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 		evbuffer_decref_and_unlock_(info->source);
 	}
 
+#ifdef USE_HUGEPAGE_CHAINS
+	if (chain->flags & EVBUFFER_HUGEPAGE) {
+		evbuffer_huge_chunk_free(chain,
+		    chain->buffer_len + EVBUFFER_CHAIN_SIZE);
+		return;
+	}
+#endif
+#ifdef USE_MIRRORED_RING
+	if (chain->flags & EVBUFFER_RING_MIRRORED)
+		munmap(chain->buffer, 2 * chain->buffer_len);
+#endif
 	mm_free(chain);
 }
 
@@ -323,13 +502,15 @@ evbuffer_chain_insert(struct evbuffer *buf,
 		buf->last = chain;
 	}
 	buf->total_len += chain->off;
+	if (buf->compact_countdown)
+		--buf->compact_countdown;
 }
 
 static inline struct evbuffer_chain *
 evbuffer_chain_insert_new(struct evbuffer *buf, size_t datlen)
 {
 	struct evbuffer_chain *chain;
-	if ((chain = evbuffer_chain_new(datlen)) == NULL)
+	if ((chain = evbuffer_chain_new_membuf(buf, datlen)) == NULL)
 		return NULL;
 	evbuffer_chain_insert(buf, chain);
 	return chain;
@@ -357,6 +538,15 @@ evbuffer_chain_incref(struct evbuffer_chain *chain)
     ++chain->refcnt;
 }
 
+/** Forget the chain offset index of 'buf'.  Must be called by anything
+ * that removes, replaces, or prepends chains with data in them. */
+static inline void
+evbuffer_chain_index_invalidate(struct evbuffer *buf)
+{
+	ASSERT_EVBUFFER_LOCKED(buf);
+	buf->n_chain_index = 0;
+}
+
 struct evbuffer *
 evbuffer_new(void)
 {
@@ -373,6 +563,155 @@ evbuffer_new(void)
 	return (buffer);
 }
 
+#ifdef USE_MIRRORED_RING
+/* Make a ring chain whose 'capacity' bytes of memory appear twice, back to
+ * back.  'capacity' must be a multiple of the page size. */
+static struct evbuffer_chain *
+evbuffer_ring_chain_new_mirrored(size_t capacity)
+{
+	struct evbuffer_chain *chain;
+	unsigned char *mem = MAP_FAILED;
+	int fd = -1;
+
+	if (capacity > EV_SIZE_MAX / 2)
+		return NULL;
+	if ((chain = mm_calloc(1, EVBUFFER_CHAIN_SIZE)) == NULL)
+		return NULL;
+	if ((fd = memfd_create("evbuffer-ring", MFD_CLOEXEC)) < 0)
+		goto err;
+	if (ftruncate(fd, capacity) < 0)
+		goto err;
+	/* Reserve room for both views, then put them in place over it. */
+	mem = mmap(NULL, 2 * capacity, PROT_NONE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		goto err;
+	if (mmap(mem, capacity, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(mem + capacity, capacity, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	chain->buffer = mem;
+	chain->buffer_len = capacity;
+	chain->flags = EVBUFFER_RING|EVBUFFER_RING_MIRRORED;
+	chain->refcnt = 1;
+	return chain;
+err:
+	if (mem != MAP_FAILED)
+		munmap(mem, 2 * capacity);
+	if (fd >= 0)
+		close(fd);
+	mm_free(chain);
+	return NULL;
+}
+#endif
+
+struct evbuffer *
+evbuffer_new_ring(size_t capacity)
+{
+	struct evbuffer *buffer;
+	struct evbuffer_chain *chain = NULL;
+
+	if (capacity == 0 || capacity > EVBUFFER_CHAIN_MAX)
+		return NULL;
+
+#ifdef USE_MIRRORED_RING
+	{
+		long pagesize = sysconf(_SC_PAGESIZE);
+		if (pagesize > 0) {
+			size_t mask = (size_t)pagesize - 1;
+			if (capacity <= EV_SIZE_MAX - mask)
+				chain = evbuffer_ring_chain_new_mirrored(
+				    (capacity + mask) & ~mask);
+		}
+	}
+#endif
+	if (chain == NULL) {
+		/* A plain chain, which we realign when the free space at
+		 * its end runs short. */
+		if ((chain = evbuffer_chain_new(capacity)) == NULL)
+			return NULL;
+		chain->flags |= EVBUFFER_RING;
+	}
+
+	if ((buffer = evbuffer_new()) == NULL) {
+		evbuffer_chain_free(chain);
+		return NULL;
+	}
+	buffer->ring = 1;
+	buffer->first = buffer->last = chain;
+
+	return buffer;
+}
+
+static void evbuffer_chain_align(struct evbuffer_chain *chain);
+
+/* Make room for 'datlen' more contiguous bytes at the end of the ring
+ * buffer 'buf'.  Requires lock. */
+static int
+evbuffer_ring_make_room(struct evbuffer *buf, size_t datlen)
+{
+	struct evbuffer_chain *chain = buf->first;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+	EVUTIL_ASSERT(buf->ring && chain == buf->last);
+
+	if (chain->buffer_len - chain->off < datlen)
+		return -1;
+	/* Only an unmirrored ring can run out of room at its end. */
+	if (CHAIN_SPACE_LEN(chain) < datlen) {
+		if (CHAIN_PINNED(chain))
+			return -1;
+		evbuffer_chain_align(chain);
+	}
+	return 0;
+}
+
+/* Move 'datlen' bytes from the front of 'src' to the end of 'dst' by
+ * copying, for when one of them is a ring buffer and so cannot give up or
+ * take chains.  Requires both locks. */
+static int
+evbuffer_ring_transfer(struct evbuffer *src, struct evbuffer *dst,
+    size_t datlen)
+{
+	struct evbuffer_chain *chain, *ring;
+	size_t n, copied = 0;
+
+	ASSERT_EVBUFFER_LOCKED(src);
+	ASSERT_EVBUFFER_LOCKED(dst);
+
+	if (datlen > src->total_len)
+		datlen = src->total_len;
+	if (!dst->ring) {
+		/* The data in a ring is always contiguous. */
+		chain = src->first;
+		if (evbuffer_add(dst, chain->buffer + chain->misalign,
+			datlen) < 0)
+			return -1;
+		return evbuffer_drain(src, datlen);
+	}
+
+	if (evbuffer_ring_make_room(dst, datlen) < 0)
+		return -1;
+	ring = dst->first;
+	for (chain = src->first; copied < datlen; chain = chain->next) {
+		n = datlen - copied;
+		if (n > chain->off)
+			n = chain->off;
+		memcpy(CHAIN_SPACE_PTR(ring), chain->buffer + chain->misalign,
+		    n);
+		ring->off += n;
+		copied += n;
+	}
+	dst->total_len += datlen;
+	dst->n_add_for_cb += datlen;
+	evbuffer_invoke_callbacks_(dst);
+
+	return evbuffer_drain(src, datlen);
+}
+
 int
 evbuffer_set_flags(struct evbuffer *buf, ev_uint64_t flags)
 {
@@ -387,6 +726,11 @@ evbuffer_clear_flags(struct evbuffer *buf, ev_uint64_t flags)
 {
 	EVBUFFER_LOCK(buf);
 	buf->flags &= ~(ev_uint32_t)flags;
+	if (flags & EVBUFFER_FLAG_CHAIN_INDEX) {
+		mm_free(buf->chain_index);
+		buf->chain_index = NULL;
+		buf->n_chain_index = buf->chain_index_alloc = 0;
+	}
 	EVBUFFER_UNLOCK(buf);
 	return 0;
 }
@@ -406,10 +750,240 @@ evbuffer_incref_and_lock_(struct evbuffer *buf)
 	++buf->refcnt;
 }
 
+/* Tell the user that the budget of 'base' has been exceeded or has
+ * recovered. */
+static void
+evbuffer_budget_report_cb(struct event_callback *cb, void *arg)
+{
+	struct event_base *base = arg;
+	evbuffer_budget_cb fn;
+	void *fn_arg;
+	size_t allocated;
+	int over;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	fn = base->evbuffer_budget_cb;
+	fn_arg = base->evbuffer_budget_cbarg;
+	allocated = base->evbuffer_allocated;
+	over = base->evbuffer_budget_over;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	if (fn)
+		fn(base, allocated, over, fn_arg);
+}
+
+/* See whether the evbuffers of 'base' have gone over their budget or come
+ * back under it, and act on any change.  Requires base lock. */
+static void
+evbuffer_budget_check(struct event_base *base)
+{
+	const size_t budget = base->evbuffer_budget;
+	int over = base->evbuffer_budget_over;
+
+	if (!over)
+		over = budget && base->evbuffer_allocated > budget;
+	else
+		over = budget && base->evbuffer_allocated > budget - budget / 8;
+	if (over == base->evbuffer_budget_over)
+		return;
+
+	base->evbuffer_budget_over = over;
+	if (!over)
+		bufferevent_budget_wake_all_(base);
+	if (base->evbuffer_budget_cb)
+		event_deferred_cb_schedule_nolock_(base,
+		    &base->evbuffer_budget_report);
+}
+
+/* Measure the memory used by 'buf'.  Requires lock. */
+static void
+evbuffer_get_memory_usage_locked(struct evbuffer *buf,
+    struct evbuffer_memory_usage *usage)
+{
+	struct evbuffer_chain *chain;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+	memset(usage, 0, sizeof(*usage));
+	usage->payload = buf->total_len;
+	for (chain = buf->first; chain; chain = chain->next) {
+		++usage->n_chains;
+		usage->allocated += EVBUFFER_CHAIN_SIZE;
+		/* Chains of these kinds only point at their data. */
+		if (!(chain->flags & (EVBUFFER_REFERENCE|EVBUFFER_FILESEGMENT|
+			    EVBUFFER_MULTICAST)))
+			usage->allocated += chain->buffer_len;
+		else if (chain->flags & EVBUFFER_REFERENCE)
+			usage->allocated +=
+			    sizeof(struct evbuffer_chain_reference);
+		else if (chain->flags & EVBUFFER_FILESEGMENT)
+			usage->allocated +=
+			    sizeof(struct evbuffer_chain_file_segment);
+		else
+			usage->allocated +=
+			    sizeof(struct evbuffer_multicast_parent);
+	}
+}
+
+/* Replace 'removed' with 'added' in the totals that 'base' keeps for its
+ * evbuffers.  Requires base lock. */
+static void
+evbuffer_mem_base_adjust(struct event_base *base,
+    const struct evbuffer_memory_usage *removed,
+    const struct evbuffer_memory_usage *added)
+{
+	base->evbuffer_payload += added->payload - removed->payload;
+	base->evbuffer_allocated += added->allocated - removed->allocated;
+	base->evbuffer_n_chains += added->n_chains - removed->n_chains;
+	evbuffer_budget_check(base);
+}
+
+/* Count 'buf' in the totals of 'base' (which may be NULL) instead of in
+ * those of the base it was counted against before.  Requires lock. */
+static void
+evbuffer_set_mem_base(struct evbuffer *buf, struct event_base *base)
+{
+	static const struct evbuffer_memory_usage none;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+	if (buf->mem_base == base)
+		return;
+	if (buf->mem_base) {
+		struct event_base *old = buf->mem_base;
+		EVBASE_ACQUIRE_LOCK(old, th_base_lock);
+		LIST_REMOVE(buf, mem_next);
+		--old->evbuffer_n_buffers;
+		evbuffer_mem_base_adjust(old, &buf->mem_accounted, &none);
+		EVBASE_RELEASE_LOCK(old, th_base_lock);
+	}
+	buf->mem_base = base;
+	memset(&buf->mem_accounted, 0, sizeof(buf->mem_accounted));
+	if (base) {
+		struct evbuffer_memory_usage usage;
+		evbuffer_get_memory_usage_locked(buf, &usage);
+		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		LIST_INSERT_HEAD(&base->evbuffers, buf, mem_next);
+		++base->evbuffer_n_buffers;
+		evbuffer_mem_base_adjust(base, &none, &usage);
+		buf->mem_accounted = usage;
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+	}
+}
+
+/* Bring the totals of the base that 'buf' is counted against up to date
+ * with its contents, if that base keeps them.  Requires lock. */
+static inline void
+evbuffer_update_mem_base(struct evbuffer *buf)
+{
+	struct evbuffer_memory_usage usage;
+
+	/* Until the base asks for accounting, a buffer stays counted as it
+	 * was when it joined; event_base_set_evbuffer_budget() recounts
+	 * every buffer when it turns accounting on. */
+	if (!buf->mem_base || !buf->mem_base->evbuffer_accounting)
+		return;
+	evbuffer_get_memory_usage_locked(buf, &usage);
+	if (usage.payload == buf->mem_accounted.payload &&
+	    usage.allocated == buf->mem_accounted.allocated &&
+	    usage.n_chains == buf->mem_accounted.n_chains)
+		return;
+	EVBASE_ACQUIRE_LOCK(buf->mem_base, th_base_lock);
+	evbuffer_mem_base_adjust(buf->mem_base, &buf->mem_accounted, &usage);
+	buf->mem_accounted = usage;
+	EVBASE_RELEASE_LOCK(buf->mem_base, th_base_lock);
+}
+
+/* Recount every evbuffer of 'base' as it is now.  Requires base lock. */
+static void
+evbuffer_mem_base_recount_all(struct event_base *base)
+{
+	struct evbuffer_memory_usage usage;
+	struct evbuffer *buf;
+	int busy;
+
+	do {
+		busy = 0;
+		LIST_FOREACH(buf, &base->evbuffers, mem_next) {
+			/* Buffers are locked before the base, so we can only
+			 * try for their locks here.  If a buffer is busy, we
+			 * let go of the base so its holder can finish, and
+			 * come back for it. */
+			if (!EVLOCK_TRY_LOCK_(buf->lock)) {
+				busy = 1;
+				continue;
+			}
+			evbuffer_get_memory_usage_locked(buf, &usage);
+			evbuffer_mem_base_adjust(base, &buf->mem_accounted,
+			    &usage);
+			buf->mem_accounted = usage;
+			EVBUFFER_UNLOCK(buf);
+		}
+		if (busy) {
+			EVBASE_RELEASE_LOCK(base, th_base_lock);
+			EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		}
+	} while (busy);
+}
+
+int
+evbuffer_get_memory_usage(struct evbuffer *buf,
+    struct evbuffer_memory_usage *usage)
+{
+	EVBUFFER_LOCK(buf);
+	evbuffer_get_memory_usage_locked(buf, usage);
+	EVBUFFER_UNLOCK(buf);
+
+	return 0;
+}
+
+void
+event_base_get_evbuffer_totals(struct event_base *base,
+    struct evbuffer_memory_usage *usage, size_t *n_buffers_out)
+{
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (usage) {
+		usage->payload = base->evbuffer_payload;
+		usage->allocated = base->evbuffer_allocated;
+		usage->n_chains = base->evbuffer_n_chains;
+	}
+	if (n_buffers_out)
+		*n_buffers_out = base->evbuffer_n_buffers;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+}
+
+int
+event_base_set_evbuffer_budget(struct event_base *base, size_t limit,
+    unsigned flags, evbuffer_budget_cb cb, void *arg)
+{
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (!base->evbuffer_budget_report.evcb_cb_union.evcb_selfcb)
+		event_deferred_cb_init_(&base->evbuffer_budget_report,
+		    base->nactivequeues / 2,
+		    evbuffer_budget_report_cb, base);
+	base->evbuffer_budget = limit;
+	base->evbuffer_budget_flags = flags;
+	base->evbuffer_budget_cb = cb;
+	base->evbuffer_budget_cbarg = arg;
+	if (!base->evbuffer_accounting) {
+		/* Buffers that change from now on keep their own counts up
+		 * to date; the ones that don't need to be counted now. */
+		base->evbuffer_accounting = 1;
+		evbuffer_mem_base_recount_all(base);
+	}
+	evbuffer_budget_check(base);
+	/* Bufferevents should no longer wait if we've stopped suspending
+	 * them. */
+	if (!(flags & EVBUFFER_BUDGET_SUSPEND_READ))
+		bufferevent_budget_wake_all_(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	return 0;
+}
+
 int
 evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base)
 {
 	EVBUFFER_LOCK(buffer);
+	evbuffer_set_mem_base(buffer, base);
 	buffer->cb_queue = base;
 	buffer->deferred_cbs = 1;
 	event_deferred_cb_init_(&buffer->deferred,
@@ -448,6 +1022,7 @@ evbuffer_set_parent_(struct evbuffer *buf, struct bufferevent *bev)
 {
 	EVBUFFER_LOCK(buf);
 	buf->parent = bev;
+	evbuffer_set_mem_base(buf, bev ? bev->ev_base : NULL);
 	EVBUFFER_UNLOCK(buf);
 }
 
@@ -509,9 +1084,166 @@ evbuffer_run_callbacks(struct evbuffer *buffer, int running_deferred)
 	}
 }
 
+/* Check whether to compact at least this often, counted in appended
+ * chains. */
+#define EVBUFFER_COMPACT_MIN_INTERVAL 16
+/* Runs of small chains are merged into chains of at least this size. */
+#define EVBUFFER_COMPACT_MIN_TARGET 4096
+
+/* True iff 'ch' is a chain whose data compaction may copy elsewhere and
+ * which it may then free. */
+#define CHAIN_MERGEABLE(ch)						\
+	(((ch)->flags & (EVBUFFER_FILESEGMENT|EVBUFFER_SENDFILE|	\
+	    EVBUFFER_REFERENCE|EVBUFFER_IMMUTABLE|EVBUFFER_MEM_PINNED_ANY| \
+	    EVBUFFER_DANGLING|EVBUFFER_MULTICAST|EVBUFFER_RING)) == 0 && \
+	    (ch)->refcnt == 1)
+
+/* Copy runs of adjacent small chains before the last chain with data into
+ * larger chains.  Returns the number of chains merged away.  Requires
+ * lock. */
+static int
+evbuffer_compact_locked(struct evbuffer *buf)
+{
+	struct evbuffer_chain **chp, *chain, *next, *tmp, *dst = NULL;
+	struct evbuffer_chain *last_with_data = *buf->last_with_datap;
+	size_t target = EVBUFFER_COMPACT_MIN_TARGET;
+	size_t copied = 0;
+	int merged = 0;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+
+	if (buf->compact_min_avg > target / 2)
+		target = buf->compact_min_avg * 2;
+
+	for (chp = &buf->first; (chain = *chp) != last_with_data; ) {
+		if (!CHAIN_MERGEABLE(chain) || chain->off >= target / 2) {
+			dst = NULL;
+			chp = &chain->next;
+			continue;
+		}
+		if (dst && CHAIN_SPACE_LEN(dst) >= chain->off) {
+			memcpy(CHAIN_SPACE_PTR(dst),
+			    chain->buffer + chain->misalign, chain->off);
+			dst->off += chain->off;
+			copied += chain->off;
+			*chp = chain->next;
+			evbuffer_chain_free(chain);
+			++merged;
+			continue;
+		}
+
+		/* This chain starts a new run.  If the next chain could join
+		 * the run but would not fit, move this one somewhere
+		 * roomier first. */
+		next = chain->next;
+		if (next != last_with_data && CHAIN_MERGEABLE(next) &&
+		    next->off < target / 2 &&
+		    CHAIN_SPACE_LEN(chain) < next->off &&
+		    (tmp = evbuffer_chain_new(target)) != NULL) {
+			memcpy(tmp->buffer, chain->buffer + chain->misalign,
+			    chain->off);
+			tmp->off = chain->off;
+			tmp->next = next;
+			copied += chain->off;
+			*chp = tmp;
+			evbuffer_chain_free(chain);
+			chain = tmp;
+		}
+		dst = chain;
+		chp = &chain->next;
+	}
+	/* We may have freed or replaced the chain whose 'next' pointed at
+	 * the last chain with data. */
+	buf->last_with_datap = chp;
+
+	if (merged || copied) {
+		evbuffer_chain_index_invalidate(buf);
+		++buf->n_compactions;
+		buf->n_compact_merged += merged;
+		buf->n_compact_copied += copied;
+	}
+
+	return merged;
+}
+
+/* Count the chains in 'buf', compact it if its policy says so, and decide
+ * when to look again.  Requires lock. */
+static void
+evbuffer_maybe_compact(struct evbuffer *buf)
+{
+	struct evbuffer_chain *chain;
+	size_t n_chains = 0;
+
+	for (chain = buf->first; chain; chain = chain->next)
+		++n_chains;
+
+	if ((buf->compact_max_chains && n_chains > buf->compact_max_chains) ||
+	    (buf->compact_min_avg && n_chains > 1 &&
+		buf->total_len / n_chains < buf->compact_min_avg))
+		n_chains -= evbuffer_compact_locked(buf);
+
+	/* Counting takes time in proportion to the number of chains, so
+	 * make the appends between counts pay for it. */
+	buf->compact_countdown = n_chains / 4;
+	if (buf->compact_countdown < EVBUFFER_COMPACT_MIN_INTERVAL)
+		buf->compact_countdown = EVBUFFER_COMPACT_MIN_INTERVAL;
+}
+
+int
+evbuffer_set_compaction(struct evbuffer *buf, size_t max_chains,
+    size_t min_avg_chain_size)
+{
+	EVBUFFER_LOCK(buf);
+	buf->compact_max_chains = max_chains;
+	buf->compact_min_avg = min_avg_chain_size;
+	buf->compact_countdown = 0;
+	EVBUFFER_UNLOCK(buf);
+
+	return 0;
+}
+
+int
+evbuffer_compact(struct evbuffer *buf)
+{
+	int merged;
+
+	EVBUFFER_LOCK(buf);
+	merged = evbuffer_compact_locked(buf);
+	EVBUFFER_UNLOCK(buf);
+
+	return merged;
+}
+
+int
+evbuffer_get_compaction_stats(struct evbuffer *buf,
+    struct evbuffer_compaction_stats *stats)
+{
+	EVBUFFER_LOCK(buf);
+	stats->n_compactions = buf->n_compactions;
+	stats->n_chains_merged = buf->n_compact_merged;
+	stats->n_bytes_copied = buf->n_compact_copied;
+	EVBUFFER_UNLOCK(buf);
+
+	return 0;
+}
+
+/* Apply the compaction policy of 'buf' if a check is due.  Call this only
+ * after removing data from the front of 'buf': that invalidates every
+ * evbuffer_ptr into it anyway, whereas appending must not.  Requires
+ * lock. */
+static inline void
+evbuffer_compact_if_due(struct evbuffer *buf)
+{
+	if (buf->compact_countdown == 0 &&
+	    (buf->compact_max_chains || buf->compact_min_avg))
+		evbuffer_maybe_compact(buf);
+}
+
 void
 evbuffer_invoke_callbacks_(struct evbuffer *buffer)
 {
+	evbuffer_update_mem_base(buffer);
+
 	if (LIST_EMPTY(&buffer->callbacks)) {
 		buffer->n_add_for_cb = buffer->n_del_for_cb = 0;
 		return;
@@ -565,8 +1297,12 @@ evbuffer_decref_and_unlock_(struct evbuffer *buffer)
 	EVUTIL_ASSERT(buffer->refcnt > 0);
 
 	if (--buffer->refcnt > 0) {
-		EVBUFFER_UNLOCK(buffer);
-		return;
+		if (buffer->refcnt > 1 || !buffer->file_read ||
+		    !evbuffer_file_read_orphaned_(buffer)) {
+			EVBUFFER_UNLOCK(buffer);
+			return;
+		}
+		--buffer->refcnt;
 	}
 
 	for (chain = buffer->first; chain != NULL; chain = next) {
@@ -574,8 +1310,10 @@ evbuffer_decref_and_unlock_(struct evbuffer *buffer)
 		evbuffer_chain_free(chain);
 	}
 	evbuffer_remove_all_callbacks(buffer);
+	evbuffer_set_mem_base(buffer, NULL);
 	if (buffer->deferred_cbs)
 		event_deferred_cb_cancel_(buffer->cb_queue, &buffer->deferred);
+	mm_free(buffer->chain_index);
 
 	EVBUFFER_UNLOCK(buffer);
 	if (buffer->own_lock)
@@ -976,11 +1714,24 @@ evbuffer_add_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		goto done;
 	}
 
+	if (inbuf->ring || outbuf->ring) {
+		result = evbuffer_ring_transfer(inbuf, outbuf, in_total_len);
+		goto done;
+	}
+
 	if (PRESERVE_PINNED(inbuf, &pinned, &last) < 0) {
 		result = -1;
 		goto done;
 	}
 
+	if (outbuf->compact_max_chains || outbuf->compact_min_avg) {
+		struct evbuffer_chain *chain;
+		for (chain = inbuf->first; chain && outbuf->compact_countdown;
+		     chain = chain->next)
+			--outbuf->compact_countdown;
+	}
+
+	evbuffer_chain_index_invalidate(inbuf);
 	if (out_total_len == 0) {
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
@@ -1003,6 +1754,74 @@ done:
 	return result;
 }
 
+ev_ssize_t
+evbuffer_detach_chains_(struct evbuffer *buf, struct evbuffer_chain **firstp,
+    struct evbuffer_chain **lastp)
+{
+	struct evbuffer_chain *last;
+	ev_ssize_t result;
+
+	EVBUFFER_LOCK(buf);
+	*firstp = *lastp = NULL;
+	if (buf->freeze_start || buf->ring || HAS_PINNED_R(buf)) {
+		result = -1;
+		goto done;
+	}
+	result = (ev_ssize_t)buf->total_len;
+	if (result == 0)
+		goto done;
+
+	/* Leave the trailing empty chains where they are, so that space the
+	 * caller has already reserved for its next read is not lost. */
+	last = *buf->last_with_datap;
+	*firstp = buf->first;
+	*lastp = last;
+	buf->first = last->next;
+	last->next = NULL;
+	if (buf->first == NULL)
+		buf->last = NULL;
+	buf->last_with_datap = &buf->first;
+	buf->total_len = 0;
+	evbuffer_chain_index_invalidate(buf);
+
+	buf->n_del_for_cb += result;
+	evbuffer_invoke_callbacks_(buf);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
+int
+evbuffer_attach_chains_(struct evbuffer *buf, struct evbuffer_chain *first,
+    struct evbuffer_chain *last, size_t len)
+{
+	struct evbuffer_chain **chp;
+	int result = 0;
+
+	EVBUFFER_LOCK(buf);
+	if (buf->freeze_end || buf->ring) {
+		result = -1;
+		goto done;
+	}
+	if (first == NULL)
+		goto done;
+
+	chp = evbuffer_free_trailing_empty_chains(buf);
+	*chp = first;
+	buf->last = last;
+	/* 'last' is the last chain with data in the list we were given. */
+	while (*chp != last)
+		chp = &(*chp)->next;
+	buf->last_with_datap = chp;
+	buf->total_len += len;
+
+	buf->n_add_for_cb += len;
+	evbuffer_invoke_callbacks_(buf);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
 int
 evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 {
@@ -1018,7 +1837,8 @@ evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (in_total_len == 0)
 		goto done;
 
-	if (outbuf->freeze_end || outbuf == inbuf) {
+	if (outbuf->freeze_end || outbuf == inbuf ||
+	    outbuf->ring || inbuf->ring) {
 		result = -1;
 		goto done;
 	}
@@ -1031,21 +1851,154 @@ evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		}
 	}
 
-	if (out_total_len == 0) {
-		/* There might be an empty chain at the start of outbuf; free
-		 * it. */
-		evbuffer_free_all_chains(outbuf->first);
+	if (out_total_len == 0) {
+		/* There might be an empty chain at the start of outbuf; free
+		 * it. */
+		evbuffer_free_all_chains(outbuf->first);
+	}
+	APPEND_CHAIN_MULTICAST(outbuf, inbuf);
+
+	outbuf->n_add_for_cb += in_total_len;
+	evbuffer_invoke_callbacks_(outbuf);
+
+done:
+	EVBUFFER_UNLOCK2(inbuf, outbuf);
+	return result;
+}
+
+/* Return a new multicast chain holding 'len' bytes of 'chain' (which
+ * belongs to 'src') starting 'offset' bytes into its data.  If 'chain' is
+ * itself a multicast chain, the new chain refers to its parent instead,
+ * so that references never nest.  Requires lock on src. */
+static struct evbuffer_chain *
+evbuffer_chain_new_multicast(struct evbuffer *src,
+    struct evbuffer_chain *chain, size_t offset, size_t len)
+{
+	struct evbuffer_chain *tmp;
+	struct evbuffer_multicast_parent *extra;
+
+	ASSERT_EVBUFFER_LOCKED(src);
+
+	tmp = evbuffer_chain_new(sizeof(struct evbuffer_multicast_parent));
+	if (!tmp)
+		return NULL;
+	extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_multicast_parent, tmp);
+
+	tmp->buffer = chain->buffer;
+	tmp->buffer_len = chain->buffer_len;
+	tmp->misalign = chain->misalign + offset;
+	tmp->off = len;
+	tmp->flags |= EVBUFFER_MULTICAST|EVBUFFER_IMMUTABLE;
+
+	if (chain->flags & EVBUFFER_MULTICAST) {
+		struct evbuffer_multicast_parent *info =
+		    EVBUFFER_CHAIN_EXTRA(struct evbuffer_multicast_parent,
+			chain);
+		src = info->source;
+		chain = info->parent;
+	}
+
+	/* reference the evbuffer holding the source chain, and the chain
+	 * itself, which now becomes immutable */
+	EVBUFFER_LOCK(src);
+	++src->refcnt;
+	evbuffer_chain_incref(chain);
+	chain->flags |= EVBUFFER_IMMUTABLE;
+	EVBUFFER_UNLOCK(src);
+	extra->source = src;
+	extra->parent = chain;
+
+	return tmp;
+}
+
+int
+evbuffer_add_buffer_reference_range(struct evbuffer *outbuf,
+    struct evbuffer *inbuf, const struct evbuffer_ptr *pos, size_t len)
+{
+	struct evbuffer_chain *chain, *first = NULL, **chp = &first;
+	struct evbuffer_chain *tmp;
+	size_t offset, remaining, n;
+	int result = -1;
+
+	EVBUFFER_LOCK2(inbuf, outbuf);
+
+	if (outbuf->freeze_end || outbuf == inbuf ||
+	    outbuf->ring || inbuf->ring)
+		goto done;
+
+	if (pos) {
+		if (pos->pos < 0 || (size_t)pos->pos > inbuf->total_len ||
+		    len > inbuf->total_len - pos->pos)
+			goto done;
+		chain = pos->internal_.chain;
+		offset = pos->internal_.pos_in_chain;
+	} else {
+		if (len > inbuf->total_len)
+			goto done;
+		chain = inbuf->first;
+		offset = 0;
+	}
+
+	/* Make sure the whole range is in memory before we touch anything. */
+	for (tmp = chain, remaining = len + offset; remaining;
+	     tmp = tmp->next) {
+		EVUTIL_ASSERT(tmp != NULL);
+		if (tmp->flags & EVBUFFER_SENDFILE)
+			goto done;
+		remaining -= remaining < tmp->off ? remaining : tmp->off;
+	}
+
+	for (remaining = len; remaining; chain = chain->next, offset = 0) {
+		if (offset >= chain->off) {
+			offset -= chain->off;
+			continue;
+		}
+		n = chain->off - offset;
+		if (n > remaining)
+			n = remaining;
+		tmp = evbuffer_chain_new_multicast(inbuf, chain, offset, n);
+		if (!tmp) {
+			event_warn("%s: out of memory", __func__);
+			evbuffer_free_all_chains(first);
+			goto done;
+		}
+		*chp = tmp;
+		chp = &tmp->next;
+		remaining -= n;
+	}
+
+	for (chain = first; chain; chain = tmp) {
+		tmp = chain->next;
+		chain->next = NULL;
+		evbuffer_chain_insert(outbuf, chain);
 	}
-	APPEND_CHAIN_MULTICAST(outbuf, inbuf);
 
-	outbuf->n_add_for_cb += in_total_len;
-	evbuffer_invoke_callbacks_(outbuf);
+	if (len) {
+		outbuf->n_add_for_cb += len;
+		evbuffer_invoke_callbacks_(outbuf);
+	}
+	result = 0;
 
 done:
 	EVBUFFER_UNLOCK2(inbuf, outbuf);
 	return result;
 }
 
+struct evbuffer *
+evbuffer_slice(struct evbuffer *buf, const struct evbuffer_ptr *pos,
+    size_t len)
+{
+	struct evbuffer *slice = evbuffer_new();
+
+	if (slice == NULL)
+		return NULL;
+	if (evbuffer_add_buffer_reference_range(slice, buf, pos, len) < 0) {
+		evbuffer_free(slice);
+		return NULL;
+	}
+	return slice;
+}
+
 int
 evbuffer_prepend_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 {
@@ -1061,7 +2014,8 @@ evbuffer_prepend_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (!in_total_len || inbuf == outbuf)
 		goto done;
 
-	if (outbuf->freeze_start || inbuf->freeze_start) {
+	if (outbuf->freeze_start || inbuf->freeze_start ||
+	    outbuf->ring || inbuf->ring) {
 		result = -1;
 		goto done;
 	}
@@ -1071,6 +2025,8 @@ evbuffer_prepend_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		goto done;
 	}
 
+	evbuffer_chain_index_invalidate(inbuf);
+	evbuffer_chain_index_invalidate(outbuf);
 	if (out_total_len == 0) {
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
@@ -1110,7 +2066,14 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 		goto done;
 	}
 
-	if (len >= old_len && !HAS_PINNED_R(buf)) {
+	evbuffer_chain_index_invalidate(buf);
+	if (len >= old_len && buf->ring) {
+		/* Keep the ring's chain, and start again at its front. */
+		len = old_len;
+		buf->first->misalign = 0;
+		buf->first->off = 0;
+		buf->total_len = 0;
+	} else if (len >= old_len && !HAS_PINNED_R(buf)) {
 		len = old_len;
 		for (chain = buf->first; chain != NULL; chain = next) {
 			next = chain->next;
@@ -1149,9 +2112,13 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 		EVUTIL_ASSERT(chain && remaining <= chain->off);
 		chain->misalign += remaining;
 		chain->off -= remaining;
+		if ((chain->flags & EVBUFFER_RING_MIRRORED) &&
+		    (size_t)chain->misalign >= chain->buffer_len)
+			chain->misalign -= chain->buffer_len;
 	}
 
 	buf->n_del_for_cb += len;
+	evbuffer_compact_if_due(buf);
 	/* Tell someone about changes in this buffer */
 	evbuffer_invoke_callbacks_(buf);
 
@@ -1276,6 +2243,16 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 		goto done;
 	}
 
+	if (src->ring || dst->ring) {
+		if (datlen > src->total_len)
+			datlen = src->total_len;
+		if (evbuffer_ring_transfer(src, dst, datlen) < 0)
+			result = -1;
+		else
+			result = (int)datlen;
+		goto done;
+	}
+
 	/* short-cut if there is no more data buffered */
 	if (datlen >= src->total_len) {
 		datlen = src->total_len;
@@ -1284,6 +2261,7 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 		goto done;
 	}
 
+	evbuffer_chain_index_invalidate(src);
 	/* removes chains if possible */
 	while (chain->off <= datlen) {
 		/* We can't remove the last with data from src unless we
@@ -1329,6 +2307,7 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 	 */
 	src->total_len -= nread;
 	src->n_del_for_cb += nread;
+	evbuffer_compact_if_due(src);
 
 	if (nread) {
 		evbuffer_invoke_callbacks_(dst);
@@ -1386,6 +2365,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 			/* not enough room at end of chunk. */
 			goto done;
 		}
+		evbuffer_chain_index_invalidate(buf);
 		buffer = CHAIN_SPACE_PTR(chain);
 		tmp = chain;
 		tmp->off = size;
@@ -1394,6 +2374,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 	} else if (chain->buffer_len - chain->misalign >= (size_t)size) {
 		/* already have enough space in the first chain */
 		size_t old_off = chain->off;
+		evbuffer_chain_index_invalidate(buf);
 		buffer = chain->buffer + chain->misalign + chain->off;
 		tmp = chain;
 		tmp->off = size;
@@ -1404,6 +2385,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 			event_warn("%s: out of memory", __func__);
 			goto done;
 		}
+		evbuffer_chain_index_invalidate(buf);
 		buffer = tmp->buffer;
 		tmp->off = size;
 		buf->first = tmp;
@@ -1673,46 +2655,549 @@ done:
 	if (eol_len_out)
 		*eol_len_out = extra_drain;
 
-	return it;
+	return it;
+}
+
+char *
+evbuffer_readln(struct evbuffer *buffer, size_t *n_read_out,
+		enum evbuffer_eol_style eol_style)
+{
+	struct evbuffer_ptr it;
+	char *line;
+	size_t n_to_copy=0, extra_drain=0;
+	char *result = NULL;
+
+	EVBUFFER_LOCK(buffer);
+
+	if (buffer->freeze_start) {
+		goto done;
+	}
+
+	it = evbuffer_search_eol(buffer, NULL, &extra_drain, eol_style);
+	if (it.pos < 0)
+		goto done;
+	n_to_copy = it.pos;
+
+	if ((line = mm_malloc(n_to_copy+1)) == NULL) {
+		event_warn("%s: out of memory", __func__);
+		goto done;
+	}
+
+	evbuffer_remove(buffer, line, n_to_copy);
+	line[n_to_copy] = '\0';
+
+	evbuffer_drain(buffer, extra_drain);
+	result = line;
+done:
+	EVBUFFER_UNLOCK(buffer);
+
+	if (n_read_out)
+		*n_read_out = result ? n_to_copy : 0;
+
+	return result;
+}
+
+int
+evbuffer_cursor_init(struct evbuffer_cursor *cursor, struct evbuffer *buffer)
+{
+	cursor->buffer = buffer;
+	return evbuffer_ptr_set(buffer, &cursor->ptr, 0, EVBUFFER_PTR_SET);
+}
+
+size_t
+evbuffer_cursor_get_length(const struct evbuffer_cursor *cursor)
+{
+	struct evbuffer *buf = cursor->buffer;
+	size_t result;
+
+	EVBUFFER_LOCK(buf);
+	result = buf->total_len - (size_t)cursor->ptr.pos;
+	EVBUFFER_UNLOCK(buf);
+
+	return result;
+}
+
+const unsigned char *
+evbuffer_cursor_peek(struct evbuffer_cursor *cursor, size_t *len_out)
+{
+	struct evbuffer *buf = cursor->buffer;
+	struct evbuffer_chain *chain;
+	const unsigned char *result = NULL;
+	size_t len = 0;
+
+	EVBUFFER_LOCK(buf);
+	chain = cursor->ptr.internal_.chain;
+	if (chain) {
+		len = chain->off - cursor->ptr.internal_.pos_in_chain;
+		result = chain->buffer + chain->misalign +
+		    cursor->ptr.internal_.pos_in_chain;
+	}
+	EVBUFFER_UNLOCK(buf);
+
+	if (len_out)
+		*len_out = len;
+	return result;
+}
+
+int
+evbuffer_cursor_advance(struct evbuffer_cursor *cursor, size_t len)
+{
+	struct evbuffer *buf = cursor->buffer;
+	int result = -1;
+
+	EVBUFFER_LOCK(buf);
+	if (len <= buf->total_len - (size_t)cursor->ptr.pos)
+		result = evbuffer_ptr_set(buf, &cursor->ptr, len,
+		    EVBUFFER_PTR_ADD);
+	EVBUFFER_UNLOCK(buf);
+
+	return result;
+}
+
+/* Return 'len' bytes at the cursor, in place or copied into 'spill', without
+ * advancing.  Requires lock. */
+static const unsigned char *
+evbuffer_cursor_get(struct evbuffer_cursor *cursor, size_t len, void *spill)
+{
+	struct evbuffer *buf = cursor->buffer;
+	struct evbuffer_chain *chain = cursor->ptr.internal_.chain;
+	size_t pos_in_chain = cursor->ptr.internal_.pos_in_chain;
+
+	if (len > buf->total_len - (size_t)cursor->ptr.pos)
+		return NULL;
+	if (!chain) /* We're at the end, and len is 0. */
+		return (const unsigned char *)"";
+	if (chain->off - pos_in_chain >= len)
+		return chain->buffer + chain->misalign + pos_in_chain;
+	if (evbuffer_copyout_from(buf, &cursor->ptr, spill, len) < 0)
+		return NULL;
+	return spill;
+}
+
+const unsigned char *
+evbuffer_cursor_read(struct evbuffer_cursor *cursor, size_t len, void *spill)
+{
+	struct evbuffer *buf = cursor->buffer;
+	const unsigned char *result;
+
+	EVBUFFER_LOCK(buf);
+	result = evbuffer_cursor_get(cursor, len, spill);
+	if (result)
+		evbuffer_ptr_set(buf, &cursor->ptr, len, EVBUFFER_PTR_ADD);
+	EVBUFFER_UNLOCK(buf);
+
+	return result;
+}
+
+const char *
+evbuffer_cursor_readln(struct evbuffer_cursor *cursor, size_t *n_read_out,
+    enum evbuffer_eol_style eol_style, char *spill, size_t spill_len)
+{
+	struct evbuffer *buf = cursor->buffer;
+	struct evbuffer_chain *chain;
+	struct evbuffer_ptr it;
+	size_t len = 0, eol_len = 0;
+	const char *result = NULL;
+
+	EVBUFFER_LOCK(buf);
+	it = evbuffer_search_eol(buf, &cursor->ptr, &eol_len, eol_style);
+	if (it.pos < 0)
+		goto done;
+	len = it.pos - cursor->ptr.pos;
+
+	/* The search found the line, so the cursor is in a chain. */
+	chain = cursor->ptr.internal_.chain;
+	if (chain->off - cursor->ptr.internal_.pos_in_chain < len &&
+	    len > spill_len)
+		goto done;
+	result = (const char *)evbuffer_cursor_get(cursor, len, spill);
+	if (result)
+		evbuffer_ptr_set(buf, &cursor->ptr, len + eol_len,
+		    EVBUFFER_PTR_ADD);
+done:
+	EVBUFFER_UNLOCK(buf);
+
+	if (n_read_out)
+		*n_read_out = result ? len : 0;
+	return result;
+}
+
+int
+evbuffer_cursor_drain(struct evbuffer_cursor *cursor)
+{
+	struct evbuffer *buf = cursor->buffer;
+	int result;
+
+	EVBUFFER_LOCK(buf);
+	result = evbuffer_drain(buf, cursor->ptr.pos);
+	if (result == 0)
+		result = evbuffer_ptr_set(buf, &cursor->ptr, 0,
+		    EVBUFFER_PTR_SET);
+	EVBUFFER_UNLOCK(buf);
+
+	return result;
+}
+
+/* Copy the 'len' bytes at the cursor into 'out', and advance past them. */
+static int
+evbuffer_cursor_read_fixed(struct evbuffer_cursor *cursor,
+    unsigned char *out, size_t len)
+{
+	struct evbuffer *buf = cursor->buffer;
+	const unsigned char *p;
+	int result = -1;
+
+	EVBUFFER_LOCK(buf);
+	if ((p = evbuffer_cursor_get(cursor, len, out)) != NULL) {
+		if (p != out)
+			memcpy(out, p, len);
+		result = evbuffer_ptr_set(buf, &cursor->ptr, len,
+		    EVBUFFER_PTR_ADD);
+	}
+	EVBUFFER_UNLOCK(buf);
+
+	return result;
+}
+
+int
+evbuffer_cursor_read_u8(struct evbuffer_cursor *cursor, ev_uint8_t *value)
+{
+	return evbuffer_cursor_read_fixed(cursor, value, 1);
+}
+
+int
+evbuffer_cursor_read_u16be(struct evbuffer_cursor *cursor, ev_uint16_t *value)
+{
+	unsigned char b[2];
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	*value = (ev_uint16_t)((b[0] << 8) | b[1]);
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u16le(struct evbuffer_cursor *cursor, ev_uint16_t *value)
+{
+	unsigned char b[2];
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	*value = (ev_uint16_t)((b[1] << 8) | b[0]);
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u32be(struct evbuffer_cursor *cursor, ev_uint32_t *value)
+{
+	unsigned char b[4];
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	*value = ((ev_uint32_t)b[0] << 24) | ((ev_uint32_t)b[1] << 16) |
+	    ((ev_uint32_t)b[2] << 8) | b[3];
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u32le(struct evbuffer_cursor *cursor, ev_uint32_t *value)
+{
+	unsigned char b[4];
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	*value = ((ev_uint32_t)b[3] << 24) | ((ev_uint32_t)b[2] << 16) |
+	    ((ev_uint32_t)b[1] << 8) | b[0];
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u64be(struct evbuffer_cursor *cursor, ev_uint64_t *value)
+{
+	unsigned char b[8];
+	ev_uint64_t v = 0;
+	int i;
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	for (i = 0; i < 8; ++i)
+		v = (v << 8) | b[i];
+	*value = v;
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u64le(struct evbuffer_cursor *cursor, ev_uint64_t *value)
+{
+	unsigned char b[8];
+	ev_uint64_t v = 0;
+	int i;
+	if (evbuffer_cursor_read_fixed(cursor, b, sizeof(b)) < 0)
+		return -1;
+	for (i = 7; i >= 0; --i)
+		v = (v << 8) | b[i];
+	*value = v;
+	return 0;
+}
+
+#define EVBUFFER_VARINT_MAX_LEN 10
+
+/* Decode the varint at the cursor without advancing.  Returns its encoded
+ * length, -1 if it is incomplete, or -2 if it is malformed.  Requires
+ * lock. */
+static int
+evbuffer_cursor_get_varint(struct evbuffer_cursor *cursor, ev_uint64_t *value)
+{
+	struct evbuffer *buf = cursor->buffer;
+	unsigned char spill[EVBUFFER_VARINT_MAX_LEN];
+	const unsigned char *p;
+	size_t avail = buf->total_len - (size_t)cursor->ptr.pos;
+	ev_uint64_t v = 0;
+	int i;
+
+	if (avail > EVBUFFER_VARINT_MAX_LEN)
+		avail = EVBUFFER_VARINT_MAX_LEN;
+	if ((p = evbuffer_cursor_get(cursor, avail, spill)) == NULL)
+		return -1;
+	for (i = 0; i < (int)avail; ++i) {
+		/* The tenth byte may only hold the top bit of a 64-bit
+		 * value. */
+		if (i == EVBUFFER_VARINT_MAX_LEN - 1 && p[i] > 1)
+			return -2;
+		v |= (ev_uint64_t)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80)) {
+			*value = v;
+			return i + 1;
+		}
+	}
+	return avail == EVBUFFER_VARINT_MAX_LEN ? -2 : -1;
+}
+
+int
+evbuffer_cursor_read_varint(struct evbuffer_cursor *cursor, ev_uint64_t *value)
+{
+	struct evbuffer *buf = cursor->buffer;
+	int n;
+
+	EVBUFFER_LOCK(buf);
+	n = evbuffer_cursor_get_varint(cursor, value);
+	if (n > 0)
+		evbuffer_ptr_set(buf, &cursor->ptr, n, EVBUFFER_PTR_ADD);
+	EVBUFFER_UNLOCK(buf);
+
+	return n < 0 ? n : 0;
+}
+
+const unsigned char *
+evbuffer_cursor_read_blob(struct evbuffer_cursor *cursor, size_t *len_out,
+    void *spill, size_t spill_len)
+{
+	struct evbuffer *buf = cursor->buffer;
+	struct evbuffer_ptr start = cursor->ptr;
+	struct evbuffer_chain *chain;
+	const unsigned char *result = NULL;
+	ev_uint64_t len;
+	int n;
+
+	EVBUFFER_LOCK(buf);
+	n = evbuffer_cursor_get_varint(cursor, &len);
+	if (n < 0 ||
+	    len > buf->total_len - (size_t)cursor->ptr.pos - (size_t)n)
+		goto done;
+	evbuffer_ptr_set(buf, &cursor->ptr, n, EVBUFFER_PTR_ADD);
+	chain = cursor->ptr.internal_.chain;
+	if (chain && chain->off - cursor->ptr.internal_.pos_in_chain < len &&
+	    len > spill_len)
+		goto done;
+	result = evbuffer_cursor_get(cursor, (size_t)len, spill);
+	if (result)
+		evbuffer_ptr_set(buf, &cursor->ptr, (size_t)len,
+		    EVBUFFER_PTR_ADD);
+done:
+	if (!result)
+		cursor->ptr = start;
+	EVBUFFER_UNLOCK(buf);
+
+	if (len_out)
+		*len_out = result ? (size_t)len : 0;
+	return result;
+}
+
+#define EVBUFFER_WRITER_DEFAULT_RESERVE 256
+
+void
+evbuffer_writer_init(struct evbuffer_writer *writer, struct evbuffer *buffer,
+    size_t size_hint)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->buffer = buffer;
+	writer->reserve = size_hint ? size_hint :
+	    EVBUFFER_WRITER_DEFAULT_RESERVE;
+}
+
+/* Commit what has been written into the current reservation, if
+ * anything. */
+static int
+evbuffer_writer_commit(struct evbuffer_writer *writer)
+{
+	int result = 0;
+
+	if (writer->used) {
+		writer->vec.iov_len = writer->used;
+		result = evbuffer_commit_space(writer->buffer, &writer->vec, 1);
+	}
+	writer->vec.iov_base = NULL;
+	writer->vec.iov_len = writer->used = 0;
+	return result;
+}
+
+/* Return a pointer to 'len' contiguous writable bytes, and count them as
+ * written.  If the current reservation is too small, commit it and reserve
+ * more: a field has to be contiguous, and reserving again without
+ * committing could hand back the space we have already written to. */
+static unsigned char *
+evbuffer_writer_space(struct evbuffer_writer *writer, size_t len)
+{
+	unsigned char *p;
+
+	if (writer->failed)
+		return NULL;
+	if (writer->vec.iov_len - writer->used < len) {
+		size_t want = len > writer->reserve ? len : writer->reserve;
+		if (evbuffer_writer_commit(writer) < 0 ||
+		    evbuffer_reserve_space(writer->buffer, want,
+			&writer->vec, 1) < 1) {
+			writer->vec.iov_base = NULL;
+			writer->vec.iov_len = 0;
+			writer->failed = 1;
+			return NULL;
+		}
+	}
+	p = (unsigned char *)writer->vec.iov_base + writer->used;
+	writer->used += len;
+	return p;
+}
+
+int
+evbuffer_writer_finish(struct evbuffer_writer *writer)
+{
+	if (evbuffer_writer_commit(writer) < 0)
+		writer->failed = 1;
+	return writer->failed ? -1 : 0;
+}
+
+int
+evbuffer_writer_add(struct evbuffer_writer *writer, const void *data,
+    size_t len)
+{
+	unsigned char *p;
+	if (!len)
+		return 0;
+	if ((p = evbuffer_writer_space(writer, len)) == NULL)
+		return -1;
+	memcpy(p, data, len);
+	return 0;
 }
 
-char *
-evbuffer_readln(struct evbuffer *buffer, size_t *n_read_out,
-		enum evbuffer_eol_style eol_style)
+int
+evbuffer_writer_add_u8(struct evbuffer_writer *writer, ev_uint8_t value)
 {
-	struct evbuffer_ptr it;
-	char *line;
-	size_t n_to_copy=0, extra_drain=0;
-	char *result = NULL;
+	unsigned char *p;
+	if ((p = evbuffer_writer_space(writer, 1)) == NULL)
+		return -1;
+	p[0] = value;
+	return 0;
+}
 
-	EVBUFFER_LOCK(buffer);
+int
+evbuffer_writer_add_u16be(struct evbuffer_writer *writer, ev_uint16_t value)
+{
+	unsigned char *p;
+	if ((p = evbuffer_writer_space(writer, 2)) == NULL)
+		return -1;
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+	return 0;
+}
 
-	if (buffer->freeze_start) {
-		goto done;
-	}
+int
+evbuffer_writer_add_u16le(struct evbuffer_writer *writer, ev_uint16_t value)
+{
+	unsigned char *p;
+	if ((p = evbuffer_writer_space(writer, 2)) == NULL)
+		return -1;
+	p[0] = (unsigned char)value;
+	p[1] = (unsigned char)(value >> 8);
+	return 0;
+}
 
-	it = evbuffer_search_eol(buffer, NULL, &extra_drain, eol_style);
-	if (it.pos < 0)
-		goto done;
-	n_to_copy = it.pos;
+int
+evbuffer_writer_add_u32be(struct evbuffer_writer *writer, ev_uint32_t value)
+{
+	unsigned char *p;
+	int i;
+	if ((p = evbuffer_writer_space(writer, 4)) == NULL)
+		return -1;
+	for (i = 3; i >= 0; --i, value >>= 8)
+		p[i] = (unsigned char)value;
+	return 0;
+}
 
-	if ((line = mm_malloc(n_to_copy+1)) == NULL) {
-		event_warn("%s: out of memory", __func__);
-		goto done;
-	}
+int
+evbuffer_writer_add_u32le(struct evbuffer_writer *writer, ev_uint32_t value)
+{
+	unsigned char *p;
+	int i;
+	if ((p = evbuffer_writer_space(writer, 4)) == NULL)
+		return -1;
+	for (i = 0; i < 4; ++i, value >>= 8)
+		p[i] = (unsigned char)value;
+	return 0;
+}
 
-	evbuffer_remove(buffer, line, n_to_copy);
-	line[n_to_copy] = '\0';
+int
+evbuffer_writer_add_u64be(struct evbuffer_writer *writer, ev_uint64_t value)
+{
+	unsigned char *p;
+	int i;
+	if ((p = evbuffer_writer_space(writer, 8)) == NULL)
+		return -1;
+	for (i = 7; i >= 0; --i, value >>= 8)
+		p[i] = (unsigned char)value;
+	return 0;
+}
 
-	evbuffer_drain(buffer, extra_drain);
-	result = line;
-done:
-	EVBUFFER_UNLOCK(buffer);
+int
+evbuffer_writer_add_u64le(struct evbuffer_writer *writer, ev_uint64_t value)
+{
+	unsigned char *p;
+	int i;
+	if ((p = evbuffer_writer_space(writer, 8)) == NULL)
+		return -1;
+	for (i = 0; i < 8; ++i, value >>= 8)
+		p[i] = (unsigned char)value;
+	return 0;
+}
 
-	if (n_read_out)
-		*n_read_out = result ? n_to_copy : 0;
+int
+evbuffer_writer_add_varint(struct evbuffer_writer *writer, ev_uint64_t value)
+{
+	unsigned char b[EVBUFFER_VARINT_MAX_LEN];
+	size_t n = 0;
+
+	do {
+		b[n] = (unsigned char)(value & 0x7f);
+		value >>= 7;
+		if (value)
+			b[n] |= 0x80;
+		++n;
+	} while (value);
 
-	return result;
+	return evbuffer_writer_add(writer, b, n);
+}
+
+int
+evbuffer_writer_add_blob(struct evbuffer_writer *writer, const void *data,
+    size_t len)
+{
+	if (evbuffer_writer_add_varint(writer, len) < 0)
+		return -1;
+	return evbuffer_writer_add(writer, data, len);
 }
 
 #define EVBUFFER_CHAIN_MAX_AUTO_SIZE 4096
@@ -1737,6 +3222,17 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 		goto done;
 	}
 
+	if (buf->ring) {
+		if (evbuffer_ring_make_room(buf, datlen) < 0)
+			goto done;
+		chain = buf->first;
+		memcpy(CHAIN_SPACE_PTR(chain), data, datlen);
+		chain->off += datlen;
+		buf->total_len += datlen;
+		buf->n_add_for_cb += datlen;
+		goto out;
+	}
+
 	if (*buf->last_with_datap == NULL) {
 		chain = buf->last;
 	} else {
@@ -1746,7 +3242,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 	/* If there are no chains allocated for this buffer, allocate one
 	 * big enough to hold all the data. */
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new_membuf(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
@@ -1788,7 +3284,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 		to_alloc <<= 1;
 	if (datlen > to_alloc)
 		to_alloc = datlen;
-	tmp = evbuffer_chain_new(to_alloc);
+	tmp = evbuffer_chain_new_membuf(buf, to_alloc);
 	if (tmp == NULL)
 		goto done;
 
@@ -1824,13 +3320,14 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 
 	EVBUFFER_LOCK(buf);
 
-	if (buf->freeze_start) {
+	if (buf->freeze_start || buf->ring) {
 		goto done;
 	}
 	if (datlen > EV_SIZE_MAX - buf->total_len) {
 		goto done;
 	}
 
+	evbuffer_chain_index_invalidate(buf);
 	chain = buf->first;
 
 	if (chain == NULL) {
@@ -1931,6 +3428,10 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 	struct evbuffer_chain *result = NULL;
 	ASSERT_EVBUFFER_LOCKED(buf);
 
+	if (buf->ring)
+		return evbuffer_ring_make_room(buf, datlen) < 0 ?
+		    NULL : buf->first;
+
 	chainp = buf->last_with_datap;
 
 	/* XXX If *chainp is no longer writeable, but has enough space in its
@@ -2003,11 +3504,13 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 		 * MAX_TO_COPY_IN_EXPAND bytes. */
 		/* figure out how much space we need */
 		size_t length = chain->off + datlen;
-		struct evbuffer_chain *tmp = evbuffer_chain_new(length);
+		struct evbuffer_chain *tmp =
+		    evbuffer_chain_new_membuf(buf, length);
 		if (tmp == NULL)
 			goto err;
 
 		/* copy the data over that we had so far */
+		evbuffer_chain_index_invalidate(buf);
 		tmp->off = chain->off;
 		memcpy(tmp->buffer, chain->buffer + chain->misalign,
 		    chain->off);
@@ -2046,10 +3549,13 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 	ASSERT_EVBUFFER_LOCKED(buf);
 	EVUTIL_ASSERT(n >= 2);
 
+	if (buf->ring)
+		return evbuffer_ring_make_room(buf, datlen);
+
 	if (chain == NULL || (chain->flags & EVBUFFER_IMMUTABLE)) {
 		/* There is no last chunk, or we can't touch the last chunk.
 		 * Just add a new chunk. */
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new_membuf(buf, datlen);
 		if (chain == NULL)
 			return (-1);
 
@@ -2092,7 +3598,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		 * chains; we can add another. */
 		EVUTIL_ASSERT(chain == NULL);
 
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new_membuf(buf, datlen - avail);
 		if (tmp == NULL)
 			return (-1);
 
@@ -2124,7 +3630,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 			evbuffer_chain_free(chain);
 		}
 		EVUTIL_ASSERT(datlen >= avail);
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new_membuf(buf, datlen - avail);
 		if (tmp == NULL) {
 			if (rmv_all) {
 				ZERO_CHAIN(buf);
@@ -2294,6 +3800,23 @@ evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 	if (howmuch < 0 || howmuch > n)
 		howmuch = n;
 
+	if (buf->ring) {
+		size_t room = buf->first->buffer_len - buf->first->off;
+		if (room == 0) {
+			/* The backlog is full; reading 0 bytes would look
+			 * like EOF. */
+#ifdef _WIN32
+			EVUTIL_SET_SOCKET_ERROR(WSAENOBUFS);
+#else
+			errno = ENOBUFS;
+#endif
+			result = -1;
+			goto done;
+		}
+		if ((size_t)howmuch > room)
+			howmuch = (int)room;
+	}
+
 #ifdef USE_IOVEC_IMPL
 	/* Since we can use iovecs, we're willing to use the last
 	 * NUM_READ_IOVEC chains. */
@@ -2444,6 +3967,18 @@ evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
 			n = bytesSent;
 	}
 #else
+#ifdef MSG_MORE
+	if (buffer->flags & EVBUFFER_FLAG_CORK) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = i;
+		n = sendmsg(fd, &msg, MSG_MORE);
+		/* Pipes and files have nothing to cork; just write to them. */
+		if (n >= 0 || errno != ENOTSOCK)
+			return (n);
+	}
+#endif
 	n = writev(fd, iov, i);
 #endif
 	return (n);
@@ -2606,6 +4141,70 @@ evbuffer_ptr_subtract(struct evbuffer *buf, struct evbuffer_ptr *pos,
 	}
 }
 
+/** Helper: use the chain offset index of 'buf' to find the last indexed
+ * chain that starts at or before 'position', extending the index over any
+ * chains appended since it was last used.  Sets *chainp to that chain and
+ * *startp to its offset.  Returns -1 if there is nothing to index, or if we
+ * can't grow the index; the caller should walk from the start instead. */
+static int
+evbuffer_chain_index_lookup(struct evbuffer *buf, size_t position,
+    struct evbuffer_chain **chainp, size_t *startp)
+{
+	struct evbuffer_chain_index_entry *ent;
+	struct evbuffer_chain *chain;
+	size_t start, lo, hi;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+
+	if (buf->n_chain_index) {
+		ent = &buf->chain_index[buf->n_chain_index - 1];
+		chain = ent->chain->next;
+		start = ent->start + ent->chain->off;
+	} else {
+		chain = buf->first;
+		start = 0;
+	}
+
+	/* Index any chains between the end of the index and 'position'. */
+	while (chain && start <= position) {
+		if (chain->off) {
+			if (buf->n_chain_index == buf->chain_index_alloc) {
+				size_t n = buf->chain_index_alloc ?
+				    buf->chain_index_alloc * 2 : 16;
+				void *p = mm_realloc(buf->chain_index,
+				    n * sizeof(*ent));
+				if (!p)
+					break;
+				buf->chain_index = p;
+				buf->chain_index_alloc = n;
+			}
+			ent = &buf->chain_index[buf->n_chain_index++];
+			ent->chain = chain;
+			ent->start = start;
+			start += chain->off;
+		}
+		chain = chain->next;
+	}
+
+	if (!buf->n_chain_index || buf->chain_index[0].start > position)
+		return -1;
+
+	/* Binary search for the last entry starting at or before position. */
+	lo = 0;
+	hi = buf->n_chain_index;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (buf->chain_index[mid].start <= position)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*chainp = buf->chain_index[lo].chain;
+	*startp = buf->chain_index[lo].start;
+	return 0;
+}
+
 int
 evbuffer_ptr_set(struct evbuffer *buf, struct evbuffer_ptr *pos,
     size_t position, enum evbuffer_ptr_how how)
@@ -2616,10 +4215,35 @@ evbuffer_ptr_set(struct evbuffer *buf, struct evbuffer_ptr *pos,
 
 	EVBUFFER_LOCK(buf);
 
+	if ((buf->flags & EVBUFFER_FLAG_CHAIN_INDEX) &&
+	    how == EVBUFFER_PTR_ADD && pos->pos >= 0 &&
+	    pos->internal_.chain &&
+	    position >= ((struct evbuffer_chain *)pos->internal_.chain)->off -
+	    pos->internal_.pos_in_chain &&
+	    EV_SIZE_MAX - position >= (size_t)pos->pos) {
+		/* We're leaving the current chain; with an index, jumping
+		 * from the start is cheaper than walking forward. */
+		position += pos->pos;
+		left = position;
+		how = EVBUFFER_PTR_SET;
+	}
+
 	switch (how) {
 	case EVBUFFER_PTR_SET:
 		chain = buf->first;
 		pos->pos = position;
+		if (position >= buf->total_len) {
+			/* No need to walk: we're at or past the end. */
+			chain = NULL;
+			left = position - buf->total_len;
+		} else if (buf->flags & EVBUFFER_FLAG_CHAIN_INDEX) {
+			size_t start;
+			if (evbuffer_chain_index_lookup(buf, position,
+				&chain, &start) == 0)
+				left = position - start;
+			else
+				chain = buf->first;
+		}
 		position = 0;
 		break;
 	case EVBUFFER_PTR_ADD:
@@ -2704,6 +4328,91 @@ evbuffer_search(struct evbuffer *buffer, const char *what, size_t len, const str
 	return evbuffer_search_range(buffer, what, len, start, NULL);
 }
 
+/* Needles at least this long are searched for with the Horspool skip loop
+ * below; shorter ones are faster with the plain memchr loop. */
+#define EVBUFFER_SEARCH_SKIP_MIN_LEN 8
+
+/** Helper: move 'ptr' forward by 'howfar' bytes.  The caller must already
+ * know that the new position lies inside the buffer. */
+static void
+evbuffer_ptr_advance(struct evbuffer_ptr *ptr, size_t howfar)
+{
+	struct evbuffer_chain *chain = ptr->internal_.chain;
+	size_t position = ptr->internal_.pos_in_chain + howfar;
+
+	while (chain && position >= chain->off) {
+		position -= chain->off;
+		chain = chain->next;
+	}
+	EVUTIL_ASSERT(chain);
+	ptr->pos += howfar;
+	ptr->internal_.chain = chain;
+	ptr->internal_.pos_in_chain = position;
+}
+
+/** Helper: search for the first occurrence of 'what' at or after 'pos' that
+ * ends no later than 'limit', using Horspool's bad-character rule.  We keep
+ * a cursor on the last byte of the current window and only walk a second
+ * cursor up to the window start when the last byte matches, so neither
+ * cursor ever moves backwards and no data is pulled up.  On success, sets
+ * 'pos' to the match and returns 0; otherwise returns -1. */
+static int
+evbuffer_search_skip(struct evbuffer *buffer, const unsigned char *what,
+    size_t len, struct evbuffer_ptr *pos, size_t limit)
+{
+	size_t skip[256];
+	struct evbuffer_chain *chain;
+	size_t i, chain_start, end_pos;
+	const unsigned char last = what[len-1];
+
+	ASSERT_EVBUFFER_LOCKED(buffer);
+
+	if (pos->pos < 0 || limit > buffer->total_len ||
+	    (size_t)pos->pos > limit || limit - pos->pos < len)
+		return -1;
+
+	for (i = 0; i < 256; ++i)
+		skip[i] = len;
+	for (i = 0; i < len - 1; ++i)
+		skip[what[i]] = len - 1 - i;
+
+	/* 'end_pos' is the absolute offset of the last byte of the window;
+	 * 'i' is that same byte's offset within 'chain'. */
+	chain = pos->internal_.chain;
+	chain_start = pos->pos - pos->internal_.pos_in_chain;
+	end_pos = pos->pos + len - 1;
+	i = end_pos - chain_start;
+
+	while (end_pos < limit) {
+		const unsigned char *data;
+		while (chain && i >= chain->off) {
+			i -= chain->off;
+			chain_start += chain->off;
+			chain = chain->next;
+		}
+		EVUTIL_ASSERT(chain);
+		data = chain->buffer + chain->misalign;
+		while (i < chain->off) {
+			const unsigned char c = data[i];
+			size_t s;
+			if (c == last) {
+				evbuffer_ptr_advance(pos,
+				    end_pos - (len - 1) - pos->pos);
+				if (!evbuffer_ptr_memcmp(buffer, pos,
+					(const char *)what, len - 1))
+					return 0;
+			}
+			s = skip[c];
+			if (limit - end_pos <= s)
+				return -1;
+			end_pos += s;
+			i += s;
+		}
+	}
+
+	return -1;
+}
+
 struct evbuffer_ptr
 evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, const struct evbuffer_ptr *start, const struct evbuffer_ptr *end)
 {
@@ -2729,6 +4438,16 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 	if (!len || len > EV_SSIZE_MAX)
 		goto done;
 
+	if (len >= EVBUFFER_SEARCH_SKIP_MIN_LEN && chain) {
+		size_t limit = buffer->total_len;
+		if (end && end->pos >= 0 && (size_t)end->pos < limit)
+			limit = end->pos;
+		if (evbuffer_search_skip(buffer, (const unsigned char *)what,
+			len, &pos, limit) < 0)
+			goto not_found;
+		goto done;
+	}
+
 	first = what[0];
 
 	while (chain) {
@@ -2768,6 +4487,128 @@ done:
 	return pos;
 }
 
+struct evbuffer_search_state *
+evbuffer_search_state_new(const char *what, size_t len)
+{
+	struct evbuffer_search_state *state;
+	size_t i, k;
+
+	if (!len || len > (EV_SIZE_MAX - sizeof(*state)) / (sizeof(size_t) + 1))
+		return NULL;
+
+	state = mm_malloc(sizeof(*state) + len * (sizeof(size_t) + 1));
+	if (!state)
+		return NULL;
+	state->len = len;
+	state->matched = 0;
+	state->scanned = 0;
+	state->fail = (size_t *)(state + 1);
+	state->what = (unsigned char *)(state->fail + len);
+	memcpy(state->what, what, len);
+
+	/* fail[i] is the length of the longest proper prefix of what[0..i]
+	 * that is also a suffix of it. */
+	state->fail[0] = 0;
+	for (i = 1, k = 0; i < len; ++i) {
+		while (k && state->what[i] != state->what[k])
+			k = state->fail[k-1];
+		if (state->what[i] == state->what[k])
+			++k;
+		state->fail[i] = k;
+	}
+
+	return state;
+}
+
+void
+evbuffer_search_state_free(struct evbuffer_search_state *state)
+{
+	mm_free(state);
+}
+
+void
+evbuffer_search_state_reset(struct evbuffer_search_state *state)
+{
+	state->matched = 0;
+	state->scanned = 0;
+}
+
+void
+evbuffer_search_state_drained(struct evbuffer_search_state *state,
+    size_t len)
+{
+	if (len > state->scanned - state->matched) {
+		/* The drain cut into a partial match; start over from the
+		 * new front of the buffer. */
+		evbuffer_search_state_reset(state);
+	} else {
+		state->scanned -= len;
+	}
+}
+
+struct evbuffer_ptr
+evbuffer_search_incremental(struct evbuffer *buffer,
+    struct evbuffer_search_state *state)
+{
+	struct evbuffer_ptr pos;
+	struct evbuffer_chain *chain;
+	const unsigned char *what = state->what;
+	const size_t len = state->len;
+	size_t i, matched = state->matched;
+
+	EVBUFFER_LOCK(buffer);
+
+	if (state->scanned > buffer->total_len) {
+		/* Somebody drained the buffer without telling us. */
+		evbuffer_search_state_reset(state);
+		matched = 0;
+	}
+
+	if (evbuffer_ptr_set(buffer, &pos, state->scanned,
+		EVBUFFER_PTR_SET) < 0)
+		goto not_found;
+
+	chain = pos.internal_.chain;
+	i = pos.internal_.pos_in_chain;
+	for (; chain; chain = chain->next, i = 0) {
+		const unsigned char *data = chain->buffer + chain->misalign;
+		while (i < chain->off) {
+			unsigned char c;
+			if (!matched) {
+				/* Nothing pending: skip straight to the next
+				 * candidate first byte. */
+				const unsigned char *p = memchr(data + i,
+				    what[0], chain->off - i);
+				if (!p) {
+					state->scanned += chain->off - i;
+					break;
+				}
+				state->scanned += p - (data + i);
+				i = p - data;
+			}
+			c = data[i++];
+			++state->scanned;
+			while (matched && what[matched] != c)
+				matched = state->fail[matched-1];
+			if (what[matched] == c)
+				++matched;
+			if (matched == len) {
+				state->matched = state->fail[len-1];
+				evbuffer_ptr_set(buffer, &pos,
+				    state->scanned - len, EVBUFFER_PTR_SET);
+				goto done;
+			}
+		}
+	}
+
+	state->matched = matched;
+not_found:
+	PTR_NOT_FOUND(&pos);
+done:
+	EVBUFFER_UNLOCK(buffer);
+	return pos;
+}
+
 int
 evbuffer_peek(struct evbuffer *buffer, ev_ssize_t len,
     struct evbuffer_ptr *start_at,
@@ -2904,6 +4745,102 @@ evbuffer_add_printf(struct evbuffer *buf, const char *fmt, ...)
 	return (res);
 }
 
+int
+evbuffer_add_string(struct evbuffer *buf, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (len > INT_MAX)
+		return -1;
+	if (evbuffer_add(buf, str, len) < 0)
+		return -1;
+	return (int)len;
+}
+
+/** Helper: append 'value' to 'buf' in 'base' (10 or 16), right-aligned in a
+ * field of at least 'width' characters filled with 'pad', preceded by a
+ * minus sign if 'negative' is set.  The digits are written backwards
+ * directly into the last chain, so we never format anything twice. */
+static int
+evbuffer_add_number(struct evbuffer *buf, ev_uint64_t value, int negative,
+    unsigned base, size_t width, char pad, int uppercase)
+{
+	const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+	struct evbuffer_chain *chain;
+	unsigned char *start, *cp;
+	size_t n_digits = 1, len;
+	ev_uint64_t v;
+	int result = -1;
+
+	for (v = value; v >= base; v /= base)
+		++n_digits;
+	len = n_digits + (negative ? 1 : 0);
+	if (len < width)
+		len = width;
+	if (len > INT_MAX)
+		return -1;
+
+	EVBUFFER_LOCK(buf);
+
+	if (buf->freeze_end)
+		goto done;
+	if (len > EV_SIZE_MAX - buf->total_len)
+		goto done;
+	if ((chain = evbuffer_expand_singlechain(buf, len)) == NULL)
+		goto done;
+
+	start = CHAIN_SPACE_PTR(chain);
+	cp = start + len;
+	do {
+		*--cp = digits[value % base];
+		value /= base;
+	} while (value);
+	if (negative && pad == '0') {
+		/* "-0042", not "00-42" */
+		*start = '-';
+		memset(start + 1, '0', cp - start - 1);
+	} else {
+		if (negative)
+			*--cp = '-';
+		memset(start, pad, cp - start);
+	}
+
+	chain->off += len;
+	buf->total_len += len;
+	buf->n_add_for_cb += len;
+
+	advance_last_with_data(buf);
+	evbuffer_invoke_callbacks_(buf);
+	result = (int)len;
+
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
+int
+evbuffer_add_int(struct evbuffer *buf, ev_int64_t value)
+{
+	if (value < 0)
+		return evbuffer_add_number(buf, 0 - (ev_uint64_t)value, 1,
+		    10, 0, ' ', 0);
+	return evbuffer_add_number(buf, (ev_uint64_t)value, 0, 10, 0, ' ', 0);
+}
+
+int
+evbuffer_add_uint(struct evbuffer *buf, ev_uint64_t value,
+    size_t width, char pad)
+{
+	return evbuffer_add_number(buf, value, 0, 10, width, pad, 0);
+}
+
+int
+evbuffer_add_hex(struct evbuffer *buf, ev_uint64_t value,
+    size_t width, int uppercase)
+{
+	return evbuffer_add_number(buf, value, 0, 16, width, '0', uppercase);
+}
+
 int
 evbuffer_add_reference(struct evbuffer *outbuf,
     const void *data, size_t datlen,
@@ -2913,6 +4850,15 @@ evbuffer_add_reference(struct evbuffer *outbuf,
 	struct evbuffer_chain_reference *info;
 	int result = -1;
 
+	if (outbuf->ring) {
+		/* A ring cannot hold a reference, so copy the data; then we
+		 * are done with it. */
+		result = evbuffer_add(outbuf, data, datlen);
+		if (result == 0 && cleanupfn)
+			(*cleanupfn)(data, datlen, extra);
+		return result;
+	}
+
 	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_reference));
 	if (!chain)
 		return (-1);
@@ -3201,7 +5147,7 @@ evbuffer_add_file_segment(struct evbuffer *buf,
 	++seg->refcnt;
 	EVLOCK_UNLOCK(seg->lock, 0);
 
-	if (buf->freeze_end)
+	if (buf->freeze_end || buf->ring)
 		goto err;
 
 	if (length < 0) {
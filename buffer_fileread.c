@@ -0,0 +1,630 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file buffer_fileread.c
+
+   This module reads evbuffer_file_segments into evbuffers in the
+   background.  Each segment is split into windows; every window is read
+   by a job that the user's submit callback runs on some other thread, and
+   the finished windows are appended, in order, by a callback on the
+   reader's event_base.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <io.h>
+#endif
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "event2/thread.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "evbuffer-internal.h"
+
+#ifdef _WIN32
+#ifndef lseek
+#define lseek _lseeki64
+#endif
+#endif
+
+#define EVBUFFER_FILE_READER_WINDOW_SIZE (256*1024)
+#define EVBUFFER_FILE_READER_MAX_WINDOWS 4
+
+/** One window of a file segment.  The data read from the file follows
+ * the structure in the same allocation. */
+struct evbuffer_file_window {
+	TAILQ_ENTRY(evbuffer_file_window) next;
+	/** The operation this window belongs to. */
+	struct evbuffer_file_read_op *op;
+	/** Offset of this window within the file segment. */
+	ev_off_t offset;
+	/** Number of bytes in this window. */
+	size_t len;
+	/** True iff we could not read the whole window. */
+	unsigned error : 1;
+};
+#define WINDOW_DATA(w) ((char *)((w) + 1))
+
+TAILQ_HEAD(evbuffer_file_window_list, evbuffer_file_window);
+
+/** One call to evbuffer_add_file_segment_async(). */
+struct evbuffer_file_read_op {
+	TAILQ_ENTRY(evbuffer_file_read_op) next;
+	struct evbuffer_file_reader *reader;
+	/** The evbuffer we're adding to.  We hold a reference to it, and keep
+	 * its end frozen, until the operation is finished, or until every
+	 * other reference to it is gone; then this is NULL. */
+	struct evbuffer *buf;
+	/** The segment we're reading; we hold a reference to it. */
+	struct evbuffer_file_segment *seg;
+	/** Segment offset of the next window to read. */
+	ev_off_t submit_pos;
+	/** Segment offset of the next window to append. */
+	ev_off_t append_pos;
+	/** Segment offset at which we stop. */
+	ev_off_t end;
+	/** Number of windows that are being read, waiting to be appended, or
+	 * sitting undrained in 'buf'. */
+	unsigned n_windows;
+	/** Windows that have been read but not appended yet, sorted by
+	 * offset. */
+	struct evbuffer_file_window_list ready;
+
+	evbuffer_file_reader_done_cb cb;
+	void *cbarg;
+
+	/** One reference for being in progress, plus one for every window. */
+	int refcnt;
+	/** True iff a read or an append has failed, or we were cancelled. */
+	unsigned failed : 1;
+	/** True iff we have run the done callback. */
+	unsigned finished : 1;
+	/** True while we are using 'buf' without holding its lock; it must
+	 * not go away until we are done. */
+	unsigned using_buf : 1;
+	/** True iff every other reference to 'buf' is gone. */
+	unsigned orphaned : 1;
+};
+
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_file_reader {
+	/** Event that we activate whenever there is work to do on the loop
+	 * thread: windows to append or room to read more. */
+	struct event pump_ev;
+
+	evbuffer_file_reader_submit_cb submit;
+	void *submit_arg;
+
+	size_t window_size;
+	unsigned max_windows;
+	size_t max_memory;
+	/** Number of bytes held by all windows of this reader. */
+	size_t memory;
+
+	/** Operations in progress. */
+	TAILQ_HEAD(evbuffer_file_read_op_list, evbuffer_file_read_op) ops;
+	/** Windows whose read has finished, in the order they finished. */
+	struct evbuffer_file_window_list completed;
+
+	/** One reference for the user, plus one for every operation. */
+	int refcnt;
+	/** True iff the user has freed this reader. */
+	unsigned closing : 1;
+	void *lock;
+};
+
+static void
+evbuffer_file_reader_decref(struct evbuffer_file_reader *reader)
+{
+	int refcnt;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	refcnt = --reader->refcnt;
+	EVLOCK_UNLOCK(reader->lock, 0);
+	if (refcnt > 0)
+		return;
+
+	EVUTIL_ASSERT(TAILQ_EMPTY(&reader->ops));
+	EVUTIL_ASSERT(TAILQ_EMPTY(&reader->completed));
+	EVTHREAD_FREE_LOCK(reader->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	mm_free(reader);
+}
+
+static void
+evbuffer_file_read_op_decref(struct evbuffer_file_read_op *op)
+{
+	struct evbuffer_file_reader *reader = op->reader;
+	int refcnt;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	refcnt = --op->refcnt;
+	EVLOCK_UNLOCK(reader->lock, 0);
+	if (refcnt > 0)
+		return;
+
+	EVUTIL_ASSERT(TAILQ_EMPTY(&op->ready));
+	evbuffer_file_segment_free(op->seg);
+	mm_free(op);
+	evbuffer_file_reader_decref(reader);
+}
+
+/* Release a window, and the room it took up.  Requires no lock. */
+static void
+evbuffer_file_window_free(struct evbuffer_file_window *w)
+{
+	struct evbuffer_file_read_op *op = w->op;
+	struct evbuffer_file_reader *reader = op->reader;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	reader->memory -= w->len;
+	--op->n_windows;
+	/* Somebody may have been waiting for the room. */
+	if (!reader->closing)
+		event_active(&reader->pump_ev, EV_TIMEOUT, 1);
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	mm_free(w);
+	evbuffer_file_read_op_decref(op);
+}
+
+/* Called when the chain holding a window is freed. */
+static void
+evbuffer_file_window_cleanup(const void *data, size_t len, void *arg)
+{
+	evbuffer_file_window_free(arg);
+}
+
+/* The job we hand to the submit callback: runs on a helper thread. */
+static void
+evbuffer_file_window_read(void *arg)
+{
+	struct evbuffer_file_window *w = arg;
+	struct evbuffer_file_reader *reader = w->op->reader;
+	struct evbuffer_file_segment *seg = w->op->seg;
+	const ev_off_t where = seg->file_offset + w->offset;
+	char *mem = WINDOW_DATA(w);
+	size_t done = 0;
+	ev_ssize_t n = 0;
+
+#ifdef EVENT__HAVE_PREAD
+	while (done < w->len) {
+		n = pread(seg->fd, mem + done, w->len - done, where + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+#else
+	/* Without pread, we have to borrow the file position; the segment
+	 * lock keeps other readers of this segment away from it. */
+	EVLOCK_LOCK(seg->lock, 0);
+	{
+		ev_off_t start_pos = lseek(seg->fd, 0, SEEK_CUR);
+		if (start_pos >= 0 && lseek(seg->fd, where, SEEK_SET) >= 0) {
+			while (done < w->len) {
+				n = read(seg->fd, mem + done,
+				    (unsigned)(w->len - done));
+				if (n <= 0)
+					break;
+				done += n;
+			}
+			lseek(seg->fd, start_pos, SEEK_SET);
+		}
+	}
+	EVLOCK_UNLOCK(seg->lock, 0);
+#endif
+	if (done < w->len)
+		w->error = 1;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	if (!reader->closing) {
+		TAILQ_INSERT_TAIL(&reader->completed, w, next);
+		event_active(&reader->pump_ev, EV_TIMEOUT, 1);
+		w = NULL;
+	}
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	if (w)
+		evbuffer_file_window_free(w);
+}
+
+/* Start reading the next window of 'op', if it has room for one.  Returns
+ * 1 if we started a read, 0 otherwise.  Loop thread only. */
+static int
+evbuffer_file_read_op_submit(struct evbuffer_file_read_op *op)
+{
+	struct evbuffer_file_reader *reader = op->reader;
+	struct evbuffer_file_window *w = NULL;
+	size_t len;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	if (op->failed || op->submit_pos == op->end ||
+	    op->n_windows >= reader->max_windows)
+		goto done;
+	len = reader->window_size;
+	if ((ev_uint64_t)len > (ev_uint64_t)(op->end - op->submit_pos))
+		len = (size_t)(op->end - op->submit_pos);
+	if (reader->max_memory && reader->memory + len > reader->max_memory)
+		goto done;
+
+	if ((w = mm_malloc(sizeof(struct evbuffer_file_window) + len)) == NULL) {
+		event_warn("%s: out of memory", __func__);
+		op->failed = 1;
+		goto done;
+	}
+	memset(w, 0, sizeof(struct evbuffer_file_window));
+	w->op = op;
+	w->offset = op->submit_pos;
+	w->len = len;
+	op->submit_pos += len;
+	++op->n_windows;
+	++op->refcnt;
+	reader->memory += len;
+done:
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	if (!w)
+		return 0;
+	if (reader->submit(evbuffer_file_window_read, w,
+		reader->submit_arg) < 0) {
+		EVLOCK_LOCK(reader->lock, 0);
+		op->failed = 1;
+		EVLOCK_UNLOCK(reader->lock, 0);
+		evbuffer_file_window_free(w);
+		return 0;
+	}
+	return 1;
+}
+
+/* Append every window of 'op' that is ready to go, in order.  Loop thread
+ * only. */
+static void
+evbuffer_file_read_op_append(struct evbuffer_file_read_op *op)
+{
+	struct evbuffer_file_reader *reader = op->reader;
+	struct evbuffer_file_window *w;
+	struct evbuffer *buf = NULL;
+	int r;
+
+	for (;;) {
+		/* Once the buffer has been given up, nothing more goes in. */
+		EVLOCK_LOCK(reader->lock, 0);
+		w = TAILQ_FIRST(&op->ready);
+		if (w && !op->failed && w->offset == op->append_pos) {
+			TAILQ_REMOVE(&op->ready, w, next);
+			op->append_pos += w->len;
+			op->using_buf = 1;
+			buf = op->buf;
+		} else {
+			w = NULL;
+		}
+		EVLOCK_UNLOCK(reader->lock, 0);
+		if (!w)
+			break;
+
+		/* We keep the end of the buffer frozen so that nobody else
+		 * can add data in the middle of the file.  The callbacks that
+		 * adding runs may release the buffer; then
+		 * evbuffer_file_read_op_finish() lets go of it. */
+		EVBUFFER_LOCK(buf);
+		buf->freeze_end = 0;
+		r = evbuffer_add_reference(buf, WINDOW_DATA(w), w->len,
+		    evbuffer_file_window_cleanup, w);
+		buf->freeze_end = 1;
+		EVLOCK_LOCK(reader->lock, 0);
+		op->using_buf = 0;
+		if (r < 0)
+			op->failed = 1;
+		EVLOCK_UNLOCK(reader->lock, 0);
+		EVBUFFER_UNLOCK(buf);
+
+		if (r < 0)
+			evbuffer_file_window_free(w);
+	}
+}
+
+/* Remove 'op' from its reader and run its callback.  Loop thread only. */
+static void
+evbuffer_file_read_op_finish(struct evbuffer_file_read_op *op, int result)
+{
+	struct evbuffer_file_reader *reader = op->reader;
+	struct evbuffer_file_window_list ready;
+	struct evbuffer_file_window *w;
+	struct evbuffer *buf;
+	int orphaned;
+
+	TAILQ_INIT(&ready);
+	EVLOCK_LOCK(reader->lock, 0);
+	TAILQ_REMOVE(&reader->ops, op, next);
+	op->finished = 1;
+	while ((w = TAILQ_FIRST(&op->ready))) {
+		TAILQ_REMOVE(&op->ready, w, next);
+		TAILQ_INSERT_TAIL(&ready, w, next);
+	}
+	if ((buf = op->buf) != NULL)
+		op->using_buf = 1;
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	while ((w = TAILQ_FIRST(&ready))) {
+		TAILQ_REMOVE(&ready, w, next);
+		evbuffer_file_window_free(w);
+	}
+
+	if (buf) {
+		EVBUFFER_LOCK(buf);
+		EVLOCK_LOCK(reader->lock, 0);
+		op->using_buf = 0;
+		op->buf = NULL;
+		orphaned = op->orphaned;
+		EVLOCK_UNLOCK(reader->lock, 0);
+		buf->file_read = NULL;
+		buf->freeze_end = 0;
+		if (orphaned) {
+			/* Ours was the last reference. */
+			evbuffer_decref_and_unlock_(buf);
+			buf = NULL;
+		} else {
+			EVBUFFER_UNLOCK(buf);
+		}
+	}
+
+	if (op->cb)
+		op->cb(buf, result, op->cbarg);
+
+	if (buf) {
+		EVBUFFER_LOCK(buf);
+		evbuffer_decref_and_unlock_(buf);
+	}
+	evbuffer_file_read_op_decref(op);
+}
+
+int
+evbuffer_file_read_orphaned_(struct evbuffer *buf)
+{
+	struct evbuffer_file_read_op *op = buf->file_read;
+	struct evbuffer_file_reader *reader = op->reader;
+	int drop;
+
+	EVLOCK_LOCK(reader->lock, 0);
+	op->failed = op->orphaned = 1;
+	/* If we are in the middle of using the buffer, we let go of it
+	 * once we are done; otherwise it can go right away, along with
+	 * the windows it holds. */
+	drop = !op->using_buf;
+	if (drop) {
+		op->buf = NULL;
+		buf->file_read = NULL;
+	}
+	if (!reader->closing)
+		event_active(&reader->pump_ev, EV_TIMEOUT, 1);
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	return drop;
+}
+
+static void
+evbuffer_file_reader_pump(evutil_socket_t fd, short what, void *arg)
+{
+	struct evbuffer_file_reader *reader = arg;
+	struct evbuffer_file_read_op *op, *next_op;
+	struct evbuffer_file_window *w, *pos;
+	struct evbuffer_file_window_list stale;
+	int progress, failed, done;
+
+	/* Sort the windows that finished reading into their operations. */
+	TAILQ_INIT(&stale);
+	EVLOCK_LOCK(reader->lock, 0);
+	while ((w = TAILQ_FIRST(&reader->completed))) {
+		TAILQ_REMOVE(&reader->completed, w, next);
+		op = w->op;
+		if (op->finished) {
+			TAILQ_INSERT_TAIL(&stale, w, next);
+			continue;
+		}
+		if (w->error)
+			op->failed = 1;
+		TAILQ_FOREACH_REVERSE(pos, &op->ready,
+		    evbuffer_file_window_list, next) {
+			if (pos->offset < w->offset)
+				break;
+		}
+		if (pos)
+			TAILQ_INSERT_AFTER(&op->ready, pos, w, next);
+		else
+			TAILQ_INSERT_HEAD(&op->ready, w, next);
+	}
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	while ((w = TAILQ_FIRST(&stale))) {
+		TAILQ_REMOVE(&stale, w, next);
+		evbuffer_file_window_free(w);
+	}
+
+	/* Append what we can, and finish the operations that are done.  An
+	 * operation whose buffer was given up has failed, and appends
+	 * nothing more. */
+	for (op = TAILQ_FIRST(&reader->ops); op; op = next_op) {
+		next_op = TAILQ_NEXT(op, next);
+		evbuffer_file_read_op_append(op);
+
+		EVLOCK_LOCK(reader->lock, 0);
+		failed = op->failed;
+		done = op->append_pos == op->end;
+		EVLOCK_UNLOCK(reader->lock, 0);
+
+		if (failed)
+			evbuffer_file_read_op_finish(op, -1);
+		else if (done)
+			evbuffer_file_read_op_finish(op, 0);
+	}
+
+	/* Start more reads, one window per operation at a time, so that
+	 * the memory limit is shared fairly.  Rotate the list so that a
+	 * different operation goes first next time. */
+	do {
+		progress = 0;
+		TAILQ_FOREACH(op, &reader->ops, next)
+			progress += evbuffer_file_read_op_submit(op);
+	} while (progress);
+
+	if ((op = TAILQ_FIRST(&reader->ops)) != NULL) {
+		TAILQ_REMOVE(&reader->ops, op, next);
+		TAILQ_INSERT_TAIL(&reader->ops, op, next);
+	}
+}
+
+struct evbuffer_file_reader *
+evbuffer_file_reader_new(struct event_base *base,
+    evbuffer_file_reader_submit_cb submit, void *submit_arg,
+    size_t window_size, unsigned max_windows, size_t max_memory)
+{
+	struct evbuffer_file_reader *reader;
+
+	if (!base || !submit)
+		return NULL;
+	if ((reader = mm_calloc(1, sizeof(struct evbuffer_file_reader))) == NULL)
+		return NULL;
+
+	if (!window_size)
+		window_size = EVBUFFER_FILE_READER_WINDOW_SIZE;
+	if (max_memory && window_size > max_memory)
+		window_size = max_memory;
+	if (!max_windows)
+		max_windows = EVBUFFER_FILE_READER_MAX_WINDOWS;
+
+	reader->submit = submit;
+	reader->submit_arg = submit_arg;
+	reader->window_size = window_size;
+	reader->max_windows = max_windows;
+	reader->max_memory = max_memory;
+	reader->refcnt = 1;
+	TAILQ_INIT(&reader->ops);
+	TAILQ_INIT(&reader->completed);
+	event_assign(&reader->pump_ev, base, -1, 0,
+	    evbuffer_file_reader_pump, reader);
+	EVTHREAD_ALLOC_LOCK(reader->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+
+	return reader;
+}
+
+void
+evbuffer_file_reader_free(struct evbuffer_file_reader *reader)
+{
+	struct evbuffer_file_window_list completed;
+	struct evbuffer_file_window *w;
+	struct evbuffer_file_read_op *op;
+
+	TAILQ_INIT(&completed);
+	EVLOCK_LOCK(reader->lock, 0);
+	reader->closing = 1;
+	while ((w = TAILQ_FIRST(&reader->completed))) {
+		TAILQ_REMOVE(&reader->completed, w, next);
+		TAILQ_INSERT_TAIL(&completed, w, next);
+	}
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	event_del(&reader->pump_ev);
+
+	while ((w = TAILQ_FIRST(&completed))) {
+		TAILQ_REMOVE(&completed, w, next);
+		evbuffer_file_window_free(w);
+	}
+	while ((op = TAILQ_FIRST(&reader->ops)))
+		evbuffer_file_read_op_finish(op, -1);
+
+	evbuffer_file_reader_decref(reader);
+}
+
+int
+evbuffer_add_file_segment_async(struct evbuffer *buf,
+    struct evbuffer_file_reader *reader, struct evbuffer_file_segment *seg,
+    ev_off_t offset, ev_off_t length,
+    evbuffer_file_reader_done_cb cb, void *cbarg)
+{
+	struct evbuffer_file_read_op *op;
+
+	if (offset < 0 || offset > seg->length)
+		return -1;
+	if (length < 0)
+		length = seg->length - offset;
+	if (length > seg->length - offset)
+		return -1;
+
+	if ((op = mm_calloc(1, sizeof(struct evbuffer_file_read_op))) == NULL)
+		return -1;
+
+	op->reader = reader;
+	EVBUFFER_LOCK(buf);
+	if (buf->freeze_end) {
+		EVBUFFER_UNLOCK(buf);
+		mm_free(op);
+		return -1;
+	}
+	buf->freeze_end = 1;
+	buf->file_read = op;
+	++buf->refcnt;
+	EVBUFFER_UNLOCK(buf);
+
+	EVLOCK_LOCK(seg->lock, 0);
+	++seg->refcnt;
+	EVLOCK_UNLOCK(seg->lock, 0);
+
+	op->buf = buf;
+	op->seg = seg;
+	op->submit_pos = op->append_pos = offset;
+	op->end = offset + length;
+	op->cb = cb;
+	op->cbarg = cbarg;
+	op->refcnt = 1;
+	TAILQ_INIT(&op->ready);
+
+	EVLOCK_LOCK(reader->lock, 0);
+	++reader->refcnt;
+	TAILQ_INSERT_TAIL(&reader->ops, op, next);
+	event_active(&reader->pump_ev, EV_TIMEOUT, 1);
+	EVLOCK_UNLOCK(reader->lock, 0);
+
+	return 0;
+}
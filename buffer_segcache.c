@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file buffer_segcache.c
+
+   This module keeps evbuffer_file_segments for recently used files open,
+   keyed by path, so that a file served over and over is opened, and
+   mapped if it needs to be, only once.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <io.h>
+#endif
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "event2/thread.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "evbuffer-internal.h"
+#include "ht-internal.h"
+
+#ifdef _WIN32
+#ifndef fstat
+#define fstat _fstat
+#endif
+#ifndef stat
+#define stat _stat
+#endif
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/** The things we compare to decide whether a file has changed since we
+ * opened it. */
+struct segcache_file_id {
+	ev_uint64_t dev;
+	ev_uint64_t ino;
+	ev_int64_t mtime;
+	ev_off_t size;
+};
+
+/** One cached file. */
+struct segcache_entry {
+	HT_ENTRY(segcache_entry) node;
+	/** Position in the cache's LRU list, most recently used first. */
+	TAILQ_ENTRY(segcache_entry) lru;
+	/** The segment for the whole file; we hold one reference to it. */
+	struct evbuffer_file_segment *seg;
+	struct segcache_file_id id;
+	/** The path we opened; stored after the structure. */
+	char *path;
+};
+
+static inline unsigned
+hash_segcache_entry(const struct segcache_entry *e)
+{
+	return ht_string_hash_(e->path);
+}
+
+static inline int
+eq_segcache_entry(const struct segcache_entry *a,
+    const struct segcache_entry *b)
+{
+	return !strcmp(a->path, b->path);
+}
+
+HT_HEAD(segcache_map, segcache_entry);
+HT_PROTOTYPE(segcache_map, segcache_entry, node, hash_segcache_entry,
+    eq_segcache_entry)
+HT_GENERATE(segcache_map, segcache_entry, node, hash_segcache_entry,
+    eq_segcache_entry, 0.5, mm_malloc, mm_realloc, mm_free)
+
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_file_segment_cache {
+	struct segcache_map map;
+	TAILQ_HEAD(segcache_lru, segcache_entry) lru;
+
+	/** Flags passed to evbuffer_file_segment_new(). */
+	unsigned seg_flags;
+	size_t max_bytes;
+	unsigned max_entries;
+	/** Sum of the sizes of all cached files. */
+	size_t n_bytes;
+
+	void *lock;
+};
+
+static void
+segcache_file_id_set(struct segcache_file_id *id, const struct stat *st)
+{
+	id->dev = st->st_dev;
+	id->ino = st->st_ino;
+	id->mtime = st->st_mtime;
+	id->size = st->st_size;
+}
+
+static int
+segcache_file_id_eq(const struct segcache_file_id *a,
+    const struct segcache_file_id *b)
+{
+	return a->dev == b->dev && a->ino == b->ino &&
+	    a->mtime == b->mtime && a->size == b->size;
+}
+
+static void
+segcache_seg_incref(struct evbuffer_file_segment *seg)
+{
+	EVLOCK_LOCK(seg->lock, 0);
+	++seg->refcnt;
+	EVLOCK_UNLOCK(seg->lock, 0);
+}
+
+/* Take 'e' out of the cache and free it.  Evbuffers and callers that still
+ * hold the segment keep it alive.  Requires lock. */
+static void
+segcache_entry_remove(struct evbuffer_file_segment_cache *cache,
+    struct segcache_entry *e)
+{
+	HT_REMOVE(segcache_map, &cache->map, e);
+	TAILQ_REMOVE(&cache->lru, e, lru);
+	cache->n_bytes -= (size_t)e->id.size;
+	evbuffer_file_segment_free(e->seg);
+	mm_free(e);
+}
+
+/* Evict least recently used entries until the cache is within its limits.
+ * Requires lock. */
+static void
+segcache_shrink(struct evbuffer_file_segment_cache *cache)
+{
+	struct segcache_entry *e;
+
+	while ((e = TAILQ_LAST(&cache->lru, segcache_lru)) != NULL &&
+	    ((cache->max_bytes && cache->n_bytes > cache->max_bytes) ||
+		(cache->max_entries &&
+		    HT_SIZE(&cache->map) > cache->max_entries)))
+		segcache_entry_remove(cache, e);
+}
+
+struct evbuffer_file_segment_cache *
+evbuffer_file_segment_cache_new(size_t max_bytes, unsigned max_entries,
+    unsigned flags)
+{
+	struct evbuffer_file_segment_cache *cache;
+
+	if ((cache = mm_calloc(1, sizeof(*cache))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return NULL;
+	}
+	HT_INIT(segcache_map, &cache->map);
+	TAILQ_INIT(&cache->lru);
+	cache->seg_flags = flags | EVBUF_FS_CLOSE_ON_FREE;
+	cache->max_bytes = max_bytes;
+	cache->max_entries = max_entries;
+	EVTHREAD_ALLOC_LOCK(cache->lock, 0);
+
+	return cache;
+}
+
+void
+evbuffer_file_segment_cache_free(struct evbuffer_file_segment_cache *cache)
+{
+	struct segcache_entry *e;
+
+	while ((e = TAILQ_FIRST(&cache->lru)) != NULL)
+		segcache_entry_remove(cache, e);
+	HT_CLEAR(segcache_map, &cache->map);
+	EVTHREAD_FREE_LOCK(cache->lock, 0);
+	mm_free(cache);
+}
+
+struct evbuffer_file_segment *
+evbuffer_file_segment_cache_get(struct evbuffer_file_segment_cache *cache,
+    const char *path)
+{
+	struct segcache_entry find, *e, *old;
+	struct evbuffer_file_segment *seg = NULL;
+	struct segcache_file_id id;
+	struct stat st;
+	size_t pathlen;
+	int fd;
+
+	/* Someone may have replaced or changed the file since we opened it;
+	 * stat() is much cheaper than opening and mapping it again. */
+	if (stat(path, &st) < 0)
+		return NULL;
+	segcache_file_id_set(&id, &st);
+
+	find.path = (char *)path;
+	EVLOCK_LOCK(cache->lock, 0);
+	e = HT_FIND(segcache_map, &cache->map, &find);
+	if (e && segcache_file_id_eq(&e->id, &id)) {
+		seg = e->seg;
+		segcache_seg_incref(seg);
+		TAILQ_REMOVE(&cache->lru, e, lru);
+		TAILQ_INSERT_HEAD(&cache->lru, e, lru);
+	}
+	EVLOCK_UNLOCK(cache->lock, 0);
+	if (seg)
+		return seg;
+
+	/* A miss, or a stale entry: open the file without holding the lock,
+	 * since this is the slow part. */
+	fd = evutil_open_closeonexec_(path, O_RDONLY|O_BINARY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	segcache_file_id_set(&id, &st);
+	seg = evbuffer_file_segment_new(fd, 0, id.size, cache->seg_flags);
+	if (!seg) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Files that could never fit are served, but not cached. */
+	if (cache->max_bytes && (ev_uint64_t)id.size > cache->max_bytes)
+		return seg;
+
+	pathlen = strlen(path);
+	if ((e = mm_malloc(sizeof(*e) + pathlen + 1)) == NULL) {
+		event_warn("%s: malloc", __func__);
+		return seg;
+	}
+	memset(e, 0, sizeof(*e));
+	e->path = (char *)(e + 1);
+	memcpy(e->path, path, pathlen + 1);
+	e->id = id;
+	e->seg = seg;
+	segcache_seg_incref(seg);
+
+	EVLOCK_LOCK(cache->lock, 0);
+	/* Whatever is there now -- the stale entry, or one that another
+	 * thread added while we were opening the file -- is older than
+	 * ours. */
+	if ((old = HT_FIND(segcache_map, &cache->map, e)) != NULL)
+		segcache_entry_remove(cache, old);
+	HT_INSERT(segcache_map, &cache->map, e);
+	TAILQ_INSERT_HEAD(&cache->lru, e, lru);
+	cache->n_bytes += (size_t)id.size;
+	segcache_shrink(cache);
+	EVLOCK_UNLOCK(cache->lock, 0);
+
+	return seg;
+}
+
+int
+evbuffer_file_segment_cache_remove(struct evbuffer_file_segment_cache *cache,
+    const char *path)
+{
+	struct segcache_entry find, *e;
+
+	find.path = (char *)path;
+	EVLOCK_LOCK(cache->lock, 0);
+	if ((e = HT_FIND(segcache_map, &cache->map, &find)) != NULL)
+		segcache_entry_remove(cache, e);
+	EVLOCK_UNLOCK(cache->lock, 0);
+
+	return e ? 0 : -1;
+}
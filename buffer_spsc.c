@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+   @file buffer_spsc.c
+
+   This module passes evbuffer chains from one producing thread to one
+   consuming thread.  Each evbuffer_spsc_publish() links a node holding the
+   published chains onto the end of a singly linked queue; the consumer
+   walks the queue from a dummy node at its head, in the manner of a
+   single-producer, single-consumer Michael-Scott queue, so neither side
+   ever takes a lock.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "event2/thread.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "evbuffer-internal.h"
+
+#if defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define EVBUFFER_SPSC_GNUC_ATOMICS
+#elif defined(_WIN32)
+#define EVBUFFER_SPSC_WIN32_ATOMICS
+#else
+/* No atomics that we know of: fall back to a lock around each access. */
+#define EVBUFFER_SPSC_LOCKED
+#endif
+
+/** A batch of chains handed over by one call to evbuffer_spsc_publish(). */
+struct evbuffer_spsc_node {
+	/** The next batch; written once by the producer, with release
+	 * semantics, and read by the consumer with acquire semantics. */
+	struct evbuffer_spsc_node *next;
+	struct evbuffer_chain *first;
+	struct evbuffer_chain *last;
+	size_t len;
+};
+
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_spsc {
+	/* Used only by the producer. */
+	struct evbuffer *producer;
+	/** The most recently published node. */
+	struct evbuffer_spsc_node *tail;
+
+	/* Keep the two sides' fields on separate cache lines. */
+	char pad_[64];
+
+	/* Used only by the consumer. */
+	struct evbuffer *consumer;
+	/** A node whose chains have already been collected; the next one,
+	 * if any, is the oldest uncollected batch. */
+	struct evbuffer_spsc_node *head;
+	struct event wakeup_ev;
+	evbuffer_spsc_cb cb;
+	void *cbarg;
+
+	/** True if the consumer has run out of data, and the next publish
+	 * must wake it up. */
+	int consumer_idle;
+
+#ifdef EVBUFFER_SPSC_LOCKED
+	void *lock;
+#endif
+};
+
+/* The three atomic operations we need.  Publishing a node and setting or
+ * clearing consumer_idle are sequentially consistent, so that a producer
+ * that finds the consumer busy is sure to have its node seen by the
+ * consumer's next check of the queue. */
+#if defined(EVBUFFER_SPSC_GNUC_ATOMICS)
+static inline struct evbuffer_spsc_node *
+spsc_load_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node)
+{
+	return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+}
+static inline void
+spsc_store_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node,
+    struct evbuffer_spsc_node *next)
+{
+	__atomic_store_n(&node->next, next, __ATOMIC_SEQ_CST);
+}
+static inline int
+spsc_exchange_idle(struct evbuffer_spsc *spsc, int idle)
+{
+	return __atomic_exchange_n(&spsc->consumer_idle, idle,
+	    __ATOMIC_SEQ_CST);
+}
+#elif defined(EVBUFFER_SPSC_WIN32_ATOMICS)
+static inline struct evbuffer_spsc_node *
+spsc_load_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node)
+{
+	return InterlockedCompareExchangePointer(
+	    (PVOID volatile *)&node->next, NULL, NULL);
+}
+static inline void
+spsc_store_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node,
+    struct evbuffer_spsc_node *next)
+{
+	InterlockedExchangePointer((PVOID volatile *)&node->next, next);
+}
+static inline int
+spsc_exchange_idle(struct evbuffer_spsc *spsc, int idle)
+{
+	return (int)InterlockedExchange((LONG volatile *)&spsc->consumer_idle,
+	    idle);
+}
+#else
+static inline struct evbuffer_spsc_node *
+spsc_load_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node)
+{
+	struct evbuffer_spsc_node *next;
+	EVLOCK_LOCK(spsc->lock, 0);
+	next = node->next;
+	EVLOCK_UNLOCK(spsc->lock, 0);
+	return next;
+}
+static inline void
+spsc_store_next(struct evbuffer_spsc *spsc, struct evbuffer_spsc_node *node,
+    struct evbuffer_spsc_node *next)
+{
+	EVLOCK_LOCK(spsc->lock, 0);
+	node->next = next;
+	EVLOCK_UNLOCK(spsc->lock, 0);
+}
+static inline int
+spsc_exchange_idle(struct evbuffer_spsc *spsc, int idle)
+{
+	int old;
+	EVLOCK_LOCK(spsc->lock, 0);
+	old = spsc->consumer_idle;
+	spsc->consumer_idle = idle;
+	EVLOCK_UNLOCK(spsc->lock, 0);
+	return old;
+}
+#endif
+
+static void
+evbuffer_spsc_wakeup(evutil_socket_t fd, short what, void *arg)
+{
+	struct evbuffer_spsc *spsc = arg;
+
+	if (evbuffer_spsc_collect(spsc) > 0 && spsc->cb)
+		spsc->cb(spsc, spsc->consumer, spsc->cbarg);
+}
+
+/* Create an spsc whose wakeup event runs on 'base', or that has no wakeup
+ * event if 'base' is NULL. */
+static struct evbuffer_spsc *
+evbuffer_spsc_new_impl(struct event_base *base, evbuffer_spsc_cb cb,
+    void *arg)
+{
+	struct evbuffer_spsc *spsc;
+
+	if ((spsc = mm_calloc(1, sizeof(*spsc))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return NULL;
+	}
+	spsc->producer = evbuffer_new();
+	spsc->consumer = evbuffer_new();
+	spsc->head = mm_calloc(1, sizeof(*spsc->head));
+	if (!spsc->producer || !spsc->consumer || !spsc->head ||
+	    (base && event_assign(&spsc->wakeup_ev, base, -1, 0,
+		evbuffer_spsc_wakeup, spsc) < 0)) {
+		if (spsc->producer)
+			evbuffer_free(spsc->producer);
+		if (spsc->consumer)
+			evbuffer_free(spsc->consumer);
+		mm_free(spsc->head);
+		mm_free(spsc);
+		return NULL;
+	}
+	spsc->tail = spsc->head;
+	spsc->cb = cb;
+	spsc->cbarg = arg;
+	/* Nothing has been published yet, so the first publish wakes the
+	 * consumer. */
+	spsc->consumer_idle = 1;
+#ifdef EVBUFFER_SPSC_LOCKED
+	EVTHREAD_ALLOC_LOCK(spsc->lock, 0);
+#endif
+
+	return spsc;
+}
+
+struct evbuffer_spsc *
+evbuffer_spsc_new(struct event_base *base, evbuffer_spsc_cb cb, void *arg)
+{
+	return evbuffer_spsc_new_impl(base, cb, arg);
+}
+
+struct evbuffer_spsc *
+evbuffer_spsc_new_nowake_(void)
+{
+	return evbuffer_spsc_new_impl(NULL, NULL, NULL);
+}
+
+void
+evbuffer_spsc_free(struct evbuffer_spsc *spsc)
+{
+	if (event_initialized(&spsc->wakeup_ev))
+		event_del(&spsc->wakeup_ev);
+	/* Anything still queued is freed along with the consumer buffer. */
+	evbuffer_unfreeze(spsc->consumer, 0);
+	evbuffer_spsc_collect(spsc);
+	mm_free(spsc->head);
+	evbuffer_free(spsc->producer);
+	evbuffer_free(spsc->consumer);
+#ifdef EVBUFFER_SPSC_LOCKED
+	EVTHREAD_FREE_LOCK(spsc->lock, 0);
+#endif
+	mm_free(spsc);
+}
+
+struct evbuffer *
+evbuffer_spsc_get_producer_buffer(struct evbuffer_spsc *spsc)
+{
+	return spsc->producer;
+}
+
+struct evbuffer *
+evbuffer_spsc_get_consumer_buffer(struct evbuffer_spsc *spsc)
+{
+	return spsc->consumer;
+}
+
+int
+evbuffer_spsc_publish(struct evbuffer_spsc *spsc)
+{
+	int wake, r;
+
+	r = evbuffer_spsc_publish_(spsc, &wake);
+	if (wake)
+		event_active(&spsc->wakeup_ev, EV_TIMEOUT, 1);
+	return r;
+}
+
+int
+evbuffer_spsc_publish_(struct evbuffer_spsc *spsc, int *wakep)
+{
+	struct evbuffer_spsc_node *node;
+	ev_ssize_t len;
+
+	*wakep = 0;
+	if (evbuffer_get_length(spsc->producer) == 0)
+		return 0;
+	/* Allocate first, so that failing leaves the data where it was. */
+	if ((node = mm_malloc(sizeof(*node))) == NULL) {
+		event_warn("%s: malloc", __func__);
+		return -1;
+	}
+	len = evbuffer_detach_chains_(spsc->producer, &node->first,
+	    &node->last);
+	if (len <= 0) {
+		mm_free(node);
+		return (int)len;
+	}
+	node->len = (size_t)len;
+	node->next = NULL;
+
+	spsc_store_next(spsc, spsc->tail, node);
+	spsc->tail = node;
+
+	*wakep = spsc_exchange_idle(spsc, 0);
+
+	return 0;
+}
+
+/* Append the chains of 'node' to the list between *firstp and *lastp. */
+static void
+evbuffer_spsc_take_node(struct evbuffer_spsc_node *node,
+    struct evbuffer_chain **firstp, struct evbuffer_chain **lastp)
+{
+	if (*lastp)
+		(*lastp)->next = node->first;
+	else
+		*firstp = node->first;
+	*lastp = node->last;
+	node->first = node->last = NULL;
+}
+
+/* Unlink every node published so far, appending its chains to the list
+ * between *firstp and *lastp.  Returns the number of bytes unlinked. */
+static size_t
+evbuffer_spsc_take(struct evbuffer_spsc *spsc,
+    struct evbuffer_chain **firstp, struct evbuffer_chain **lastp)
+{
+	struct evbuffer_spsc_node *next;
+	size_t len = 0;
+
+	/* Chains we could not hand to a frozen consumer buffer last time. */
+	if (spsc->head->first) {
+		len += spsc->head->len;
+		evbuffer_spsc_take_node(spsc->head, firstp, lastp);
+	}
+	while ((next = spsc_load_next(spsc, spsc->head)) != NULL) {
+		/* The old head has been collected already; 'next' takes its
+		 * place once we have its chains. */
+		mm_free(spsc->head);
+		spsc->head = next;
+		len += next->len;
+		evbuffer_spsc_take_node(next, firstp, lastp);
+	}
+	return len;
+}
+
+ev_ssize_t
+evbuffer_spsc_collect(struct evbuffer_spsc *spsc)
+{
+	struct evbuffer_chain *first = NULL, *last = NULL;
+	size_t len = 0;
+
+	/* Mark ourselves idle once the queue is empty, then look once more:
+	 * a producer that published before seeing the mark did not wake us,
+	 * so its node must be visible by now. */
+	for (;;) {
+		len += evbuffer_spsc_take(spsc, &first, &last);
+		spsc_exchange_idle(spsc, 1);
+		if (spsc_load_next(spsc, spsc->head) == NULL)
+			break;
+		spsc_exchange_idle(spsc, 0);
+	}
+	if (len == 0)
+		return 0;
+
+	if (evbuffer_attach_chains_(spsc->consumer, first, last, len) < 0) {
+		/* The consumer buffer is frozen: keep the chains on the head
+		 * node until the next collect. */
+		spsc->head->first = first;
+		spsc->head->last = last;
+		spsc->head->len = len;
+		return -1;
+	}
+	return (ev_ssize_t)len;
+}
@@ -73,6 +73,9 @@ extern "C" {
 /* On a base bufferevent, for reading: used when a filter has choked this
  * (underlying) bufferevent because it has stopped reading from it. */
 #define BEV_SUSPEND_FILT_READ 0x10
+/* On a socket bufferevent, for reading: used when the evbuffers of our
+ * event_base have gone over their memory budget. */
+#define BEV_SUSPEND_MEM 0x20
 
 typedef ev_uint16_t bufferevent_suspend_flags;
 
@@ -149,6 +152,15 @@ struct bufferevent_rate_limit {
 	struct event refill_bucket_event;
 };
 
+/** Statistics kept by a bufferevent with BEV_OPT_STATS. */
+struct bufferevent_stats_block {
+	/** The counters we report. */
+	struct bufferevent_stats s;
+	/** When the output buffer last went from empty to non-empty; cleared
+	 * while it is empty. */
+	struct timeval output_busy_since;
+};
+
 /** Parts of the bufferevent structure that are shared among all bufferevent
  * types, but not exposed in bufferevent_struct.h. */
 struct bufferevent_private {
@@ -172,6 +184,15 @@ struct bufferevent_private {
 	/** Flag: set if a connect failed prematurely; this is a hack for
 	 * getting around the bufferevent abstraction. */
 	unsigned connection_refused : 1;
+	/** Flag: set if the output has been corked with
+	 * bufferevent_socket_cork(). */
+	unsigned corked : 1;
+	/** Flag: set if we wrote corked data that the kernel may still be
+	 * holding back. */
+	unsigned cork_unpushed : 1;
+	/** Flag: set if we are on our base's list of bufferevents waiting for
+	 * its evbuffers to come back under their memory budget. */
+	unsigned budget_waiting : 1;
 	/** Set to the events pending if we have deferred callbacks and
 	 * an events callback is pending. */
 	short eventcb_pending;
@@ -196,6 +217,24 @@ struct bufferevent_private {
 	/** Used to implement deferred callbacks */
 	struct event_callback deferred;
 
+	/** Entry in our base's list of bufferevents that wait for the
+	 * evbuffer memory budget to recover. */
+	LIST_ENTRY(bufferevent_private) budget_next;
+	/** Used to resume reading once the budget has recovered. */
+	struct event_callback budget_resume;
+
+	/** Used by socket bufferevents with BEV_OPT_WRITE_THROUGH to write
+	 * new output without waiting for EV_WRITE. */
+	struct event_callback write_through;
+
+	/** Used by socket bufferevents with BEV_OPT_LAZY_TIMEOUTS: one timer
+	 * for both timeouts, the time it is set for, and when reading and
+	 * writing last made progress. */
+	struct event lazy_timeout;
+	struct timeval lazy_deadline;
+	struct timeval lazy_read_at;
+	struct timeval lazy_write_at;
+
 	/** The options this bufferevent was constructed with */
 	enum bufferevent_options options;
 
@@ -214,9 +253,17 @@ struct bufferevent_private {
 	 * much in a single write operation. */
 	ev_ssize_t max_single_write;
 
+	/** The most bytes and reads a socket bufferevent makes per read
+	 * callback; 0 for the defaults.  See bufferevent_set_read_budget(). */
+	size_t read_budget_bytes;
+	unsigned read_budget_reads;
+
 	/** Rate-limiting information for this bufferevent */
 	struct bufferevent_rate_limit *rate_limiting;
 
+	/** I/O statistics, if we were created with BEV_OPT_STATS. */
+	struct bufferevent_stats_block *stats;
+
 	/* Saved conn_addr, to extract IP address from it.
 	 *
 	 * Because some servers may reset/close connection without waiting clients,
@@ -229,7 +276,9 @@ struct bufferevent_private {
 		struct sockaddr_in in;
 	} conn_address;
 
-	struct evdns_getaddrinfo_request *dns_request;
+	/** The connection attempts bufferevent_socket_connect_hostname() has
+	 * going, if any. */
+	struct bufferevent_connect_race *connect_race;
 };
 
 /** Possible operations for a control callback. */
@@ -301,6 +350,7 @@ struct bufferevent_ops {
 extern const struct bufferevent_ops bufferevent_ops_socket;
 extern const struct bufferevent_ops bufferevent_ops_filter;
 extern const struct bufferevent_ops bufferevent_ops_pair;
+extern const struct bufferevent_ops bufferevent_ops_pair_cross;
 
 #define BEV_IS_SOCKET(bevp) ((bevp)->be_ops == &bufferevent_ops_socket)
 #define BEV_IS_FILTER(bevp) ((bevp)->be_ops == &bufferevent_ops_filter)
@@ -316,6 +366,11 @@ extern const struct bufferevent_ops bufferevent_ops_async;
 /** Initialize the shared parts of a bufferevent. */
 int bufferevent_init_common_(struct bufferevent_private *, struct event_base *, const struct bufferevent_ops *, enum bufferevent_options options);
 
+/** Move the shared parts of a bufferevent (buffer accounting, the memory
+ * budget wait list, scheduled deferred callbacks) to 'base'.  The caller
+ * moves its own events.  Requires lock. */
+void bufferevent_migrate_common_(struct bufferevent_private *, struct event_base *base);
+
 /** For internal use: temporarily stop all reads on bufev, until the conditions
  * in 'what' are over. */
 void bufferevent_suspend_read_(struct bufferevent *bufev, bufferevent_suspend_flags what);
@@ -335,6 +390,46 @@ void bufferevent_unsuspend_write_(struct bufferevent *bufev, bufferevent_suspend
 #define bufferevent_wm_unsuspend_read(b) \
 	bufferevent_unsuspend_read_((b), BEV_SUSPEND_WM)
 
+/** Note in the statistics of bufferevent_private 'bevp', if it keeps any,
+ * one attempt to read or write that moved 'n' bytes (or none, if n <= 0).
+ * Requires lock. */
+#define BEV_STATS_READ(bevp, n)						\
+	do {								\
+		if ((bevp)->stats) {					\
+			++(bevp)->stats->s.n_reads;			\
+			if ((n) > 0)					\
+				(bevp)->stats->s.bytes_read += (n);	\
+		}							\
+	} while (0)
+#define BEV_STATS_WRITE(bevp, n)					\
+	do {								\
+		if ((bevp)->stats) {					\
+			++(bevp)->stats->s.n_writes;			\
+			if ((n) > 0)					\
+				(bevp)->stats->s.bytes_written += (n);	\
+		}							\
+	} while (0)
+/** Note that the last read or write noted for 'bevp' would have blocked.
+ * Requires lock. */
+#define BEV_STATS_READ_AGAIN(bevp)					\
+	do {								\
+		if ((bevp)->stats)					\
+			++(bevp)->stats->s.n_reads_again;		\
+	} while (0)
+#define BEV_STATS_WRITE_AGAIN(bevp)					\
+	do {								\
+		if ((bevp)->stats)					\
+			++(bevp)->stats->s.n_writes_again;		\
+	} while (0)
+
+/** For internal use: if the evbuffers of bufev's base are over their memory
+ * budget, and the budget says so, suspend reading on bufev until they
+ * recover.  Return 1 if we suspended reading, 0 otherwise. */
+int bufferevent_budget_suspend_read_(struct bufferevent_private *bufev);
+/** For internal use: resume reading on every bufferevent that is waiting
+ * for the memory budget of 'base' to recover.  Requires base lock. */
+void bufferevent_budget_wake_all_(struct event_base *base);
+
 /*
   Disable a bufferevent.  Equivalent to bufferevent_disable(), but
   first resets 'connecting' flag to force EV_WRITE down for sure.
@@ -71,6 +71,14 @@ bufferevent_suspend_read_(struct bufferevent *bufev, bufferevent_suspend_flags w
 	BEV_LOCK(bufev);
 	if (!bufev_private->read_suspended)
 		bufev->be_ops->disable(bufev, EV_READ);
+	if (bufev_private->stats) {
+		bufferevent_suspend_flags added =
+		    what & ~bufev_private->read_suspended;
+		if (added & BEV_SUSPEND_WM)
+			++bufev_private->stats->s.n_read_suspended_wm;
+		if (added & (BEV_SUSPEND_BW|BEV_SUSPEND_BW_GROUP))
+			++bufev_private->stats->s.n_read_suspended_rate;
+	}
 	bufev_private->read_suspended |= what;
 	BEV_UNLOCK(bufev);
 }
@@ -87,6 +95,70 @@ bufferevent_unsuspend_read_(struct bufferevent *bufev, bufferevent_suspend_flags
 	BEV_UNLOCK(bufev);
 }
 
+int
+bufferevent_budget_suspend_read_(struct bufferevent_private *bufev_private)
+{
+	struct event_base *base = bufev_private->bev.ev_base;
+	int suspend;
+
+	/* A base that never had a budget can't be over one. */
+	if (!base || !base->evbuffer_accounting)
+		return 0;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	suspend = base->evbuffer_budget_over &&
+	    (base->evbuffer_budget_flags & EVBUFFER_BUDGET_SUSPEND_READ);
+	if (suspend && !bufev_private->budget_waiting) {
+		LIST_INSERT_HEAD(&base->evbuffer_budget_waiters,
+		    bufev_private, budget_next);
+		bufev_private->budget_waiting = 1;
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	/* If the budget recovers in the meantime, our resume callback will
+	 * run after this, since it needs our lock. */
+	if (suspend)
+		bufferevent_suspend_read_(&bufev_private->bev,
+		    BEV_SUSPEND_MEM);
+	return suspend;
+}
+
+void
+bufferevent_budget_wake_all_(struct event_base *base)
+{
+	struct bufferevent_private *bufev_private;
+
+	while ((bufev_private = LIST_FIRST(&base->evbuffer_budget_waiters))) {
+		LIST_REMOVE(bufev_private, budget_next);
+		bufev_private->budget_waiting = 0;
+		event_deferred_cb_schedule_nolock_(base,
+		    &bufev_private->budget_resume);
+	}
+}
+
+static void
+bufferevent_budget_resume_cb(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_private *bufev_private = arg;
+
+	bufferevent_unsuspend_read_(&bufev_private->bev, BEV_SUSPEND_MEM);
+}
+
+/* Stop waiting for the budget of our base to recover. */
+static void
+bufferevent_budget_unwait(struct bufferevent_private *bufev_private)
+{
+	struct event_base *base = bufev_private->bev.ev_base;
+
+	if (!base)
+		return;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (bufev_private->budget_waiting) {
+		LIST_REMOVE(bufev_private, budget_next);
+		bufev_private->budget_waiting = 0;
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+}
+
 void
 bufferevent_suspend_write_(struct bufferevent *bufev, bufferevent_suspend_flags what)
 {
@@ -287,6 +359,65 @@ bufferevent_trigger_event(struct bufferevent *bufev, short what, int options)
 	bufferevent_decref_and_unlock_(bufev);
 }
 
+static void
+bufferevent_stats_inbuf_cb(struct evbuffer *buf,
+    const struct evbuffer_cb_info *cbinfo, void *arg)
+{
+	struct bufferevent_private *bufev_private = arg;
+	size_t len = evbuffer_get_length(buf);
+
+	if (len > bufev_private->stats->s.max_input)
+		bufev_private->stats->s.max_input = len;
+}
+
+static void
+bufferevent_stats_outbuf_cb(struct evbuffer *buf,
+    const struct evbuffer_cb_info *cbinfo, void *arg)
+{
+	struct bufferevent_private *bufev_private = arg;
+	struct bufferevent_stats_block *stats = bufev_private->stats;
+	size_t len = evbuffer_get_length(buf);
+	struct timeval now;
+
+	if (len > stats->s.max_output)
+		stats->s.max_output = len;
+	if (!len == !evutil_timerisset(&stats->output_busy_since))
+		return;
+	if (event_base_gettime_cached_(bufev_private->bev.ev_base, &now) < 0)
+		return;
+	if (len) {
+		stats->output_busy_since = now;
+	} else {
+		evutil_timersub(&now, &stats->output_busy_since, &now);
+		evutil_timeradd(&stats->s.output_busy, &now,
+		    &stats->s.output_busy);
+		evutil_timerclear(&stats->output_busy_since);
+	}
+}
+
+/* Start keeping statistics for a bufferevent with BEV_OPT_STATS. */
+static int
+bufferevent_stats_init(struct bufferevent_private *bufev_private)
+{
+	struct bufferevent *bufev = &bufev_private->bev;
+
+	bufev_private->stats =
+	    mm_calloc(1, sizeof(struct bufferevent_stats_block));
+	if (!bufev_private->stats) {
+		event_warn("%s: calloc", __func__);
+		return -1;
+	}
+	if (!evbuffer_add_cb(bufev->input, bufferevent_stats_inbuf_cb,
+		bufev_private) ||
+	    !evbuffer_add_cb(bufev->output, bufferevent_stats_outbuf_cb,
+		bufev_private)) {
+		mm_free(bufev_private->stats);
+		bufev_private->stats = NULL;
+		return -1;
+	}
+	return 0;
+}
+
 int
 bufferevent_init_common_(struct bufferevent_private *bufev_private,
     struct event_base *base,
@@ -355,6 +486,21 @@ bufferevent_init_common_(struct bufferevent_private *bufev_private,
 		    bufferevent_run_deferred_callbacks_locked,
 		    bufev_private);
 
+	event_deferred_cb_init_(
+	    &bufev_private->budget_resume,
+	    event_base_get_npriorities(base) / 2,
+	    bufferevent_budget_resume_cb,
+	    bufev_private);
+
+	if ((options & BEV_OPT_STATS) &&
+	    bufferevent_stats_init(bufev_private) < 0) {
+		evbuffer_free(bufev->input);
+		evbuffer_free(bufev->output);
+		bufev->input = NULL;
+		bufev->output = NULL;
+		return -1;
+	}
+
 	bufev_private->options = options;
 
 	evbuffer_set_parent_(bufev->input, bufev);
@@ -363,6 +509,77 @@ bufferevent_init_common_(struct bufferevent_private *bufev_private,
 	return 0;
 }
 
+/* Take 'cb', one of our deferred callbacks, off the queue of 'base'.
+ * Return true iff it was scheduled there. */
+static int
+bufferevent_unschedule_deferred(struct event_base *base,
+    struct event_callback *cb)
+{
+	int queued;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	queued = (cb->evcb_flags & (EVLIST_ACTIVE|EVLIST_ACTIVE_LATER)) != 0;
+	if (queued)
+		event_callback_cancel_nolock_(base, cb, 0);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return queued;
+}
+
+/* Make sure the deferred callback 'cb' has a priority below
+ * 'npriorities'. */
+static void
+bufferevent_clamp_deferred_priority(struct event_callback *cb,
+    int npriorities)
+{
+	if (cb->evcb_pri >= npriorities)
+		event_deferred_cb_set_priority_(cb, npriorities - 1);
+}
+
+void
+bufferevent_migrate_common_(struct bufferevent_private *bufev_private,
+    struct event_base *base)
+{
+	struct bufferevent *bufev = &bufev_private->bev;
+	struct event_base *old_base = bufev->ev_base;
+	int npriorities = event_base_get_npriorities(base);
+	int deferred, resume, through = 0;
+
+	deferred = bufferevent_unschedule_deferred(old_base,
+	    &bufev_private->deferred);
+	resume = bufferevent_unschedule_deferred(old_base,
+	    &bufev_private->budget_resume);
+	if (bufev_private->options & BEV_OPT_WRITE_THROUGH)
+		through = bufferevent_unschedule_deferred(old_base,
+		    &bufev_private->write_through);
+	bufferevent_budget_unwait(bufev_private);
+
+	bufev->ev_base = base;
+	evbuffer_set_parent_(bufev->input, bufev);
+	evbuffer_set_parent_(bufev->output, bufev);
+
+	/* Keep our priorities, as far as the new base has room for them. */
+	bufferevent_clamp_deferred_priority(&bufev_private->deferred,
+	    npriorities);
+	bufferevent_clamp_deferred_priority(&bufev_private->budget_resume,
+	    npriorities);
+	if (bufev_private->options & BEV_OPT_WRITE_THROUGH)
+		bufferevent_clamp_deferred_priority(
+		    &bufev_private->write_through, npriorities);
+
+	/* The reference we took when 'deferred' was first scheduled goes
+	 * along with it. */
+	if (deferred)
+		event_deferred_cb_schedule_(base, &bufev_private->deferred);
+	/* If we were waiting on the old base's budget, let the new base's
+	 * budget decide whether to keep waiting. */
+	if (resume || (bufev_private->read_suspended & BEV_SUSPEND_MEM))
+		event_deferred_cb_schedule_(base,
+		    &bufev_private->budget_resume);
+	if (through)
+		event_deferred_cb_schedule_(base,
+		    &bufev_private->write_through);
+}
+
 void
 bufferevent_setcb(struct bufferevent *bufev,
     bufferevent_data_cb readcb, bufferevent_data_cb writecb,
@@ -640,6 +857,45 @@ bufferevent_getwatermark(struct bufferevent *bufev, short events,
 	return -1;
 }
 
+int
+bufferevent_set_read_budget(struct bufferevent *bufev, size_t max_bytes,
+    unsigned max_reads)
+{
+	struct bufferevent_private *bufev_private = BEV_UPCAST(bufev);
+
+	BEV_LOCK(bufev);
+	bufev_private->read_budget_bytes = max_bytes;
+	bufev_private->read_budget_reads = max_reads;
+	BEV_UNLOCK(bufev);
+	return 0;
+}
+
+int
+bufferevent_get_stats(struct bufferevent *bufev,
+    struct bufferevent_stats *stats)
+{
+	struct bufferevent_private *bufev_private = BEV_UPCAST(bufev);
+	struct timeval now;
+	int r = -1;
+
+	BEV_LOCK(bufev);
+	if (!bufev_private->stats)
+		goto done;
+	*stats = bufev_private->stats->s;
+	/* Count the time the output has been busy so far. */
+	if (evutil_timerisset(&bufev_private->stats->output_busy_since) &&
+	    event_base_gettime_cached_(bufev->ev_base, &now) == 0) {
+		evutil_timersub(&now,
+		    &bufev_private->stats->output_busy_since, &now);
+		evutil_timeradd(&stats->output_busy, &now,
+		    &stats->output_busy);
+	}
+	r = 0;
+done:
+	BEV_UNLOCK(bufev);
+	return r;
+}
+
 int
 bufferevent_flush(struct bufferevent *bufev,
     short iotype,
@@ -698,13 +954,18 @@ bufferevent_decref_and_unlock_(struct bufferevent *bufev)
 
 	if (bufev->be_ops->unlink)
 		bufev->be_ops->unlink(bufev);
+	bufferevent_budget_unwait(bufev_private);
 
 	/* Okay, we're out of references. Let's finalize this once all the
 	 * callbacks are done running. */
 	cbs[0] = &bufev->ev_read.ev_evcallback;
 	cbs[1] = &bufev->ev_write.ev_evcallback;
 	cbs[2] = &bufev_private->deferred;
-	n_cbs = 3;
+	cbs[3] = &bufev_private->budget_resume;
+	cbs[4] = &bufev_private->write_through;
+	n_cbs = 5;
+	if (event_initialized(&bufev_private->lazy_timeout))
+		cbs[n_cbs++] = &bufev_private->lazy_timeout.ev_evcallback;
 	if (bufev_private->rate_limiting) {
 		struct event *e = &bufev_private->rate_limiting->refill_bucket_event;
 		if (event_initialized(e))
@@ -750,7 +1011,10 @@ bufferevent_finalize_cb_(struct event_callback *evcb, void *arg_)
 		mm_free(bufev_private->rate_limiting);
 		bufev_private->rate_limiting = NULL;
 	}
-
+	if (bufev_private->stats) {
+		mm_free(bufev_private->stats);
+		bufev_private->stats = NULL;
+	}
 
 	BEV_UNLOCK(bufev);
 
@@ -316,12 +316,16 @@ be_filter_process_input(struct bufferevent_filtered *bevf,
 
 	do {
 		ev_ssize_t limit = -1;
+		size_t before = evbuffer_get_length(bev->input);
 		if (state == BEV_NORMAL && bev->wm_read.high)
-			limit = bev->wm_read.high -
-			    evbuffer_get_length(bev->input);
+			limit = bev->wm_read.high - before;
 
 		res = bevf->process_in(bevf->underlying->input,
 		    bev->input, limit, state, bevf->context);
+		BEV_STATS_READ(&bevf->bev,
+		    (ev_ssize_t)(evbuffer_get_length(bev->input) - before));
+		if (res == BEV_NEED_MORE)
+			BEV_STATS_READ_AGAIN(&bevf->bev);
 
 		if (res == BEV_OK)
 			*processed_out = 1;
@@ -370,6 +374,7 @@ be_filter_process_output(struct bufferevent_filtered *bevf,
 
 		do {
 			ev_ssize_t limit = -1;
+			size_t before = evbuffer_get_length(bufev->output);
 			if (state == BEV_NORMAL &&
 			    bevf->underlying->wm_write.high)
 				limit = bevf->underlying->wm_write.high -
@@ -380,6 +385,9 @@ be_filter_process_output(struct bufferevent_filtered *bevf,
 			    limit,
 			    state,
 			    bevf->context);
+			BEV_STATS_WRITE(&bevf->bev,
+			    (ev_ssize_t)(before -
+				evbuffer_get_length(bufev->output)));
 
 			if (res == BEV_OK)
 				processed = *processed_out = 1;
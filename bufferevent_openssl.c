@@ -597,6 +597,7 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 			break;
 		ERR_clear_error();
 		r = SSL_read(bev_ssl->ssl, space[i].iov_base, space[i].iov_len);
+		BEV_STATS_READ(&bev_ssl->bev, r);
 		if (r>0) {
 			result |= OP_MADE_PROGRESS;
 			if (bev_ssl->read_blocked_on_write)
@@ -611,6 +612,7 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 			switch (err) {
 			case SSL_ERROR_WANT_READ:
 				/* Can't read until underlying has more data. */
+				BEV_STATS_READ_AGAIN(&bev_ssl->bev);
 				if (bev_ssl->read_blocked_on_write)
 					if (clear_rbow(bev_ssl) < 0)
 						return OP_ERR | result;
@@ -618,6 +620,7 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 			case SSL_ERROR_WANT_WRITE:
 				/* This read operation requires a write, and the
 				 * underlying is full */
+				BEV_STATS_READ_AGAIN(&bev_ssl->bev);
 				if (!bev_ssl->read_blocked_on_write)
 					if (set_rbow(bev_ssl) < 0)
 						return OP_ERR | result;
@@ -675,6 +678,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 		ERR_clear_error();
 		r = SSL_write(bev_ssl->ssl, space[i].iov_base,
 		    space[i].iov_len);
+		BEV_STATS_WRITE(&bev_ssl->bev, r);
 		if (r > 0) {
 			result |= OP_MADE_PROGRESS;
 			if (bev_ssl->write_blocked_on_read)
@@ -689,6 +693,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 			switch (err) {
 			case SSL_ERROR_WANT_WRITE:
 				/* Can't read until underlying has more data. */
+				BEV_STATS_WRITE_AGAIN(&bev_ssl->bev);
 				if (bev_ssl->write_blocked_on_read)
 					if (clear_wbor(bev_ssl) < 0)
 						return OP_ERR | result;
@@ -697,6 +702,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 			case SSL_ERROR_WANT_READ:
 				/* This read operation requires a write, and the
 				 * underlying is full */
+				BEV_STATS_WRITE_AGAIN(&bev_ssl->bev);
 				if (!bev_ssl->write_blocked_on_read)
 					if (set_wbor(bev_ssl) < 0)
 						return OP_ERR | result;
@@ -34,13 +34,18 @@
 
 #include "event2/util.h"
 #include "event2/buffer.h"
+#include "event2/buffer_compat.h"
 #include "event2/bufferevent.h"
 #include "event2/bufferevent_struct.h"
 #include "event2/event.h"
+#include "event2/thread.h"
 #include "defer-internal.h"
 #include "bufferevent-internal.h"
 #include "mm-internal.h"
 #include "util-internal.h"
+#include "evthread-internal.h"
+#include "event-internal.h"
+#include "evbuffer-internal.h"
 
 struct bufferevent_pair {
 	struct bufferevent_private bev;
@@ -155,6 +160,7 @@ be_pair_transfer(struct bufferevent *src, struct bufferevent *dst,
 {
 	size_t dst_size;
 	size_t n;
+	int r;
 
 	evbuffer_unfreeze(src->output, 1);
 	evbuffer_unfreeze(dst->input, 0);
@@ -162,11 +168,15 @@ be_pair_transfer(struct bufferevent *src, struct bufferevent *dst,
 	if (dst->wm_read.high) {
 		dst_size = evbuffer_get_length(dst->input);
 		if (dst_size < dst->wm_read.high) {
-			n = dst->wm_read.high - dst_size;
-			evbuffer_remove_buffer(src->output, dst->input, n);
+			r = evbuffer_remove_buffer(src->output, dst->input,
+			    dst->wm_read.high - dst_size);
+			n = r < 0 ? 0 : (size_t)r;
 		} else {
-			if (!ignore_wm)
+			if (!ignore_wm) {
+				BEV_STATS_WRITE(BEV_UPCAST(src), 0);
+				BEV_STATS_WRITE_AGAIN(BEV_UPCAST(src));
 				goto done;
+			}
 			n = evbuffer_get_length(src->output);
 			evbuffer_add_buffer(dst->input, src->output);
 		}
@@ -176,6 +186,8 @@ be_pair_transfer(struct bufferevent *src, struct bufferevent *dst,
 	}
 
 	if (n) {
+		BEV_STATS_WRITE(BEV_UPCAST(src), n);
+		BEV_STATS_READ(BEV_UPCAST(dst), n);
 		BEV_RESET_GENERIC_READ_TIMEOUT(dst);
 
 		if (evbuffer_get_length(dst->output))
@@ -363,3 +375,348 @@ const struct bufferevent_ops bufferevent_ops_pair = {
 	be_pair_flush,
 	NULL, /* ctrl */
 };
+
+/*
+ * Cross-base pairs.
+ *
+ * Each end of a cross-base pair lives on its own event_base, and usually
+ * in its own thread.  The ends share no lock on the data path: what one
+ * end writes is handed to the other through an evbuffer_spsc, which moves
+ * whole chains.  The writer wakes the reader's base only when the reader
+ * has run out of data.  The link lock guards the ends going away, and
+ * those wakeups, so that nothing touches an end's base once it is gone.
+ *
+ * Each end tears down what lives on its own base when it is destructed.
+ * The last end frees only memory: the queues, the lock and the link.
+ */
+
+struct bufferevent_pair_link;
+
+struct bufferevent_pair_cross {
+	struct bufferevent_private bev;
+	struct bufferevent_pair_link *link;
+	/** Our index in link->end[]; data for us arrives on link->q[idx]. */
+	int idx;
+	/** Set once we have seen that the partner will send nothing more. */
+	unsigned peer_eof : 1;
+	/** Set once we have told the user about it. */
+	unsigned eof_reported : 1;
+};
+
+/** What the two ends of a cross-base pair share. */
+struct bufferevent_pair_link {
+	void *lock;
+	/** Number of ends that have not been destructed.  Protected by
+	 * lock. */
+	int refcnt;
+	/** end[i], until it is destructed.  Only the thread running end[i]'s
+	 * base touches end[i]. */
+	struct bufferevent_pair_cross *end[2];
+	/** q[i] carries data to end[i]; its consumer runs on end[i]'s
+	 * base.  These have no wakeup events of their own. */
+	struct evbuffer_spsc *q[2];
+	/** Activated on end[i]'s base when end[i] needs to look at its queue
+	 * again.  Only activated from another thread under lock, and only
+	 * while end[i] is there. */
+	struct event wake[2];
+	/** Set when end[i]'s partner will send nothing more.  Protected by
+	 * lock. */
+	int eof[2];
+};
+
+static inline struct bufferevent_pair_cross *
+upcast_cross(struct bufferevent *bev)
+{
+	if (bev->be_ops != &bufferevent_ops_pair_cross)
+		return NULL;
+	return EVUTIL_UPCAST(bev, struct bufferevent_pair_cross, bev.bev);
+}
+
+/* Free a link, once neither end is left to use it.  Each end has already
+ * removed its wake event, so this touches neither base. */
+static void
+be_pair_link_free(struct bufferevent_pair_link *link)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		if (link->q[i])
+			evbuffer_spsc_free(link->q[i]);
+	}
+	EVTHREAD_FREE_LOCK(link->lock, 0);
+	mm_free(link);
+}
+
+/* Wake end 'idx' of 'link' to look at its queue, unless it is gone. */
+static void
+be_pair_link_wake(struct bufferevent_pair_link *link, int idx)
+{
+	EVLOCK_LOCK(link->lock, 0);
+	if (link->end[idx])
+		event_active(&link->wake[idx], EV_READ, 1);
+	EVLOCK_UNLOCK(link->lock, 0);
+}
+
+/* Hand everything in our output buffer to the partner.  Requires lock. */
+static void
+be_pair_cross_push(struct bufferevent_pair_cross *p)
+{
+	struct bufferevent *bev = downcast(p);
+	struct evbuffer_spsc *q = p->link->q[!p->idx];
+	int wake;
+
+	if (!evbuffer_get_length(bev->output))
+		return;
+	evbuffer_unfreeze(bev->output, 1);
+	BEV_STATS_WRITE(&p->bev, evbuffer_get_length(bev->output));
+	evbuffer_add_buffer(evbuffer_spsc_get_producer_buffer(q), bev->output);
+	evbuffer_freeze(bev->output, 1);
+	/* If this fails, the data waits in the producer buffer for the next
+	 * publish. */
+	evbuffer_spsc_publish_(q, &wake);
+	if (wake)
+		be_pair_link_wake(p->link, !p->idx);
+
+	BEV_DEL_GENERIC_WRITE_TIMEOUT(bev);
+	bufferevent_trigger_nolock_(bev, EV_WRITE, 0);
+}
+
+/* Move what the partner has sent into our input buffer, as far as our read
+ * watermark allows, and report the partner's EOF once we have all of its
+ * data.  Only call this from the thread running our base.  Requires
+ * lock. */
+static void
+be_pair_cross_pull(struct bufferevent_pair_cross *p)
+{
+	struct bufferevent *bev = downcast(p);
+	struct evbuffer_spsc *q = p->link->q[p->idx];
+	struct evbuffer *pending = evbuffer_spsc_get_consumer_buffer(q);
+	size_t len, n, have;
+
+	evbuffer_spsc_collect(q);
+	len = evbuffer_get_length(pending);
+	if (len && (bev->enabled & EV_READ) && !p->bev.read_suspended) {
+		n = len;
+		if (bev->wm_read.high) {
+			have = evbuffer_get_length(bev->input);
+			n = have < bev->wm_read.high ?
+			    bev->wm_read.high - have : 0;
+			if (n > len)
+				n = len;
+		}
+		if (n) {
+			evbuffer_unfreeze(bev->input, 0);
+			evbuffer_remove_buffer(pending, bev->input, n);
+			evbuffer_freeze(bev->input, 0);
+			BEV_STATS_READ(&p->bev, n);
+			len -= n;
+			BEV_RESET_GENERIC_READ_TIMEOUT(bev);
+			bufferevent_trigger_nolock_(bev, EV_READ, 0);
+		}
+	}
+
+	if (p->peer_eof && !len && !p->eof_reported) {
+		p->eof_reported = 1;
+		bufferevent_run_eventcb_(bev, BEV_EVENT_EOF|BEV_EVENT_READING, 0);
+	}
+}
+
+/* Look at our queue again; runs on the base of the end that 'endp' points
+ * to, and does nothing once that end is gone. */
+static void
+be_pair_cross_wake(struct bufferevent_pair_cross **endp, int check_eof)
+{
+	struct bufferevent_pair_cross *p = *endp;
+	struct bufferevent *bev;
+
+	if (!p)
+		return;
+	bev = downcast(p);
+	BEV_LOCK(bev);
+	if (check_eof) {
+		EVLOCK_LOCK(p->link->lock, 0);
+		if (p->link->eof[p->idx])
+			p->peer_eof = 1;
+		EVLOCK_UNLOCK(p->link->lock, 0);
+	}
+	/* A bufferevent that is being freed gets no more data. */
+	if (p->bev.refcnt)
+		be_pair_cross_pull(p);
+	BEV_UNLOCK(bev);
+}
+
+static void
+be_pair_cross_wake_cb(evutil_socket_t fd, short what, void *arg)
+{
+	be_pair_cross_wake(arg, 1);
+}
+
+static void
+be_pair_cross_outbuf_cb(struct evbuffer *outbuf,
+    const struct evbuffer_cb_info *info, void *arg)
+{
+	struct bufferevent_pair_cross *p = arg;
+	struct bufferevent *bev = downcast(p);
+
+	if (info->n_added <= info->n_deleted)
+		return;
+	BEV_LOCK(bev);
+	if (bev->enabled & EV_WRITE)
+		be_pair_cross_push(p);
+	BEV_UNLOCK(bev);
+}
+
+/* Tell the partner that we will send nothing more.  Requires lock. */
+static void
+be_pair_cross_send_eof(struct bufferevent_pair_cross *p)
+{
+	struct bufferevent_pair_link *link = p->link;
+
+	EVLOCK_LOCK(link->lock, 0);
+	link->eof[!p->idx] = 1;
+	if (link->end[!p->idx])
+		event_active(&link->wake[!p->idx], EV_READ, 1);
+	EVLOCK_UNLOCK(link->lock, 0);
+}
+
+static int
+be_pair_cross_enable(struct bufferevent *bev, short events)
+{
+	struct bufferevent_pair_cross *p = upcast_cross(bev);
+
+	if (events & EV_READ) {
+		BEV_RESET_GENERIC_READ_TIMEOUT(bev);
+		/* Only our base's thread may collect from our queue. */
+		if (EVBASE_IN_THREAD(bev->ev_base))
+			be_pair_cross_pull(p);
+		else
+			event_active(&p->link->wake[p->idx], EV_READ, 1);
+	}
+	if (events & EV_WRITE) {
+		if (evbuffer_get_length(bev->output))
+			BEV_RESET_GENERIC_WRITE_TIMEOUT(bev);
+		be_pair_cross_push(p);
+	}
+	return 0;
+}
+
+static void
+be_pair_cross_destruct(struct bufferevent *bev)
+{
+	struct bufferevent_pair_cross *p = upcast_cross(bev);
+	struct bufferevent_pair_link *link = p->link;
+	struct evbuffer *pending;
+	int last;
+
+	EVLOCK_LOCK(link->lock, 0);
+	link->end[p->idx] = NULL;
+	last = --link->refcnt == 0;
+	if (!last) {
+		link->eof[!p->idx] = 1;
+		event_active(&link->wake[!p->idx], EV_READ, 1);
+	}
+	EVLOCK_UNLOCK(link->lock, 0);
+
+	/* Nobody will wake us now, so take our event off our base while we
+	 * know it is still there.  Whatever the partner already sent us is
+	 * dropped here, on our thread; anything it sends later is freed with
+	 * the link. */
+	event_del(&link->wake[p->idx]);
+	pending = evbuffer_spsc_get_consumer_buffer(link->q[p->idx]);
+	evbuffer_spsc_collect(link->q[p->idx]);
+	evbuffer_drain(pending, evbuffer_get_length(pending));
+
+	if (last)
+		be_pair_link_free(link);
+}
+
+static int
+be_pair_cross_flush(struct bufferevent *bev, short iotype,
+    enum bufferevent_flush_mode mode)
+{
+	struct bufferevent_pair_cross *p = upcast_cross(bev);
+
+	if (mode == BEV_NORMAL || !(iotype & EV_WRITE))
+		return 0;
+
+	BEV_LOCK(bev);
+	be_pair_cross_push(p);
+	if (mode == BEV_FINISHED)
+		be_pair_cross_send_eof(p);
+	BEV_UNLOCK(bev);
+	return 0;
+}
+
+int
+bufferevent_pair_new_cross(struct event_base *base_a,
+    struct event_base *base_b, int options, struct bufferevent *pair[2])
+{
+	struct bufferevent_pair_link *link;
+	struct bufferevent_pair_cross *p;
+	struct event_base *base;
+	int i, n;
+
+	if ((link = mm_calloc(1, sizeof(*link))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return -1;
+	}
+	EVTHREAD_ALLOC_LOCK(link->lock, 0);
+	for (i = 0; i < 2; ++i) {
+		base = i ? base_b : base_a;
+		link->q[i] = evbuffer_spsc_new_nowake_();
+		if (!link->q[i] ||
+		    event_assign(&link->wake[i], base, -1, 0,
+			be_pair_cross_wake_cb, &link->end[i]) < 0) {
+			be_pair_link_free(link);
+			return -1;
+		}
+	}
+
+	/* As with bufferevent_pair_new(), writing to one end must not run
+	 * the other end's callbacks from inside the write. */
+	options |= BEV_OPT_DEFER_CALLBACKS;
+	for (i = 0; i < 2; ++i) {
+		base = i ? base_b : base_a;
+		if ((p = mm_calloc(1, sizeof(*p))) == NULL)
+			goto err;
+		if (bufferevent_init_common_(&p->bev, base,
+			&bufferevent_ops_pair_cross, options) < 0) {
+			mm_free(p);
+			goto err;
+		}
+		p->link = link;
+		p->idx = i;
+		link->end[i] = p;
+		++link->refcnt;
+		pair[i] = downcast(p);
+		if (!evbuffer_add_cb(pair[i]->output, be_pair_cross_outbuf_cb,
+			p))
+			goto err;
+		bufferevent_init_generic_timeout_cbs_(pair[i]);
+		evbuffer_freeze(pair[i]->input, 0);
+		evbuffer_freeze(pair[i]->output, 1);
+	}
+	return 0;
+
+err:
+	/* The last end to be destructed frees the link. */
+	if (!(n = link->refcnt)) {
+		be_pair_link_free(link);
+		return -1;
+	}
+	for (i = 0; i < n; ++i)
+		bufferevent_free(pair[i]);
+	return -1;
+}
+
+const struct bufferevent_ops bufferevent_ops_pair_cross = {
+	"pair_cross_elt",
+	evutil_offsetof(struct bufferevent_pair_cross, bev.bev),
+	be_pair_cross_enable,
+	be_pair_disable,
+	NULL, /* unlink */
+	be_pair_cross_destruct,
+	bufferevent_generic_adj_timeouts_,
+	be_pair_cross_flush,
+	NULL, /* ctrl */
+};
@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file bufferevent_pool.c
+
+   This module keeps connected bufferevents to the destinations a program
+   talks to over and over, so that a new request can skip the TCP (and TLS)
+   handshake.  Connections are keyed by address and by an opaque tag that
+   callers use to tell apart, for instance, plain and TLS connections to
+   the same address.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/thread.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "event-internal.h"
+#include "ht-internal.h"
+
+/** Everything we have for one address and tag. */
+struct bevpool_dest {
+	HT_ENTRY(bevpool_dest) node;
+	struct sockaddr_storage addr;
+	int socklen;
+	void *tag;
+	/** Idle connections, most recently returned first. */
+	TAILQ_HEAD(bevpool_idle_list, bevpool_conn) idle;
+	/** Connections, idle or handed out. */
+	unsigned n_conns;
+};
+
+/** One connection that the pool made. */
+struct bevpool_conn {
+	HT_ENTRY(bevpool_conn) node;
+	struct bufferevent *bev;
+	struct bevpool_dest *dest;
+	struct bufferevent_pool *pool;
+	/** Position in dest->idle, when idle. */
+	TAILQ_ENTRY(bevpool_conn) next_idle;
+	/** While idle: watches for the peer closing the connection, and for
+	 * the idle timeout. */
+	struct event watch;
+	unsigned idle : 1;
+	/** True once 'watch' has been assigned.  From then on its callback
+	 * may be running, so we free the connection from a finalizer. */
+	unsigned watch_assigned : 1;
+};
+
+static inline unsigned
+hash_bevpool_dest(const struct bevpool_dest *d)
+{
+	const struct sockaddr *sa = (const struct sockaddr *)&d->addr;
+	unsigned h = (unsigned)(ev_uintptr_t)d->tag ^ sa->sa_family;
+	const unsigned char *p;
+	size_t i, len;
+
+	if (sa->sa_family == AF_INET) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+		h ^= sin->sin_port;
+		p = (const unsigned char *)&sin->sin_addr;
+		len = sizeof(sin->sin_addr);
+	} else {
+		const struct sockaddr_in6 *sin6 =
+		    (const struct sockaddr_in6 *)sa;
+		h ^= sin6->sin6_port;
+		p = (const unsigned char *)&sin6->sin6_addr;
+		len = sizeof(sin6->sin6_addr);
+	}
+	for (i = 0; i < len; ++i)
+		h = h * 31 + p[i];
+	return h;
+}
+
+static inline int
+eq_bevpool_dest(const struct bevpool_dest *a, const struct bevpool_dest *b)
+{
+	return a->tag == b->tag &&
+	    !evutil_sockaddr_cmp((const struct sockaddr *)&a->addr,
+		(const struct sockaddr *)&b->addr, 1);
+}
+
+HT_HEAD(bevpool_dest_map, bevpool_dest);
+HT_PROTOTYPE(bevpool_dest_map, bevpool_dest, node, hash_bevpool_dest,
+    eq_bevpool_dest)
+HT_GENERATE(bevpool_dest_map, bevpool_dest, node, hash_bevpool_dest,
+    eq_bevpool_dest, 0.5, mm_malloc, mm_realloc, mm_free)
+
+static inline unsigned
+hash_bevpool_conn(const struct bevpool_conn *c)
+{
+	/* Every bufferevent is bigger than 64 bytes. */
+	return (unsigned)(((ev_uintptr_t)c->bev) >> 6);
+}
+
+static inline int
+eq_bevpool_conn(const struct bevpool_conn *a, const struct bevpool_conn *b)
+{
+	return a->bev == b->bev;
+}
+
+HT_HEAD(bevpool_conn_map, bevpool_conn);
+HT_PROTOTYPE(bevpool_conn_map, bevpool_conn, node, hash_bevpool_conn,
+    eq_bevpool_conn)
+HT_GENERATE(bevpool_conn_map, bevpool_conn, node, hash_bevpool_conn,
+    eq_bevpool_conn, 0.5, mm_malloc, mm_realloc, mm_free)
+
+/* Declared in event2/bufferevent.h; defined here. */
+struct bufferevent_pool {
+	struct event_base *base;
+	struct bevpool_dest_map dests;
+	struct bevpool_conn_map conns;
+
+	unsigned max_per_dest;
+	struct timeval idle_timeout;
+	/** What the watch events wait for: EV_CLOSED if the backend can
+	 * tell us about it, and EV_READ otherwise. */
+	short watch_events;
+
+	bufferevent_pool_connect_cb connect_cb;
+	void *connect_cb_arg;
+
+	struct bufferevent_pool_stats stats;
+
+	void *lock;
+};
+
+#define POOL_LOCK(p) EVLOCK_LOCK((p)->lock, 0)
+#define POOL_UNLOCK(p) EVLOCK_UNLOCK((p)->lock, 0)
+
+static void
+bevpool_conn_finalize_cb(struct event *ev, void *arg)
+{
+	mm_free(arg);
+}
+
+/* Free 'conn', once its watch callback can no longer be running. */
+static void
+bevpool_conn_free(struct bevpool_conn *conn)
+{
+	if (conn->watch_assigned)
+		event_finalize(0, &conn->watch, bevpool_conn_finalize_cb);
+	else
+		mm_free(conn);
+}
+
+/* Forget 'conn', which must not be idle, and free its destination if that
+ * was the last connection to it.  Requires lock. */
+static void
+bevpool_conn_remove(struct bufferevent_pool *pool, struct bevpool_conn *conn)
+{
+	struct bevpool_dest *dest = conn->dest;
+
+	EVUTIL_ASSERT(!conn->idle);
+	HT_REMOVE(bevpool_conn_map, &pool->conns, conn);
+	bevpool_conn_free(conn);
+	if (--dest->n_conns == 0) {
+		HT_REMOVE(bevpool_dest_map, &pool->dests, dest);
+		mm_free(dest);
+	}
+}
+
+/* Take 'conn' off its destination's idle list.  Requires lock. */
+static void
+bevpool_conn_unidle(struct bufferevent_pool *pool, struct bevpool_conn *conn)
+{
+	EVUTIL_ASSERT(conn->idle);
+	/* The watch callback may be waiting for our lock; don't wait for it
+	 * in turn.  It will see that the connection is no longer idle. */
+	event_del_noblock(&conn->watch);
+	TAILQ_REMOVE(&conn->dest->idle, conn, next_idle);
+	conn->idle = 0;
+	--pool->stats.n_idle;
+}
+
+static void
+bevpool_watch_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bevpool_conn *conn = arg;
+	struct bufferevent_pool *pool = conn->pool;
+	struct bufferevent *bev = conn->bev;
+
+	POOL_LOCK(pool);
+	/* Someone took the connection, and perhaps gave it back, while we
+	 * waited for the lock. */
+	if (!conn->idle ||
+	    event_pending(&conn->watch, EV_TIMEOUT|EV_READ|EV_CLOSED, NULL)) {
+		POOL_UNLOCK(pool);
+		return;
+	}
+	if (what & EV_TIMEOUT)
+		++pool->stats.expired;
+	else
+		++pool->stats.closed;
+	bevpool_conn_unidle(pool, conn);
+	bevpool_conn_remove(pool, conn);
+	POOL_UNLOCK(pool);
+
+	bufferevent_free(bev);
+}
+
+static struct bufferevent *
+bevpool_default_connect(struct event_base *base, const struct sockaddr *sa,
+    int socklen, void *tag, void *arg)
+{
+	struct bufferevent *bev;
+
+	if ((bev = bufferevent_socket_new(base, -1,
+		    BEV_OPT_CLOSE_ON_FREE)) == NULL)
+		return NULL;
+	if (bufferevent_socket_connect(bev, sa, socklen) < 0) {
+		bufferevent_free(bev);
+		return NULL;
+	}
+	return bev;
+}
+
+struct bufferevent_pool *
+bufferevent_pool_new(struct event_base *base, unsigned max_per_dest,
+    const struct timeval *idle_timeout, bufferevent_pool_connect_cb cb,
+    void *arg)
+{
+	struct bufferevent_pool *pool;
+
+	if ((pool = mm_calloc(1, sizeof(*pool))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return NULL;
+	}
+	pool->base = base;
+	HT_INIT(bevpool_dest_map, &pool->dests);
+	HT_INIT(bevpool_conn_map, &pool->conns);
+	pool->max_per_dest = max_per_dest;
+	if (idle_timeout)
+		pool->idle_timeout = *idle_timeout;
+	pool->watch_events =
+	    (event_base_get_features(base) & EV_FEATURE_EARLY_CLOSE) ?
+	    EV_CLOSED : EV_READ;
+	pool->connect_cb = cb ? cb : bevpool_default_connect;
+	pool->connect_cb_arg = arg;
+	EVTHREAD_ALLOC_LOCK(pool->lock, 0);
+
+	return pool;
+}
+
+void
+bufferevent_pool_free(struct bufferevent_pool *pool)
+{
+	struct bevpool_conn **connp, *conn;
+	struct bevpool_dest **destp, *dest;
+
+	/* Idle connections go with the pool; the rest now belong to whoever
+	 * has them. */
+	for (connp = HT_START(bevpool_conn_map, &pool->conns); connp; ) {
+		conn = *connp;
+		connp = HT_NEXT_RMV(bevpool_conn_map, &pool->conns, connp);
+		if (conn->idle) {
+			conn->idle = 0;
+			bufferevent_free(conn->bev);
+		}
+		bevpool_conn_free(conn);
+	}
+	for (destp = HT_START(bevpool_dest_map, &pool->dests); destp; ) {
+		dest = *destp;
+		destp = HT_NEXT_RMV(bevpool_dest_map, &pool->dests, destp);
+		mm_free(dest);
+	}
+	HT_CLEAR(bevpool_conn_map, &pool->conns);
+	HT_CLEAR(bevpool_dest_map, &pool->dests);
+	EVTHREAD_FREE_LOCK(pool->lock, 0);
+	mm_free(pool);
+}
+
+struct bufferevent *
+bufferevent_pool_get(struct bufferevent_pool *pool,
+    const struct sockaddr *sa, int socklen, void *tag)
+{
+	struct bevpool_dest find, *dest;
+	struct bevpool_conn *conn;
+	struct bufferevent *bev = NULL;
+
+	if ((sa->sa_family != AF_INET && sa->sa_family != AF_INET6) ||
+	    socklen <= 0 || (size_t)socklen > sizeof(find.addr))
+		return NULL;
+
+	memset(&find, 0, sizeof(find));
+	memcpy(&find.addr, sa, socklen);
+	find.tag = tag;
+
+	POOL_LOCK(pool);
+	dest = HT_FIND(bevpool_dest_map, &pool->dests, &find);
+	if (dest && (conn = TAILQ_FIRST(&dest->idle)) != NULL) {
+		bevpool_conn_unidle(pool, conn);
+		++pool->stats.n_active;
+		++pool->stats.hits;
+		bev = conn->bev;
+		goto done;
+	}
+	if (dest && pool->max_per_dest && dest->n_conns >= pool->max_per_dest) {
+		++pool->stats.limited;
+		goto done;
+	}
+
+	if ((conn = mm_calloc(1, sizeof(*conn))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		goto done;
+	}
+	if (!dest) {
+		if ((dest = mm_malloc(sizeof(*dest))) == NULL) {
+			event_warn("%s: malloc", __func__);
+			mm_free(conn);
+			goto done;
+		}
+		*dest = find;
+		dest->socklen = socklen;
+		TAILQ_INIT(&dest->idle);
+		HT_INSERT(bevpool_dest_map, &pool->dests, dest);
+	}
+	/* Count the connection before we make it, so that the limit holds
+	 * even if the callback comes back to us. */
+	++dest->n_conns;
+	conn->dest = dest;
+	conn->pool = pool;
+	POOL_UNLOCK(pool);
+
+	bev = pool->connect_cb(pool->base, sa, socklen, tag,
+	    pool->connect_cb_arg);
+
+	POOL_LOCK(pool);
+	if (!bev) {
+		if (--dest->n_conns == 0) {
+			HT_REMOVE(bevpool_dest_map, &pool->dests, dest);
+			mm_free(dest);
+		}
+		mm_free(conn);
+		goto done;
+	}
+	conn->bev = bev;
+	HT_INSERT(bevpool_conn_map, &pool->conns, conn);
+	++pool->stats.n_active;
+	++pool->stats.misses;
+done:
+	POOL_UNLOCK(pool);
+	return bev;
+}
+
+int
+bufferevent_pool_put(struct bufferevent_pool *pool, struct bufferevent *bev)
+{
+	struct bevpool_conn find, *conn;
+	evutil_socket_t fd = bufferevent_getfd(bev);
+	const struct timeval *tv = NULL;
+
+	find.bev = bev;
+	POOL_LOCK(pool);
+	conn = HT_FIND(bevpool_conn_map, &pool->conns, &find);
+	if (!conn || conn->idle) {
+		POOL_UNLOCK(pool);
+		return -1;
+	}
+
+	/* Only a connection with nothing left over from its last use can
+	 * serve the next one. */
+	if (fd < 0 || evbuffer_get_length(bufferevent_get_input(bev)) ||
+	    evbuffer_get_length(bufferevent_get_output(bev))) {
+		--pool->stats.n_active;
+		bevpool_conn_remove(pool, conn);
+		POOL_UNLOCK(pool);
+		bufferevent_free(bev);
+		return -1;
+	}
+
+	bufferevent_setcb(bev, NULL, NULL, NULL, NULL);
+	bufferevent_disable(bev, EV_READ|EV_WRITE);
+	bufferevent_set_timeouts(bev, NULL, NULL);
+
+	/* A callback from the last time the connection was idle may still be
+	 * running, so only reassign the watch if we must. */
+	if (!conn->watch_assigned || event_get_fd(&conn->watch) != fd) {
+		event_assign(&conn->watch, pool->base, fd,
+		    pool->watch_events|EV_FINALIZE, bevpool_watch_cb, conn);
+		conn->watch_assigned = 1;
+	}
+	if (evutil_timerisset(&pool->idle_timeout))
+		tv = &pool->idle_timeout;
+	event_add(&conn->watch, tv);
+	conn->idle = 1;
+	TAILQ_INSERT_HEAD(&conn->dest->idle, conn, next_idle);
+	--pool->stats.n_active;
+	++pool->stats.n_idle;
+	POOL_UNLOCK(pool);
+	return 0;
+}
+
+void
+bufferevent_pool_drop(struct bufferevent_pool *pool, struct bufferevent *bev)
+{
+	struct bevpool_conn find, *conn;
+
+	find.bev = bev;
+	POOL_LOCK(pool);
+	conn = HT_FIND(bevpool_conn_map, &pool->conns, &find);
+	if (conn && !conn->idle) {
+		--pool->stats.n_active;
+		bevpool_conn_remove(pool, conn);
+	}
+	POOL_UNLOCK(pool);
+	bufferevent_free(bev);
+}
+
+void
+bufferevent_pool_get_stats(struct bufferevent_pool *pool,
+    struct bufferevent_pool_stats *stats)
+{
+	POOL_LOCK(pool);
+	*stats = pool->stats;
+	POOL_UNLOCK(pool);
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file bufferevent_proxy.c
+
+   This module joins two bufferevents so that everything read from one is
+   written to the other.  When both are plain socket bufferevents, and the
+   system has splice(), the data goes from one socket to the other through
+   a pipe without ever being copied into user space; otherwise, it moves
+   from one bufferevent's input buffer to the other's output buffer.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "bufferevent-internal.h"
+
+#if defined(EVENT__HAVE_SPLICE) && defined(EVENT__HAVE_PIPE)
+#define USE_SPLICE
+#endif
+
+/** In evbuffer mode, stop reading from a side once this much is waiting to
+ * be written to the other one, and start again once half of it has been
+ * written. */
+#define PROXY_MAX_QUEUED (256*1024)
+/** The most we ask splice() to move at once; a pipe holds 64K by
+ * default. */
+#define PROXY_SPLICE_MAX (64*1024)
+
+/** One direction of a proxy. */
+struct proxy_dir {
+	struct bufferevent_proxy *proxy;
+	struct bufferevent *src;
+	struct bufferevent *dst;
+	/** Bytes read from src and passed on toward dst. */
+	ev_uint64_t total;
+
+	/** Splice mode: the pipe between the two sockets, how much of what
+	 * we put in it has not come out yet, and our events on the source's
+	 * and destination's sockets. */
+	evutil_socket_t pipe[2];
+	size_t in_pipe;
+	struct event ev_read;
+	struct event ev_write;
+
+	/** Set while we wait for dst's socket to finish writing, so that we
+	 * can shut it down. */
+	struct evbuffer *shut_output;
+	struct evbuffer_cb_entry *shut_cb;
+	evutil_socket_t shut_fd;
+
+	/** Set once src has reached EOF. */
+	unsigned eof : 1;
+	/** Set once everything from src has been written to dst. */
+	unsigned done : 1;
+	/** Evbuffer mode: set while we have stopped reading from src
+	 * because dst has too much to write. */
+	unsigned paused : 1;
+};
+
+/* Declared in event2/bufferevent.h; defined here. */
+struct bufferevent_proxy {
+	/** dir[0] goes from the first bufferevent to the second; dir[1]
+	 * goes back. */
+	struct proxy_dir dir[2];
+	int options;
+	bufferevent_proxy_cb cb;
+	void *cbarg;
+	unsigned splicing : 1;
+	/** Set once we have reported the end of the proxy. */
+	unsigned finished : 1;
+};
+
+/* Stop moving data in both directions. */
+static void
+proxy_stop(struct bufferevent_proxy *proxy)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		if (proxy->splicing) {
+			event_del(&d->ev_read);
+			event_del(&d->ev_write);
+		}
+		bufferevent_setcb(d->src, NULL, NULL, NULL, NULL);
+		bufferevent_disable(d->src, EV_READ|EV_WRITE);
+	}
+}
+
+/* Tell the user that the proxy is over.  The callback may free the proxy,
+ * so callers must return right after calling this. */
+static void
+proxy_report(struct bufferevent_proxy *proxy, short what)
+{
+	proxy->finished = 1;
+	proxy_stop(proxy);
+	if (proxy->cb)
+		proxy->cb(proxy, what, proxy->cbarg);
+}
+
+/* Shut down the writing half of a socket once everything queued for it has
+ * been written. */
+static void
+proxy_shutdown_cb(struct evbuffer *buffer,
+    const struct evbuffer_cb_info *info, void *arg)
+{
+	struct proxy_dir *d = arg;
+
+	if (evbuffer_get_length(buffer))
+		return;
+	shutdown(d->shut_fd, EVUTIL_SHUT_WR);
+	evbuffer_remove_cb_entry(buffer, d->shut_cb);
+	d->shut_cb = NULL;
+}
+
+/* Everything from d->src has reached d->dst: pass the EOF on.  May report
+ * the end of the proxy; callers must return right after calling this. */
+static void
+proxy_dir_finish(struct proxy_dir *d)
+{
+	struct bufferevent_proxy *proxy = d->proxy;
+	struct bufferevent *bottom = d->dst, *under;
+	struct evbuffer *output;
+
+	d->done = 1;
+
+	/* A filter has to finish what it is doing before the socket under it
+	 * can be shut down. */
+	if (!BEV_IS_SOCKET(d->dst))
+		bufferevent_flush(d->dst, EV_WRITE, BEV_FINISHED);
+	while ((under = bufferevent_get_underlying(bottom)) != NULL)
+		bottom = under;
+	if (BEV_IS_SOCKET(bottom) &&
+	    (d->shut_fd = bufferevent_getfd(bottom)) >= 0) {
+		output = bufferevent_get_output(bottom);
+		if (!evbuffer_get_length(output)) {
+			shutdown(d->shut_fd, EVUTIL_SHUT_WR);
+		} else {
+			d->shut_output = output;
+			d->shut_cb = evbuffer_add_cb(output,
+			    proxy_shutdown_cb, d);
+		}
+	}
+
+	if (proxy->dir[0].done && proxy->dir[1].done)
+		proxy_report(proxy, BEV_EVENT_EOF);
+}
+
+/* Evbuffer mode */
+
+static struct proxy_dir *
+proxy_dir_from_src(struct bufferevent_proxy *proxy, struct bufferevent *bev)
+{
+	return proxy->dir[0].src == bev ? &proxy->dir[0] : &proxy->dir[1];
+}
+
+static void
+proxy_bev_move(struct proxy_dir *d)
+{
+	struct evbuffer *src = bufferevent_get_input(d->src);
+	struct evbuffer *dst = bufferevent_get_output(d->dst);
+
+	d->total += evbuffer_get_length(src);
+	evbuffer_add_buffer(dst, src);
+	if (!d->eof && !d->paused &&
+	    evbuffer_get_length(dst) >= PROXY_MAX_QUEUED) {
+		d->paused = 1;
+		bufferevent_disable(d->src, EV_READ);
+		bufferevent_setwatermark(d->dst, EV_WRITE,
+		    PROXY_MAX_QUEUED / 2, 0);
+	}
+}
+
+static void
+proxy_bev_readcb(struct bufferevent *bev, void *arg)
+{
+	proxy_bev_move(proxy_dir_from_src(arg, bev));
+}
+
+static void
+proxy_bev_writecb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent_proxy *proxy = arg;
+	/* bev is the destination of the direction it is not the source
+	 * of. */
+	struct proxy_dir *d = proxy->dir[0].dst == bev ?
+	    &proxy->dir[0] : &proxy->dir[1];
+
+	if (d->paused) {
+		d->paused = 0;
+		bufferevent_setwatermark(d->dst, EV_WRITE, 0, 0);
+		if (!d->eof)
+			bufferevent_enable(d->src, EV_READ);
+	}
+	if (d->eof && !d->done &&
+	    !evbuffer_get_length(bufferevent_get_output(bev)))
+		proxy_dir_finish(d);
+}
+
+static void
+proxy_bev_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct bufferevent_proxy *proxy = arg;
+	struct proxy_dir *d;
+
+	if (what & BEV_EVENT_CONNECTED)
+		return;
+	if (!(what & BEV_EVENT_EOF)) {
+		proxy_report(proxy, what);
+		return;
+	}
+
+	d = proxy_dir_from_src(proxy, bev);
+	if (d->eof)
+		return;
+	proxy_bev_move(d);
+	d->eof = 1;
+	if (d->paused) {
+		d->paused = 0;
+		bufferevent_setwatermark(d->dst, EV_WRITE, 0, 0);
+	}
+	if (!evbuffer_get_length(bufferevent_get_output(d->dst)))
+		proxy_dir_finish(d);
+}
+
+/* Splice mode */
+
+#ifdef USE_SPLICE
+/* Move what is in the pipe to the destination, and decide what to wait
+ * for next: we only read more once the pipe is empty, so a slow
+ * destination holds back its source. */
+static void
+proxy_splice_flush(struct proxy_dir *d)
+{
+	evutil_socket_t fd = bufferevent_getfd(d->dst);
+	ev_ssize_t n;
+
+	while (d->in_pipe) {
+		n = splice(d->pipe[0], NULL, fd, NULL, d->in_pipe,
+		    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n < 0) {
+			if (EVUTIL_ERR_RW_RETRIABLE(errno))
+				break;
+			proxy_report(d->proxy,
+			    BEV_EVENT_WRITING|BEV_EVENT_ERROR);
+			return;
+		}
+		d->in_pipe -= n;
+	}
+
+	if (d->in_pipe) {
+		event_del(&d->ev_read);
+		event_add(&d->ev_write, NULL);
+		return;
+	}
+	event_del(&d->ev_write);
+	if (d->eof)
+		proxy_dir_finish(d);
+	else
+		event_add(&d->ev_read, NULL);
+}
+
+static void
+proxy_splice_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct proxy_dir *d = arg;
+	ev_ssize_t n;
+
+	n = splice(fd, NULL, d->pipe[1], NULL, PROXY_SPLICE_MAX,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	if (n < 0) {
+		if (EVUTIL_ERR_RW_RETRIABLE(errno))
+			return;
+		proxy_report(d->proxy, BEV_EVENT_READING|BEV_EVENT_ERROR);
+		return;
+	}
+	if (n == 0) {
+		d->eof = 1;
+		event_del(&d->ev_read);
+	} else {
+		d->in_pipe += n;
+		d->total += n;
+	}
+	proxy_splice_flush(d);
+}
+
+static void
+proxy_splice_writecb(evutil_socket_t fd, short what, void *arg)
+{
+	struct proxy_dir *d = arg;
+	struct evbuffer *output = bufferevent_get_output(d->dst);
+
+	/* Whatever the bufferevent had queued goes out before anything we
+	 * splice. */
+	if (evbuffer_get_length(output)) {
+		int res;
+		evbuffer_unfreeze(output, 1);
+		res = evbuffer_write(output, fd);
+		evbuffer_freeze(output, 1);
+		if (res < 0 &&
+		    !EVUTIL_ERR_RW_RETRIABLE(evutil_socket_geterror(fd))) {
+			proxy_report(d->proxy,
+			    BEV_EVENT_WRITING|BEV_EVENT_ERROR);
+			return;
+		}
+		if (evbuffer_get_length(output))
+			return;
+	}
+	proxy_splice_flush(d);
+}
+
+/* Return true if we can move data to and from bev's socket ourselves. */
+static int
+proxy_can_splice(struct bufferevent *bev)
+{
+	struct bufferevent_private *bev_p = BEV_UPCAST(bev);
+	int ok;
+
+	BEV_LOCK(bev);
+	ok = BEV_IS_SOCKET(bev) && bufferevent_getfd(bev) >= 0 &&
+	    !bev_p->connecting && !bev_p->rate_limiting;
+	BEV_UNLOCK(bev);
+	return ok;
+}
+
+static int
+proxy_splice_start(struct bufferevent_proxy *proxy)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		if (evutil_make_internal_pipe_(d->pipe) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		struct event_base *base = bufferevent_get_base(d->src);
+
+		event_assign(&d->ev_read, base, bufferevent_getfd(d->src),
+		    EV_READ|EV_PERSIST, proxy_splice_readcb, d);
+		event_assign(&d->ev_write, base, bufferevent_getfd(d->dst),
+		    EV_WRITE|EV_PERSIST, proxy_splice_writecb, d);
+		bufferevent_setcb(d->src, NULL, NULL, NULL, NULL);
+		bufferevent_disable(d->src, EV_READ|EV_WRITE);
+	}
+	proxy->splicing = 1;
+
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		struct evbuffer *input = bufferevent_get_input(d->src);
+		struct evbuffer *output = bufferevent_get_output(d->dst);
+
+		d->total += evbuffer_get_length(input);
+		evbuffer_add_buffer(output, input);
+		if (evbuffer_get_length(output))
+			event_add(&d->ev_write, NULL);
+		else
+			event_add(&d->ev_read, NULL);
+	}
+	return 0;
+}
+#endif
+
+struct bufferevent_proxy *
+bufferevent_proxy_new(struct bufferevent *a, struct bufferevent *b,
+    int options, bufferevent_proxy_cb cb, void *cbarg)
+{
+	struct bufferevent_proxy *proxy;
+	int i;
+
+	if (a == b || bufferevent_get_base(a) != bufferevent_get_base(b))
+		return NULL;
+
+	if ((proxy = mm_calloc(1, sizeof(*proxy))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return NULL;
+	}
+	proxy->options = options;
+	proxy->cb = cb;
+	proxy->cbarg = cbarg;
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		d->proxy = proxy;
+		d->src = i ? b : a;
+		d->dst = i ? a : b;
+		d->pipe[0] = d->pipe[1] = -1;
+	}
+
+#ifdef USE_SPLICE
+	if (proxy_can_splice(a) && proxy_can_splice(b)) {
+		if (proxy_splice_start(proxy) == 0)
+			return proxy;
+		for (i = 0; i < 2; ++i) {
+			struct proxy_dir *d = &proxy->dir[i];
+			if (d->pipe[0] >= 0) {
+				evutil_closesocket(d->pipe[0]);
+				evutil_closesocket(d->pipe[1]);
+				d->pipe[0] = d->pipe[1] = -1;
+			}
+		}
+	}
+#endif
+
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		bufferevent_setcb(d->src, proxy_bev_readcb, proxy_bev_writecb,
+		    proxy_bev_eventcb, proxy);
+		bufferevent_setwatermark(d->dst, EV_WRITE, 0, 0);
+	}
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		bufferevent_enable(d->src, EV_READ|EV_WRITE);
+		proxy_bev_move(d);
+	}
+	return proxy;
+}
+
+void
+bufferevent_proxy_free(struct bufferevent_proxy *proxy)
+{
+	int i;
+
+	if (!proxy->finished)
+		proxy_stop(proxy);
+	for (i = 0; i < 2; ++i) {
+		struct proxy_dir *d = &proxy->dir[i];
+		if (d->shut_cb)
+			evbuffer_remove_cb_entry(d->shut_output, d->shut_cb);
+		if (d->pipe[0] >= 0) {
+			evutil_closesocket(d->pipe[0]);
+			evutil_closesocket(d->pipe[1]);
+		}
+	}
+	if (proxy->options & BEV_OPT_CLOSE_ON_FREE) {
+		bufferevent_free(proxy->dir[0].src);
+		bufferevent_free(proxy->dir[1].src);
+	}
+	mm_free(proxy);
+}
+
+int
+bufferevent_proxy_is_splicing(const struct bufferevent_proxy *proxy)
+{
+	return proxy->splicing;
+}
+
+void
+bufferevent_proxy_get_totals(const struct bufferevent_proxy *proxy,
+    ev_uint64_t *a_to_b, ev_uint64_t *b_to_a)
+{
+	if (a_to_b)
+		*a_to_b = proxy->dir[0].total;
+	if (b_to_a)
+		*b_to_a = proxy->dir[1].total;
+}
@@ -60,16 +60,22 @@
 #ifdef EVENT__HAVE_NETINET_IN6_H
 #include <netinet/in6.h>
 #endif
+#ifdef EVENT__HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
 
 #include "event2/util.h"
 #include "event2/bufferevent.h"
 #include "event2/buffer.h"
 #include "event2/bufferevent_struct.h"
+#include "event2/buffer_compat.h"
 #include "event2/bufferevent_compat.h"
 #include "event2/event.h"
 #include "log-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
+#include "evbuffer-internal.h"
+#include "event-internal.h"
 #include "util-internal.h"
 #ifdef _WIN32
 #include "iocp-internal.h"
@@ -77,6 +83,7 @@
 
 /* prototypes */
 static int be_socket_enable(struct bufferevent *, short);
+static int be_socket_adj_timeouts(struct bufferevent *);
 static int be_socket_disable(struct bufferevent *, short);
 static void be_socket_destruct(struct bufferevent *);
 static int be_socket_flush(struct bufferevent *, short, enum bufferevent_flush_mode);
@@ -91,7 +98,7 @@ const struct bufferevent_ops bufferevent_ops_socket = {
 	be_socket_disable,
 	NULL, /* unlink */
 	be_socket_destruct,
-	bufferevent_generic_adj_existing_timeouts_,
+	be_socket_adj_timeouts,
 	be_socket_flush,
 	be_socket_ctrl,
 };
@@ -121,6 +128,139 @@ bufferevent_socket_set_conn_address(struct bufferevent_private *bev_p,
 	memcpy(&bev_p->conn_address, addr, addrlen);
 }
 
+/* With BEV_OPT_LAZY_TIMEOUTS, ev_read and ev_write are added without a
+ * timeout.  Reads and writes just note the time, and lazy_timeout goes off
+ * at the earliest deadline we have told it about; it then works out which
+ * deadlines have really passed. */
+
+/* Set 'deadline' to the earliest time at which a pending event of 'bufev'
+ * would time out.  Returns 0 if none would.  Requires lock. */
+static int
+be_socket_lazy_next_deadline(struct bufferevent *bufev,
+    struct timeval *deadline)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	struct timeval tv;
+	int found = 0;
+
+	if (evutil_timerisset(&bufev->timeout_read) &&
+	    event_pending(&bufev->ev_read, EV_READ, NULL)) {
+		evutil_timeradd(&bufev_p->lazy_read_at, &bufev->timeout_read,
+		    deadline);
+		found = 1;
+	}
+	if (evutil_timerisset(&bufev->timeout_write) &&
+	    event_pending(&bufev->ev_write, EV_WRITE, NULL)) {
+		evutil_timeradd(&bufev_p->lazy_write_at, &bufev->timeout_write,
+		    &tv);
+		if (!found || evutil_timercmp(&tv, deadline, <))
+			*deadline = tv;
+		found = 1;
+	}
+	return found;
+}
+
+/* Make sure lazy_timeout goes off no later than 'deadline'.  Requires
+ * lock. */
+static int
+be_socket_lazy_arm(struct bufferevent_private *bufev_p,
+    const struct timeval *deadline, const struct timeval *now)
+{
+	struct timeval delay;
+
+	if (event_pending(&bufev_p->lazy_timeout, EV_TIMEOUT, NULL) &&
+	    !evutil_timercmp(deadline, &bufev_p->lazy_deadline, <))
+		return 0;
+	if (evutil_timercmp(deadline, now, >))
+		evutil_timersub(deadline, now, &delay);
+	else
+		evutil_timerclear(&delay);
+	bufev_p->lazy_deadline = *deadline;
+	return event_add(&bufev_p->lazy_timeout, &delay);
+}
+
+/* Add 'ev', our read or write event, with the timeout 'tv'. */
+static int
+be_socket_add_event(struct bufferevent *bufev, struct event *ev,
+    const struct timeval *tv)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	struct timeval now, deadline;
+
+	if (!(bufev_p->options & BEV_OPT_LAZY_TIMEOUTS))
+		return bufferevent_add_event_(ev, tv);
+
+	if (event_add(ev, NULL) == -1)
+		return -1;
+	if (!evutil_timerisset(tv))
+		return 0;
+	if (event_base_gettime_cached_(bufev->ev_base, &now) == -1)
+		return -1;
+	if (ev == &bufev->ev_read)
+		bufev_p->lazy_read_at = now;
+	else
+		bufev_p->lazy_write_at = now;
+	evutil_timeradd(&now, tv, &deadline);
+	return be_socket_lazy_arm(bufev_p, &deadline, &now);
+}
+
+/* Note that reading or writing (as given by 'what') just made progress. */
+static inline void
+be_socket_lazy_touch(struct bufferevent *bufev, short what)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+
+	if (!(bufev_p->options & BEV_OPT_LAZY_TIMEOUTS))
+		return;
+	event_base_gettime_cached_(bufev->ev_base,
+	    what == EV_READ ? &bufev_p->lazy_read_at : &bufev_p->lazy_write_at);
+}
+
+static void bufferevent_readcb(evutil_socket_t fd, short event, void *arg);
+static void bufferevent_writecb(evutil_socket_t fd, short event, void *arg);
+
+static void
+be_socket_lazy_timeout_cb(evutil_socket_t fd_, short what_, void *arg)
+{
+	struct bufferevent *bufev = arg;
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	struct timeval now, deadline;
+
+	bufferevent_incref_and_lock_(bufev);
+	if (event_base_gettime_cached_(bufev->ev_base, &now) == -1)
+		goto done;
+
+	/* Time out whatever has really been idle long enough, just as the
+	 * events themselves would have. */
+	if (evutil_timerisset(&bufev->timeout_read) &&
+	    event_pending(&bufev->ev_read, EV_READ, NULL)) {
+		evutil_timeradd(&bufev_p->lazy_read_at, &bufev->timeout_read,
+		    &deadline);
+		if (!evutil_timercmp(&deadline, &now, >))
+			bufferevent_readcb(event_get_fd(&bufev->ev_read),
+			    EV_TIMEOUT, bufev);
+	}
+	if (evutil_timerisset(&bufev->timeout_write) &&
+	    event_pending(&bufev->ev_write, EV_WRITE, NULL)) {
+		evutil_timeradd(&bufev_p->lazy_write_at,
+		    &bufev->timeout_write, &deadline);
+		if (!evutil_timercmp(&deadline, &now, >))
+			bufferevent_writecb(event_get_fd(&bufev->ev_write),
+			    EV_TIMEOUT, bufev);
+	}
+
+	/* Anything that made progress in the meantime gets its remaining
+	 * time. */
+	if (be_socket_lazy_next_deadline(bufev, &deadline))
+		be_socket_lazy_arm(bufev_p, &deadline, &now);
+done:
+	bufferevent_decref_and_unlock_(bufev);
+}
+
 static void
 bufferevent_socket_outbuf_cb(struct evbuffer *buf,
     const struct evbuffer_cb_info *cbinfo,
@@ -136,12 +276,52 @@ bufferevent_socket_outbuf_cb(struct evbuffer *buf,
 	    !bufev_p->write_suspended) {
 		/* Somebody added data to the buffer, and we would like to
 		 * write, and we were not writing.  So, start writing. */
-		if (bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write) == -1) {
+		if ((bufev_p->options & BEV_OPT_WRITE_THROUGH) &&
+		    !bufev_p->connecting) {
+			/* ...right away, once whoever is adding data is done
+			 * with this pass of the loop. */
+			event_deferred_cb_schedule_(bufev->ev_base,
+			    &bufev_p->write_through);
+		} else if (be_socket_add_event(bufev, &bufev->ev_write, &bufev->timeout_write) == -1) {
 		    /* Should we log this? */
 		}
 	}
 }
 
+/* The extra flags for our events: both need to agree, since the backend
+ * keeps one mode per fd. */
+static inline short
+be_socket_et(const struct bufferevent_private *bufev_p)
+{
+	return (bufev_p->options & BEV_OPT_EDGE_TRIGGERED) ? EV_ET : 0;
+}
+
+static void
+bufferevent_write_through_cb(struct event_callback *cb, void *arg)
+{
+	struct bufferevent *bufev = arg;
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+
+	bufferevent_incref_and_lock_(bufev);
+	if (!(bufev->enabled & EV_WRITE) || bufev_p->write_suspended ||
+	    bufev_p->connecting || event_get_fd(&bufev->ev_write) < 0 ||
+	    event_pending(&bufev->ev_write, EV_WRITE, NULL) ||
+	    !evbuffer_get_length(bufev->output))
+		goto done;
+
+	/* Write as though the socket had just become writable.  Whatever
+	 * the kernel would not take waits for EV_WRITE as usual. */
+	bufferevent_writecb(event_get_fd(&bufev->ev_write), EV_WRITE, bufev);
+	if (evbuffer_get_length(bufev->output) &&
+	    (bufev->enabled & EV_WRITE) && !bufev_p->write_suspended &&
+	    !event_pending(&bufev->ev_write, EV_WRITE, NULL))
+		be_socket_add_event(bufev, &bufev->ev_write,
+		    &bufev->timeout_write);
+done:
+	bufferevent_decref_and_unlock_(bufev);
+}
+
 static void
 bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 {
@@ -152,6 +332,8 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	int res = 0;
 	short what = BEV_EVENT_READING;
 	ev_ssize_t howmuch = -1, readmax=-1;
+	size_t total = 0;
+	unsigned nreads = 0, max_reads;
 
 	bufferevent_incref_and_lock_(bufev);
 
@@ -164,34 +346,68 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	}
 
 	input = bufev->input;
+	max_reads = bufev_p->read_budget_reads ? bufev_p->read_budget_reads : 1;
+
+	/* Keep reading until the socket is empty or we have had our share;
+	 * see bufferevent_set_read_budget(). */
+	for (;;) {
+		/*
+		 * If we have a high watermark configured then we don't want to
+		 * read more data than would make us reach the watermark.
+		 */
+		howmuch = -1;
+		if (bufev->wm_read.high != 0) {
+			howmuch = bufev->wm_read.high - evbuffer_get_length(input);
+			/* we somehow lowered the watermark, stop reading */
+			if (howmuch <= 0) {
+				bufferevent_wm_suspend_read(bufev);
+				goto done;
+			}
+		}
+		readmax = bufferevent_get_read_max_(bufev_p);
+		if (howmuch < 0 || howmuch > readmax) /* The use of -1 for "unlimited"
+						       * uglifies this code. XXXX */
+			howmuch = readmax;
+		if (bufev_p->read_budget_bytes &&
+		    (size_t)howmuch > bufev_p->read_budget_bytes - total)
+			howmuch = (ev_ssize_t)(bufev_p->read_budget_bytes - total);
+		if (bufev_p->read_suspended)
+			goto done;
+		if (bufferevent_budget_suspend_read_(bufev_p))
+			goto done;
 
-	/*
-	 * If we have a high watermark configured then we don't want to
-	 * read more data than would make us reach the watermark.
-	 */
-	if (bufev->wm_read.high != 0) {
-		howmuch = bufev->wm_read.high - evbuffer_get_length(input);
-		/* we somehow lowered the watermark, stop reading */
-		if (howmuch <= 0) {
-			bufferevent_wm_suspend_read(bufev);
+		evbuffer_unfreeze(input, 0);
+		res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
+		evbuffer_freeze(input, 0);
+		BEV_STATS_READ(bufev_p, res);
+
+		if (res <= 0)
+			break;
+
+		total += res;
+		bufferevent_decrement_read_buckets_(bufev_p, res);
+
+		/* A short read means the kernel had no more for us. */
+		if (res < howmuch)
+			goto done;
+		if (++nreads >= max_reads || (bufev_p->read_budget_bytes &&
+			total >= bufev_p->read_budget_bytes)) {
+			/* There may be more waiting.  An edge-triggered event
+			 * won't tell us so again; come back once the others
+			 * have had their turn. */
+			if ((bufev_p->options & BEV_OPT_EDGE_TRIGGERED) &&
+			    event_pending(&bufev->ev_read, EV_READ, NULL))
+				event_active_later_(&bufev->ev_read, EV_READ);
 			goto done;
 		}
 	}
-	readmax = bufferevent_get_read_max_(bufev_p);
-	if (howmuch < 0 || howmuch > readmax) /* The use of -1 for "unlimited"
-					       * uglifies this code. XXXX */
-		howmuch = readmax;
-	if (bufev_p->read_suspended)
-		goto done;
-
-	evbuffer_unfreeze(input, 0);
-	res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
-	evbuffer_freeze(input, 0);
 
 	if (res == -1) {
 		int err = evutil_socket_geterror(fd);
-		if (EVUTIL_ERR_RW_RETRIABLE(err))
-			goto reschedule;
+		if (EVUTIL_ERR_RW_RETRIABLE(err)) {
+			BEV_STATS_READ_AGAIN(bufev_p);
+			goto done;
+		}
 		if (EVUTIL_ERR_CONNECT_REFUSED(err)) {
 			bufev_p->connection_refused = 1;
 			goto done;
@@ -203,24 +419,22 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 		what |= BEV_EVENT_EOF;
 	}
 
-	if (res <= 0)
-		goto error;
-
-	bufferevent_decrement_read_buckets_(bufev_p, res);
-
-	/* Invoke the user callback - must always be called last */
-	bufferevent_trigger_nolock_(bufev, EV_READ, 0);
-
-	goto done;
-
- reschedule:
-	goto done;
-
  error:
+	/* Whatever we read before the error or EOF comes first. */
+	if (total)
+		bufferevent_trigger_nolock_(bufev, EV_READ, 0);
 	bufferevent_disable(bufev, EV_READ);
 	bufferevent_run_eventcb_(bufev, what, 0);
+	goto unlock;
 
  done:
+	if (total) {
+		be_socket_lazy_touch(bufev, EV_READ);
+		/* Invoke the user callback - must always be called last */
+		bufferevent_trigger_nolock_(bufev, EV_READ, 0);
+	}
+
+ unlock:
 	bufferevent_decref_and_unlock_(bufev);
 }
 
@@ -293,10 +507,13 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 		evbuffer_unfreeze(bufev->output, 1);
 		res = evbuffer_write_atmost(bufev->output, fd, atmost);
 		evbuffer_freeze(bufev->output, 1);
+		BEV_STATS_WRITE(bufev_p, res);
 		if (res == -1) {
 			int err = evutil_socket_geterror(fd);
-			if (EVUTIL_ERR_RW_RETRIABLE(err))
+			if (EVUTIL_ERR_RW_RETRIABLE(err)) {
+				BEV_STATS_WRITE_AGAIN(bufev_p);
 				goto reschedule;
+			}
 			what |= BEV_EVENT_ERROR;
 		} else if (res == 0) {
 			/* eof case
@@ -308,11 +525,21 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 		if (res <= 0)
 			goto error;
 
+		/* A write made without the cork pushes out everything the
+		 * kernel was holding back. */
+		bufev_p->cork_unpushed = bufev_p->corked;
+
 		bufferevent_decrement_write_buckets_(bufev_p, res);
+		be_socket_lazy_touch(bufev, EV_WRITE);
 	}
 
 	if (evbuffer_get_length(bufev->output) == 0) {
 		event_del(&bufev->ev_write);
+	} else if (res > 0 && (bufev_p->options & BEV_OPT_EDGE_TRIGGERED) &&
+	    event_pending(&bufev->ev_write, EV_WRITE, NULL)) {
+		/* The socket may still be writable, and an edge-triggered
+		 * event won't say so again. */
+		event_active_later_(&bufev->ev_write, EV_WRITE);
 	}
 
 	/*
@@ -363,9 +590,18 @@ bufferevent_socket_new(struct event_base *base, evutil_socket_t fd,
 	evbuffer_set_flags(bufev->output, EVBUFFER_FLAG_DRAINS_TO_FD);
 
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|EV_PERSIST|EV_FINALIZE|be_socket_et(bufev_p),
+	    bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|EV_PERSIST|EV_FINALIZE|be_socket_et(bufev_p),
+	    bufferevent_writecb, bufev);
+	if (options & BEV_OPT_LAZY_TIMEOUTS)
+		event_assign(&bufev_p->lazy_timeout, bufev->ev_base, -1,
+		    EV_FINALIZE, be_socket_lazy_timeout_cb, bufev);
+	if (options & BEV_OPT_WRITE_THROUGH)
+		event_deferred_cb_init_(&bufev_p->write_through,
+		    event_base_get_npriorities(base) / 2,
+		    bufferevent_write_through_cb, bufev);
 
 	evbuffer_add_cb(bufev->output, bufferevent_socket_outbuf_cb, bufev);
 
@@ -459,42 +695,404 @@ done:
 	return result;
 }
 
+/*
+ * bufferevent_socket_connect_hostname() connects the way RFC 8305 ("Happy
+ * Eyeballs") describes.  With AF_UNSPEC we look up the IPv6 and IPv4
+ * addresses separately and start connecting as soon as we have something
+ * to connect to; an IPv4 answer alone waits a little for the IPv6 one.  We
+ * try the addresses one at a time, alternating between the families and
+ * starting with IPv6, but when an attempt fails or has not finished after a
+ * short delay we start the next one alongside it.  The first socket to
+ * connect becomes the bufferevent's; the rest are closed.
+ */
+
+/** How long an IPv4 answer waits for the IPv6 one before we use it. */
+#define CONNECT_RESOLUTION_DELAY_MSEC 50
+/** How long one attempt has before we start the next one as well. */
+#define CONNECT_ATTEMPT_DELAY_MSEC 250
+
+#define CONNECT_V6 0
+#define CONNECT_V4 1
+
+/** One outstanding connect() in a race. */
+struct bufferevent_connect_attempt {
+	LIST_ENTRY(bufferevent_connect_attempt) next;
+	struct bufferevent_connect_race *race;
+	/** EV_WRITE on the attempt's socket. */
+	struct event ev;
+	struct sockaddr_storage addr;
+	int addrlen;
+};
+
+/** One lookup in a race: for IPv6 or IPv4 addresses. */
+struct bufferevent_connect_lookup {
+	struct bufferevent_connect_race *race;
+	struct evdns_getaddrinfo_request *req;
+	/** True until the lookup's callback has run. */
+	int pending;
+	/** Everything the lookup found, and the first address not yet
+	 * tried. */
+	struct evutil_addrinfo *ai;
+	struct evutil_addrinfo *next_ai;
+};
+
+struct bufferevent_connect_race {
+	struct bufferevent *bev;
+	/** One reference while the race is on, and one for each pending
+	 * lookup.  The race holds a reference to bev until it is freed. */
+	int refcnt;
+	struct bufferevent_connect_lookup lookups[2];
+	LIST_HEAD(bufferevent_connect_attempt_list, bufferevent_connect_attempt)
+	    attempts;
+	/** Runs out the resolution delay, then each attempt delay. */
+	struct event timer;
+	/** The family to take the next address from. */
+	int next_family;
+	/** True once we have started an attempt. */
+	unsigned started : 1;
+	/** True once a lookup has given us an address to try. */
+	unsigned got_addr : 1;
+	/** True if we may start an attempt without waiting. */
+	unsigned ready : 1;
+	/** True while the timer is running out the resolution delay, and
+	 * once it has. */
+	unsigned resolution_wait : 1;
+	unsigned resolution_waited : 1;
+	/** True if the last attempt to fail timed out. */
+	unsigned timed_out : 1;
+	/** The first failed lookup's error, and the last failed attempt's. */
+	int dns_error;
+	int socket_error;
+};
+
 static void
-bufferevent_connect_getaddrinfo_cb(int result, struct evutil_addrinfo *ai,
-    void *arg)
+be_connect_race_decref(struct bufferevent_connect_race *race)
 {
-	struct bufferevent *bev = arg;
-	struct bufferevent_private *bev_p =
-	    EVUTIL_UPCAST(bev, struct bufferevent_private, bev);
-	int r;
-	BEV_LOCK(bev);
+	struct bufferevent *bev = race->bev;
+
+	if (--race->refcnt)
+		return;
+	mm_free(race);
+	bufferevent_decref_(bev);
+}
+
+static void
+be_connect_race_set_timer(struct bufferevent_connect_race *race, int msec)
+{
+	struct timeval tv;
 
+	tv.tv_sec = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	event_add(&race->timer, &tv);
+}
+
+/* End the race: close every attempt that is still going, and give up on
+ * the lookups.  Drops the race's own reference, so 'race' may be gone when
+ * this returns.  Requires lock. */
+static void
+be_connect_race_finish(struct bufferevent_connect_race *race)
+{
+	struct bufferevent_private *bev_p = BEV_UPCAST(race->bev);
+	struct bufferevent_connect_attempt *attempt;
+	int i;
+
+	bev_p->connect_race = NULL;
+	event_del(&race->timer);
+	while ((attempt = LIST_FIRST(&race->attempts)) != NULL) {
+		LIST_REMOVE(attempt, next);
+		event_del(&attempt->ev);
+		evutil_closesocket(event_get_fd(&attempt->ev));
+		mm_free(attempt);
+	}
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_connect_lookup *l = &race->lookups[i];
+		if (l->ai) {
+			evutil_freeaddrinfo(l->ai);
+			l->ai = l->next_ai = NULL;
+		}
+		/* The callback still runs, and drops the lookup's
+		 * reference. */
+		if (l->pending && l->req)
+			evutil_getaddrinfo_cancel_async_(l->req);
+	}
+	be_connect_race_decref(race);
+}
+
+/* Nothing is left to try: tell the user.  Requires lock. */
+static void
+be_connect_race_fail(struct bufferevent_connect_race *race)
+{
+	struct bufferevent *bev = race->bev;
+	struct bufferevent_private *bev_p = BEV_UPCAST(bev);
+	short what = BEV_EVENT_ERROR;
+	int err = race->socket_error;
+
+	/* If we had addresses but could not connect to any of them, the
+	 * socket error is the one that matters. */
+	if (!race->got_addr)
+		bev_p->dns_error = race->dns_error ?
+		    race->dns_error : EVUTIL_EAI_FAIL;
+	else if (race->timed_out)
+		what = BEV_EVENT_WRITING|BEV_EVENT_TIMEOUT;
+
+	be_connect_race_finish(race);
+	bufferevent_unsuspend_write_(bev, BEV_SUSPEND_LOOKUP);
+	bufferevent_unsuspend_read_(bev, BEV_SUSPEND_LOOKUP);
+	/* Leave the last attempt's error for the user to find. */
+	if (err)
+		EVUTIL_SET_SOCKET_ERROR(err);
+	bufferevent_run_eventcb_(bev, what, 0);
+}
+
+/* 'attempt' has connected: make its socket ours.  Requires lock. */
+static void
+be_connect_race_won(struct bufferevent_connect_attempt *attempt)
+{
+	struct bufferevent_connect_race *race = attempt->race;
+	struct bufferevent *bev = race->bev;
+	struct bufferevent_private *bev_p = BEV_UPCAST(bev);
+	evutil_socket_t fd = event_get_fd(&attempt->ev);
+
+	LIST_REMOVE(attempt, next);
+	event_del(&attempt->ev);
+	be_connect_race_finish(race);
+
+	bufferevent_socket_set_conn_address(bev_p,
+	    (struct sockaddr *)&attempt->addr, attempt->addrlen);
+	bufferevent_setfd(bev, fd);
+	bev_p->connecting = 1;
 	bufferevent_unsuspend_write_(bev, BEV_SUSPEND_LOOKUP);
 	bufferevent_unsuspend_read_(bev, BEV_SUSPEND_LOOKUP);
+	/* Let bufferevent_writecb() notice, and report it, as it does for
+	 * bufferevent_socket_connect(). */
+	event_active(&bev->ev_write, EV_WRITE, 1);
+	mm_free(attempt);
+}
+
+static void be_connect_race_step(struct bufferevent_connect_race *race);
+
+static void
+be_connect_attempt_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_connect_attempt *attempt = arg;
+	struct bufferevent_connect_race *race = attempt->race;
+	struct bufferevent *bev = race->bev;
+	int c;
 
-	bev_p->dns_request = NULL;
+	bufferevent_incref_and_lock_(bev);
+	if (what & EV_TIMEOUT) {
+		c = -1;
+		EVUTIL_SET_SOCKET_ERROR(ETIMEDOUT);
+	} else {
+		c = evutil_socket_finished_connecting_(fd);
+	}
+	if (c == 0)
+		goto done;
+	if (c > 0) {
+		be_connect_race_won(attempt);
+		goto done;
+	}
+
+	/* This one failed; move on to the next address right away. */
+	race->socket_error = evutil_socket_geterror(fd);
+	race->timed_out = (what & EV_TIMEOUT) != 0;
+	LIST_REMOVE(attempt, next);
+	event_del(&attempt->ev);
+	evutil_closesocket(fd);
+	mm_free(attempt);
+	race->ready = 1;
+	be_connect_race_step(race);
+done:
+	bufferevent_decref_and_unlock_(bev);
+}
 
-	if (result == EVUTIL_EAI_CANCEL) {
-		bev_p->dns_error = result;
-		bufferevent_decref_and_unlock_(bev);
+/* Take the next address to try, alternating between the families.
+ * Requires lock. */
+static struct evutil_addrinfo *
+be_connect_race_next_addr(struct bufferevent_connect_race *race)
+{
+	struct bufferevent_connect_lookup *l;
+	struct evutil_addrinfo *ai;
+	int i, family;
+
+	for (i = 0; i < 2; ++i) {
+		family = race->next_family ^ i;
+		l = &race->lookups[family];
+		while ((ai = l->next_ai) != NULL) {
+			l->next_ai = ai->ai_next;
+			if (ai->ai_family == AF_INET || ai->ai_family == AF_INET6) {
+				race->next_family = family ^ 1;
+				race->got_addr = 1;
+				return ai;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Start connecting to the next address that lets us.  Returns 0 if we
+ * started an attempt, -1 if we ran out of addresses.  Requires lock. */
+static int
+be_connect_race_start_next(struct bufferevent_connect_race *race)
+{
+	struct bufferevent *bev = race->bev;
+	struct bufferevent_connect_attempt *attempt;
+	struct evutil_addrinfo *ai;
+	evutil_socket_t fd;
+	int r;
+
+	while ((ai = be_connect_race_next_addr(race)) != NULL) {
+		fd = evutil_socket_(ai->ai_family,
+		    SOCK_STREAM|EVUTIL_SOCK_NONBLOCK, 0);
+		if (fd < 0) {
+			race->socket_error = EVUTIL_SOCKET_ERROR();
+			continue;
+		}
+		r = evutil_socket_connect_(&fd, ai->ai_addr,
+		    (int)ai->ai_addrlen);
+		if (r < 0 || r == 2) {
+			race->socket_error = evutil_socket_geterror(fd);
+			race->timed_out = 0;
+			evutil_closesocket(fd);
+			continue;
+		}
+		if ((attempt = mm_calloc(1, sizeof(*attempt))) == NULL) {
+			event_warn("%s: calloc", __func__);
+			race->socket_error = ENOMEM;
+			evutil_closesocket(fd);
+			continue;
+		}
+		attempt->race = race;
+		memcpy(&attempt->addr, ai->ai_addr, ai->ai_addrlen);
+		attempt->addrlen = (int)ai->ai_addrlen;
+		event_assign(&attempt->ev, bev->ev_base, fd, EV_WRITE|EV_PERSIST,
+		    be_connect_attempt_cb, attempt);
+		bufferevent_add_event_(&attempt->ev, &bev->timeout_write);
+		LIST_INSERT_HEAD(&race->attempts, attempt, next);
+		if (r == 1)
+			event_active(&attempt->ev, EV_WRITE, 1);
+
+		race->started = 1;
+		race->ready = 0;
+		be_connect_race_set_timer(race, CONNECT_ATTEMPT_DELAY_MSEC);
+		return 0;
+	}
+	return -1;
+}
+
+/* Do whatever the race calls for next.  'race' may be gone when this
+ * returns.  Requires lock. */
+static void
+be_connect_race_step(struct bufferevent_connect_race *race)
+{
+	struct bufferevent_connect_lookup *v6 = &race->lookups[CONNECT_V6];
+	struct bufferevent_connect_lookup *v4 = &race->lookups[CONNECT_V4];
+
+	if (!race->started && v6->pending && v4->next_ai &&
+	    !race->resolution_waited) {
+		/* Only the IPv4 answer is in.  Give the IPv6 one a moment. */
+		if (!race->resolution_wait) {
+			race->resolution_wait = 1;
+			be_connect_race_set_timer(race,
+			    CONNECT_RESOLUTION_DELAY_MSEC);
+		}
 		return;
 	}
-	if (result != 0) {
-		bev_p->dns_error = result;
-		bufferevent_run_eventcb_(bev, BEV_EVENT_ERROR, 0);
-		bufferevent_decref_and_unlock_(bev);
-		if (ai)
-			evutil_freeaddrinfo(ai);
+	if (race->ready && be_connect_race_start_next(race) == 0)
 		return;
+	if (LIST_EMPTY(&race->attempts) && !v6->pending && !v4->pending &&
+	    !v6->next_ai && !v4->next_ai)
+		be_connect_race_fail(race);
+}
+
+static void
+be_connect_race_timer_cb(evutil_socket_t fd_, short what_, void *arg)
+{
+	struct bufferevent_connect_race *race = arg;
+	struct bufferevent *bev = race->bev;
+
+	bufferevent_incref_and_lock_(bev);
+	if (race->resolution_wait) {
+		race->resolution_wait = 0;
+		race->resolution_waited = 1;
+	} else {
+		race->ready = 1;
 	}
+	be_connect_race_step(race);
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static void
+bufferevent_connect_getaddrinfo_cb(int result, struct evutil_addrinfo *ai,
+    void *arg)
+{
+	struct bufferevent_connect_lookup *l = arg;
+	struct bufferevent_connect_race *race = l->race;
+	struct bufferevent *bev = race->bev;
 
-	/* XXX use the other addrinfos? */
-	/* XXX use this return value */
-	bufferevent_socket_set_conn_address(bev_p, ai->ai_addr, (int)ai->ai_addrlen);
-	r = bufferevent_socket_connect(bev, ai->ai_addr, (int)ai->ai_addrlen);
-	(void)r;
+	bufferevent_incref_and_lock_(bev);
+	l->pending = 0;
+	l->req = NULL;
+
+	if (BEV_UPCAST(bev)->connect_race != race) {
+		/* The race is over. */
+		if (ai)
+			evutil_freeaddrinfo(ai);
+	} else {
+		if (result != 0) {
+			if (!race->dns_error)
+				race->dns_error = result;
+			if (ai)
+				evutil_freeaddrinfo(ai);
+		} else {
+			l->ai = l->next_ai = ai;
+		}
+		if (l == &race->lookups[CONNECT_V6] && race->resolution_wait) {
+			/* No need to wait any longer. */
+			event_del(&race->timer);
+			race->resolution_wait = 0;
+		}
+		be_connect_race_step(race);
+	}
+	be_connect_race_decref(race);
 	bufferevent_decref_and_unlock_(bev);
-	evutil_freeaddrinfo(ai);
+}
+
+/* Return the family of 'hostname' if it is a numeric address, and
+ * AF_UNSPEC otherwise.  There is nothing to race for those. */
+static int
+be_connect_numeric_family(const char *hostname)
+{
+	struct in_addr in;
+	struct in6_addr in6;
+	char buf[128];
+	size_t len = strlen(hostname);
+
+	if (evutil_inet_pton(AF_INET, hostname, &in) == 1)
+		return AF_INET;
+	if (evutil_inet_pton(AF_INET6, hostname, &in6) == 1)
+		return AF_INET6;
+	if (len > 2 && len < sizeof(buf) + 2 &&
+	    hostname[0] == '[' && hostname[len-1] == ']') {
+		memcpy(buf, hostname + 1, len - 2);
+		buf[len - 2] = '\0';
+		if (evutil_inet_pton(AF_INET6, buf, &in6) == 1)
+			return AF_INET6;
+	}
+	return AF_UNSPEC;
+}
+
+/* Give up on any connect race that 'bev' has going.  Requires lock. */
+static void
+be_socket_cancel_connect(struct bufferevent *bev)
+{
+	struct bufferevent_private *bev_p = BEV_UPCAST(bev);
+
+	if (!bev_p->connect_race)
+		return;
+	be_connect_race_finish(bev_p->connect_race);
+	bufferevent_unsuspend_write_(bev, BEV_SUSPEND_LOOKUP);
+	bufferevent_unsuspend_read_(bev, BEV_SUSPEND_LOOKUP);
 }
 
 int
@@ -505,6 +1103,8 @@ bufferevent_socket_connect_hostname(struct bufferevent *bev,
 	struct evutil_addrinfo hint;
 	struct bufferevent_private *bev_p =
 	    EVUTIL_UPCAST(bev, struct bufferevent_private, bev);
+	struct bufferevent_connect_race *race;
+	int i;
 
 	if (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC)
 		return -1;
@@ -512,21 +1112,57 @@ bufferevent_socket_connect_hostname(struct bufferevent *bev,
 		return -1;
 
 	memset(&hint, 0, sizeof(hint));
-	hint.ai_family = family;
 	hint.ai_protocol = IPPROTO_TCP;
 	hint.ai_socktype = SOCK_STREAM;
 
 	evutil_snprintf(portbuf, sizeof(portbuf), "%d", port);
+	if (family == AF_UNSPEC)
+		family = be_connect_numeric_family(hostname);
+
+	if ((race = mm_calloc(1, sizeof(*race))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return -1;
+	}
 
 	BEV_LOCK(bev);
+	be_socket_cancel_connect(bev);
 	bev_p->dns_error = 0;
 
 	bufferevent_suspend_write_(bev, BEV_SUSPEND_LOOKUP);
 	bufferevent_suspend_read_(bev, BEV_SUSPEND_LOOKUP);
 
 	bufferevent_incref_(bev);
-	bev_p->dns_request = evutil_getaddrinfo_async_(evdns_base, hostname,
-	    portbuf, &hint, bufferevent_connect_getaddrinfo_cb, bev);
+	race->bev = bev;
+	LIST_INIT(&race->attempts);
+	evtimer_assign(&race->timer, bev->ev_base, be_connect_race_timer_cb,
+	    race);
+	race->ready = 1;
+	race->next_family = CONNECT_V6;
+	/* Ours, and one we hold while starting the lookups, since their
+	 * callbacks can run before we are done. */
+	race->refcnt = 2;
+	for (i = 0; i < 2; ++i) {
+		race->lookups[i].race = race;
+		if (family == AF_UNSPEC ||
+		    family == (i == CONNECT_V6 ? AF_INET6 : AF_INET)) {
+			race->lookups[i].pending = 1;
+			++race->refcnt;
+		}
+	}
+	bev_p->connect_race = race;
+
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_connect_lookup *l = &race->lookups[i];
+		struct evdns_getaddrinfo_request *req;
+		if (!l->pending)
+			continue;
+		hint.ai_family = i == CONNECT_V6 ? AF_INET6 : AF_INET;
+		req = evutil_getaddrinfo_async_(evdns_base, hostname, portbuf,
+		    &hint, bufferevent_connect_getaddrinfo_cb, l);
+		if (l->pending)
+			l->req = req;
+	}
+	be_connect_race_decref(race);
 	BEV_UNLOCK(bev);
 
 	return 0;
@@ -577,14 +1213,36 @@ static int
 be_socket_enable(struct bufferevent *bufev, short event)
 {
 	if (event & EV_READ &&
-	    bufferevent_add_event_(&bufev->ev_read, &bufev->timeout_read) == -1)
+	    be_socket_add_event(bufev, &bufev->ev_read, &bufev->timeout_read) == -1)
 			return -1;
 	if (event & EV_WRITE &&
-	    bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write) == -1)
+	    be_socket_add_event(bufev, &bufev->ev_write, &bufev->timeout_write) == -1)
 			return -1;
 	return 0;
 }
 
+static int
+be_socket_adj_timeouts(struct bufferevent *bufev)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	int r = 0;
+
+	if (!(bufev_p->options & BEV_OPT_LAZY_TIMEOUTS))
+		return bufferevent_generic_adj_existing_timeouts_(bufev);
+
+	/* As with the generic version, a new timeout starts now. */
+	if (event_pending(&bufev->ev_read, EV_READ, NULL) &&
+	    be_socket_add_event(bufev, &bufev->ev_read,
+		&bufev->timeout_read) == -1)
+		r = -1;
+	if (event_pending(&bufev->ev_write, EV_WRITE, NULL) &&
+	    be_socket_add_event(bufev, &bufev->ev_write,
+		&bufev->timeout_write) == -1)
+		r = -1;
+	return r;
+}
+
 static int
 be_socket_disable(struct bufferevent *bufev, short event)
 {
@@ -614,14 +1272,93 @@ be_socket_destruct(struct bufferevent *bufev)
 
 	if ((bufev_p->options & BEV_OPT_CLOSE_ON_FREE) && fd >= 0)
 		EVUTIL_CLOSESOCKET(fd);
+}
 
-	evutil_getaddrinfo_cancel_async_(bufev_p->dns_request);
+/* Tell the kernel to send any partial segment that it is holding back
+ * because we wrote it with MSG_MORE. */
+static void
+be_socket_push(evutil_socket_t fd)
+{
+#if defined(MSG_MORE) && defined(EVENT__HAVE_NETINET_TCP_H) && defined(TCP_CORK)
+	int zero = 0;
+
+	/* Clearing TCP_CORK pushes pending frames, whether or not TCP_CORK
+	 * was set.  This fails harmlessly on non-TCP sockets, which do not
+	 * hold data back in the first place. */
+	(void) setsockopt(fd, IPPROTO_TCP, TCP_CORK, (void *)&zero,
+	    (ev_socklen_t)sizeof(zero));
+#else
+	(void) fd;
+#endif
+}
+
+static void
+be_socket_uncork(struct bufferevent *bufev)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	evutil_socket_t fd;
+
+	if (!bufev_p->corked)
+		return;
+	bufev_p->corked = 0;
+	evbuffer_clear_flags(bufev->output, EVBUFFER_FLAG_CORK);
+
+	if (!bufev_p->cork_unpushed)
+		return;
+
+	/* Push what the kernel is holding back now, rather than counting on
+	 * another write to do it: whatever is still queued may be held up
+	 * by rate limits or a disabled write, or never come at all. */
+	bufev_p->cork_unpushed = 0;
+	fd = event_get_fd(&bufev->ev_write);
+	if (fd >= 0)
+		be_socket_push(fd);
+}
+
+int
+bufferevent_socket_cork(struct bufferevent *bev)
+{
+	struct bufferevent_private *bev_p =
+	    EVUTIL_UPCAST(bev, struct bufferevent_private, bev);
+	int r = -1;
+
+	BEV_LOCK(bev);
+	if (!BEV_IS_SOCKET(bev))
+		goto done;
+
+	if (!bev_p->corked) {
+		bev_p->corked = 1;
+		evbuffer_set_flags(bev->output, EVBUFFER_FLAG_CORK);
+	}
+	r = 0;
+done:
+	BEV_UNLOCK(bev);
+	return r;
+}
+
+int
+bufferevent_socket_uncork(struct bufferevent *bev)
+{
+	int r = -1;
+
+	BEV_LOCK(bev);
+	if (!BEV_IS_SOCKET(bev))
+		goto done;
+
+	be_socket_uncork(bev);
+	r = 0;
+done:
+	BEV_UNLOCK(bev);
+	return r;
 }
 
 static int
 be_socket_flush(struct bufferevent *bev, short iotype,
     enum bufferevent_flush_mode mode)
 {
+	if ((iotype & EV_WRITE) && mode != BEV_NORMAL)
+		be_socket_uncork(bev);
 	return 0;
 }
 
@@ -642,14 +1379,18 @@ be_socket_setfd(struct bufferevent *bufev, evutil_socket_t fd)
 	evbuffer_unfreeze(bufev->output, 1);
 
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|EV_PERSIST|EV_FINALIZE|be_socket_et(bufev_p),
+	    bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|EV_PERSIST|EV_FINALIZE|be_socket_et(bufev_p),
+	    bufferevent_writecb, bufev);
+
+	bufev_p->cork_unpushed = 0;
 
 	if (fd >= 0)
 		bufferevent_enable(bufev, bufev->enabled);
 
-	evutil_getaddrinfo_cancel_async_(bufev_p->dns_request);
+	be_socket_cancel_connect(bufev);
 
 	BEV_UNLOCK(bufev);
 }
@@ -672,6 +1413,12 @@ bufferevent_priority_set(struct bufferevent *bufev, int priority)
 		goto done;
 
 	event_deferred_cb_set_priority_(&bufev_p->deferred, priority);
+	if (bufev_p->options & BEV_OPT_WRITE_THROUGH)
+		event_deferred_cb_set_priority_(&bufev_p->write_through,
+		    priority);
+	if ((bufev_p->options & BEV_OPT_LAZY_TIMEOUTS) &&
+	    event_priority_set(&bufev_p->lazy_timeout, priority) == -1)
+		goto done;
 
 	r = 0;
 done:
@@ -683,6 +1430,8 @@ done:
 int
 bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 {
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
 	int res = -1;
 
 	BEV_LOCK(bufev);
@@ -690,12 +1439,118 @@ bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 		goto done;
 
 	bufev->ev_base = base;
+	/* Count our buffers against the new base. */
+	evbuffer_set_parent_(bufev->input, bufev);
+	evbuffer_set_parent_(bufev->output, bufev);
 
 	res = event_base_set(base, &bufev->ev_read);
 	if (res == -1)
 		goto done;
 
 	res = event_base_set(base, &bufev->ev_write);
+	if (res == -1)
+		goto done;
+
+	if (event_initialized(&bufev_p->lazy_timeout)) {
+		/* It is set again the next time one of our events is. */
+		event_del(&bufev_p->lazy_timeout);
+		res = event_base_set(base, &bufev_p->lazy_timeout);
+	}
+done:
+	BEV_UNLOCK(bufev);
+	return res;
+}
+
+/* Return true iff 'base' is running its loop in some other thread. */
+static int
+be_socket_base_busy_elsewhere(struct event_base *base)
+{
+	int busy;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	busy = base->running_loop && !EVBASE_IN_THREAD(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return busy;
+}
+
+int
+bufferevent_migrate(struct bufferevent *bufev, struct event_base *base)
+{
+	struct bufferevent_private *bufev_p =
+	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
+	struct bufferevent_rate_limit *rlim;
+	int reading, writing, refilling = 0;
+	int priority;
+	int res = -1;
+
+	if (!base)
+		return -1;
+
+	BEV_LOCK(bufev);
+	if (bufev->be_ops != &bufferevent_ops_socket)
+		goto done;
+	if (bufev->ev_base == base) {
+		res = 0;
+		goto done;
+	}
+	/* Finish connecting first: the attempts belong to the old base. */
+	if (bufev_p->connecting || bufev_p->connect_race)
+		goto done;
+	/* We can't take our events away from a loop that might be running
+	 * their callbacks right now, and we can't hand them to one that
+	 * might run them before we let go of the bufferevent. */
+	if (be_socket_base_busy_elsewhere(bufev->ev_base))
+		goto done;
+	if (!bufev_p->lock && be_socket_base_busy_elsewhere(base))
+		goto done;
+
+	reading = event_pending(&bufev->ev_read, EV_READ, NULL);
+	writing = event_pending(&bufev->ev_write, EV_WRITE, NULL);
+	event_del(&bufev->ev_read);
+	event_del(&bufev->ev_write);
+	if (event_initialized(&bufev_p->lazy_timeout))
+		event_del(&bufev_p->lazy_timeout);
+	rlim = bufev_p->rate_limiting;
+	if (rlim && event_initialized(&rlim->refill_bucket_event)) {
+		refilling = event_pending(&rlim->refill_bucket_event,
+		    EV_TIMEOUT, NULL);
+		event_del(&rlim->refill_bucket_event);
+	}
+
+	bufferevent_migrate_common_(bufev_p, base);
+
+	if (event_base_set(base, &bufev->ev_read) == -1 ||
+	    event_base_set(base, &bufev->ev_write) == -1)
+		goto done;
+	if (event_initialized(&bufev_p->lazy_timeout) &&
+	    event_base_set(base, &bufev_p->lazy_timeout) == -1)
+		goto done;
+	if (rlim && event_initialized(&rlim->refill_bucket_event) &&
+	    event_base_set(base, &rlim->refill_bucket_event) == -1)
+		goto done;
+
+	/* event_base_set() put our events back at the new base's default
+	 * priority; restore ours, which bufferevent_migrate_common_() has
+	 * already fit to the new base. */
+	priority = bufev_p->deferred.evcb_pri;
+	if (event_priority_set(&bufev->ev_read, priority) == -1 ||
+	    event_priority_set(&bufev->ev_write, priority) == -1)
+		goto done;
+	if (event_initialized(&bufev_p->lazy_timeout) &&
+	    event_priority_set(&bufev_p->lazy_timeout, priority) == -1)
+		goto done;
+
+	/* As with bufferevent_set_timeouts(), the timeouts start over. */
+	res = 0;
+	if (reading && be_socket_add_event(bufev, &bufev->ev_read,
+		&bufev->timeout_read) == -1)
+		res = -1;
+	if (writing && be_socket_add_event(bufev, &bufev->ev_write,
+		&bufev->timeout_write) == -1)
+		res = -1;
+	if (refilling && rlim->cfg && event_add(&rlim->refill_bucket_event,
+		&rlim->cfg->tick_timeout) == -1)
+		res = -1;
 done:
 	BEV_UNLOCK(bufev);
 	return res;
@@ -712,8 +1567,10 @@ be_socket_ctrl(struct bufferevent *bev, enum bufferevent_ctrl_op op,
 	case BEV_CTRL_GET_FD:
 		data->fd = event_get_fd(&bev->ev_read);
 		return 0;
-	case BEV_CTRL_GET_UNDERLYING:
 	case BEV_CTRL_CANCEL_ALL:
+		be_socket_cancel_connect(bev);
+		return 0;
+	case BEV_CTRL_GET_UNDERLYING:
 	default:
 		return -1;
 	}
@@ -61,6 +61,12 @@ void event_deferred_cb_cancel_(struct event_base *, struct event_callback *);
    Return true if it was not previously scheduled.
  */
 int event_deferred_cb_schedule_(struct event_base *, struct event_callback *);
+/**
+   As event_deferred_cb_schedule_(), but the caller must hold the lock of
+   the event_base.
+ */
+int event_deferred_cb_schedule_nolock_(struct event_base *,
+    struct event_callback *);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,886 @@
+/*
+ * Copyright (c) 2002-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file dgram.c
+
+   Batched datagram I/O.  An evdgram keeps received packets, and packets
+   waiting to be sent, in queues of fixed-size buffers taken from a free
+   list, and moves them to and from the kernel a batch at a time with
+   recvmmsg() and sendmmsg() where we have them, or one at a time
+   otherwise.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#include "event2/dgram.h"
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "log-internal.h"
+#include "evthread-internal.h"
+#include "event-internal.h"
+
+#if defined(EVENT__HAVE_RECVMMSG) || defined(EVENT__HAVE_SENDMMSG)
+#define USE_MMSG
+#endif
+
+/** Packets per system call unless told otherwise. */
+#define EVDGRAM_DEFAULT_BATCH 32
+/** The most packets per system call; Linux refuses more than this. */
+#define EVDGRAM_MAX_BATCH 1024
+
+struct evdgram_packet {
+	TAILQ_ENTRY(evdgram_packet) next;
+	/** Length of the data. */
+	size_t len;
+	/** Length of addr, or 0 for none. */
+	ev_socklen_t addrlen;
+	/** Set if the datagram was longer than our buffer. */
+	unsigned truncated : 1;
+	struct sockaddr_storage addr;
+	/** The data; as long as the max_packet of our evdgram. */
+	unsigned char data[1];
+};
+
+TAILQ_HEAD(evdgram_packetq, evdgram_packet);
+
+struct evdgram {
+	void *lock;
+	struct event_base *base;
+	struct event ev_read;
+	struct event ev_write;
+
+	evdgram_data_cb readcb;
+	evdgram_data_cb writecb;
+	evdgram_error_cb errorcb;
+	void *cbarg;
+
+	unsigned flags;
+	/** EV_READ and/or EV_WRITE, as enabled by the user. */
+	short enabled;
+	int refcnt;
+
+	/** Size of every packet buffer. */
+	size_t max_packet;
+	/** Packets per system call. */
+	unsigned batch;
+	/** Most free packet buffers to keep. */
+	size_t max_free;
+
+	struct evdgram_packetq input;
+	struct evdgram_packetq output;
+	struct evdgram_packetq free_pkts;
+	size_t n_input;
+	size_t n_output;
+	size_t n_free;
+
+	/** Watermarks, in packets; see evdgram_setwatermark(). */
+	size_t rd_low, rd_high;
+	size_t wr_low, wr_high;
+
+#ifdef USE_MMSG
+	/** Scratch space for one batch. */
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct evdgram_packet **pkts;
+#endif
+};
+
+#define LOCK(dg) EVLOCK_LOCK((dg)->lock, 0)
+#define UNLOCK(dg) EVLOCK_UNLOCK((dg)->lock, 0)
+
+static void evdgram_readcb(evutil_socket_t fd, short what, void *arg);
+static void evdgram_writecb(evutil_socket_t fd, short what, void *arg);
+
+/* Return an empty packet, reusing a free one if we have one.  Requires
+ * lock. */
+static struct evdgram_packet *
+evdgram_packet_get(struct evdgram *dg)
+{
+	struct evdgram_packet *pkt = TAILQ_FIRST(&dg->free_pkts);
+
+	if (pkt) {
+		TAILQ_REMOVE(&dg->free_pkts, pkt, next);
+		--dg->n_free;
+	} else {
+		pkt = mm_malloc(offsetof(struct evdgram_packet, data) +
+		    dg->max_packet);
+		if (!pkt) {
+			event_warn("%s: malloc", __func__);
+			return NULL;
+		}
+	}
+	pkt->len = 0;
+	pkt->addrlen = 0;
+	pkt->truncated = 0;
+	return pkt;
+}
+
+/* Put a packet on the free list, or free it if the list is long enough.
+ * Requires lock. */
+static void
+evdgram_packet_put(struct evdgram *dg, struct evdgram_packet *pkt)
+{
+	if (dg->n_free < dg->max_free) {
+		TAILQ_INSERT_HEAD(&dg->free_pkts, pkt, next);
+		++dg->n_free;
+	} else {
+		mm_free(pkt);
+	}
+}
+
+static void
+evdgram_packetq_clear(struct evdgram_packetq *q)
+{
+	struct evdgram_packet *pkt;
+
+	while ((pkt = TAILQ_FIRST(q))) {
+		TAILQ_REMOVE(q, pkt, next);
+		mm_free(pkt);
+	}
+}
+
+static int
+evdgram_input_full(struct evdgram *dg)
+{
+	return dg->rd_high && dg->n_input >= dg->rd_high;
+}
+
+/* Read if we should be reading, and stop if we should not.  Requires
+ * lock. */
+static int
+evdgram_update_read(struct evdgram *dg)
+{
+	if (!(dg->enabled & EV_READ) || evdgram_input_full(dg))
+		return event_del(&dg->ev_read);
+	if (event_pending(&dg->ev_read, EV_READ, NULL))
+		return 0;
+	return event_add(&dg->ev_read, NULL);
+}
+
+/* Write if we have anything to write.  Requires lock. */
+static int
+evdgram_update_write(struct evdgram *dg)
+{
+	if (!(dg->enabled & EV_WRITE) || !dg->n_output)
+		return event_del(&dg->ev_write);
+	if (event_pending(&dg->ev_write, EV_WRITE, NULL))
+		return 0;
+	return event_add(&dg->ev_write, NULL);
+}
+
+/* Make room for batches of dg->batch packets.  Requires lock. */
+static int
+evdgram_alloc_batch(struct evdgram *dg)
+{
+#ifdef USE_MMSG
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct evdgram_packet **pkts;
+
+	msgs = mm_realloc(dg->msgs, dg->batch * sizeof(*msgs));
+	if (!msgs)
+		goto err;
+	dg->msgs = msgs;
+	iovs = mm_realloc(dg->iovs, dg->batch * sizeof(*iovs));
+	if (!iovs)
+		goto err;
+	dg->iovs = iovs;
+	pkts = mm_realloc(dg->pkts, dg->batch * sizeof(*pkts));
+	if (!pkts)
+		goto err;
+	dg->pkts = pkts;
+	return 0;
+err:
+	event_warn("%s: realloc", __func__);
+	return -1;
+#else
+	return 0;
+#endif
+}
+
+struct evdgram *
+evdgram_new(struct event_base *base, evutil_socket_t fd, unsigned flags,
+    size_t max_packet)
+{
+	struct evdgram *dg;
+
+	if (!max_packet)
+		max_packet = EVDGRAM_DEFAULT_PACKET_SIZE;
+
+	dg = mm_calloc(1, sizeof(struct evdgram));
+	if (!dg)
+		return NULL;
+
+	dg->base = base;
+	dg->flags = flags;
+	dg->refcnt = 1;
+	dg->enabled = EV_WRITE;
+	dg->max_packet = max_packet;
+	dg->batch = EVDGRAM_DEFAULT_BATCH;
+	dg->max_free = 2 * EVDGRAM_DEFAULT_BATCH;
+	TAILQ_INIT(&dg->input);
+	TAILQ_INIT(&dg->output);
+	TAILQ_INIT(&dg->free_pkts);
+	if (evdgram_alloc_batch(dg) < 0)
+		goto err;
+
+	if (flags & EVDGRAM_OPT_THREADSAFE) {
+		EVTHREAD_ALLOC_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	}
+
+	event_assign(&dg->ev_read, base, fd, EV_READ|EV_PERSIST|EV_FINALIZE,
+	    evdgram_readcb, dg);
+	event_assign(&dg->ev_write, base, fd, EV_WRITE|EV_PERSIST|EV_FINALIZE,
+	    evdgram_writecb, dg);
+
+	return dg;
+err:
+#ifdef USE_MMSG
+	mm_free(dg->msgs);
+	mm_free(dg->iovs);
+	mm_free(dg->pkts);
+#endif
+	mm_free(dg);
+	return NULL;
+}
+
+struct evdgram *
+evdgram_new_bind(struct event_base *base, unsigned flags, size_t max_packet,
+    const struct sockaddr *sa, int socklen)
+{
+	struct evdgram *dg;
+	evutil_socket_t fd;
+
+	fd = evutil_socket_(sa->sa_family,
+	    SOCK_DGRAM|EVUTIL_SOCK_NONBLOCK|EVUTIL_SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return NULL;
+	if (bind(fd, sa, socklen) < 0)
+		goto err;
+
+	dg = evdgram_new(base, fd, flags | EVDGRAM_OPT_CLOSE_ON_FREE,
+	    max_packet);
+	if (!dg)
+		goto err;
+	return dg;
+err:
+	evutil_closesocket(fd);
+	return NULL;
+}
+
+static void
+evdgram_finalize_cb(struct event_callback *evcb, void *arg)
+{
+	struct evdgram *dg = arg;
+
+	LOCK(dg);
+	if (dg->flags & EVDGRAM_OPT_CLOSE_ON_FREE)
+		evutil_closesocket(event_get_fd(&dg->ev_read));
+	evdgram_packetq_clear(&dg->input);
+	evdgram_packetq_clear(&dg->output);
+	evdgram_packetq_clear(&dg->free_pkts);
+#ifdef USE_MMSG
+	mm_free(dg->msgs);
+	mm_free(dg->iovs);
+	mm_free(dg->pkts);
+#endif
+	UNLOCK(dg);
+	EVTHREAD_FREE_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	mm_free(dg);
+}
+
+/* Drop a reference, and once there are none, free the evdgram when none of
+ * its events are running. */
+static void
+evdgram_decref_and_unlock(struct evdgram *dg)
+{
+	struct event_callback *cbs[2];
+
+	if (--dg->refcnt) {
+		UNLOCK(dg);
+		return;
+	}
+	cbs[0] = &dg->ev_read.ev_evcallback;
+	cbs[1] = &dg->ev_write.ev_evcallback;
+	event_callback_finalize_many_(dg->base, 2, cbs, evdgram_finalize_cb);
+	UNLOCK(dg);
+}
+
+void
+evdgram_free(struct evdgram *dg)
+{
+	LOCK(dg);
+	dg->readcb = NULL;
+	dg->writecb = NULL;
+	dg->errorcb = NULL;
+	dg->enabled = 0;
+	evdgram_decref_and_unlock(dg);
+}
+
+void
+evdgram_setcb(struct evdgram *dg, evdgram_data_cb readcb,
+    evdgram_data_cb writecb, evdgram_error_cb errorcb, void *arg)
+{
+	LOCK(dg);
+	dg->readcb = readcb;
+	dg->writecb = writecb;
+	dg->errorcb = errorcb;
+	dg->cbarg = arg;
+	UNLOCK(dg);
+}
+
+int
+evdgram_enable(struct evdgram *dg, short events)
+{
+	int r = 0;
+
+	LOCK(dg);
+	dg->enabled |= events & (EV_READ|EV_WRITE);
+	if ((events & EV_READ) && evdgram_update_read(dg) < 0)
+		r = -1;
+	if ((events & EV_WRITE) && evdgram_update_write(dg) < 0)
+		r = -1;
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_disable(struct evdgram *dg, short events)
+{
+	int r = 0;
+
+	LOCK(dg);
+	dg->enabled &= ~(events & (EV_READ|EV_WRITE));
+	if ((events & EV_READ) && evdgram_update_read(dg) < 0)
+		r = -1;
+	if ((events & EV_WRITE) && evdgram_update_write(dg) < 0)
+		r = -1;
+	UNLOCK(dg);
+	return r;
+}
+
+void
+evdgram_setwatermark(struct evdgram *dg, short events, size_t lowmark,
+    size_t highmark)
+{
+	LOCK(dg);
+	if (events & EV_READ) {
+		dg->rd_low = lowmark;
+		dg->rd_high = highmark;
+		evdgram_update_read(dg);
+	}
+	if (events & EV_WRITE) {
+		dg->wr_low = lowmark;
+		dg->wr_high = highmark;
+	}
+	UNLOCK(dg);
+}
+
+int
+evdgram_set_batch(struct evdgram *dg, unsigned batch, size_t max_free)
+{
+	struct evdgram_packet *pkt;
+	unsigned old_batch;
+	int r = -1;
+
+	if (!batch)
+		batch = EVDGRAM_DEFAULT_BATCH;
+	if (batch > EVDGRAM_MAX_BATCH)
+		return -1;
+	if (!max_free)
+		max_free = 2 * (size_t)batch;
+
+	LOCK(dg);
+	old_batch = dg->batch;
+	dg->batch = batch;
+	if (evdgram_alloc_batch(dg) < 0) {
+		/* Whatever we did get is at least this large. */
+		if (batch > old_batch)
+			dg->batch = old_batch;
+		goto done;
+	}
+	dg->max_free = max_free;
+	while (dg->n_free > max_free) {
+		pkt = TAILQ_FIRST(&dg->free_pkts);
+		TAILQ_REMOVE(&dg->free_pkts, pkt, next);
+		--dg->n_free;
+		mm_free(pkt);
+	}
+	r = 0;
+done:
+	UNLOCK(dg);
+	return r;
+}
+
+size_t
+evdgram_get_input_count(struct evdgram *dg)
+{
+	size_t n;
+
+	LOCK(dg);
+	n = dg->n_input;
+	UNLOCK(dg);
+	return n;
+}
+
+size_t
+evdgram_get_output_count(struct evdgram *dg)
+{
+	size_t n;
+
+	LOCK(dg);
+	n = dg->n_output;
+	UNLOCK(dg);
+	return n;
+}
+
+/* Take the first packet off our input queue, if there is one.  Requires
+ * lock. */
+static struct evdgram_packet *
+evdgram_input_take(struct evdgram *dg)
+{
+	struct evdgram_packet *pkt = TAILQ_FIRST(&dg->input);
+
+	if (!pkt)
+		return NULL;
+	TAILQ_REMOVE(&dg->input, pkt, next);
+	/* Back under the high watermark: start reading again. */
+	if (dg->n_input-- == dg->rd_high)
+		evdgram_update_read(dg);
+	return pkt;
+}
+
+struct evdgram_packet *
+evdgram_recv_packet(struct evdgram *dg)
+{
+	struct evdgram_packet *pkt;
+
+	LOCK(dg);
+	pkt = evdgram_input_take(dg);
+	UNLOCK(dg);
+	return pkt;
+}
+
+ev_ssize_t
+evdgram_recv(struct evdgram *dg, void *buf, size_t len,
+    struct sockaddr *from, ev_socklen_t *fromlen)
+{
+	struct evdgram_packet *pkt;
+	ev_ssize_t r;
+
+	LOCK(dg);
+	pkt = evdgram_input_take(dg);
+	if (!pkt) {
+		UNLOCK(dg);
+		return -1;
+	}
+	memcpy(buf, pkt->data, pkt->len < len ? pkt->len : len);
+	if (from) {
+		memcpy(from, &pkt->addr,
+		    pkt->addrlen < *fromlen ? pkt->addrlen : *fromlen);
+		*fromlen = pkt->addrlen;
+	}
+	r = (ev_ssize_t)pkt->len;
+	evdgram_packet_put(dg, pkt);
+	UNLOCK(dg);
+	return r;
+}
+
+struct evdgram_packet *
+evdgram_packet_new(struct evdgram *dg)
+{
+	struct evdgram_packet *pkt;
+
+	LOCK(dg);
+	pkt = evdgram_packet_get(dg);
+	UNLOCK(dg);
+	return pkt;
+}
+
+void
+evdgram_packet_free(struct evdgram *dg, struct evdgram_packet *pkt)
+{
+	LOCK(dg);
+	evdgram_packet_put(dg, pkt);
+	UNLOCK(dg);
+}
+
+/* Queue 'pkt' to go to 'to', or to wherever it says if 'to' is NULL.
+ * Free it and return -1 if we can't.  Requires lock. */
+static int
+evdgram_output_add(struct evdgram *dg, struct evdgram_packet *pkt,
+    size_t len, const struct sockaddr *to, ev_socklen_t tolen)
+{
+	if (len > dg->max_packet ||
+	    (to && (size_t)tolen > sizeof(pkt->addr)) ||
+	    (dg->wr_high && dg->n_output >= dg->wr_high)) {
+		evdgram_packet_put(dg, pkt);
+		return -1;
+	}
+	pkt->len = len;
+	pkt->truncated = 0;
+	if (to) {
+		memcpy(&pkt->addr, to, tolen);
+		pkt->addrlen = tolen;
+	}
+	TAILQ_INSERT_TAIL(&dg->output, pkt, next);
+	++dg->n_output;
+	evdgram_update_write(dg);
+	return 0;
+}
+
+int
+evdgram_send_packet(struct evdgram *dg, struct evdgram_packet *pkt,
+    size_t len, const struct sockaddr *to, ev_socklen_t tolen)
+{
+	int r;
+
+	LOCK(dg);
+	r = evdgram_output_add(dg, pkt, len, to, tolen);
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_send(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *to, ev_socklen_t tolen)
+{
+	struct evdgram_packet *pkt;
+	int r = -1;
+
+	LOCK(dg);
+	if (len > dg->max_packet ||
+	    (dg->wr_high && dg->n_output >= dg->wr_high))
+		goto done;
+	if (!(pkt = evdgram_packet_get(dg)))
+		goto done;
+	memcpy(pkt->data, data, len);
+	r = evdgram_output_add(dg, pkt, len, to, tolen);
+done:
+	UNLOCK(dg);
+	return r;
+}
+
+void *
+evdgram_packet_data(struct evdgram_packet *pkt)
+{
+	return pkt->data;
+}
+
+size_t
+evdgram_packet_length(struct evdgram_packet *pkt)
+{
+	return pkt->len;
+}
+
+int
+evdgram_packet_truncated(struct evdgram_packet *pkt)
+{
+	return pkt->truncated;
+}
+
+const struct sockaddr *
+evdgram_packet_addr(struct evdgram_packet *pkt, ev_socklen_t *socklen)
+{
+	if (socklen)
+		*socklen = pkt->addrlen;
+	return pkt->addrlen ? (const struct sockaddr *)&pkt->addr : NULL;
+}
+
+evutil_socket_t
+evdgram_get_fd(struct evdgram *dg)
+{
+	return event_get_fd(&dg->ev_read);
+}
+
+struct event_base *
+evdgram_get_base(struct evdgram *dg)
+{
+	return dg->base;
+}
+
+#ifndef _WIN32
+/* Point 'msg' at 'pkt', to receive into it or send from it. */
+static void
+evdgram_packet_msghdr(struct evdgram *dg, struct evdgram_packet *pkt,
+    struct msghdr *msg, struct iovec *iov, int sending)
+{
+	memset(msg, 0, sizeof(*msg));
+	iov->iov_base = pkt->data;
+	iov->iov_len = sending ? pkt->len : dg->max_packet;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	if (!sending || pkt->addrlen) {
+		msg->msg_name = &pkt->addr;
+		msg->msg_namelen = sending ? pkt->addrlen : sizeof(pkt->addr);
+	}
+}
+#endif
+
+/* Receive up to 'want' packets into our input queue.  Return the number
+ * received; set *err to the socket error if one other than "try again"
+ * happened.  Requires lock. */
+static size_t
+evdgram_read_batch(struct evdgram *dg, evutil_socket_t fd, size_t want,
+    int *err)
+{
+	struct evdgram_packet *pkt;
+	size_t n = 0;
+#ifdef EVENT__HAVE_RECVMMSG
+	size_t i;
+	int r;
+
+	for (i = 0; i < want; ++i) {
+		if (!(pkt = evdgram_packet_get(dg)))
+			break;
+		dg->pkts[i] = pkt;
+		evdgram_packet_msghdr(dg, pkt, &dg->msgs[i].msg_hdr,
+		    &dg->iovs[i], 0);
+	}
+	r = i ? recvmmsg(fd, dg->msgs, (unsigned)i, 0, NULL) : 0;
+	if (r < 0) {
+		int e = evutil_socket_geterror(fd);
+		if (!EVUTIL_ERR_RW_RETRIABLE(e))
+			*err = e;
+		r = 0;
+	}
+	for (n = 0; n < (size_t)r; ++n) {
+		pkt = dg->pkts[n];
+		pkt->len = dg->msgs[n].msg_len;
+		pkt->addrlen = dg->msgs[n].msg_hdr.msg_namelen;
+		pkt->truncated = !!(dg->msgs[n].msg_hdr.msg_flags & MSG_TRUNC);
+		TAILQ_INSERT_TAIL(&dg->input, pkt, next);
+	}
+	for (; i > n; --i)
+		evdgram_packet_put(dg, dg->pkts[i - 1]);
+#else
+	for (n = 0; n < want; ++n) {
+		ev_ssize_t r;
+#ifdef _WIN32
+		int socklen = sizeof(struct sockaddr_storage);
+#else
+		struct msghdr msg;
+		struct iovec iov;
+#endif
+		if (!(pkt = evdgram_packet_get(dg)))
+			break;
+#ifdef _WIN32
+		r = recvfrom(fd, (char *)pkt->data, (int)dg->max_packet, 0,
+		    (struct sockaddr *)&pkt->addr, &socklen);
+		pkt->addrlen = socklen;
+		if (r < 0 && evutil_socket_geterror(fd) == WSAEMSGSIZE) {
+			r = (ev_ssize_t)dg->max_packet;
+			pkt->truncated = 1;
+		}
+#else
+		evdgram_packet_msghdr(dg, pkt, &msg, &iov, 0);
+		r = recvmsg(fd, &msg, 0);
+		pkt->addrlen = msg.msg_namelen;
+		pkt->truncated = !!(msg.msg_flags & MSG_TRUNC);
+#endif
+		if (r < 0) {
+			int e = evutil_socket_geterror(fd);
+			if (!EVUTIL_ERR_RW_RETRIABLE(e))
+				*err = e;
+			evdgram_packet_put(dg, pkt);
+			break;
+		}
+		pkt->len = (size_t)r;
+		TAILQ_INSERT_TAIL(&dg->input, pkt, next);
+	}
+#endif
+	dg->n_input += n;
+	return n;
+}
+
+/* Take the first packet off our output queue.  Requires lock. */
+static void
+evdgram_output_drop(struct evdgram *dg)
+{
+	struct evdgram_packet *pkt = TAILQ_FIRST(&dg->output);
+
+	TAILQ_REMOVE(&dg->output, pkt, next);
+	--dg->n_output;
+	evdgram_packet_put(dg, pkt);
+}
+
+/* Send up to a batch of packets from our output queue.  Return the number
+ * sent; if sending a packet failed for a reason other than "try again",
+ * drop it and set *err to the socket error.  Requires lock. */
+static size_t
+evdgram_write_batch(struct evdgram *dg, evutil_socket_t fd, int *err)
+{
+	struct evdgram_packet *pkt;
+	size_t n = 0;
+	int e = 0;
+#ifdef EVENT__HAVE_SENDMMSG
+	unsigned i = 0;
+	int r;
+
+	TAILQ_FOREACH(pkt, &dg->output, next) {
+		if (i == dg->batch)
+			break;
+		evdgram_packet_msghdr(dg, pkt, &dg->msgs[i].msg_hdr,
+		    &dg->iovs[i], 1);
+		++i;
+	}
+	r = sendmmsg(fd, dg->msgs, i, 0);
+	if (r < 0)
+		e = evutil_socket_geterror(fd);
+	for (; (int)n < r; ++n)
+		evdgram_output_drop(dg);
+#else
+	while (n < dg->batch && (pkt = TAILQ_FIRST(&dg->output))) {
+		ev_ssize_t r;
+#ifdef _WIN32
+		r = sendto(fd, (const char *)pkt->data, (int)pkt->len, 0,
+		    pkt->addrlen ? (struct sockaddr *)&pkt->addr : NULL,
+		    (int)pkt->addrlen);
+#else
+		struct msghdr msg;
+		struct iovec iov;
+		evdgram_packet_msghdr(dg, pkt, &msg, &iov, 1);
+		r = sendmsg(fd, &msg, 0);
+#endif
+		if (r < 0) {
+			e = evutil_socket_geterror(fd);
+			break;
+		}
+		evdgram_output_drop(dg);
+		++n;
+	}
+#endif
+
+	if (e && !EVUTIL_ERR_RW_RETRIABLE(e)) {
+		/* The first packet we haven't sent is the one that failed;
+		 * trying it again would only fail again. */
+		evdgram_output_drop(dg);
+		*err = e;
+	}
+	return n;
+}
+
+/* Run one of our callbacks without holding the lock.  Requires lock and a
+ * reference. */
+static void
+evdgram_run_datacb(struct evdgram *dg, evdgram_data_cb cb)
+{
+	void *arg = dg->cbarg;
+
+	UNLOCK(dg);
+	cb(dg, arg);
+	LOCK(dg);
+}
+
+static void
+evdgram_run_errorcb(struct evdgram *dg, short what, int err)
+{
+	evdgram_error_cb cb = dg->errorcb;
+	void *arg = dg->cbarg;
+
+	if (!cb) {
+		event_sock_warn(event_get_fd(&dg->ev_read), "%s: %s failed",
+		    __func__, what == EV_READ ? "receive" : "send");
+		return;
+	}
+	UNLOCK(dg);
+	cb(dg, what, err, arg);
+	LOCK(dg);
+}
+
+static void
+evdgram_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evdgram *dg = arg;
+	size_t want, n;
+	int err = 0;
+
+	LOCK(dg);
+	++dg->refcnt;
+	if (!(dg->enabled & EV_READ) || evdgram_input_full(dg))
+		goto done;
+
+	/* One batch per wakeup: if there is more, we'll hear about it again
+	 * once everyone else has had a turn. */
+	want = dg->batch;
+	if (dg->rd_high && dg->rd_high - dg->n_input < want)
+		want = dg->rd_high - dg->n_input;
+	n = evdgram_read_batch(dg, fd, want, &err);
+	if (evdgram_input_full(dg))
+		evdgram_update_read(dg);
+
+	/* Whatever we read before the error comes first. */
+	if (n && dg->n_input >= dg->rd_low && dg->readcb)
+		evdgram_run_datacb(dg, dg->readcb);
+	if (err && (dg->enabled & EV_READ))
+		evdgram_run_errorcb(dg, EV_READ, err);
+done:
+	evdgram_decref_and_unlock(dg);
+}
+
+static void
+evdgram_writecb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evdgram *dg = arg;
+	size_t n;
+	int err = 0;
+
+	LOCK(dg);
+	++dg->refcnt;
+	if (!(dg->enabled & EV_WRITE))
+		goto done;
+
+	n = evdgram_write_batch(dg, fd, &err);
+	evdgram_update_write(dg);
+
+	if (err)
+		evdgram_run_errorcb(dg, EV_WRITE, err);
+	if (n && dg->n_output <= dg->wr_low && dg->writecb)
+		evdgram_run_datacb(dg, dg->writecb);
+done:
+	evdgram_decref_and_unlock(dg);
+}
@@ -34,6 +34,7 @@ extern "C" {
 #include "event2/event-config.h"
 #include "evconfig-private.h"
 #include "event2/util.h"
+#include "event2/buffer.h"
 #include "event2/event_struct.h"
 #include "util-internal.h"
 #include "defer-internal.h"
@@ -77,6 +78,18 @@ struct evbuffer_cb_entry {
 
 struct bufferevent;
 struct evbuffer_chain;
+
+/** One entry in the chain offset index of an evbuffer. */
+struct evbuffer_chain_index_entry {
+	/** A chain with data in it. */
+	struct evbuffer_chain *chain;
+	/** Offset of the first byte of 'chain' from the front of the
+	 * buffer. */
+	size_t start;
+};
+
+struct evbuffer_file_read_op;
+
 struct evbuffer {
 	/** The first chain in this buffer's linked list of chains. */
 	struct evbuffer_chain *first;
@@ -127,6 +140,10 @@ struct evbuffer {
 	 * overflows when we have mutually recursive callbacks, and for
 	 * serializing callbacks in a single thread. */
 	unsigned deferred_cbs : 1;
+	/** True iff this evbuffer was made with evbuffer_new_ring(): it
+	 * always has exactly one chain, flagged EVBUFFER_RING, which is never
+	 * freed or replaced until the buffer is. */
+	unsigned ring : 1;
 #ifdef _WIN32
 	/** True iff this buffer is set up for overlapped IO. */
 	unsigned is_overlapped : 1;
@@ -137,6 +154,14 @@ struct evbuffer {
 	/** Used to implement deferred callbacks. */
 	struct event_base *cb_queue;
 
+	/** The event_base whose evbuffer totals count this buffer, or NULL.
+	 * See event_base_get_evbuffer_totals(). */
+	struct event_base *mem_base;
+	/** This buffer as it was last added to mem_base's totals. */
+	struct evbuffer_memory_usage mem_accounted;
+	/** Links this buffer into mem_base's list of evbuffers. */
+	LIST_ENTRY(evbuffer) mem_next;
+
 	/** A reference count on this evbuffer.	 When the reference count
 	 * reaches 0, the buffer is destroyed.	Manipulated with
 	 * evbuffer_incref and evbuffer_decref_and_unlock and
@@ -153,6 +178,32 @@ struct evbuffer {
 	/** The parent bufferevent object this evbuffer belongs to.
 	 * NULL if the evbuffer stands alone. */
 	struct bufferevent *parent;
+
+	/** The evbuffer_add_file_segment_async() operation adding to this
+	 * buffer, if any.  It holds one of our references. */
+	struct evbuffer_file_read_op *file_read;
+
+	/** If EVBUFFER_FLAG_CHAIN_INDEX is set, an array of the non-empty
+	 * chains at the front of the buffer along with their offsets, in
+	 * order.  Appending data never invalidates it; anything that
+	 * removes, replaces, or prepends chains must empty it. */
+	struct evbuffer_chain_index_entry *chain_index;
+	/** Number of valid entries in chain_index. */
+	size_t n_chain_index;
+	/** Number of entries allocated for chain_index. */
+	size_t chain_index_alloc;
+
+	/** The thresholds set with evbuffer_set_compaction(); both are 0 if
+	 * the buffer has no compaction policy. */
+	size_t compact_max_chains;
+	size_t compact_min_avg;
+	/** How many more chains may be appended before a drain next checks
+	 * whether to compact. */
+	size_t compact_countdown;
+	/** Counters reported by evbuffer_get_compaction_stats(). */
+	size_t n_compactions;
+	size_t n_compact_merged;
+	size_t n_compact_copied;
 };
 
 #if EVENT__SIZEOF_OFF_T < EVENT__SIZEOF_SIZE_T
@@ -200,6 +251,15 @@ struct evbuffer_chain {
 #define EVBUFFER_DANGLING	0x0040
 	/** a chain that is a referenced copy of another chain */
 #define EVBUFFER_MULTICAST	0x0080
+	/** a chain whose memory is a huge-page mapping rather than a heap
+	 * allocation */
+#define EVBUFFER_HUGEPAGE	0x0100
+	/** the single chain of a ring buffer; see evbuffer_new_ring() */
+#define EVBUFFER_RING		0x0200
+	/** a ring chain whose memory is mapped twice in a row, so that
+	 * misalign wraps around at buffer_len and the data and the free
+	 * space are each always contiguous */
+#define EVBUFFER_RING_MIRRORED	0x0400
 
 	/** number of references to this chain */
 	int refcnt;
@@ -274,6 +334,20 @@ struct evbuffer_multicast_parent {
 	struct evbuffer_chain *parent;
 };
 
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_search_state {
+	/** Length of the string we are looking for. */
+	size_t len;
+	/** How many bytes of 'what' matched the end of the scanned data. */
+	size_t matched;
+	/** How many bytes from the front of the buffer we have examined. */
+	size_t scanned;
+	/** Knuth-Morris-Pratt failure function for 'what'. */
+	size_t *fail;
+	/** The string we are looking for. */
+	unsigned char *what;
+};
+
 #define EVBUFFER_CHAIN_SIZE sizeof(struct evbuffer_chain)
 /** Return a pointer to extra data allocated along with an evbuffer. */
 #define EVBUFFER_CHAIN_EXTRA(t, c) (t *)((struct evbuffer_chain *)(c) + 1)
@@ -344,6 +418,43 @@ int evbuffer_get_callbacks_(struct evbuffer *buffer,
     struct event_callback **cbs,
     int max_cbs);
 
+/** Update a CRC32C checksum over a block of memory, using the crc32
+ * instruction if the CPU has it. */
+ev_uint32_t evbuffer_crc32c_update_(ev_uint32_t crc, const void *data,
+    size_t len);
+/** As evbuffer_crc32c_update_, but always use the lookup table. */
+ev_uint32_t evbuffer_crc32c_sw_(ev_uint32_t crc, const void *data,
+    size_t len);
+
+/** Unlink the chains of 'buf' up to and including the last one with data,
+ * and store the first and last of them in *firstp and *lastp.  Trailing
+ * empty chains stay in 'buf'.  Returns the number of bytes unlinked, or -1
+ * if the start of 'buf' is frozen or 'buf' cannot give up its chains. */
+ev_ssize_t evbuffer_detach_chains_(struct evbuffer *buf,
+    struct evbuffer_chain **firstp, struct evbuffer_chain **lastp);
+/** Append a list of chains from evbuffer_detach_chains_(), holding 'len'
+ * bytes, to the end of 'buf'.  Returns 0 on success, or -1 if the end of
+ * 'buf' is frozen or 'buf' cannot take chains. */
+int evbuffer_attach_chains_(struct evbuffer *buf,
+    struct evbuffer_chain *first, struct evbuffer_chain *last, size_t len);
+
+/** Create an evbuffer_spsc with no wakeup event and no event_base.  The
+ * producer publishes with evbuffer_spsc_publish_() and wakes the consumer
+ * by its own means.  Since nothing ties it to an event_base, it may be
+ * freed from any thread once neither side uses it any more. */
+struct evbuffer_spsc *evbuffer_spsc_new_nowake_(void);
+/** As evbuffer_spsc_publish(), but instead of activating the wakeup event,
+ * set *wakep to 1 if the consumer has run out of data and must be woken to
+ * collect it, and to 0 otherwise. */
+int evbuffer_spsc_publish_(struct evbuffer_spsc *spsc, int *wakep);
+
+/** Called from evbuffer_decref_and_unlock_() when the only reference left
+ * to 'buf' is the one held by buf->file_read, so that nobody will ever see
+ * what the operation adds.  Cancels the operation.  Returns 1 if the caller
+ * should drop the operation's reference for it, or 0 if the operation will
+ * drop it itself.  Requires lock. */
+int evbuffer_file_read_orphaned_(struct evbuffer *buf);
+
 #ifdef __cplusplus
 }
 #endif
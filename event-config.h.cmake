@@ -53,6 +53,9 @@
 /* Define to 1 if you have the `arc4random_buf' function. */
 #cmakedefine EVENT__HAVE_ARC4RANDOM_BUF
 
+/* Define to 1 if you have the `arc4random_addrandom' function. */
+#cmakedefine EVENT__HAVE_ARC4RANDOM_ADDRANDOM
+
 /* Define if clock_gettime is available in libc */
 #cmakedefine EVENT__DNS_USE_CPU_CLOCK_FOR_ID
 
@@ -178,6 +181,9 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #cmakedefine EVENT__HAVE_MEMORY_H
 
+/* Define to 1 if you have the `memfd_create' function. */
+#cmakedefine EVENT__HAVE_MEMFD_CREATE
+
 /* Define to 1 if you have the `mmap' function. */
 #cmakedefine EVENT__HAVE_MMAP
 
@@ -208,6 +214,9 @@
 /* Define to 1 if you have the `poll' function. */
 #cmakedefine EVENT__HAVE_POLL
 
+/* Define to 1 if you have the `pread' function. */
+#cmakedefine EVENT__HAVE_PREAD
+
 /* Define to 1 if you have the <poll.h> header file. */
 #cmakedefine EVENT__HAVE_POLL_H
 
@@ -223,6 +232,9 @@
 /* Define to 1 if you have the `putenv' function. */
 #cmakedefine EVENT__HAVE_PUTENV
 
+/* Define to 1 if you have the `recvmmsg' function. */
+#cmakedefine EVENT__HAVE_RECVMMSG
+
 /* Define to 1 if the system has the type `sa_family_t'. */
 #cmakedefine EVENT__HAVE_SA_FAMILY_T
 
@@ -241,6 +253,9 @@
 /* Define to 1 if you have the `sendfile' function. */
 #cmakedefine EVENT__HAVE_SENDFILE
 
+/* Define to 1 if you have the `sendmmsg' function. */
+#cmakedefine EVENT__HAVE_SENDMMSG
+
 /* Define if F_SETFD is defined in <fcntl.h> */
 #cmakedefine EVENT__HAVE_SETFD
 
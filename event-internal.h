@@ -222,6 +222,8 @@ struct event_once {
 };
 
 //event_base˵ĺָݡ
+struct bufferevent_private;
+
 struct event_base {
 
 	/* evselװ˶ʽķַƣevbaseָ˾ʹһ.
@@ -362,6 +364,38 @@ struct event_base {
 	/** List of event_onces that have not yet fired. */
 	LIST_HEAD(once_event_list, event_once) once_events;
 
+	/* Memory accounting for evbuffers; see
+	 * event_base_get_evbuffer_totals().  Protected by th_base_lock. */
+	/** The evbuffers counted against this base. */
+	LIST_HEAD(evbuffer_list, evbuffer) evbuffers;
+	/** Total length of those evbuffers. */
+	size_t evbuffer_payload;
+	/** Total memory allocated for those evbuffers. */
+	size_t evbuffer_allocated;
+	/** Total number of chains in those evbuffers. */
+	size_t evbuffer_n_chains;
+	/** Number of those evbuffers. */
+	size_t evbuffer_n_buffers;
+	/** True once the totals are kept up to date as buffers change.
+	 * Never cleared, so buffers may check it without the lock. */
+	int evbuffer_accounting;
+	/** Budget for evbuffer_allocated, or 0 for none. */
+	size_t evbuffer_budget;
+	/** EVBUFFER_BUDGET_* flags. */
+	unsigned evbuffer_budget_flags;
+	/** True iff evbuffer_allocated has gone over the budget, and hasn't yet
+	 * come back under 7/8 of it. */
+	int evbuffer_budget_over;
+	/** Callback to tell the user about evbuffer_budget_over changing. */
+	void (*evbuffer_budget_cb)(struct event_base *, size_t, int, void *);
+	void *evbuffer_budget_cbarg;
+	/** Used to run evbuffer_budget_cb from the loop. */
+	struct event_callback evbuffer_budget_report;
+	/** Bufferevents that have stopped reading until the budget
+	 * recovers. */
+	LIST_HEAD(bufferevent_budget_waiters, bufferevent_private)
+	    evbuffer_budget_waiters;
+
 };
 
 struct event_config_entry {
@@ -481,6 +515,10 @@ void event_base_assert_ok_nolock_(struct event_base *base);
 int event_base_foreach_event_nolock_(struct event_base *base,
     event_base_foreach_event_cb cb, void *arg);
 
+/** Set 'tv' to the time the timers in 'base' are measured against: the
+ * loop's cached time if it has one, otherwise the monotonic clock. */
+int event_base_gettime_cached_(struct event_base *base, struct timeval *tv);
+
 /* Cleanup function to reset debug mode during shutdown.
  *
  * Calling this function doesn't mean it'll be possible to re-enable
@@ -419,6 +419,17 @@ event_base_gettimeofday_cached(struct event_base *base, struct timeval *tv)
     return r;
 }
 
+int
+event_base_gettime_cached_(struct event_base *base, struct timeval *tv)
+{
+    int r;
+
+    EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+    r = gettime(base, tv);
+    EVBASE_RELEASE_LOCK(base, th_base_lock);
+    return r;
+}
+
 /** Make 'base' have no current cached time. */
 static inline void
 clear_time_cache(struct event_base *base)
@@ -3241,14 +3252,12 @@ event_deferred_cb_cancel_(struct event_base *base, struct event_callback *cb)
 
 #define MAX_DEFERREDS_QUEUED 32
 int
-event_deferred_cb_schedule_(struct event_base *base, struct event_callback *cb)
+event_deferred_cb_schedule_nolock_(struct event_base *base,
+    struct event_callback *cb)
 {
     int r = 1;
 
-    if (!base)
-        base = current_base;
-
-    EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+    EVENT_BASE_ASSERT_LOCKED(base);
 
     if (base->n_deferreds_queued > MAX_DEFERREDS_QUEUED) {
         r = event_callback_activate_later_nolock_(base, cb);
@@ -3260,6 +3269,19 @@ event_deferred_cb_schedule_(struct event_base *base, struct event_callback *cb)
         }
     }
 
+    return r;
+}
+
+int
+event_deferred_cb_schedule_(struct event_base *base, struct event_callback *cb)
+{
+    int r;
+
+    if (!base)
+        base = current_base;
+
+    EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+    r = event_deferred_cb_schedule_nolock_(base, cb);
     EVBASE_RELEASE_LOCK(base, th_base_lock);
     return r;
 }
@@ -4070,12 +4092,19 @@ event_free_evutil_globals(void)
     evutil_free_globals_();
 }
 
+static void
+event_free_evbuffer_globals(void)
+{
+    evbuffer_free_globals_();
+}
+
 static void
 event_free_globals(void)
 {
     event_free_debug_globals();
     event_free_evsig_globals();
     event_free_evutil_globals();
+    event_free_evbuffer_globals();
 }
 
 void
@@ -4102,6 +4131,9 @@ event_global_setup_locks_(const int enable_locks)
     if (evutil_secure_rng_global_setup_locks_(enable_locks) < 0)
         return -1;
 
+    if (evbuffer_global_setup_locks_(enable_locks) < 0)
+        return -1;
+
     return 0;
 }
 #endif
@@ -196,49 +196,29 @@ evtag_encode_tag(struct evbuffer *evbuf, ev_uint32_t tag)
 static int
 decode_tag_internal(ev_uint32_t *ptag, struct evbuffer *evbuf, int dodrain)
 {
-	ev_uint32_t number = 0;
-	size_t len = evbuffer_get_length(evbuf);
-	ev_uint8_t *data;
-	size_t count = 0;
-	int  shift = 0, done = 0;
+	struct evbuffer_cursor cursor;
+	ev_uint64_t number;
+	size_t count;
+
+	if (evbuffer_cursor_init(&cursor, evbuf) < 0 ||
+	    evbuffer_cursor_read_varint(&cursor, &number) < 0)
+		return (-1);
 
 	/*
 	 * the encoding of a number is at most one byte more than its
-	 * storage size.  however, it may also be much smaller.
+	 * storage size, and tags are 32 bits.
 	 */
-	data = evbuffer_pullup(
-		evbuf, len < sizeof(number) + 1 ? len : sizeof(number) + 1);
-	if (!data)
-		return (-1);
-
-	while (count++ < len) {
-		ev_uint8_t lower = *data++;
-		if (shift >= 28) {
-			/* Make sure it fits into 32 bits */
-			if (shift > 28)
-				return (-1);
-			if ((lower & 0x7f) > 15)
-				return (-1);
-		}
-		number |= (lower & (unsigned)0x7f) << shift;
-		shift += 7;
-
-		if (!(lower & 0x80)) {
-			done = 1;
-			break;
-		}
-	}
-
-	if (!done)
+	count = (size_t)cursor.ptr.pos;
+	if (count > sizeof(ev_uint32_t) + 1 || (number >> 32) != 0)
 		return (-1);
 
 	if (dodrain)
-		evbuffer_drain(evbuf, count);
+		evbuffer_cursor_drain(&cursor);
 
 	if (ptag != NULL)
-		*ptag = number;
+		*ptag = (ev_uint32_t)number;
 
-	return count > INT_MAX ? INT_MAX : (int)(count);
+	return (int)(count);
 }
 
 int
@@ -253,22 +233,51 @@ evtag_decode_tag(ev_uint32_t *ptag, struct evbuffer *evbuf)
  * tag number: one byte; length: var bytes; payload: var bytes
  */
 
+/* Payloads up to this size are copied in with the tag and length; larger
+ * ones are added separately, so that we never ask for a large contiguous
+ * reservation. */
+#define EVTAG_MARSHAL_INLINE_MAX 4096
+
+/* Write a tag and a length.  The length uses the same encoding as
+ * evtag_encode_int(); tags are varints. */
+static void
+evtag_marshal_header(struct evbuffer_writer *writer, ev_uint32_t tag,
+    ev_uint32_t len)
+{
+	ev_uint8_t data[5];
+	int n = encode_int_internal(data, len);
+
+	evbuffer_writer_add_varint(writer, tag);
+	evbuffer_writer_add(writer, data, n);
+}
+
 void
 evtag_marshal(struct evbuffer *evbuf, ev_uint32_t tag,
     const void *data, ev_uint32_t len)
 {
-	evtag_encode_tag(evbuf, tag);
-	evtag_encode_int(evbuf, len);
-	evbuffer_add(evbuf, (void *)data, len);
+	struct evbuffer_writer writer;
+	int inline_data = len <= EVTAG_MARSHAL_INLINE_MAX;
+
+	evbuffer_writer_init(&writer, evbuf, 10 + (inline_data ? len : 0));
+	evtag_marshal_header(&writer, tag, len);
+	if (inline_data)
+		evbuffer_writer_add(&writer, data, len);
+	evbuffer_writer_finish(&writer);
+	if (!inline_data)
+		evbuffer_add(evbuf, (void *)data, len);
 }
 
 void
 evtag_marshal_buffer(struct evbuffer *evbuf, ev_uint32_t tag,
     struct evbuffer *data)
 {
-	evtag_encode_tag(evbuf, tag);
+	struct evbuffer_writer writer;
+
+	evbuffer_writer_init(&writer, evbuf, 10);
 	/* XXX support more than UINT32_MAX data */
-	evtag_encode_int(evbuf, (ev_uint32_t)evbuffer_get_length(data));
+	evtag_marshal_header(&writer, tag,
+	    (ev_uint32_t)evbuffer_get_length(data));
+	evbuffer_writer_finish(&writer);
 	evbuffer_add_buffer(evbuf, data);
 }
 
@@ -279,9 +288,7 @@ evtag_marshal_int(struct evbuffer *evbuf, ev_uint32_t tag, ev_uint32_t integer)
 	ev_uint8_t data[5];
 	int len = encode_int_internal(data, integer);
 
-	evtag_encode_tag(evbuf, tag);
-	evtag_encode_int(evbuf, len);
-	evbuffer_add(evbuf, data, len);
+	evtag_marshal(evbuf, tag, data, len);
 }
 
 void
@@ -291,9 +298,7 @@ evtag_marshal_int64(struct evbuffer *evbuf, ev_uint32_t tag,
 	ev_uint8_t data[9];
 	int len = encode_int64_internal(data, integer);
 
-	evtag_encode_tag(evbuf, tag);
-	evtag_encode_int(evbuf, len);
-	evbuffer_add(evbuf, data, len);
+	evtag_marshal(evbuf, tag, data, len);
 }
 
 void
@@ -314,15 +319,21 @@ evtag_marshal_timeval(struct evbuffer *evbuf, ev_uint32_t tag, struct timeval *t
 
 #define DECODE_INT_INTERNAL(number, maxnibbles, pnumber, evbuf, offset) \
 do {									\
-	ev_uint8_t *data;						\
+	struct evbuffer_cursor cursor;					\
+	ev_uint8_t spill[(maxnibbles >> 1) + 1];			\
+	const ev_uint8_t *data;						\
 	ev_ssize_t len = evbuffer_get_length(evbuf) - offset;		\
 	int nibbles = 0;						\
 									\
 	if (len <= 0)							\
 		return (-1);						\
 									\
-	/* XXX(niels): faster? */					\
-	data = evbuffer_pullup(evbuf, offset + 1) + offset;		\
+	/* Parse in place; only a number that straddles two chains	\
+	 * gets copied. */						\
+	if (evbuffer_cursor_init(&cursor, evbuf) < 0 ||			\
+	    evbuffer_cursor_advance(&cursor, offset) < 0)		\
+		return (-1);						\
+	data = evbuffer_cursor_peek(&cursor, NULL);			\
 	if (!data)							\
 		return (-1);						\
 									\
@@ -331,7 +342,7 @@ do {									\
 		return (-1);						\
 	len = (nibbles >> 1) + 1;					\
 									\
-	data = evbuffer_pullup(evbuf, offset + len) + offset;		\
+	data = evbuffer_cursor_read(&cursor, len, spill);		\
 	if (!data)							\
 		return (-1);						\
 									\
@@ -471,11 +482,11 @@ evtag_unmarshal(struct evbuffer *src, ev_uint32_t *ptag, struct evbuffer *dst)
 	if ((len = evtag_unmarshal_header(src, ptag)) == -1)
 		return (-1);
 
-	if (evbuffer_add(dst, evbuffer_pullup(src, len), len) == -1)
+	/* Move the payload's chains rather than pulling it up and copying
+	 * it. */
+	if (evbuffer_remove_buffer(src, dst, len) != len)
 		return (-1);
 
-	evbuffer_drain(src, len);
-
 	return (len);
 }
 
@@ -375,6 +375,7 @@ int event_global_setup_locks_(const int enable_locks);
 int evsig_global_setup_locks_(const int enable_locks);
 int evutil_global_setup_locks_(const int enable_locks);
 int evutil_secure_rng_global_setup_locks_(const int enable_locks);
+int evbuffer_global_setup_locks_(const int enable_locks);
 
 /** Return current evthread_lock_callbacks */
 struct evthread_lock_callbacks *evthread_get_lock_callbacks(void);
@@ -607,8 +607,10 @@ evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
 	}
 
 	TAILQ_FOREACH(header, req->output_headers, next) {
-		evbuffer_add_printf(output, "%s: %s\r\n",
-		    header->key, header->value);
+		evbuffer_add_string(output, header->key);
+		evbuffer_add(output, ": ", 2);
+		evbuffer_add_string(output, header->value);
+		evbuffer_add(output, "\r\n", 2);
 	}
 	evbuffer_add(output, "\r\n", 2);
 
@@ -2855,8 +2857,8 @@ evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *dat
 	if (!evhttp_response_needs_body(req))
 		return;
 	if (req->chunked) {
-		evbuffer_add_printf(output, "%x\r\n",
-				    (unsigned)evbuffer_get_length(databuf));
+		evbuffer_add_hex(output, evbuffer_get_length(databuf), 0, 0);
+		evbuffer_add(output, "\r\n", 2);
 	}
 	evbuffer_add_buffer(output, databuf);
 	if (req->chunked) {
@@ -3093,7 +3095,8 @@ evhttp_uriencode(const char *uri, ev_ssize_t len, int space_as_plus)
 		} else if (*p == ' ' && space_as_plus) {
 			evbuffer_add(buf, "+", 1);
 		} else {
-			evbuffer_add_printf(buf, "%%%02X", (unsigned char)(*p));
+			evbuffer_add(buf, "%", 1);
+			evbuffer_add_hex(buf, (unsigned char)(*p), 2, 1);
 		}
 	}
 
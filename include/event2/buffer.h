@@ -150,6 +150,37 @@ struct evbuffer_iovec {
  */
 EVENT2_EXPORT_SYMBOL
 struct evbuffer *evbuffer_new(void);
+
+/**
+  Allocate a new evbuffer that stores its data in a single fixed-size ring.
+
+  A ring evbuffer never allocates, frees or moves memory after it is
+  created.  Where the platform allows it (memfd_create() and mmap()), the
+  ring's memory is mapped twice in a row, so the data and the free space
+  are each always contiguous: reads and writes wrap around the end of the
+  ring without copying, and evbuffer_read() and evbuffer_write() use a
+  single iovec.  Elsewhere the ring is an ordinary allocation, and the data
+  is moved back to its start when the free space at its end runs short.
+
+  The buffer can never hold more than its capacity.  Adding data that does
+  not fit fails, and evbuffer_read() on a full ring fails with ENOBUFS;
+  when a ring is a bufferevent's input buffer, give the bufferevent a read
+  high-watermark no greater than 'capacity'.
+
+  Chains cannot be moved into or out of a ring, so evbuffer_add_buffer()
+  and evbuffer_remove_buffer() copy when either buffer is a ring, and
+  evbuffer_add_reference() copies the data and calls the cleanup function
+  at once.  evbuffer_prepend(), evbuffer_prepend_buffer(),
+  evbuffer_add_file_segment() and evbuffer_add_buffer_reference() fail on
+  rings.
+
+  @param capacity the number of bytes the ring must be able to hold.  It
+    may be rounded up, for instance to a multiple of the page size.
+  @return a pointer to a newly allocated evbuffer struct, or NULL if an error
+	occurred
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer *evbuffer_new_ring(size_t capacity);
 /**
   Deallocate storage for an evbuffer.
 
@@ -205,6 +236,48 @@ void evbuffer_unlock(struct evbuffer *buf);
  */
 #define EVBUFFER_FLAG_DRAINS_TO_FD 1
 
+/** If this flag is set, the evbuffer keeps an index of the offsets at
+ * which its chains start, so that evbuffer_ptr_set() can find a position
+ * deep inside a buffer made of many chains without walking the whole
+ * chain list.
+ *
+ * The index is built lazily as positions are looked up, grows as data is
+ * appended, and is discarded whenever data is drained or prepended.  It is
+ * worth setting on buffers that are searched or peeked at random offsets
+ * while they hold thousands of chains.
+ */
+#define EVBUFFER_FLAG_CHAIN_INDEX 2
+
+/** If this flag is set, evbuffer_write() and evbuffer_write_atmost() tell
+ * the kernel that more data will follow soon (with MSG_MORE, where the
+ * platform supports it), so that several small writes can leave the host
+ * as full-sized TCP segments rather than one short segment each.
+ *
+ * The kernel may hold back the tail of corked data until the next write
+ * made without this flag, so clear the flag and write (or push the socket)
+ * once the last piece of output is queued.  Buffers that drain to a pipe
+ * or a file are written as usual.  Bufferevents manage this flag for you;
+ * see bufferevent_socket_cork().
+ */
+#define EVBUFFER_FLAG_CORK 4
+
+/** If this flag is set, large chains in the evbuffer are backed by
+ * anonymous mappings aligned on 2 MiB, which the kernel is asked to back
+ * with transparent huge pages (MADV_HUGEPAGE), instead of by the heap.
+ *
+ * Once the buffer holds 256 KiB, or a single addition needs that much
+ * room, new chains are allocated a whole multiple of 2 MiB at a time.
+ * Buffers that hold many megabytes then take fewer TLB entries and page
+ * faults.  Freed 2 MiB chunks are kept in a small process-wide pool and
+ * reused.  This memory does not come from the functions set with
+ * event_set_mem_functions().
+ *
+ * The flag is ignored on platforms without MADV_HUGEPAGE.  It only pays
+ * off for buffers that really grow to several megabytes: a buffer that
+ * holds a little more than 256 KiB can take up a whole 2 MiB chunk.
+ */
+#define EVBUFFER_FLAG_HUGEPAGES 8
+
 /** Change the flags that are set for an evbuffer by adding more.
  *
  * @param buffer the evbuffer that the callback is watching.
@@ -470,6 +543,50 @@ EVENT2_EXPORT_SYMBOL
 int evbuffer_add_buffer_reference(struct evbuffer *outbuf,
     struct evbuffer *inbuf);
 
+/**
+  Append a reference to a range of bytes in one evbuffer to another
+  evbuffer, without copying them.
+
+  The referenced chains of inbuf become read-only and stay alive until
+  every buffer that references them has let them go, so inbuf may be
+  drained, appended to, or freed while outbuf still holds the range.
+  Ranges of buffers that were themselves built by reference can be
+  referenced in turn; the new chains point straight at the original
+  memory.
+
+  @param outbuf the output buffer
+  @param inbuf the input buffer
+  @param pos the position in inbuf at which the range starts, or NULL
+     to start at the beginning of inbuf
+  @param len the number of bytes to reference
+  @return 0 if successful, or -1 if an error occurred (including if the
+     range runs past the end of inbuf, or covers data that is only
+     available to sendfile)
+
+  @see evbuffer_slice()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_buffer_reference_range(struct evbuffer *outbuf,
+    struct evbuffer *inbuf, const struct evbuffer_ptr *pos, size_t len);
+
+/**
+  Return a new evbuffer holding a reference to a range of bytes in an
+  existing evbuffer, without copying them.
+
+  This is a convenience wrapper around
+  evbuffer_add_buffer_reference_range(); it is meant for handing one
+  frame of a large read to another component.
+
+  @param buf the buffer to slice
+  @param pos the position in buf at which the slice starts, or NULL to
+     start at the beginning of buf
+  @param len the number of bytes in the slice
+  @return a new evbuffer, or NULL if an error occurred
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer *evbuffer_slice(struct evbuffer *buf,
+    const struct evbuffer_ptr *pos, size_t len);
+
 /**
    A cleanup function for a piece of memory added to an evbuffer by
    reference.
@@ -646,6 +763,301 @@ EVENT2_EXPORT_SYMBOL
 int evbuffer_add_file_segment(struct evbuffer *buf,
     struct evbuffer_file_segment *seg, ev_off_t offset, ev_off_t length);
 
+struct event_base;
+
+/**
+   An evbuffer_file_reader reads file segments into evbuffers in the
+   background, so that the thread running an event_base never blocks on
+   disk I/O.
+
+   When data from a file segment can't be sent with sendfile (for example,
+   because the evbuffer belongs to a filtering or SSL bufferevent),
+   evbuffer_add_file_segment() maps or reads the whole segment on the
+   calling thread.  evbuffer_add_file_segment_async() instead reads the
+   segment in windows of a fixed size, hands each read to a helper thread,
+   and appends the windows to the evbuffer in order, from the event_base's
+   loop, as they complete.
+
+   Libevent does not start any threads of its own: the reader passes each
+   read to an evbuffer_file_reader_submit_cb, which is expected to run it on
+   a thread pool.  If reads may run on other threads, you must have enabled
+   threading (see evthread_use_pthreads()) before creating the event_base.
+ */
+struct evbuffer_file_reader;
+
+/**
+   A read handed out by an evbuffer_file_reader.  Call it exactly once, with
+   the job pointer you were given, from any thread.
+ */
+typedef void (*evbuffer_file_reader_job_fn)(void *job);
+
+/**
+   Callback used by an evbuffer_file_reader to run a read in the background.
+
+   The callback must arrange for fn(job) to be called exactly once.  It is
+   allowed to call it before returning, which makes the reads synchronous.
+
+   @param fn the function to run
+   @param job the argument to pass to fn
+   @param arg the argument passed to evbuffer_file_reader_new()
+   @return 0 if the job was accepted, or -1 if it was not
+ */
+typedef int (*evbuffer_file_reader_submit_cb)(evbuffer_file_reader_job_fn fn,
+    void *job, void *arg);
+
+/**
+   Callback invoked from the event_base's loop once an asynchronous file
+   segment has been completely added to an evbuffer, or has failed.
+
+   @param buf the evbuffer the segment was being added to, or NULL if every
+     other reference to it was released first
+   @param result 0 if the whole range was added, or -1 if reading failed,
+     the job could not be submitted, or the operation was cancelled
+   @param arg the argument passed to evbuffer_add_file_segment_async()
+ */
+typedef void (*evbuffer_file_reader_done_cb)(struct evbuffer *buf,
+    int result, void *arg);
+
+/**
+   Create a new evbuffer_file_reader.
+
+   @param base the event_base whose loop appends the data and runs the
+     done callbacks
+   @param submit the callback used to run reads in the background
+   @param submit_arg an argument to pass to the submit callback
+   @param window_size the number of bytes to read at a time, or 0 for a
+     default of 256 KiB
+   @param max_windows the number of windows of each segment that may be in
+     flight or sitting undrained in its evbuffer at once, or 0 for a
+     default of 4
+   @param max_memory the number of bytes that all windows of this reader
+     may take up at once, or 0 for no limit
+   @return a new evbuffer_file_reader, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_file_reader *evbuffer_file_reader_new(struct event_base *base,
+    evbuffer_file_reader_submit_cb submit, void *submit_arg,
+    size_t window_size, unsigned max_windows, size_t max_memory);
+
+/**
+   Free an evbuffer_file_reader.
+
+   Every operation still in progress is cancelled, and its done callback is
+   invoked with a result of -1.  Windows that have already been added to
+   evbuffers stay valid.  Reads that are still running on helper threads
+   finish in the background.  Call this function from the thread running
+   the reader's event_base.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_file_reader_free(struct evbuffer_file_reader *reader);
+
+/**
+   Start adding some or all of an evbuffer_file_segment to the end of an
+   evbuffer, reading it in the background with an evbuffer_file_reader.
+
+   The offset and length parameters mean the same as they do for
+   evbuffer_add_file_segment().  The segment is read through its file
+   descriptor, whether or not it could have been mapped.
+
+   Until the done callback runs, the end of the evbuffer is frozen (see
+   evbuffer_freeze()), so that nothing else can be added in the middle of
+   the file data; only one such operation can be in progress on an evbuffer
+   at a time.  If every other reference to the evbuffer is released in the
+   meantime (for example, because it was freed, or because the bufferevent
+   it belongs to was), the operation is cancelled: the evbuffer is freed
+   right away, along with whatever had been added to it, and the done
+   callback is invoked with a NULL evbuffer.
+
+   @param buf the evbuffer to add the data to
+   @param reader the reader to use
+   @param seg the file segment to read
+   @param offset the offset within the segment at which to start
+   @param length the number of bytes to add, or -1 to add to the end of
+     the segment
+   @param cb a callback to invoke once the operation is over, or NULL
+   @param cbarg an argument to pass to cb
+   @return 0 if the operation was started, or -1 on error
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_file_segment_async(struct evbuffer *buf,
+    struct evbuffer_file_reader *reader, struct evbuffer_file_segment *seg,
+    ev_off_t offset, ev_off_t length,
+    evbuffer_file_reader_done_cb cb, void *cbarg);
+
+/**
+   An evbuffer_file_segment_cache keeps evbuffer_file_segments for recently
+   used files, keyed by path, so that a program that serves the same files
+   over and over opens (and, if it needs to, maps) each one only once.
+
+   Each lookup checks the file's device, inode, modification time, and size
+   with stat(), and reopens the file if any of them changed.  When the
+   cache grows past its limits, the least recently used files are dropped
+   from it; evbuffers and callers that still hold their segments are not
+   affected.
+
+   As with any evbuffer_file_segment, data that has not been sent yet is
+   read from the open file, so update files by renaming new versions over
+   them rather than by rewriting them in place.
+
+   If threading is enabled (see evthread_use_pthreads()) when the cache is
+   created, it may be shared by several threads and event_bases.
+ */
+struct evbuffer_file_segment_cache;
+
+/**
+   Create a new evbuffer_file_segment_cache.
+
+   @param max_bytes the total size of the files to keep cached, or 0 for
+     no limit.  Files larger than this are never cached.
+   @param max_entries the number of files to keep cached, or 0 for no
+     limit
+   @param flags flags to pass to evbuffer_file_segment_new() for each file.
+     EVBUF_FS_CLOSE_ON_FREE is always added.
+   @return a new evbuffer_file_segment_cache, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_file_segment_cache *evbuffer_file_segment_cache_new(
+    size_t max_bytes, unsigned max_entries, unsigned flags);
+
+/**
+   Free an evbuffer_file_segment_cache, and release its references to the
+   segments it holds.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_file_segment_cache_free(
+    struct evbuffer_file_segment_cache *cache);
+
+/**
+   Return an evbuffer_file_segment covering the whole of the file at
+   'path', from the cache if it is there and unchanged, or by opening the
+   file otherwise.
+
+   The caller owns a reference to the returned segment, and must release it
+   with evbuffer_file_segment_free() once it has been added to the
+   evbuffers that need it.
+
+   @param cache the cache to use
+   @param path the path of the file
+   @return a file segment, or NULL if the file could not be opened
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_file_segment *evbuffer_file_segment_cache_get(
+    struct evbuffer_file_segment_cache *cache, const char *path);
+
+/**
+   Drop the file at 'path' from an evbuffer_file_segment_cache.
+
+   @return 0 if the file was cached, or -1 if it was not
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_file_segment_cache_remove(
+    struct evbuffer_file_segment_cache *cache, const char *path);
+
+/**
+   An evbuffer_spsc hands data from one thread to another without locking
+   either evbuffer.
+
+   It has two evbuffers, neither of which is shared: the producer buffer,
+   which belongs to the producing thread, and the consumer buffer, which
+   belongs to the thread running the consumer's event_base.  The producer
+   adds data to its buffer with the usual evbuffer functions (including
+   evbuffer_read()), then calls evbuffer_spsc_publish() to hand over
+   everything in it.  Publishing moves the chains themselves; no data is
+   copied, and the only synchronization is a pair of atomic operations.
+   On the consumer's side, evbuffer_spsc_collect() moves everything
+   published so far to the end of the consumer buffer.
+
+   When data is published while the consumer is idle, the spsc activates an
+   event on the consumer's event_base, which collects the data and runs the
+   callback given to evbuffer_spsc_new().  There is at most one such wakeup
+   for each time the consumer runs out of data, however often the producer
+   publishes in the meantime.  For the wakeup to work across threads, you
+   must have enabled threading (see evthread_use_pthreads()) before creating
+   the event_base.
+
+   Only one thread may produce and only one may consume at a time.  Data
+   travels with its chains, so the cleanup functions of references added
+   with evbuffer_add_reference() run on the consumer's thread, and the
+   producer buffer should not hold references to other evbuffers (see
+   evbuffer_add_buffer_reference()) unless those buffers are locked.
+ */
+struct evbuffer_spsc;
+
+/**
+   Callback invoked from the consumer's event_base when published data has
+   been collected into the consumer buffer.
+
+   @param spsc the evbuffer_spsc
+   @param buf the consumer buffer
+   @param arg the argument passed to evbuffer_spsc_new()
+ */
+typedef void (*evbuffer_spsc_cb)(struct evbuffer_spsc *spsc,
+    struct evbuffer *buf, void *arg);
+
+/**
+   Create a new evbuffer_spsc.
+
+   @param base the event_base of the consuming thread
+   @param cb the callback to invoke when data arrives, or NULL
+   @param arg an argument to pass to the callback
+   @return a new evbuffer_spsc, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_spsc *evbuffer_spsc_new(struct event_base *base,
+    evbuffer_spsc_cb cb, void *arg);
+
+/**
+   Free an evbuffer_spsc, its two evbuffers, and any data that has been
+   published but not collected.
+
+   Call this from the consumer's thread, once the producer has stopped
+   using the spsc.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_spsc_free(struct evbuffer_spsc *spsc);
+
+/**
+   Return the producer buffer of an evbuffer_spsc.  Only the producing
+   thread may use it.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer *evbuffer_spsc_get_producer_buffer(struct evbuffer_spsc *spsc);
+
+/**
+   Return the consumer buffer of an evbuffer_spsc.  Only the consuming
+   thread may use it.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer *evbuffer_spsc_get_consumer_buffer(struct evbuffer_spsc *spsc);
+
+/**
+   Hand all the data in the producer buffer over to the consumer.  Call
+   this from the producing thread.
+
+   Empty chains at the end of the producer buffer stay there, so space
+   reserved with evbuffer_expand() or evbuffer_reserve_space() is kept.
+
+   @param spsc the evbuffer_spsc
+   @return 0 on success, or -1 on failure, in which case the data stays in
+     the producer buffer
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_spsc_publish(struct evbuffer_spsc *spsc);
+
+/**
+   Move all the data published so far to the end of the consumer buffer.
+   Call this from the consuming thread.
+
+   Consumers that wait for the callback do not need to call this function;
+   it is useful for polling, or for picking up data published after the
+   callback was scheduled.
+
+   @param spsc the evbuffer_spsc
+   @return the number of bytes moved, or -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+ev_ssize_t evbuffer_spsc_collect(struct evbuffer_spsc *spsc);
+
 /**
   Append a formatted string to the end of an evbuffer.
 
@@ -681,6 +1093,69 @@ int evbuffer_add_vprintf(struct evbuffer *buf, const char *fmt, va_list ap)
 ;
 
 
+/**
+  Append a NUL-terminated string to the end of an evbuffer.
+
+  The terminating NUL is not added.
+
+  @param buf the evbuffer that will be appended to
+  @param str the string to append
+  @return The number of bytes added if successful, or -1 if an error occurred.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_string(struct evbuffer *buf, const char *str);
+
+/**
+  Append the decimal representation of a signed integer to the end of an
+  evbuffer.
+
+  This is equivalent to evbuffer_add_printf(buf, "%lld", value), but it
+  writes the digits straight into the buffer without parsing a format
+  string or formatting anything twice.
+
+  @param buf the evbuffer that will be appended to
+  @param value the number to append
+  @return The number of bytes added if successful, or -1 if an error occurred.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_int(struct evbuffer *buf, ev_int64_t value);
+
+/**
+  Append the decimal representation of an unsigned integer to the end of
+  an evbuffer, right-aligned in a field of at least 'width' characters.
+
+  This is equivalent to evbuffer_add_printf(buf, "%*llu", width, value)
+  if 'pad' is ' ', or to evbuffer_add_printf(buf, "%0*llu", width, value)
+  if 'pad' is '0'.
+
+  @param buf the evbuffer that will be appended to
+  @param value the number to append
+  @param width the minimum number of characters to append; 0 for no
+     padding
+  @param pad the character to fill the field with
+  @return The number of bytes added if successful, or -1 if an error occurred.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_uint(struct evbuffer *buf, ev_uint64_t value,
+    size_t width, char pad);
+
+/**
+  Append the hexadecimal representation of an unsigned integer to the end
+  of an evbuffer, zero-padded to at least 'width' digits.
+
+  This is equivalent to evbuffer_add_printf(buf, "%0*llx", width, value),
+  or to "%0*llX" if 'uppercase' is true.
+
+  @param buf the evbuffer that will be appended to
+  @param value the number to append
+  @param width the minimum number of digits to append
+  @param uppercase true if we should use the digits A-F rather than a-f
+  @return The number of bytes added if successful, or -1 if an error occurred.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_hex(struct evbuffer *buf, ev_uint64_t value,
+    size_t width, int uppercase);
+
 /**
   Remove a specified number of bytes data from the beginning of an evbuffer.
 
@@ -764,6 +1239,73 @@ struct evbuffer_ptr evbuffer_search(struct evbuffer *buffer, const char *what, s
 EVENT2_EXPORT_SYMBOL
 struct evbuffer_ptr evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, const struct evbuffer_ptr *start, const struct evbuffer_ptr *end);
 
+/**
+   An evbuffer_search_state remembers how far an incremental search through
+   a growing evbuffer has progressed, including any partial match at the end
+   of the data seen so far.
+
+   @see evbuffer_search_incremental()
+ */
+struct evbuffer_search_state;
+
+/**
+   Create a new state for incrementally searching for a string.
+
+   @param what the string to be searched for
+   @param len the length of the search string
+   @return a new evbuffer_search_state, or NULL on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_search_state *evbuffer_search_state_new(const char *what,
+    size_t len);
+
+/**
+   Free an evbuffer_search_state.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_search_state_free(struct evbuffer_search_state *state);
+
+/**
+   Forget all progress made by an evbuffer_search_state, so that the next
+   search starts again at the front of the buffer.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_search_state_reset(struct evbuffer_search_state *state);
+
+/**
+   Tell an evbuffer_search_state that 'len' bytes have been drained from
+   the front of the buffer it is searching.
+
+   If the drained bytes include part of a pending partial match, the state
+   is reset.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_search_state_drained(struct evbuffer_search_state *state,
+    size_t len);
+
+/**
+   Continue searching for a string within an evbuffer that may have grown
+   since the last call.
+
+   Only bytes that were not examined by an earlier call with the same state
+   are looked at, so repeatedly calling this function as data arrives costs
+   time proportional to the new data only.  A match that straddles the
+   boundary between two calls is still found.
+
+   After a match is reported, the next call continues looking for further
+   (possibly overlapping) occurrences.  If you drain data from the front of
+   the buffer, report it with evbuffer_search_state_drained().
+
+   @param buffer the evbuffer to be searched
+   @param state a state made with evbuffer_search_state_new()
+   @return a struct evbuffer_ptr whose 'pos' field has the offset of the
+     next occurrence of the string in the buffer.  The 'pos' field of the
+     result is -1 if no new occurrence was found.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_ptr evbuffer_search_incremental(struct evbuffer *buffer,
+    struct evbuffer_search_state *state);
+
 /**
    Defines how to adjust an evbuffer_ptr by evbuffer_ptr_set()
 
@@ -854,6 +1396,349 @@ int evbuffer_peek(struct evbuffer *buffer, ev_ssize_t len,
     struct evbuffer_ptr *start_at,
     struct evbuffer_iovec *vec_out, int n_vec);
 
+/**
+   A read cursor over the contents of an evbuffer.
+
+   Parsers can use a cursor to walk through a buffer one contiguous
+   extent at a time, without calling evbuffer_pullup() and so without
+   moving or reallocating any data.  Only tokens that straddle a chain
+   boundary are copied, into a small buffer supplied by the caller.
+
+   Like an evbuffer_ptr, a cursor is invalidated by any function that
+   removes data from the buffer or re-packs its contents; adding data at
+   the end of the buffer is fine.  Nothing is removed from the buffer
+   until you call evbuffer_cursor_drain().  Do not modify the fields
+   directly.
+
+   @see evbuffer_cursor_init()
+ */
+struct evbuffer_cursor {
+	/** The buffer we are reading from. */
+	struct evbuffer *buffer;
+	/** Our position in the buffer; 'ptr.pos' is the number of bytes
+	 * read so far. */
+	struct evbuffer_ptr ptr;
+};
+
+/**
+   Set up a cursor at the start of an evbuffer.
+
+   @param cursor the cursor to initialize
+   @param buffer the evbuffer to read from
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_init(struct evbuffer_cursor *cursor,
+    struct evbuffer *buffer);
+
+/**
+   Return the number of bytes in the buffer after the cursor.
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_cursor_get_length(const struct evbuffer_cursor *cursor);
+
+/**
+   Look at the contiguous extent of data starting at the cursor, without
+   advancing it.
+
+   The extent runs to the end of the chain that the cursor is in; call
+   evbuffer_cursor_advance() to consume some or all of it, and then call
+   this function again to get the next extent.
+
+   @param cursor the cursor to peek through
+   @param len_out set to the number of bytes in the extent
+   @return a pointer to the extent, or NULL if there is no data after the
+     cursor.
+ */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_cursor_peek(struct evbuffer_cursor *cursor,
+    size_t *len_out);
+
+/**
+   Move a cursor forward.
+
+   @param cursor the cursor to move
+   @param len the number of bytes to skip
+   @return 0 on success, or -1 if there are fewer than 'len' bytes after
+     the cursor, in which case the cursor is not moved.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_advance(struct evbuffer_cursor *cursor, size_t len);
+
+/**
+   Read a fixed number of contiguous bytes at the cursor, and advance past
+   them.
+
+   If the bytes all lie within one chain, the returned pointer points into
+   the buffer itself and nothing is copied.  Otherwise they are copied into
+   'spill', which must then have room for 'len' bytes, and 'spill' is
+   returned.
+
+   @param cursor the cursor to read from
+   @param len the number of bytes to read
+   @param spill a buffer of at least 'len' bytes, used only if the bytes
+     straddle a chain boundary
+   @return a pointer to the bytes, or NULL if there are fewer than 'len'
+     bytes after the cursor.
+ */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_cursor_read(struct evbuffer_cursor *cursor,
+    size_t len, void *spill);
+
+/**
+   Read a line at the cursor, and advance past it and its end-of-line
+   marker.
+
+   As with evbuffer_cursor_read(), the line is returned in place when it
+   lies within one chain, and is copied into 'spill' otherwise.  The line
+   is not NUL-terminated, and does not include the end-of-line marker.
+
+   @param cursor the cursor to read from
+   @param n_read_out set to the length of the line
+   @param eol_style the end-of-line style to look for; see evbuffer_readln()
+   @param spill a buffer used for lines that straddle a chain boundary
+   @param spill_len the size of 'spill'
+   @return a pointer to the line, or NULL if there is no complete line after
+     the cursor, or if the line has to be copied and is longer than
+     'spill_len'.  In either case the cursor is not moved.
+ */
+EVENT2_EXPORT_SYMBOL
+const char *evbuffer_cursor_readln(struct evbuffer_cursor *cursor,
+    size_t *n_read_out, enum evbuffer_eol_style eol_style,
+    char *spill, size_t spill_len);
+
+/**
+   Remove everything before the cursor from the buffer, and reset the
+   cursor to the new start of the buffer.
+
+   @param cursor the cursor
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_drain(struct evbuffer_cursor *cursor);
+
+/**
+   @name Binary field readers
+
+   These functions decode one field at the cursor and advance past it.  A
+   field that lies within one chain is decoded in place; one that
+   straddles a chain boundary is copied first.  Nothing is drained until
+   evbuffer_cursor_drain(), so a parser can read a whole message, find
+   that it is incomplete, and start over later from the same place.
+
+   To look at a field without consuming it, read it through a copy of the
+   cursor.  If the buffer has locking enabled, hold evbuffer_lock() around
+   a batch of reads so the lock is not taken again for each field.
+
+   Each function returns 0 on success, or -1 if the buffer does not hold
+   the whole field, in which case the cursor is not moved.
+   @{
+ */
+/** Read one byte. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u8(struct evbuffer_cursor *cursor,
+    ev_uint8_t *value);
+/** Read a big-endian 16-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u16be(struct evbuffer_cursor *cursor,
+    ev_uint16_t *value);
+/** Read a little-endian 16-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u16le(struct evbuffer_cursor *cursor,
+    ev_uint16_t *value);
+/** Read a big-endian 32-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u32be(struct evbuffer_cursor *cursor,
+    ev_uint32_t *value);
+/** Read a little-endian 32-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u32le(struct evbuffer_cursor *cursor,
+    ev_uint32_t *value);
+/** Read a big-endian 64-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u64be(struct evbuffer_cursor *cursor,
+    ev_uint64_t *value);
+/** Read a little-endian 64-bit integer. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u64le(struct evbuffer_cursor *cursor,
+    ev_uint64_t *value);
+
+/**
+   Read an unsigned varint: seven bits per byte, least significant group
+   first, with the high bit of each byte set on all but the last.  This is
+   the encoding used by Protocol Buffers and by event_tagging for tags.
+
+   @return 0 on success, -1 if the varint is incomplete, or -2 if it is
+     longer than 10 bytes or does not fit in 64 bits
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_varint(struct evbuffer_cursor *cursor,
+    ev_uint64_t *value);
+
+/**
+   Read a blob prefixed with its length as a varint, as written by
+   evbuffer_writer_add_blob().
+
+   As with evbuffer_cursor_read(), the blob is returned in place if it lies
+   within one chain, and is copied into 'spill' otherwise.
+
+   @param cursor the cursor to read from
+   @param len_out set to the length of the blob
+   @param spill a buffer used for blobs that straddle a chain boundary
+   @param spill_len the size of 'spill'
+   @return a pointer to the blob, or NULL if the blob is incomplete, its
+     length is malformed, or it has to be copied and is longer than
+     'spill_len'.  In each case the cursor is not moved.
+ */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_cursor_read_blob(struct evbuffer_cursor *cursor,
+    size_t *len_out, void *spill, size_t spill_len);
+/**@}*/
+
+/**
+   A writer that appends binary fields to an evbuffer.
+
+   The writer reserves space at the end of the buffer and encodes fields
+   straight into it.  What has been written becomes part of the buffer,
+   and the buffer's callbacks run, when evbuffer_writer_finish() is called,
+   and also each time the reserved space runs out and the writer has to
+   reserve more.  A batch that fits in the size hint given to
+   evbuffer_writer_init() is therefore added all at once.  Until
+   evbuffer_writer_finish(), do not add anything else to the buffer.
+
+   Do not modify the fields directly.
+
+   @see evbuffer_writer_init()
+ */
+struct evbuffer_writer {
+	/** The buffer we are writing to. */
+	struct evbuffer *buffer;
+	/** The space we have reserved at the end of the buffer. */
+	struct evbuffer_iovec vec;
+	/** The number of bytes of 'vec' written so far. */
+	size_t used;
+	/** The number of bytes to reserve at a time. */
+	size_t reserve;
+	/** True if any write has failed. */
+	int failed;
+};
+
+/**
+   Set up a writer at the end of an evbuffer.
+
+   @param writer the writer to initialize
+   @param buffer the evbuffer to append to
+   @param size_hint the number of bytes you expect to write, or 0 for a
+     default.  This much space is reserved at a time.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_writer_init(struct evbuffer_writer *writer,
+    struct evbuffer *buffer, size_t size_hint);
+
+/**
+   Make everything written since the writer last reserved space part of
+   the buffer, and run its callbacks.
+
+   @return 0 on success, or -1 if any write failed.  Fields written before
+     the failure are still added to the buffer.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_finish(struct evbuffer_writer *writer);
+
+/**
+   @name Binary field writers
+
+   These functions encode one field with a writer.  Each returns 0 on
+   success, or -1 if space could not be reserved.
+   @{
+ */
+/** Write 'len' bytes from 'data'. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add(struct evbuffer_writer *writer,
+    const void *data, size_t len);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u8(struct evbuffer_writer *writer, ev_uint8_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u16be(struct evbuffer_writer *writer,
+    ev_uint16_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u16le(struct evbuffer_writer *writer,
+    ev_uint16_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u32be(struct evbuffer_writer *writer,
+    ev_uint32_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u32le(struct evbuffer_writer *writer,
+    ev_uint32_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u64be(struct evbuffer_writer *writer,
+    ev_uint64_t value);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_u64le(struct evbuffer_writer *writer,
+    ev_uint64_t value);
+/** Write an unsigned varint; see evbuffer_cursor_read_varint(). */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_varint(struct evbuffer_writer *writer,
+    ev_uint64_t value);
+/** Write the length of a blob as a varint, followed by the blob. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_writer_add_blob(struct evbuffer_writer *writer,
+    const void *data, size_t len);
+/**@}*/
+
+
+/** The value to pass to evbuffer_hash64() when starting a new hash. */
+#define EVBUFFER_HASH64_INIT \
+	((((ev_uint64_t)0xcbf29ce4UL) << 32) | 0x84222325UL)
+
+/**
+   Compute the CRC32C (Castagnoli) checksum of a range of an evbuffer.
+
+   The data is read where it lies in the buffer's chains, without copying.
+   On x86 CPUs with SSE4.2 the crc32 instruction is used; elsewhere we fall
+   back to a lookup table.
+
+   The checksum can be computed incrementally: set *crc to 0 to start,
+   and leave the previous result there to continue over data that arrives
+   later.
+
+   Data added with evbuffer_add_file() or evbuffer_add_file_segment() that
+   the buffer will send with sendfile() is not in memory, so a range that
+   includes it can't be checksummed.
+
+   @param buffer the evbuffer to read from
+   @param pos the start of the range, or NULL for the start of the buffer
+   @param len the number of bytes to checksum, or -1 for everything after
+     'pos'.  If the buffer holds fewer bytes, only those are used.
+   @param crc 0, or the checksum of the data before this range; on success
+     it is set to the updated checksum
+   @return 0 on success, or -1 if part of the range is not in memory, in
+     which case *crc is unchanged.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_crc32c(struct evbuffer *buffer,
+    const struct evbuffer_ptr *pos, ev_ssize_t len, ev_uint32_t *crc);
+
+/**
+   Compute a fast non-cryptographic 64-bit hash (FNV-1a) of a range of an
+   evbuffer.
+
+   Like evbuffer_crc32c(), this reads the data in place, fails on data that
+   is not in memory, and can be updated incrementally.  The result depends only on the bytes hashed, not on how
+   they are split between chains or calls.  Do not use it where an
+   attacker could choose keys to make them collide.
+
+   @param buffer the evbuffer to read from
+   @param pos the start of the range, or NULL for the start of the buffer
+   @param len the number of bytes to hash, or -1 for everything after 'pos'
+   @param hash EVBUFFER_HASH64_INIT, or the hash of the data before this
+     range; on success it is set to the updated hash
+   @return 0 on success, or -1 if part of the range is not in memory, in
+     which case *hash is unchanged.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_hash64(struct evbuffer *buffer,
+    const struct evbuffer_ptr *pos, ev_ssize_t len, ev_uint64_t *hash);
 
 /** Structure passed to an evbuffer_cb_func evbuffer callback
 
@@ -1053,6 +1938,183 @@ struct event_base;
 EVENT2_EXPORT_SYMBOL
 int evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base);
 
+/**
+   How much memory an evbuffer is using.
+
+   @see evbuffer_get_memory_usage()
+ */
+struct evbuffer_memory_usage {
+	/** Number of bytes of data in the buffer; the same as
+	 * evbuffer_get_length(). */
+	size_t payload;
+	/** Number of bytes allocated for the buffer's chains, including
+	 * their headers and any unused space.  Memory that the buffer only
+	 * refers to, such as that added with evbuffer_add_reference() or
+	 * evbuffer_add_file_segment(), is not counted. */
+	size_t allocated;
+	/** Number of chains the buffer is made of. */
+	size_t n_chains;
+};
+
+/**
+   Report how much memory an evbuffer is using.
+
+   This walks over all of the buffer's chains, so it takes time
+   proportional to their number.
+
+   @param buf the evbuffer to examine
+   @param usage a structure to fill in
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_get_memory_usage(struct evbuffer *buf,
+    struct evbuffer_memory_usage *usage);
+
+/**
+   Make an evbuffer merge runs of small chains once it holds too many.
+
+   Appending many small pieces, for instance with evbuffer_add_buffer(),
+   can leave a buffer with thousands of tiny chains, which makes every
+   walk over it slow and lets only a little data go out with each write.
+   With a compaction policy, the buffer checks its shape every so often as
+   data is drained from it.  If it has more than 'max_chains' chains, or
+   its chains hold fewer than 'min_avg_chain_size' bytes each on average,
+   it copies runs of adjacent small chains into larger ones.
+
+   Only chains whose memory the buffer owns are merged.  Chains that are
+   pinned, that refer to memory added with evbuffer_add_reference(),
+   evbuffer_add_buffer_reference() or evbuffer_add_file_segment(), or that
+   another buffer refers to, are left where they are, as is the last chain
+   with data.
+
+   The checks are spread out so that their cost stays in proportion to the
+   appends, so a buffer can go somewhat past 'max_chains' before it is
+   compacted.  Compaction only happens when data is removed, which
+   invalidates evbuffer_ptrs, evbuffer_cursors and evbuffer_peek() results
+   anyway; appending never re-packs the buffer.  So the first write after
+   a burst of appends sees the chains as they were appended.  To compact a
+   buffer that is only appended to, call evbuffer_compact() before writing
+   it.
+
+   @param buf the evbuffer to configure
+   @param max_chains compact when the buffer has more chains than this, or
+     0 for no limit
+   @param min_avg_chain_size compact when the average chain holds fewer
+     bytes than this, or 0 for no limit
+   @return 0 on success, -1 on failure.
+   @see evbuffer_compact(), evbuffer_get_compaction_stats()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_compaction(struct evbuffer *buf, size_t max_chains,
+    size_t min_avg_chain_size);
+
+/**
+   Merge runs of small chains in an evbuffer now.
+
+   This does what a compaction policy set with evbuffer_set_compaction()
+   does when it triggers, whether or not the buffer has a policy.
+
+   @param buf the evbuffer to compact
+   @return the number of chains merged away
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_compact(struct evbuffer *buf);
+
+/** Statistics about the compactions done on an evbuffer.
+
+    @see evbuffer_get_compaction_stats()
+ */
+struct evbuffer_compaction_stats {
+	/** Number of times the buffer was compacted. */
+	size_t n_compactions;
+	/** Number of chains merged away. */
+	size_t n_chains_merged;
+	/** Number of bytes copied while merging. */
+	size_t n_bytes_copied;
+};
+
+/**
+   Report how much compacting an evbuffer has done.
+
+   @param buf the evbuffer to examine
+   @param stats a structure to fill in
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_get_compaction_stats(struct evbuffer *buf,
+    struct evbuffer_compaction_stats *stats);
+
+/**
+   Report the memory used by the evbuffers of an event_base.
+
+   The evbuffers of an event_base are the input and output buffers of its
+   bufferevents, and any evbuffer passed to evbuffer_defer_callbacks() with
+   it.  Each of them is measured as by evbuffer_get_memory_usage().
+
+   Keeping the totals exact costs a walk over a buffer's chains and a lock
+   on the base each time one of those buffers changes, so it is only done
+   once event_base_set_evbuffer_budget() has been called for the base;
+   call it with a limit of 0 to keep totals without a budget.  Before
+   that, each buffer is counted as it was when it joined the base.
+
+   @param base the event_base to examine
+   @param usage if not NULL, set to the sum of the memory usage of those
+     evbuffers
+   @param n_buffers_out if not NULL, set to the number of those evbuffers
+   @see evbuffer_get_memory_usage()
+ */
+EVENT2_EXPORT_SYMBOL
+void event_base_get_evbuffer_totals(struct event_base *base,
+    struct evbuffer_memory_usage *usage, size_t *n_buffers_out);
+
+/**
+   Flag for event_base_set_evbuffer_budget(): while the budget is exceeded,
+   socket-based bufferevents on the event_base stop reading.
+ */
+#define EVBUFFER_BUDGET_SUSPEND_READ 1
+
+/**
+   Callback invoked when the evbuffers of an event_base go over their
+   memory budget, or come back under it.
+
+   It runs from the event loop, so by the time it runs the state may have
+   changed again; 'over' says what the state was when the callback ran.
+
+   @param base the event_base whose budget this is
+   @param allocated the total number of bytes allocated for its evbuffers
+   @param over 1 if the budget is exceeded, 0 if it is not
+   @param arg the argument passed to event_base_set_evbuffer_budget()
+ */
+typedef void (*evbuffer_budget_cb)(struct event_base *base, size_t allocated,
+    int over, void *arg);
+
+/**
+   Set a memory budget for the evbuffers of an event_base.
+
+   The budget applies to the memory allocated for the base's evbuffers
+   (see event_base_get_evbuffer_totals()), not just to the data they hold,
+   so mostly empty chains count in full.  Once that total grows past
+   'limit' bytes, the budget is exceeded until the total falls back to 7/8
+   of the limit.  Each time this state changes, the callback (if any) is
+   invoked, and if EVBUFFER_BUDGET_SUSPEND_READ is set, socket-based
+   bufferevents on the base stop reading from the network until the budget
+   recovers.  Data that is already buffered keeps being written, so the
+   total can go back down.
+
+   The first call for a base recounts every one of its evbuffers.
+
+   @param base the event_base to set the budget for
+   @param limit the budget in bytes, or 0 to remove the budget
+   @param flags zero or more EVBUFFER_BUDGET_* flags
+   @param cb a callback to invoke when the state of the budget changes, or
+     NULL
+   @param arg an argument to pass to cb
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_set_evbuffer_budget(struct event_base *base, size_t limit,
+    unsigned flags, evbuffer_budget_cb cb, void *arg);
+
 /**
   Append data from 1 or more iovec's to an evbuffer
 
@@ -170,7 +170,36 @@ enum bufferevent_options {
 	* bufferevent.  This option currently requires that
 	* BEV_OPT_DEFER_CALLBACKS also be set; a future version of Libevent
 	* might remove the requirement.*/
-	BEV_OPT_UNLOCK_CALLBACKS = (1<<3)
+	BEV_OPT_UNLOCK_CALLBACKS = (1<<3),
+
+	/** If set, data added to the output buffer of a socket bufferevent
+	 * is written at the end of the current pass of the event loop,
+	 * without waiting to be told that the socket is writable.  EV_WRITE
+	 * is only added if the kernel does not take all the data.  This
+	 * saves a system call to add the write event and a trip through the
+	 * backend for every response.  All writes made before the loop gets
+	 * back to it go out together. */
+	BEV_OPT_WRITE_THROUGH = (1<<4),
+
+	/** If set, a socket bufferevent registers its events with EV_ET.
+	 * Each callback keeps reading (or writing) until the kernel has
+	 * nothing more for it or its budget runs out, and comes back on its
+	 * own in the latter case, so nothing is left waiting for an edge
+	 * that will not come.  See bufferevent_set_read_budget(). */
+	BEV_OPT_EDGE_TRIGGERED = (1<<5),
+
+	/** If set, a socket bufferevent keeps its read and write timeouts
+	 * lazily.  Each read or write only notes the time, and a single timer
+	 * checks, when it goes off, whether the bufferevent has really been
+	 * idle that long, and sets itself again if not.  Busy connections with
+	 * timeouts then no longer move their events around in the timer heap
+	 * on every read and write. */
+	BEV_OPT_LAZY_TIMEOUTS = (1<<6),
+
+	/** If set, the bufferevent counts its reads and writes, how often it
+	 * had to wait, and how full its buffers got.  See
+	 * bufferevent_get_stats(). */
+	BEV_OPT_STATS = (1<<7)
 };
 
 /**
@@ -234,6 +263,16 @@ struct evdns_base;
        ::1		(ipv6address)
        [::1]		([ipv6address])
 
+   When the name has several addresses, they are tried as RFC 8305
+   ("Happy Eyeballs") describes.  With AF_UNSPEC, the IPv6 and IPv4 lookups
+   are separate, and connecting starts as soon as either has answered
+   (an IPv4 answer first waits briefly for the IPv6 one).  Addresses are
+   tried alternating between the families, IPv6 first.  If an attempt has
+   neither succeeded nor failed within 250 msec, the next address is tried
+   alongside it.  The first connection to succeed is kept and yields
+   BEV_EVENT_CONNECTED; if none does, the bufferevent gets BEV_EVENT_ERROR
+   with the error of the last attempt.
+
    Performance note: If you do not provide an evdns_base, this function
    may block while it waits for a DNS response.	 This is probably not
    what you want.
@@ -253,6 +292,43 @@ int bufferevent_socket_connect_hostname(struct bufferevent *,
 EVENT2_EXPORT_SYMBOL
 int bufferevent_socket_get_dns_error(struct bufferevent *bev);
 
+/**
+   Cork the output of a socket bufferevent.
+
+   While a bufferevent is corked, data is still written as the socket
+   becomes writable, but the kernel is told that more output is on its
+   way (see EVBUFFER_FLAG_CORK), so a response that is assembled over
+   several callbacks or loop iterations leaves the host in as few TCP
+   segments as possible instead of one short segment per piece.
+
+   The cork stays in place until bufferevent_socket_uncork() is called or
+   the bufferevent is flushed with bufferevent_flush(bev, EV_WRITE,
+   BEV_FLUSH) or BEV_FINISHED.  Always uncork once the last piece of
+   output has been added, or the kernel may hold back its tail.
+
+   NOTE that only socket bufferevents support this function.
+
+   @param bev the bufferevent to cork
+   @return 0 if successful, or -1 if an error occurred
+   @see bufferevent_socket_uncork()
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_socket_cork(struct bufferevent *bev);
+
+/**
+   Uncork the output of a socket bufferevent corked with
+   bufferevent_socket_cork().
+
+   Anything still queued in the output buffer is written without the cork,
+   and anything the kernel has been holding back is pushed to the network.
+
+   @param bev the bufferevent to uncork
+   @return 0 if successful, or -1 if an error occurred
+   @see bufferevent_socket_cork()
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_socket_uncork(struct bufferevent *bev);
+
 /**
   Assign a bufferevent to a specific event_base.
 
@@ -267,6 +343,38 @@ int bufferevent_socket_get_dns_error(struct bufferevent *bev);
 EVENT2_EXPORT_SYMBOL
 int bufferevent_base_set(struct event_base *base, struct bufferevent *bufev);
 
+/**
+  Move a bufferevent, while it is in use, to another event_base.
+
+  Unlike bufferevent_base_set(), this is safe to call on a bufferevent that
+  is reading, writing, or has callbacks waiting to run.  Its events,
+  timeouts and rate-limit timer are taken off the old base and added to the
+  new one; callbacks that were deferred on the old base run on the new one
+  instead; and its buffers are counted against the new base's memory
+  budget.  No buffered data is lost.  Membership in a rate-limit group is
+  kept.
+
+  Read and write timeouts start over on the new base, as they do when you
+  call bufferevent_set_timeouts().  The bufferevent keeps its priority; if
+  the new base has fewer priorities than that, it gets the new base's
+  lowest one.
+
+  Call this from the thread running the bufferevent's current base (for
+  example, from one of its callbacks), or while that base is not running.
+  If the new base is running in another thread, the bufferevent must have
+  been created with BEV_OPT_THREADSAFE.
+
+  NOTE that only socket bufferevents support this function, and not while
+  they are connecting.
+
+  @param bufev the bufferevent to move
+  @param base the event_base to move it to
+  @return 0 if successful, or -1 if an error occurred
+  @see bufferevent_base_set()
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_migrate(struct bufferevent *bufev, struct event_base *base);
+
 /**
    Return the event_base used by a bufferevent
 */
@@ -548,6 +656,76 @@ EVENT2_EXPORT_SYMBOL
 int bufferevent_getwatermark(struct bufferevent *bufev, short events,
     size_t *lowmark, size_t *highmark);
 
+/**
+  Sets how much a socket bufferevent may read each time its socket is
+  readable.
+
+  By default a bufferevent makes one read per readiness notification.  With
+  a larger budget it keeps reading until the socket has no more data, or
+  until it has made max_reads reads or read max_bytes bytes, and then runs
+  the read callback once for everything.  A busy socket thus costs fewer
+  trips through the backend, while still giving up the loop to others
+  after its share.  Watermarks, rate limits and the base's memory budget
+  still apply to every read.
+
+  Other kinds of bufferevent ignore the budget.
+
+  @param bufev the bufferevent to be modified
+  @param max_bytes the most to read per callback, or 0 for no limit
+    beyond max_reads
+  @param max_reads the most reads per callback, or 0 for the default of 1
+  @return 0 on success, -1 on failure.
+  @see BEV_OPT_EDGE_TRIGGERED
+*/
+EVENT2_EXPORT_SYMBOL
+int bufferevent_set_read_budget(struct bufferevent *bufev, size_t max_bytes,
+    unsigned max_reads);
+
+/** I/O statistics for a bufferevent created with BEV_OPT_STATS, as returned
+ * by bufferevent_get_stats(). */
+struct bufferevent_stats {
+	/** Bytes added to the input buffer from the transport. */
+	ev_uint64_t bytes_read;
+	/** Bytes taken from the output buffer and given to the transport. */
+	ev_uint64_t bytes_written;
+	/** Number of attempts to read from the transport: recv() calls for a
+	 * socket, SSL_read() calls for OpenSSL, filter calls for a filter, and
+	 * transfers from the partner for a pair. */
+	ev_uint64_t n_reads;
+	/** Number of attempts to write to the transport, counted the same
+	 * way. */
+	ev_uint64_t n_writes;
+	/** How many of those reads found nothing ready to read. */
+	ev_uint64_t n_reads_again;
+	/** How many of those writes found no room to write. */
+	ev_uint64_t n_writes_again;
+	/** Number of times reading stopped because the input buffer reached
+	 * its high watermark. */
+	ev_uint64_t n_read_suspended_wm;
+	/** Number of times reading stopped because of a rate limit on the
+	 * bufferevent or its group. */
+	ev_uint64_t n_read_suspended_rate;
+	/** Total time the output buffer has held data, by the clock of the
+	 * bufferevent's event_base. */
+	struct timeval output_busy;
+	/** The most bytes the input buffer has held. */
+	size_t max_input;
+	/** The most bytes the output buffer has held. */
+	size_t max_output;
+};
+
+/**
+  Copy the I/O statistics of a bufferevent into *stats.
+
+  @param bufev a bufferevent created with BEV_OPT_STATS
+  @param stats the structure to fill in
+  @return 0 on success, or -1 if bufev does not keep statistics
+  @see BEV_OPT_STATS
+*/
+EVENT2_EXPORT_SYMBOL
+int bufferevent_get_stats(struct bufferevent *bufev,
+    struct bufferevent_stats *stats);
+
 /**
    Acquire the lock on a bufferevent.  Has no effect if locking was not
    enabled with BEV_OPT_THREADSAFE.
@@ -738,9 +916,40 @@ EVENT2_EXPORT_SYMBOL
 int bufferevent_pair_new(struct event_base *base, int options,
     struct bufferevent *pair[2]);
 
+/**
+   Allocate a pair of linked bufferevents whose ends live on different
+   event_bases, usually run by different threads.
+
+   The ends behave like those of bufferevent_pair_new(), but they share no
+   lock: what one end writes is handed to the other through an
+   evbuffer_spsc (see evbuffer_spsc_new()), which moves the buffer's chains
+   without copying them and wakes the other end's base only when that end
+   has run out of data.  Freeing one end, or flushing it with BEV_FINISHED,
+   delivers BEV_EVENT_EOF to the other once it has read everything sent
+   before.
+
+   The read high-watermark of each end is respected; writing has no limit,
+   since data leaves the output buffer as soon as it is written.
+
+   For wakeups to work across threads, you must have enabled threading
+   (see evthread_use_pthreads()) before creating either event_base.  As
+   with any bufferevent, free each end before freeing its own base; the
+   ends may be freed in either order, each from its own base's thread.
+
+   @param base_a The event base for pair[0].
+   @param base_b The event base for pair[1]; may be the same as base_a.
+   @param options A set of options for both bufferevents
+   @param pair A pointer to an array to hold the two new bufferevent objects.
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_pair_new_cross(struct event_base *base_a,
+    struct event_base *base_b, int options, struct bufferevent *pair[2]);
+
 /**
    Given one bufferevent returned by bufferevent_pair_new(), returns the
-   other one if it still exists.  Otherwise returns NULL.
+   other one if it still exists.  Otherwise returns NULL.  Always returns
+   NULL for the ends of a bufferevent_pair_new_cross() pair.
  */
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_pair_get_partner(struct bufferevent *bev);
@@ -1014,6 +1223,233 @@ void
 bufferevent_rate_limit_group_reset_totals(
 	struct bufferevent_rate_limit_group *grp);
 
+/**
+   @name Connection pools
+
+   A connection pool keeps connected bufferevents that a program is done
+   with, so that the next request to the same destination can reuse one
+   instead of opening a new connection.  Destinations are keyed by address
+   and port, and by an opaque tag: connections are only ever handed out to
+   callers that asked for the same address and the same tag.  A program
+   that speaks TLS can pass its SSL_CTX as the tag and make its connections
+   in a bufferevent_pool_connect_cb.
+
+   While a connection is idle in the pool, the pool watches it: if the peer
+   closes it (detected with EV_CLOSED when the backend supports it, and by
+   readability otherwise), or if it stays idle longer than the pool's idle
+   timeout, the pool frees it.
+
+   @{
+ */
+
+/** A pool of reusable outgoing connections. */
+struct bufferevent_pool;
+
+/**
+   Make a new connection for a connection pool.
+
+   @param base the pool's event_base
+   @param sa the destination address
+   @param socklen the length of sa
+   @param tag the tag passed to bufferevent_pool_get()
+   @param arg the argument passed to bufferevent_pool_new()
+   @return a bufferevent that is connected, or connecting, to sa, or NULL
+     on failure.  The pool frees it with bufferevent_free() once it is done
+     with it, so it should usually have BEV_OPT_CLOSE_ON_FREE set.
+ */
+typedef struct bufferevent *(*bufferevent_pool_connect_cb)(
+    struct event_base *base, const struct sockaddr *sa, int socklen,
+    void *tag, void *arg);
+
+/** Statistics for a connection pool, as returned by
+ * bufferevent_pool_get_stats(). */
+struct bufferevent_pool_stats {
+	/** Number of bufferevent_pool_get() calls that reused a connection. */
+	ev_uint64_t hits;
+	/** Number of bufferevent_pool_get() calls that made a new one. */
+	ev_uint64_t misses;
+	/** Number of bufferevent_pool_get() calls that failed because their
+	 * destination already had max_per_dest connections. */
+	ev_uint64_t limited;
+	/** Number of idle connections the peer closed. */
+	ev_uint64_t closed;
+	/** Number of idle connections that reached the idle timeout. */
+	ev_uint64_t expired;
+	/** Number of connections idle in the pool right now. */
+	unsigned n_idle;
+	/** Number of connections handed out right now. */
+	unsigned n_active;
+};
+
+/**
+   Create a new connection pool.
+
+   @param base the event_base that the pool's connections use
+   @param max_per_dest the largest number of connections, idle or handed
+     out, that the pool makes to any one destination, or 0 for no limit
+   @param idle_timeout how long a connection may stay idle before the pool
+     closes it, or NULL to keep idle connections until the peer closes them
+   @param cb the function used to make new connections, or NULL to use
+     bufferevent_socket_new() with BEV_OPT_CLOSE_ON_FREE, followed by
+     bufferevent_socket_connect()
+   @param arg an argument to pass to cb
+   @return the new pool, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent_pool *bufferevent_pool_new(struct event_base *base,
+    unsigned max_per_dest, const struct timeval *idle_timeout,
+    bufferevent_pool_connect_cb cb, void *arg);
+
+/**
+   Free a connection pool.
+
+   Idle connections are freed along with the pool.  Connections that are
+   handed out stay open; their owners must free them with bufferevent_free().
+
+   The pool's other functions may be called from any thread once locking
+   is enabled, but this one must not run while the pool's event_base is
+   dispatching in another thread.  Some of the pool's memory is released
+   by the event_base's next loop iteration, or when it is freed.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_pool_free(struct bufferevent_pool *pool);
+
+/**
+   Get a connection to a destination from a pool.
+
+   If the pool has an idle connection to sa with the same tag, return the
+   one that was returned to the pool most recently.  Otherwise, make a new
+   connection, which may still be connecting when this function returns.
+
+   The connection comes with no callbacks, with reading and writing
+   disabled, and with no timeouts: set them up as for any new bufferevent.
+   When you are done with it, give it back with bufferevent_pool_put(), or
+   close it with bufferevent_pool_drop().
+
+   @param pool the connection pool
+   @param sa the destination: an AF_INET or AF_INET6 address
+   @param socklen the length of sa
+   @param tag an opaque value that must also match for a connection to be
+     reused, or NULL
+   @return a bufferevent, or NULL if the destination already has
+     max_per_dest connections, or on error.
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent *bufferevent_pool_get(struct bufferevent_pool *pool,
+    const struct sockaddr *sa, int socklen, void *tag);
+
+/**
+   Return a connection that came from bufferevent_pool_get() to its pool.
+
+   A connection can only be reused if it is open and it has nothing left in
+   its input or output buffers; otherwise, the pool frees it.
+
+   @return 0 if the connection is now idle in the pool, or -1 if it was
+     freed, or did not come from this pool.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_pool_put(struct bufferevent_pool *pool,
+    struct bufferevent *bev);
+
+/**
+   Free a connection that came from bufferevent_pool_get(), instead of
+   returning it to the pool.  Use this when the connection is broken, or
+   when the protocol does not allow it to be reused.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_pool_drop(struct bufferevent_pool *pool,
+    struct bufferevent *bev);
+
+/** Copy a pool's statistics into *stats. */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_pool_get_stats(struct bufferevent_pool *pool,
+    struct bufferevent_pool_stats *stats);
+/*@}*/
+
+/**
+   @name Proxies
+
+   A proxy joins two bufferevents, so that everything read from either one
+   is written to the other, the way sample/le-proxy.c does by hand.  When
+   one side reads more than the other can write, the proxy stops reading
+   from it until the other side catches up.
+
+   When both bufferevents are socket bufferevents with no filters and no
+   rate limits, and the system has splice(), the proxy moves data from one
+   socket to the other through a kernel pipe, without copying it into user
+   space.  Otherwise, it moves data from one bufferevent's input buffer to
+   the other's output buffer.
+
+   When one side reaches EOF, the proxy writes whatever it still has from
+   that side to the other side, and then shuts down the writing half of
+   the other side's socket, so that its peer sees EOF too.
+
+   @{
+ */
+
+/** Two bufferevents joined by bufferevent_proxy_new(). */
+struct bufferevent_proxy;
+
+/**
+   A callback invoked once a proxy is over.
+
+   @param proxy the proxy
+   @param what BEV_EVENT_EOF if both sides reached EOF and everything read
+     from each was written to the other, or the event (such as
+     BEV_EVENT_ERROR|BEV_EVENT_READING, or a timeout) that ended it
+   @param arg the argument passed to bufferevent_proxy_new()
+ */
+typedef void (*bufferevent_proxy_cb)(struct bufferevent_proxy *proxy,
+    short what, void *arg);
+
+/**
+   Join two bufferevents.
+
+   The proxy takes over both bufferevents' callbacks and enables them; do
+   not change either until the proxy is freed.  Anything already in either
+   bufferevent's input buffer is passed on to the other side.
+
+   @param a one bufferevent; it may still be connecting
+   @param b the other bufferevent, on the same event_base as a
+   @param options BEV_OPT_CLOSE_ON_FREE to free both bufferevents along
+     with the proxy, or 0
+   @param cb a callback to invoke once the proxy is over, or NULL
+   @param cbarg an argument to pass to cb
+   @return the new proxy, or NULL on error
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent_proxy *bufferevent_proxy_new(struct bufferevent *a,
+    struct bufferevent *b, int options, bufferevent_proxy_cb cb,
+    void *cbarg);
+
+/**
+   Free a proxy.
+
+   Data that the proxy has read from one side, but not yet written to the
+   other, is lost.  This function may be called from the proxy's callback.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_proxy_free(struct bufferevent_proxy *proxy);
+
+/** Return true if the proxy moves its data with splice(). */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_proxy_is_splicing(const struct bufferevent_proxy *proxy);
+
+/**
+   Get the number of bytes that a proxy has read from each side to pass on
+   to the other.
+
+   @param proxy the proxy
+   @param a_to_b set to the number of bytes read from the first
+     bufferevent, if not NULL
+   @param b_to_a set to the number of bytes read from the second
+     bufferevent, if not NULL
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_proxy_get_totals(const struct bufferevent_proxy *proxy,
+    ev_uint64_t *a_to_b, ev_uint64_t *b_to_a);
+/*@}*/
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_DGRAM_H_INCLUDED_
+#define EVENT2_DGRAM_H_INCLUDED_
+
+/** @file event2/dgram.h
+
+  Datagram I/O: the UDP counterpart of bufferevents.
+
+  An evdgram owns a datagram socket and two queues of packets.  While
+  reading is enabled it takes every datagram the socket has into its input
+  queue, many per system call where recvmmsg() is available, and runs its
+  read callback.  Packets you queue for sending go out, again many per
+  system call where sendmmsg() is available, as soon as the socket can take
+  them.  Each packet keeps its own boundaries and its peer's address.
+
+  Packet buffers come from a small free list kept by each evdgram, so a busy
+  socket does not allocate memory for every datagram.  Callers that want to
+  avoid copying can take packets from the input queue, and fill packets for
+  the output queue, directly; see evdgram_recv_packet() and
+  evdgram_packet_new().
+
+  Watermarks, counted in packets, work as they do for bufferevents: the
+  read callback runs once the input queue holds at least the low watermark,
+  reading stops while it holds the high watermark, and sending fails while
+  the output queue holds its high watermark.  The write callback runs once
+  the output queue drains to its low watermark.
+ */
+
+#include <event2/visibility.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/event.h>
+
+struct sockaddr;
+struct evdgram;
+struct evdgram_packet;
+
+/**
+   A read or write callback for an evdgram.
+
+   @param dg the evdgram whose input queue has reached its low watermark
+     (for reading) or whose output queue has drained to its low watermark
+     (for writing)
+   @param arg the pointer passed to evdgram_setcb()
+ */
+typedef void (*evdgram_data_cb)(struct evdgram *dg, void *arg);
+
+/**
+   An error callback for an evdgram.
+
+   Errors on a datagram socket are usually about a single packet (an ICMP
+   error from some peer, a packet too large to send), so the evdgram keeps
+   going afterwards.  Disable or free it from here to make it stop.
+
+   @param dg the evdgram
+   @param what EV_READ or EV_WRITE, depending on which failed
+   @param err the socket error, as from EVUTIL_SOCKET_ERROR()
+   @param arg the pointer passed to evdgram_setcb()
+ */
+typedef void (*evdgram_error_cb)(struct evdgram *dg, short what, int err,
+    void *arg);
+
+/** Flag: freeing the evdgram closes its socket. */
+#define EVDGRAM_OPT_CLOSE_ON_FREE	(1u<<0)
+/** Flag: the evdgram should be locked, so that it is safe to use from
+ * several threads at once. */
+#define EVDGRAM_OPT_THREADSAFE		(1u<<1)
+
+/** The largest datagram an evdgram receives in full unless told otherwise;
+ * see evdgram_new(). */
+#define EVDGRAM_DEFAULT_PACKET_SIZE	2048
+
+/**
+   Create an evdgram on a datagram socket.
+
+   Reading starts disabled; call evdgram_enable() to start.  Writing starts
+   enabled.
+
+   @param base the event_base to use
+   @param fd a nonblocking datagram socket, bound or connected as needed
+   @param flags any number of EVDGRAM_OPT_* flags
+   @param max_packet the size of each packet buffer, or 0 for
+     EVDGRAM_DEFAULT_PACKET_SIZE.  Longer datagrams are truncated when
+     received, and can't be sent.
+   @return the new evdgram, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram *evdgram_new(struct event_base *base, evutil_socket_t fd,
+    unsigned flags, size_t max_packet);
+
+/**
+   Create a new nonblocking UDP socket bound to an address, and an evdgram
+   on it.  The evdgram closes the socket when freed.
+
+   @param base the event_base to use
+   @param flags any number of EVDGRAM_OPT_* flags
+   @param max_packet as for evdgram_new()
+   @param sa the address to bind to
+   @param socklen the length of sa
+   @return the new evdgram, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram *evdgram_new_bind(struct event_base *base, unsigned flags,
+    size_t max_packet, const struct sockaddr *sa, int socklen);
+
+/**
+   Free an evdgram, along with any packets still in its queues.
+
+   Packets still waiting to be sent are dropped.
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_free(struct evdgram *dg);
+
+/**
+   Change the callbacks of an evdgram.
+
+   @param dg the evdgram
+   @param readcb called when packets have arrived, or NULL
+   @param writecb called when the output queue has drained, or NULL
+   @param errorcb called when a send or receive fails, or NULL
+   @param arg an argument for the callbacks
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_setcb(struct evdgram *dg, evdgram_data_cb readcb,
+    evdgram_data_cb writecb, evdgram_error_cb errorcb, void *arg);
+
+/**
+   Enable reading and/or writing on an evdgram.
+
+   @param dg the evdgram
+   @param events any combination of EV_READ and EV_WRITE
+   @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_enable(struct evdgram *dg, short events);
+
+/**
+   Disable reading and/or writing on an evdgram.  Packets already queued
+   stay queued.
+
+   @param dg the evdgram
+   @param events any combination of EV_READ and EV_WRITE
+   @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_disable(struct evdgram *dg, short events);
+
+/**
+   Set the watermarks of an evdgram, in packets.
+
+   For reading, the read callback runs only once the input queue holds at
+   least lowmark packets, and the evdgram stops reading while it holds
+   highmark packets or more.  For writing, the write callback runs once the
+   output queue holds no more than lowmark packets, and sending fails while
+   it holds highmark packets or more.  A highmark of 0 means no limit.
+
+   @param dg the evdgram
+   @param events EV_READ, EV_WRITE, or both
+   @param lowmark the low watermark
+   @param highmark the high watermark, or 0 for none
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_setwatermark(struct evdgram *dg, short events,
+    size_t lowmark, size_t highmark);
+
+/**
+   Set how many packets an evdgram moves per system call, and how many free
+   packet buffers it keeps for reuse.
+
+   @param dg the evdgram
+   @param batch packets per recvmmsg() or sendmmsg() call, or 0 for the
+     default of 32
+   @param max_free free packet buffers to keep, or 0 for twice the batch
+   @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_set_batch(struct evdgram *dg, unsigned batch, size_t max_free);
+
+/** Return the number of packets in the input queue of an evdgram. */
+EVENT2_EXPORT_SYMBOL
+size_t evdgram_get_input_count(struct evdgram *dg);
+
+/** Return the number of packets in the output queue of an evdgram. */
+EVENT2_EXPORT_SYMBOL
+size_t evdgram_get_output_count(struct evdgram *dg);
+
+/**
+   Take the oldest packet from the input queue of an evdgram, copying it
+   out.
+
+   @param dg the evdgram
+   @param buf where to put the packet
+   @param len the size of buf; any more of the packet is discarded
+   @param from if not NULL, where to put the sender's address
+   @param fromlen if from is not NULL, the size of from on input, and the
+     length of the address on output
+   @return the length of the packet, which may be more than len, or -1 if
+     the input queue is empty
+ */
+EVENT2_EXPORT_SYMBOL
+ev_ssize_t evdgram_recv(struct evdgram *dg, void *buf, size_t len,
+    struct sockaddr *from, ev_socklen_t *fromlen);
+
+/**
+   Queue a copy of a datagram to be sent.
+
+   @param dg the evdgram
+   @param data the packet
+   @param len the length of the packet
+   @param to the address to send it to, or NULL on a connected socket
+   @param tolen the length of to
+   @return 0 on success, or -1 if the packet is too large, the output queue
+     is at its high watermark, or memory ran out
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_send(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *to, ev_socklen_t tolen);
+
+/**
+   Take the oldest packet from the input queue of an evdgram without
+   copying it.  Give it back with evdgram_packet_free() or
+   evdgram_send_packet() when done.
+
+   @param dg the evdgram
+   @return the packet, or NULL if the input queue is empty
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram_packet *evdgram_recv_packet(struct evdgram *dg);
+
+/**
+   Get an empty packet from the free packet buffers of an evdgram, to fill
+   in and pass to evdgram_send_packet().
+
+   @param dg the evdgram
+   @return the packet, with room for the max_packet bytes given to
+     evdgram_new(), or NULL if memory ran out
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram_packet *evdgram_packet_new(struct evdgram *dg);
+
+/**
+   Queue a packet to be sent.  The evdgram takes the packet in all cases.
+
+   @param dg the evdgram the packet came from
+   @param pkt the packet, with its data filled in
+   @param len the length of the data
+   @param to the address to send it to, or NULL to reply to the sender of
+     a received packet, or on a connected socket
+   @param tolen the length of to
+   @return 0 on success, or -1 if len is too large or the output queue is
+     at its high watermark, in which case the packet is freed
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_send_packet(struct evdgram *dg, struct evdgram_packet *pkt,
+    size_t len, const struct sockaddr *to, ev_socklen_t tolen);
+
+/** Give a packet back to the evdgram it came from. */
+EVENT2_EXPORT_SYMBOL
+void evdgram_packet_free(struct evdgram *dg, struct evdgram_packet *pkt);
+
+/** Return the data of a packet. */
+EVENT2_EXPORT_SYMBOL
+void *evdgram_packet_data(struct evdgram_packet *pkt);
+
+/** Return the length of a received packet. */
+EVENT2_EXPORT_SYMBOL
+size_t evdgram_packet_length(struct evdgram_packet *pkt);
+
+/** Return true iff a received packet was longer than the evdgram's packet
+ * buffers, and lost its end. */
+EVENT2_EXPORT_SYMBOL
+int evdgram_packet_truncated(struct evdgram_packet *pkt);
+
+/**
+   Return the address a received packet came from.
+
+   @param pkt the packet
+   @param socklen if not NULL, set to the length of the address
+   @return the address, or NULL if the socket did not report one
+ */
+EVENT2_EXPORT_SYMBOL
+const struct sockaddr *evdgram_packet_addr(struct evdgram_packet *pkt,
+    ev_socklen_t *socklen);
+
+/** Return the socket of an evdgram. */
+EVENT2_EXPORT_SYMBOL
+evutil_socket_t evdgram_get_fd(struct evdgram *dg);
+
+/** Return the event_base of an evdgram. */
+EVENT2_EXPORT_SYMBOL
+struct event_base *evdgram_get_base(struct evdgram *dg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_DGRAM_H_INCLUDED_ */
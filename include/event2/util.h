@@ -853,6 +853,10 @@ int evutil_secure_rng_set_urandom_device_file(char *fname);
     contains a fairly large amount of strong entropy.  Doing so is
     notoriously hard: most people who try get it wrong.  Watch out!
 
+    If Libevent uses a system arc4random() that cannot be given extra
+    entropy, as with glibc 2.36 and later, this function does nothing:
+    that arc4random() seeds itself from the kernel.
+
     @param dat a buffer full of a strong source of random numbers
     @param datlen the number of bytes to read from datlen
  */
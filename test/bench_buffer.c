@@ -0,0 +1,178 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+
+/*
+ * This benchmark measures how quickly we can generate typical HTTP
+ * response headers into an evbuffer, first with evbuffer_add_printf and
+ * then with the typed evbuffer_add_* functions.
+ */
+
+static const char *header_names[] = {
+	"Content-Type", "Server", "Cache-Control", "Connection",
+	"X-Request-Id", NULL
+};
+static const char *header_values[] = {
+	"text/html; charset=ISO-8859-1", "libevent", "max-age=3600",
+	"keep-alive", "3f2a9c41b07e", NULL
+};
+
+static void
+headers_printf(struct evbuffer *buf, int i)
+{
+	int j;
+
+	evbuffer_add_printf(buf, "HTTP/%d.%d %d %s\r\n", 1, 1, 200, "OK");
+	for (j = 0; header_names[j]; ++j)
+		evbuffer_add_printf(buf, "%s: %s\r\n",
+		    header_names[j], header_values[j]);
+	evbuffer_add_printf(buf, "Content-Length: %d\r\n", 1000 + i % 100000);
+	evbuffer_add_printf(buf, "Age: %05d\r\n\r\n", i % 86400);
+	evbuffer_add_printf(buf, "%x\r\n", (unsigned)(i & 0xffff));
+}
+
+static void
+headers_typed(struct evbuffer *buf, int i)
+{
+	int j;
+
+	evbuffer_add_string(buf, "HTTP/");
+	evbuffer_add_int(buf, 1);
+	evbuffer_add(buf, ".", 1);
+	evbuffer_add_int(buf, 1);
+	evbuffer_add(buf, " ", 1);
+	evbuffer_add_int(buf, 200);
+	evbuffer_add_string(buf, " OK\r\n");
+	for (j = 0; header_names[j]; ++j) {
+		evbuffer_add_string(buf, header_names[j]);
+		evbuffer_add(buf, ": ", 2);
+		evbuffer_add_string(buf, header_values[j]);
+		evbuffer_add(buf, "\r\n", 2);
+	}
+	evbuffer_add_string(buf, "Content-Length: ");
+	evbuffer_add_int(buf, 1000 + i % 100000);
+	evbuffer_add_string(buf, "\r\nAge: ");
+	evbuffer_add_uint(buf, i % 86400, 5, '0');
+	evbuffer_add_string(buf, "\r\n\r\n");
+	evbuffer_add_hex(buf, i & 0xffff, 0, 0);
+	evbuffer_add(buf, "\r\n", 2);
+}
+
+static long
+run_once(void (*fn)(struct evbuffer *, int), int num_responses, size_t *lenp)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct timeval ts, te;
+	int i;
+
+	if (buf == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_responses; ++i) {
+		fn(buf, i);
+		/* Pretend that we flushed the response to the network. */
+		if ((i & 63) == 63) {
+			*lenp += evbuffer_get_length(buf);
+			evbuffer_drain(buf, evbuffer_get_length(buf));
+		}
+	}
+	*lenp += evbuffer_get_length(buf);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+
+	evbuffer_free(buf);
+
+	return te.tv_sec * 1000000L + te.tv_usec;
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, c;
+	int num_responses = 100000;
+	int num_runs = 10;
+	long printf_usec = 0, typed_usec = 0;
+	size_t printf_len = 0, typed_len = 0;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_responses = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < num_runs; i++) {
+		printf_usec += run_once(headers_printf, num_responses,
+		    &printf_len);
+		typed_usec += run_once(headers_typed, num_responses,
+		    &typed_len);
+	}
+
+	if (printf_len != typed_len) {
+		fprintf(stderr, "Output length mismatch: %lu vs %lu\n",
+		    (unsigned long)printf_len, (unsigned long)typed_len);
+		exit(1);
+	}
+
+	fprintf(stdout, "%d responses x %d runs\n", num_responses, num_runs);
+	fprintf(stdout, "evbuffer_add_printf: %ld usec (%.1f ns/response)\n",
+	    printf_usec, printf_usec * 1000.0 / num_responses / num_runs);
+	fprintf(stdout, "evbuffer_add_*:      %ld usec (%.1f ns/response)\n",
+	    typed_usec, typed_usec * 1000.0 / num_responses / num_runs);
+
+	exit(0);
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/util.h"
+
+#ifdef _WIN32
+#define strtok_r strtok_s
+#endif
+
+/*
+ * This benchmark sends messages over a loopback TCP connection with
+ * TCP_NODELAY set.  Each message is produced in several pieces, one per
+ * loop iteration, the way a server assembles a response while it waits
+ * on other work.  We run once with plain writes and once with the
+ * bufferevent corked for the duration of each message, and report the
+ * time taken and (where /proc/net/snmp exists) the number of TCP segments
+ * the host sent.
+ */
+
+static int num_messages = 20000;
+static int num_pieces = 4;
+static int piece_size = 100;
+
+static struct event_base *base;
+static struct bufferevent *sender, *receiver;
+static struct event *step_ev;
+static char *piece;
+static int use_cork;
+static int cur_message, cur_piece;
+static size_t received, expected;
+
+static long
+get_out_segments(void)
+{
+	FILE *f = fopen("/proc/net/snmp", "r");
+	char names[1024], values[1024];
+	char *n, *v, *n_save = NULL, *v_save = NULL;
+	long result = -1;
+
+	if (f == NULL)
+		return -1;
+	while (fgets(names, sizeof(names), f)) {
+		if (strncmp(names, "Tcp:", 4))
+			continue;
+		if (!fgets(values, sizeof(values), f))
+			break;
+		n = strtok_r(names, " \n", &n_save);
+		v = strtok_r(values, " \n", &v_save);
+		while (n && v) {
+			if (!strcmp(n, "OutSegs")) {
+				result = atol(v);
+				break;
+			}
+			n = strtok_r(NULL, " \n", &n_save);
+			v = strtok_r(NULL, " \n", &v_save);
+		}
+		break;
+	}
+	fclose(f);
+	return result;
+}
+
+static void
+step_cb(evutil_socket_t fd, short what, void *arg)
+{
+	static const struct timeval zero = { 0, 0 };
+
+	if (cur_piece == 0 && use_cork)
+		bufferevent_socket_cork(sender);
+	bufferevent_write(sender, piece, piece_size);
+	if (++cur_piece == num_pieces) {
+		if (use_cork)
+			bufferevent_socket_uncork(sender);
+		cur_piece = 0;
+		if (++cur_message == num_messages)
+			return;
+	}
+	/* Produce the next piece on the next loop iteration. */
+	event_add(step_ev, &zero);
+}
+
+static void
+read_cb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	if (received >= expected)
+		event_base_loopexit(base, NULL);
+}
+
+static void
+event_cb(struct bufferevent *bev, short what, void *arg)
+{
+	fprintf(stderr, "Unexpected event 0x%x\n", what);
+	exit(1);
+}
+
+static void
+connect_pair(evutil_socket_t *fds)
+{
+	struct sockaddr_in sin;
+	ev_socklen_t slen = sizeof(sin);
+	evutil_socket_t listener;
+	int one = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 ||
+	    bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(listener, 1) < 0 ||
+	    getsockname(listener, (struct sockaddr *)&sin, &slen) < 0) {
+		perror("listener");
+		exit(1);
+	}
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0 ||
+	    connect(fds[0], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	fds[1] = accept(listener, NULL, NULL);
+	if (fds[1] < 0) {
+		perror("accept");
+		exit(1);
+	}
+	evutil_closesocket(listener);
+
+	setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, (void *)&one,
+	    sizeof(one));
+	evutil_make_socket_nonblocking(fds[0]);
+	evutil_make_socket_nonblocking(fds[1]);
+}
+
+static void
+run_once(int cork, long *usecp, long *segsp)
+{
+	evutil_socket_t fds[2];
+	struct timeval ts, te;
+	long segs_start;
+
+	connect_pair(fds);
+	sender = bufferevent_socket_new(base, fds[0], BEV_OPT_CLOSE_ON_FREE);
+	receiver = bufferevent_socket_new(base, fds[1], BEV_OPT_CLOSE_ON_FREE);
+	step_ev = evtimer_new(base, step_cb, NULL);
+	if (!sender || !receiver || !step_ev) {
+		fprintf(stderr, "Couldn't set up bufferevents\n");
+		exit(1);
+	}
+	bufferevent_setcb(sender, NULL, NULL, event_cb, NULL);
+	bufferevent_setcb(receiver, read_cb, NULL, event_cb, NULL);
+	bufferevent_enable(sender, EV_WRITE);
+	bufferevent_enable(receiver, EV_READ);
+
+	use_cork = cork;
+	cur_message = cur_piece = 0;
+	received = 0;
+	expected = (size_t)num_messages * num_pieces * piece_size;
+
+	segs_start = get_out_segments();
+	evutil_gettimeofday(&ts, NULL);
+	event_active(step_ev, EV_TIMEOUT, 1);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+
+	*usecp = te.tv_sec * 1000000L + te.tv_usec;
+	*segsp = segs_start < 0 ? -1 : get_out_segments() - segs_start;
+
+	event_free(step_ev);
+	bufferevent_free(sender);
+	bufferevent_free(receiver);
+}
+
+static void
+report(const char *name, long usec, long segs)
+{
+	double mb = (double)num_messages * num_pieces * piece_size / 1e6;
+
+	fprintf(stdout, "%-8s %ld usec (%.1f msgs/sec, %.1f MB/sec)",
+	    name, usec, num_messages * 1e6 / usec, mb * 1e6 / usec);
+	if (segs >= 0)
+		fprintf(stdout, ", %ld segments (%.2f/msg)", segs,
+		    (double)segs / num_messages);
+	fprintf(stdout, "\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+	long plain_usec, cork_usec, plain_segs, cork_segs;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#endif
+
+	while ((c = getopt(argc, argv, "n:p:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_messages = atoi(optarg);
+			break;
+		case 'p':
+			num_pieces = atoi(optarg);
+			break;
+		case 's':
+			piece_size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_messages <= 0 || num_pieces <= 0 || piece_size <= 0) {
+		fprintf(stderr, "Counts and sizes must be positive\n");
+		exit(1);
+	}
+
+	piece = malloc(piece_size);
+	base = event_base_new();
+	if (piece == NULL || base == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(piece, 'x', piece_size);
+
+	run_once(0, &plain_usec, &plain_segs);
+	run_once(1, &cork_usec, &cork_segs);
+
+	fprintf(stdout, "%d messages of %d x %d bytes\n",
+	    num_messages, num_pieces, piece_size);
+	report("plain:", plain_usec, plain_segs);
+	report("corked:", cork_usec, cork_segs);
+
+	event_base_free(base);
+	free(piece);
+
+	exit(0);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+
+/*
+ * This benchmark models a replication stream: data arrives in small
+ * pieces until an evbuffer holds many megabytes, then the consumer walks
+ * over all of it with evbuffer_peek() and drains it.  We run once with
+ * ordinary heap chains and once with EVBUFFER_FLAG_HUGEPAGES, and report
+ * the throughput, the resident memory of the full buffer, and (where
+ * getrusage() reports them) the page faults taken.
+ */
+
+static int buffer_mb = 64;
+static int piece_size = 16384;
+static int rounds = 10;
+
+static long
+get_rss_kb(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long size, resident = -1;
+
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+	fclose(f);
+	if (resident < 0)
+		return -1;
+#ifdef EVENT__HAVE_UNISTD_H
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+	return -1;
+#endif
+}
+
+static long
+get_faults(void)
+{
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		return ru.ru_minflt + ru.ru_majflt;
+#endif
+	return -1;
+}
+
+static void
+run_once(ev_uint64_t flags, const char *name)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_iovec *v = NULL;
+	size_t target = (size_t)buffer_mb * 1024 * 1024;
+	char *piece = malloc(piece_size);
+	struct timeval ts, te;
+	long rss_start, rss_full = -1, faults_start;
+	unsigned sum = 0;
+	int r, i, n_vec;
+
+	if (!buf || !piece) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(piece, 'x', piece_size);
+	evbuffer_set_flags(buf, flags);
+
+	rss_start = get_rss_kb();
+	faults_start = get_faults();
+	evutil_gettimeofday(&ts, NULL);
+	for (r = 0; r < rounds; ++r) {
+		while (evbuffer_get_length(buf) < target)
+			evbuffer_add(buf, piece, piece_size);
+		if (r == 0)
+			rss_full = get_rss_kb();
+
+		n_vec = evbuffer_peek(buf, -1, NULL, NULL, 0);
+		v = realloc(v, n_vec * sizeof(*v));
+		if (!v) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		evbuffer_peek(buf, -1, NULL, v, n_vec);
+		for (i = 0; i < n_vec; ++i) {
+			const unsigned char *p = v[i].iov_base;
+			size_t j;
+			for (j = 0; j < v[i].iov_len; j += 64)
+				sum += p[j];
+		}
+		evbuffer_drain(buf, evbuffer_get_length(buf));
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+
+	fprintf(stdout, "%-10s %8ld usec (%.1f MB/sec)",
+	    name, (long)(te.tv_sec * 1000000L + te.tv_usec),
+	    (double)buffer_mb * rounds /
+	    (te.tv_sec + te.tv_usec / 1e6));
+	if (rss_start >= 0 && rss_full >= 0)
+		fprintf(stdout, ", RSS +%ld KB", rss_full - rss_start);
+	if (faults_start >= 0)
+		fprintf(stdout, ", %ld page faults",
+		    get_faults() - faults_start);
+	fprintf(stdout, "\n");
+	if (sum == 1)
+		fprintf(stdout, "\n");
+
+	evbuffer_free(buf);
+	free(v);
+	free(piece);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "m:p:r:")) != -1) {
+		switch (c) {
+		case 'm':
+			buffer_mb = atoi(optarg);
+			break;
+		case 'p':
+			piece_size = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (buffer_mb <= 0 || piece_size <= 0 || rounds <= 0) {
+		fprintf(stderr, "Sizes and counts must be positive\n");
+		exit(1);
+	}
+
+	fprintf(stdout, "%d rounds of %d MB in %d byte pieces\n",
+	    rounds, buffer_mb, piece_size);
+	run_once(0, "heap:");
+	run_once(EVBUFFER_FLAG_HUGEPAGES, "hugepages:");
+
+	exit(0);
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/util.h"
+
+/*
+ * This benchmark pushes data from a client, through a proxy, to a server,
+ * over loopback TCP connections.  We run once with a proxy that moves
+ * data between two bufferevents from their callbacks, the way
+ * sample/le-proxy.c does, and once with bufferevent_proxy_new(), which
+ * uses splice() where it can.  We report the throughput of each.
+ */
+
+#define CHUNK_SIZE (1024*1024)
+/* Same as in le-proxy.c */
+#define MAX_OUTPUT (512*1024)
+
+static int num_megabytes = 1024;
+
+static struct event_base *base;
+static char *chunk;
+static size_t sent, received;
+
+static void
+source_write_cb(struct bufferevent *bev, void *arg)
+{
+	if (sent == (size_t)num_megabytes * CHUNK_SIZE)
+		return;
+	bufferevent_write(bev, chunk, CHUNK_SIZE);
+	sent += CHUNK_SIZE;
+}
+
+static void
+sink_read_cb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	if (received == (size_t)num_megabytes * CHUNK_SIZE)
+		event_base_loopexit(base, NULL);
+}
+
+static void
+event_cb(struct bufferevent *bev, short what, void *arg)
+{
+	fprintf(stderr, "Unexpected event 0x%x\n", what);
+	exit(1);
+}
+
+/* The le-proxy way: callbacks that move data between the two sides. */
+
+static void
+drained_write_cb(struct bufferevent *bev, void *arg);
+
+static void
+le_read_cb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent *partner = arg;
+	struct evbuffer *dst = bufferevent_get_output(partner);
+
+	bufferevent_write_buffer(partner, bufferevent_get_input(bev));
+	if (evbuffer_get_length(dst) >= MAX_OUTPUT) {
+		bufferevent_setcb(partner, le_read_cb, drained_write_cb,
+		    event_cb, bev);
+		bufferevent_setwatermark(partner, EV_WRITE, MAX_OUTPUT/2,
+		    MAX_OUTPUT);
+		bufferevent_disable(bev, EV_READ);
+	}
+}
+
+static void
+drained_write_cb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent *partner = arg;
+
+	bufferevent_setcb(bev, le_read_cb, NULL, event_cb, partner);
+	bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
+	if (partner)
+		bufferevent_enable(partner, EV_READ);
+}
+
+static void
+connect_pair(evutil_socket_t *fds)
+{
+	struct sockaddr_in sin;
+	ev_socklen_t slen = sizeof(sin);
+	evutil_socket_t listener;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 ||
+	    bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(listener, 1) < 0 ||
+	    getsockname(listener, (struct sockaddr *)&sin, &slen) < 0) {
+		perror("listener");
+		exit(1);
+	}
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0 ||
+	    connect(fds[0], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	fds[1] = accept(listener, NULL, NULL);
+	if (fds[1] < 0) {
+		perror("accept");
+		exit(1);
+	}
+	evutil_closesocket(listener);
+
+	evutil_make_socket_nonblocking(fds[0]);
+	evutil_make_socket_nonblocking(fds[1]);
+}
+
+static void
+run_once(int use_proxy_api)
+{
+	struct bufferevent *source, *sink, *in, *out;
+	struct bufferevent_proxy *proxy = NULL;
+	evutil_socket_t client[2], server[2];
+	struct timeval ts, te;
+	const char *name;
+	double secs;
+
+	/* source -- client -- in <proxy> out -- server -- sink */
+	connect_pair(client);
+	connect_pair(server);
+	source = bufferevent_socket_new(base, client[0], BEV_OPT_CLOSE_ON_FREE);
+	in = bufferevent_socket_new(base, client[1], BEV_OPT_CLOSE_ON_FREE);
+	out = bufferevent_socket_new(base, server[0], BEV_OPT_CLOSE_ON_FREE);
+	sink = bufferevent_socket_new(base, server[1], BEV_OPT_CLOSE_ON_FREE);
+	if (!source || !in || !out || !sink) {
+		fprintf(stderr, "Couldn't set up bufferevents\n");
+		exit(1);
+	}
+
+	if (use_proxy_api) {
+		proxy = bufferevent_proxy_new(in, out, BEV_OPT_CLOSE_ON_FREE,
+		    NULL, NULL);
+		if (!proxy) {
+			fprintf(stderr, "Couldn't set up proxy\n");
+			exit(1);
+		}
+		name = bufferevent_proxy_is_splicing(proxy) ?
+		    "proxy (splice):" : "proxy (evbuffer):";
+	} else {
+		bufferevent_setcb(in, le_read_cb, NULL, event_cb, out);
+		bufferevent_setcb(out, le_read_cb, NULL, event_cb, in);
+		bufferevent_enable(in, EV_READ|EV_WRITE);
+		bufferevent_enable(out, EV_READ|EV_WRITE);
+		name = "le-proxy:";
+	}
+
+	bufferevent_setcb(source, NULL, source_write_cb, event_cb, NULL);
+	bufferevent_setcb(sink, sink_read_cb, NULL, event_cb, NULL);
+	bufferevent_enable(source, EV_WRITE);
+	bufferevent_enable(sink, EV_READ);
+
+	sent = received = 0;
+	evutil_gettimeofday(&ts, NULL);
+	source_write_cb(source, NULL);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	secs = te.tv_sec + te.tv_usec / 1e6;
+
+	fprintf(stdout, "%-18s %.3f sec (%.1f MB/sec)\n",
+	    name, secs, num_megabytes / secs);
+
+	if (proxy) {
+		bufferevent_proxy_free(proxy);
+	} else {
+		bufferevent_free(in);
+		bufferevent_free(out);
+	}
+	bufferevent_free(source);
+	bufferevent_free(sink);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#endif
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_megabytes = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_megabytes <= 0) {
+		fprintf(stderr, "Counts must be positive\n");
+		exit(1);
+	}
+
+	chunk = malloc(CHUNK_SIZE);
+	base = event_base_new();
+	if (chunk == NULL || base == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(chunk, 'x', CHUNK_SIZE);
+
+	fprintf(stdout, "%d megabytes through a proxy\n", num_megabytes);
+	run_once(0);
+	run_once(1);
+
+	event_base_free(base);
+	free(chunk);
+
+	exit(0);
+}
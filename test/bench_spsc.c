@@ -0,0 +1,248 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#endif
+#ifdef EVENT__HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/thread.h"
+
+#include "regress_thread.h"
+
+/*
+ * This benchmark models a network thread handing data to a worker
+ * thread.  A producer thread adds the data in small pieces; the main
+ * thread takes it out and drains it.  We run once through a single
+ * evbuffer with locking enabled, once through an evbuffer_spsc that the
+ * consumer polls, and once through an evbuffer_spsc whose consumer sleeps
+ * in event_base_dispatch() until it is woken up.
+ */
+
+static int total_mb = 128;
+static int piece_size = 4096;
+static int batch = 1;
+
+static size_t total_bytes;
+static char *piece;
+
+static struct evbuffer *locked_buf;
+static struct evbuffer_spsc *spsc;
+static size_t consumed;
+
+static THREAD_FN
+produce_locked(void *arg)
+{
+	size_t n;
+
+	for (n = 0; n < total_bytes; n += piece_size)
+		evbuffer_add(locked_buf, piece, piece_size);
+	THREAD_RETURN();
+}
+
+static THREAD_FN
+produce_spsc(void *arg)
+{
+	struct evbuffer *buf = evbuffer_spsc_get_producer_buffer(spsc);
+	size_t n;
+	int i = 0;
+
+	for (n = 0; n < total_bytes; n += piece_size) {
+		evbuffer_add(buf, piece, piece_size);
+		if (++i == batch) {
+			evbuffer_spsc_publish(spsc);
+			i = 0;
+		}
+	}
+	evbuffer_spsc_publish(spsc);
+	THREAD_RETURN();
+}
+
+static void
+consume_cb(struct evbuffer_spsc *s, struct evbuffer *buf, void *arg)
+{
+	struct event_base *base = arg;
+
+	consumed += evbuffer_get_length(buf);
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	if (consumed >= total_bytes)
+		event_base_loopbreak(base);
+}
+
+static void
+report(const char *name, struct timeval *ts)
+{
+	struct timeval te;
+
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, ts, &te);
+	fprintf(stdout, "%-12s %8ld usec (%.1f MB/sec)\n",
+	    name, (long)(te.tv_sec * 1000000L + te.tv_usec),
+	    (double)total_mb / (te.tv_sec + te.tv_usec / 1e6));
+}
+
+static void
+run_locked(void)
+{
+	struct evbuffer *local = evbuffer_new();
+	struct timeval ts;
+	THREAD_T thread;
+
+	locked_buf = evbuffer_new();
+	evbuffer_enable_locking(locked_buf, NULL);
+	consumed = 0;
+
+	evutil_gettimeofday(&ts, NULL);
+	THREAD_START(thread, produce_locked, NULL);
+	while (consumed < total_bytes) {
+		evbuffer_add_buffer(local, locked_buf);
+		consumed += evbuffer_get_length(local);
+		evbuffer_drain(local, evbuffer_get_length(local));
+	}
+	THREAD_JOIN(thread);
+	report("locked:", &ts);
+
+	evbuffer_free(locked_buf);
+	evbuffer_free(local);
+}
+
+static void
+run_spsc_poll(struct event_base *base)
+{
+	struct evbuffer *buf;
+	struct timeval ts;
+	THREAD_T thread;
+
+	spsc = evbuffer_spsc_new(base, NULL, NULL);
+	buf = evbuffer_spsc_get_consumer_buffer(spsc);
+	consumed = 0;
+
+	evutil_gettimeofday(&ts, NULL);
+	THREAD_START(thread, produce_spsc, NULL);
+	while (consumed < total_bytes) {
+		evbuffer_spsc_collect(spsc);
+		consumed += evbuffer_get_length(buf);
+		evbuffer_drain(buf, evbuffer_get_length(buf));
+	}
+	THREAD_JOIN(thread);
+	report("spsc-poll:", &ts);
+
+	evbuffer_spsc_free(spsc);
+}
+
+static void
+run_spsc_event(struct event_base *base)
+{
+	struct timeval ts;
+	THREAD_T thread;
+
+	spsc = evbuffer_spsc_new(base, consume_cb, base);
+	consumed = 0;
+
+	evutil_gettimeofday(&ts, NULL);
+	THREAD_START(thread, produce_spsc, NULL);
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	THREAD_JOIN(thread);
+	report("spsc-event:", &ts);
+
+	evbuffer_spsc_free(spsc);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct event_base *base;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:p:b:")) != -1) {
+		switch (c) {
+		case 'm':
+			total_mb = atoi(optarg);
+			break;
+		case 'p':
+			piece_size = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (total_mb <= 0 || piece_size <= 0 || batch <= 0) {
+		fprintf(stderr, "Sizes and counts must be positive\n");
+		exit(1);
+	}
+
+#if defined(EVTHREAD_USE_PTHREADS_IMPLEMENTED)
+	evthread_use_pthreads();
+#elif defined(EVTHREAD_USE_WINDOWS_THREADS_IMPLEMENTED)
+	evthread_use_windows_threads();
+#else
+	fprintf(stderr, "This benchmark needs thread support\n");
+	exit(1);
+#endif
+
+	total_bytes = (size_t)total_mb * 1024 * 1024;
+	if ((piece = malloc(piece_size)) == NULL ||
+	    (base = event_base_new()) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(piece, 'x', piece_size);
+
+	fprintf(stdout, "%d MB in %d byte pieces, published %d at a time\n",
+	    total_mb, piece_size, batch);
+	run_locked();
+	run_spsc_poll(base);
+	run_spsc_event(base);
+
+	event_base_free(base);
+	free(piece);
+	exit(0);
+}
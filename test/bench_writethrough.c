@@ -0,0 +1,223 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/util.h"
+
+/*
+ * This benchmark bounces a message back and forth over a loopback TCP
+ * connection, the way a client waits on each response from a server
+ * before sending its next request.  Both ends answer from their read
+ * callbacks.  We run once with plain socket bufferevents, which wait for
+ * EV_WRITE before writing each reply, and once with BEV_OPT_WRITE_THROUGH,
+ * and report the mean round-trip time.
+ */
+
+static int num_round_trips = 50000;
+static int message_size = 64;
+
+static struct event_base *base;
+static char *message;
+static int round_trips;
+
+static void
+client_read_cb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	if (evbuffer_get_length(input) < (size_t)message_size)
+		return;
+	evbuffer_drain(input, message_size);
+	if (++round_trips == num_round_trips) {
+		event_base_loopexit(base, NULL);
+		return;
+	}
+	bufferevent_write(bev, message, message_size);
+}
+
+static void
+server_read_cb(struct bufferevent *bev, void *arg)
+{
+	bufferevent_write_buffer(bev, bufferevent_get_input(bev));
+}
+
+static void
+event_cb(struct bufferevent *bev, short what, void *arg)
+{
+	fprintf(stderr, "Unexpected event 0x%x\n", what);
+	exit(1);
+}
+
+static void
+connect_pair(evutil_socket_t *fds)
+{
+	struct sockaddr_in sin;
+	ev_socklen_t slen = sizeof(sin);
+	evutil_socket_t listener;
+	int one = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 ||
+	    bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(listener, 1) < 0 ||
+	    getsockname(listener, (struct sockaddr *)&sin, &slen) < 0) {
+		perror("listener");
+		exit(1);
+	}
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0 ||
+	    connect(fds[0], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	fds[1] = accept(listener, NULL, NULL);
+	if (fds[1] < 0) {
+		perror("accept");
+		exit(1);
+	}
+	evutil_closesocket(listener);
+
+	setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, (void *)&one,
+	    sizeof(one));
+	setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, (void *)&one,
+	    sizeof(one));
+	evutil_make_socket_nonblocking(fds[0]);
+	evutil_make_socket_nonblocking(fds[1]);
+}
+
+static void
+run_once(int options, const char *name)
+{
+	struct bufferevent *client, *server;
+	evutil_socket_t fds[2];
+	struct timeval ts, te;
+	long usec;
+
+	connect_pair(fds);
+	client = bufferevent_socket_new(base, fds[0],
+	    BEV_OPT_CLOSE_ON_FREE|options);
+	server = bufferevent_socket_new(base, fds[1],
+	    BEV_OPT_CLOSE_ON_FREE|options);
+	if (!client || !server) {
+		fprintf(stderr, "Couldn't set up bufferevents\n");
+		exit(1);
+	}
+	bufferevent_setcb(client, client_read_cb, NULL, event_cb, NULL);
+	bufferevent_setcb(server, server_read_cb, NULL, event_cb, NULL);
+	bufferevent_enable(client, EV_READ);
+	bufferevent_enable(server, EV_READ);
+
+	round_trips = 0;
+	evutil_gettimeofday(&ts, NULL);
+	bufferevent_write(client, message, message_size);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+
+	fprintf(stdout, "%-15s %ld usec (%.2f usec per round trip)\n",
+	    name, usec, (double)usec / num_round_trips);
+
+	bufferevent_free(client);
+	bufferevent_free(server);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#endif
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_round_trips = atoi(optarg);
+			break;
+		case 's':
+			message_size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_round_trips <= 0 || message_size <= 0) {
+		fprintf(stderr, "Counts and sizes must be positive\n");
+		exit(1);
+	}
+
+	message = malloc(message_size);
+	base = event_base_new();
+	if (message == NULL || base == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(message, 'x', message_size);
+
+	fprintf(stdout, "%d round trips of %d bytes\n",
+	    num_round_trips, message_size);
+	run_once(0, "plain:");
+	run_once(BEV_OPT_WRITE_THROUGH, "write-through:");
+
+	event_base_free(base);
+	free(message);
+
+	exit(0);
+}
@@ -39,6 +39,9 @@
 #include <sys/time.h>
 #endif
 #include <sys/queue.h>
+#ifdef EVENT__HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifndef _WIN32
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -55,6 +58,7 @@
 #include "event2/event.h"
 #include "event2/buffer.h"
 #include "event2/buffer_compat.h"
+#include "event2/bufferevent.h"
 #include "event2/util.h"
 
 #include "defer-internal.h"
@@ -725,6 +729,397 @@ end:
 	evbuffer_free(buf);
 }
 
+/* Check that the evbuffer totals of 'base' add up the usage of 'a' and
+ * 'b' (either of which may be NULL). */
+static int
+memory_totals_match(struct event_base *base, struct evbuffer *a,
+    struct evbuffer *b)
+{
+	struct evbuffer_memory_usage totals, usage, sum;
+	struct evbuffer *bufs[2];
+	size_t n_buffers;
+	int i;
+
+	bufs[0] = a;
+	bufs[1] = b;
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < 2; ++i) {
+		if (!bufs[i])
+			continue;
+		evbuffer_get_memory_usage(bufs[i], &usage);
+		sum.payload += usage.payload;
+		sum.allocated += usage.allocated;
+		sum.n_chains += usage.n_chains;
+	}
+	event_base_get_evbuffer_totals(base, &totals, &n_buffers);
+	return totals.payload == sum.payload &&
+	    totals.allocated == sum.allocated &&
+	    totals.n_chains == sum.n_chains &&
+	    n_buffers == (size_t)((a != NULL) + (b != NULL));
+}
+
+static void
+test_evbuffer_memory_usage(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct evbuffer *buf = evbuffer_new(), *buf2 = evbuffer_new();
+	struct evbuffer_memory_usage usage, totals;
+	static const char ref[] = "a reference";
+	char data[1000];
+	size_t n_buffers;
+
+	tt_assert(buf && buf2);
+	memset(data, 'x', sizeof(data));
+
+	tt_int_op(evbuffer_get_memory_usage(buf, &usage), ==, 0);
+	tt_int_op(usage.payload, ==, 0);
+	tt_int_op(usage.n_chains, ==, 0);
+	tt_int_op(usage.allocated, ==, 0);
+
+	evbuffer_add(buf, data, sizeof(data));
+	evbuffer_add_reference(buf, ref, strlen(ref), NULL, NULL);
+	tt_int_op(evbuffer_get_memory_usage(buf, &usage), ==, 0);
+	tt_int_op(usage.payload, ==, sizeof(data) + strlen(ref));
+	tt_int_op(usage.n_chains, ==, 2);
+	/* The reference is counted without the memory it points to. */
+	tt_int_op(usage.allocated, >=, sizeof(data) + 2 * EVBUFFER_CHAIN_SIZE);
+	tt_int_op(usage.allocated, <, 2048 + 2 * EVBUFFER_CHAIN_SIZE);
+
+	/* Buffers that defer their callbacks to a base count toward its
+	 * totals, as they were when they joined it... */
+	event_base_get_evbuffer_totals(testdata->base, &totals, &n_buffers);
+	tt_int_op(totals.payload, ==, 0);
+	tt_int_op(totals.allocated, ==, 0);
+	tt_int_op(n_buffers, ==, 0);
+	evbuffer_defer_callbacks(buf, testdata->base);
+	evbuffer_defer_callbacks(buf2, testdata->base);
+	tt_assert(memory_totals_match(testdata->base, buf, buf2));
+	evbuffer_add(buf2, data, 10);
+	event_base_get_evbuffer_totals(testdata->base, &totals, NULL);
+	tt_int_op(totals.payload, ==, sizeof(data) + strlen(ref));
+
+	/* ...until we ask for exact totals, which recounts them all. */
+	tt_int_op(event_base_set_evbuffer_budget(testdata->base, 0, 0, NULL,
+		NULL), ==, 0);
+	tt_assert(memory_totals_match(testdata->base, buf, buf2));
+	event_base_get_evbuffer_totals(testdata->base, &totals, NULL);
+	tt_int_op(totals.payload, ==, sizeof(data) + strlen(ref) + 10);
+	tt_int_op(totals.n_chains, ==, 3);
+
+	evbuffer_add_buffer(buf2, buf);
+	evbuffer_drain(buf2, 100);
+	evbuffer_add(buf, data, 10);
+	tt_assert(memory_totals_match(testdata->base, buf, buf2));
+	event_base_get_evbuffer_totals(testdata->base, &totals, NULL);
+	tt_int_op(totals.payload, ==, sizeof(data) + strlen(ref) - 100 + 20);
+
+	/* Draining the data from a chain does not free its memory. */
+	evbuffer_drain(buf2, 10);
+	tt_assert(memory_totals_match(testdata->base, buf, buf2));
+	event_base_get_evbuffer_totals(testdata->base, &totals, NULL);
+	tt_int_op(totals.allocated, >, sizeof(data) + strlen(ref));
+
+	evbuffer_free(buf2);
+	buf2 = NULL;
+	tt_assert(memory_totals_match(testdata->base, buf, NULL));
+	event_base_get_evbuffer_totals(testdata->base, &totals, &n_buffers);
+	tt_int_op(totals.payload, ==, 10);
+	tt_int_op(n_buffers, ==, 1);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (buf2)
+		evbuffer_free(buf2);
+}
+
+static size_t
+count_chains(struct evbuffer *buf)
+{
+	struct evbuffer_memory_usage usage;
+
+	if (evbuffer_get_memory_usage(buf, &usage) < 0)
+		return 0;
+	return usage.n_chains;
+}
+
+/* Append 'n' chains of 'len' bytes each, filled with 'n' counting up from
+ * 'first'. */
+static int
+add_small_chains(struct evbuffer *buf, int first, int n, size_t len)
+{
+	struct evbuffer *tmp = evbuffer_new();
+	char piece[64];
+	int i;
+
+	if (!tmp || len > sizeof(piece))
+		return -1;
+	for (i = first; i < first + n; ++i) {
+		memset(piece, 'a' + i % 26, len);
+		evbuffer_add(tmp, piece, len);
+		evbuffer_add_buffer(buf, tmp);
+	}
+	evbuffer_free(tmp);
+	return 0;
+}
+
+/* Check that 'buf' holds exactly the chains that add_small_chains() added
+ * from 'first' to 'first' + 'n'. */
+static int
+check_small_chains(struct evbuffer *buf, int first, int n, size_t len)
+{
+	unsigned char *data = evbuffer_pullup(buf, -1);
+	size_t i;
+
+	if (!data || evbuffer_get_length(buf) != n * len)
+		return -1;
+	for (i = 0; i < n * len; ++i)
+		if (data[i] != 'a' + (first + i / len) % 26)
+			return -1;
+	return 0;
+}
+
+static void
+test_evbuffer_compaction(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_compaction_stats stats;
+	struct evbuffer_ptr pos;
+	static const char ref[] = "referenced";
+	char out[10];
+	size_t n;
+	int i;
+
+	tt_assert(buf);
+
+	/* Without a policy nothing happens on its own. */
+	tt_int_op(add_small_chains(buf, 0, 100, 10), ==, 0);
+	tt_int_op(count_chains(buf), ==, 100);
+	tt_int_op(evbuffer_get_compaction_stats(buf, &stats), ==, 0);
+	tt_int_op(stats.n_compactions, ==, 0);
+
+	/* Compacting by hand merges everything but the last chain. */
+	n = evbuffer_compact(buf);
+	tt_int_op(n, >=, 97);
+	tt_int_op(count_chains(buf), ==, 100 - n);
+	tt_int_op(evbuffer_get_compaction_stats(buf, &stats), ==, 0);
+	tt_int_op(stats.n_compactions, ==, 1);
+	tt_int_op(stats.n_chains_merged, ==, n);
+	tt_int_op(stats.n_bytes_copied, >=, 10 * n);
+	tt_int_op(check_small_chains(buf, 0, 100, 10), ==, 0);
+	evbuffer_free(buf);
+
+	/* A chain limit.  The policy runs as data is drained, like a
+	 * consumer would. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_compaction(buf, 64, 0), ==, 0);
+	for (i = 0; i < 2000; i += 50) {
+		tt_int_op(add_small_chains(buf, i, 50, 20), ==, 0);
+		tt_int_op(evbuffer_drain(buf, 20), ==, 0);
+		tt_int_op(count_chains(buf), <=, 64 + 64);
+	}
+	tt_int_op(evbuffer_get_compaction_stats(buf, &stats), ==, 0);
+	tt_int_op(stats.n_compactions, >, 0);
+	tt_int_op(check_small_chains(buf, 40, 1960, 20), ==, 0);
+	evbuffer_free(buf);
+
+	/* An average size. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_compaction(buf, 0, 1024), ==, 0);
+	tt_int_op(add_small_chains(buf, 0, 1000, 30), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 30), ==, 0);
+	tt_int_op(evbuffer_get_length(buf) / count_chains(buf), >=, 256);
+	tt_int_op(check_small_chains(buf, 1, 999, 30), ==, 0);
+	evbuffer_free(buf);
+
+	/* Appending leaves the chains alone, so positions stay valid. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_compaction(buf, 8, 0), ==, 0);
+	tt_int_op(add_small_chains(buf, 0, 50, 10), ==, 0);
+	tt_int_op(evbuffer_ptr_set(buf, &pos, 105, EVBUFFER_PTR_SET), ==, 0);
+	tt_int_op(add_small_chains(buf, 50, 50, 10), ==, 0);
+	tt_int_op(count_chains(buf), ==, 100);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, out, sizeof(out)), ==, 10);
+	tt_int_op(out[0], ==, 'a' + 10);
+	tt_int_op(out[5], ==, 'a' + 11);
+	tt_int_op(evbuffer_drain(buf, 10), ==, 0);
+	tt_int_op(count_chains(buf), <, 10);
+	tt_int_op(check_small_chains(buf, 1, 99, 10), ==, 0);
+	evbuffer_free(buf);
+
+	/* References are never copied. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_compaction(buf, 8, 0), ==, 0);
+	for (i = 0; i < 50; ++i)
+		evbuffer_add_reference(buf, ref, strlen(ref), NULL, NULL);
+	tt_int_op(count_chains(buf), ==, 50);
+	tt_int_op(evbuffer_compact(buf), ==, 0);
+	tt_int_op(evbuffer_get_compaction_stats(buf, &stats), ==, 0);
+	tt_int_op(stats.n_bytes_copied, ==, 0);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static int ring_cleanup_called = 0;
+static void
+ring_ref_cleanup(const void *data, size_t len, void *arg)
+{
+	++ring_cleanup_called;
+}
+
+static void
+test_evbuffer_ring(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct evbuffer *ring = evbuffer_new_ring(4000);
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_iovec v[2];
+	struct evbuffer_memory_usage usage;
+	static const char ref[] = "by reference";
+	unsigned char data[8192], out[8192];
+	size_t capacity, i, n;
+
+	tt_assert(ring && buf);
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (unsigned char)(i % 251);
+
+	/* Find out how much the ring holds. */
+	while (evbuffer_add(ring, data, 1) == 0)
+		;
+	capacity = evbuffer_get_length(ring);
+	tt_int_op(capacity, >=, 4000);
+	if (capacity > sizeof(data))
+		tt_skip();
+	tt_int_op(evbuffer_add(ring, data, 1), ==, -1);
+	tt_int_op(evbuffer_prepend(ring, data, 1), ==, -1);
+	evbuffer_drain(ring, capacity);
+	tt_int_op(evbuffer_get_length(ring), ==, 0);
+
+	/* Wrap around the end; the data is still one extent. */
+	n = capacity - 2500;
+	tt_int_op(evbuffer_add(ring, data, 2000), ==, 0);
+	tt_int_op(evbuffer_add(ring, data, n), ==, 0);
+	evbuffer_drain(ring, capacity - 1000);
+	tt_int_op(evbuffer_add(ring, data, 2500), ==, 0);
+	tt_int_op(evbuffer_get_length(ring), ==, 3000);
+	tt_int_op(evbuffer_peek(ring, -1, NULL, v, 2), ==, 1);
+	tt_int_op(v[0].iov_len, ==, 3000);
+	tt_int_op(evbuffer_copyout(ring, out, 1000), ==, 1000);
+	tt_int_op(memcmp(out, data + n - 500, 500), ==, 0);
+	tt_int_op(memcmp(out + 500, data, 500), ==, 0);
+	tt_int_op(evbuffer_get_memory_usage(ring, &usage), ==, 0);
+	tt_int_op(usage.n_chains, ==, 1);
+
+	/* Moving data in and out of a ring copies it. */
+	tt_int_op(evbuffer_remove_buffer(ring, buf, 500), ==, 500);
+	tt_int_op(evbuffer_get_length(buf), ==, 500);
+	tt_int_op(evbuffer_get_length(ring), ==, 2500);
+	tt_int_op(evbuffer_add_buffer(buf, ring), ==, 0);
+	tt_int_op(evbuffer_get_length(ring), ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, 3000);
+	evbuffer_drain(buf, 1000);
+	tt_int_op(evbuffer_add_buffer(ring, buf), ==, 0);
+	tt_int_op(evbuffer_get_length(ring), ==, 2000);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+	tt_int_op(evbuffer_copyout(ring, out, 2000), ==, 2000);
+	tt_int_op(memcmp(out, data + 500, 2000), ==, 0);
+	tt_int_op(evbuffer_add_buffer_reference(buf, ring), ==, -1);
+	tt_int_op(evbuffer_add_reference(ring, ref, strlen(ref),
+		ring_ref_cleanup, NULL), ==, 0);
+	tt_int_op(ring_cleanup_called, ==, 1);
+	tt_int_op(evbuffer_get_length(ring), ==, 2000 + strlen(ref));
+
+	/* Reading and writing through a socket. */
+	evbuffer_drain(ring, evbuffer_get_length(ring));
+	tt_int_op(evbuffer_add(ring, data, capacity - 1000), ==, 0);
+	evbuffer_drain(ring, capacity - 1000);
+	tt_int_op(send(testdata->pair[0], (const char *)data, 2000, 0),
+	    ==, 2000);
+	tt_int_op(evbuffer_read(ring, testdata->pair[1], 2000), ==, 2000);
+	tt_int_op(evbuffer_write(ring, testdata->pair[1]), ==, 2000);
+	tt_int_op(recv(testdata->pair[0], (char *)out, 2000, 0), ==, 2000);
+	tt_int_op(memcmp(out, data, 2000), ==, 0);
+
+	/* A full ring refuses to read. */
+	tt_int_op(evbuffer_add(ring, data, capacity - 3000), ==, 0);
+	tt_int_op(evbuffer_add(ring, data, 3000), ==, 0);
+	tt_int_op(send(testdata->pair[0], (const char *)data, 10, 0), ==, 10);
+	tt_int_op(evbuffer_read(ring, testdata->pair[1], 10), ==, -1);
+
+end:
+	if (ring)
+		evbuffer_free(ring);
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+test_evbuffer_hugepages(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_chain *chain;
+	unsigned char *piece = malloc(100000), *out = malloc(100000);
+	size_t n_huge = 0;
+	int i, j, round;
+
+	tt_assert(buf && piece && out);
+	evbuffer_set_flags(buf, EVBUFFER_FLAG_HUGEPAGES);
+
+	/* The second round reuses the chunks that the first round freed. */
+	for (round = 0; round < 2; ++round) {
+		for (i = 0; i < 50; ++i) {
+			for (j = 0; j < 100000; ++j)
+				piece[j] = (unsigned char)(i + j);
+			tt_int_op(evbuffer_add(buf, piece, 100000), ==, 0);
+		}
+		evbuffer_validate(buf);
+		tt_int_op(evbuffer_get_length(buf), ==, 5000000);
+
+		n_huge = 0;
+		for (chain = buf->first; chain; chain = chain->next) {
+			if (chain->flags & EVBUFFER_HUGEPAGE) {
+				++n_huge;
+				tt_int_op((ev_uintptr_t)chain %
+				    (2*1024*1024), ==, 0);
+			}
+		}
+#ifdef MADV_HUGEPAGE
+		tt_int_op(n_huge, >=, 2);
+#endif
+
+		for (i = 0; i < 50; ++i) {
+			tt_int_op(evbuffer_remove(buf, out, 100000), ==,
+			    100000);
+			for (j = 0; j < 100000; ++j)
+				piece[j] = (unsigned char)(i + j);
+			tt_assert(!memcmp(out, piece, 100000));
+		}
+		evbuffer_validate(buf);
+	}
+
+	/* A single large request is rounded up to a multiple of 2 MiB. */
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+	tt_int_op(evbuffer_expand(buf, 3*1024*1024), ==, 0);
+	evbuffer_validate(buf);
+#ifdef MADV_HUGEPAGE
+	tt_assert(buf->last->flags & EVBUFFER_HUGEPAGE);
+	tt_int_op(buf->last->buffer_len + EVBUFFER_CHAIN_SIZE, ==,
+	    4*1024*1024);
+#endif
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	free(piece);
+	free(out);
+}
+
 static void
 test_evbuffer_add1(void *ptr)
 {
@@ -1184,6 +1579,496 @@ end:
 	}
 }
 
+struct file_reader_test {
+	evbuffer_file_reader_job_fn fns[64];
+	void *jobs[64];
+	int n_jobs;
+	int n_run;
+	int sync;
+	int n_done;
+	int result;
+	struct evbuffer *done_buf;
+};
+
+static int
+file_reader_test_submit(evbuffer_file_reader_job_fn fn, void *job, void *arg)
+{
+	struct file_reader_test *t = arg;
+
+	if (t->sync) {
+		fn(job);
+		return 0;
+	}
+	if (t->n_jobs == 64)
+		return -1;
+	t->fns[t->n_jobs] = fn;
+	t->jobs[t->n_jobs++] = job;
+	return 0;
+}
+
+/* Run the jobs that haven't run yet, most recent first. */
+static void
+file_reader_test_run_jobs(struct file_reader_test *t)
+{
+	int i;
+
+	for (i = t->n_jobs - 1; i >= t->n_run; --i)
+		t->fns[i](t->jobs[i]);
+	t->n_run = t->n_jobs;
+}
+
+static void
+file_reader_test_done(struct evbuffer *buf, int result, void *arg)
+{
+	struct file_reader_test *t = arg;
+
+	++t->n_done;
+	t->result = result;
+	t->done_buf = buf;
+}
+
+static void
+test_evbuffer_add_file_segment_async(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct event_base *base = testdata->base;
+	struct evbuffer_file_reader *reader = NULL;
+	struct evbuffer_file_segment *seg = NULL;
+	struct evbuffer *buf = NULL, *buf2 = NULL;
+	struct file_reader_test t, t2;
+	char *tmpfilename = NULL;
+	char data[10000], out[10000];
+	size_t got = 0, got2 = 0;
+	int fd = -1, i;
+
+	for (i = 0; i < (int)sizeof(data); ++i)
+		data[i] = 'a' + i % 23;
+	fd = regress_make_tmpfile(data, sizeof(data), &tmpfilename);
+	tt_int_op(fd, >=, 0);
+	seg = evbuffer_file_segment_new(fd, 0, -1, EVBUF_FS_CLOSE_ON_FREE);
+	tt_assert(seg);
+	fd = -1;
+
+	memset(&t, 0, sizeof(t));
+	reader = evbuffer_file_reader_new(base, file_reader_test_submit, &t,
+	    1000, 3, 0);
+	tt_assert(reader);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 100, 5000,
+		file_reader_test_done, &t), ==, 0);
+	/* Nothing else may be added while the file is on its way. */
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, -1);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, 1,
+		NULL, NULL), ==, -1);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, 10001,
+		NULL, NULL), ==, -1);
+
+	/* Only three windows may be read ahead... */
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 3);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+
+	/* ...and they are appended in order, whatever order they finish. */
+	file_reader_test_run_jobs(&t);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, 3000);
+	tt_int_op(t.n_jobs, ==, 3);
+
+	/* Draining a window makes room for the next one. */
+	tt_int_op(evbuffer_remove(buf, out, 1500), ==, 1500);
+	got = 1500;
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 4);
+
+	while (!t.n_done) {
+		file_reader_test_run_jobs(&t);
+		event_base_loop(base, EVLOOP_NONBLOCK);
+		got += evbuffer_remove(buf, out + got, sizeof(out) - got);
+		event_base_loop(base, EVLOOP_NONBLOCK);
+	}
+	tt_int_op(t.result, ==, 0);
+	tt_int_op(t.n_done, ==, 1);
+	tt_int_op(t.n_jobs, ==, 5);
+	tt_int_op(got, ==, 5000);
+	tt_int_op(memcmp(out, data + 100, 5000), ==, 0);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, 0);
+	evbuffer_drain(buf, 1);
+
+	/* Two buffers sharing a memory limit both make progress. */
+	evbuffer_file_reader_free(reader);
+	memset(&t, 0, sizeof(t));
+	memset(&t2, 0, sizeof(t2));
+	t.sync = 1;
+	reader = evbuffer_file_reader_new(base, file_reader_test_submit, &t,
+	    512, 0, 1024);
+	tt_assert(reader);
+	buf2 = evbuffer_new();
+	tt_assert(buf2);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, -1,
+		file_reader_test_done, &t), ==, 0);
+	tt_int_op(evbuffer_add_file_segment_async(buf2, reader, seg, 9000, -1,
+		file_reader_test_done, &t2), ==, 0);
+	got = got2 = 0;
+	while (t.n_done + t2.n_done < 2) {
+		event_base_loop(base, EVLOOP_NONBLOCK);
+		tt_int_op(evbuffer_get_length(buf) +
+		    evbuffer_get_length(buf2), <=, 1024);
+		got += evbuffer_remove(buf, out + got, sizeof(out) - got);
+		if (evbuffer_get_length(buf2)) {
+			tt_int_op(evbuffer_get_length(buf2), <=, 512);
+			got2 += evbuffer_drain(buf2, 512) == 0 ? 512 : 0;
+		}
+	}
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	got += evbuffer_remove(buf, out + got, sizeof(out) - got);
+	tt_int_op(t.result, ==, 0);
+	tt_int_op(t2.result, ==, 0);
+	tt_int_op(got, ==, 10000);
+	tt_int_op(got2, ==, 1024);
+	tt_int_op(memcmp(out, data, 10000), ==, 0);
+
+	/* Freeing the reader cancels what is in progress. */
+	evbuffer_file_reader_free(reader);
+	memset(&t, 0, sizeof(t));
+	reader = evbuffer_file_reader_new(base, file_reader_test_submit, &t,
+	    1000, 2, 0);
+	tt_assert(reader);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, -1,
+		file_reader_test_done, &t), ==, 0);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 2);
+	evbuffer_file_reader_free(reader);
+	reader = NULL;
+	tt_int_op(t.n_done, ==, 1);
+	tt_int_op(t.result, ==, -1);
+	file_reader_test_run_jobs(&t);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, 0);
+
+end:
+	if (reader)
+		evbuffer_file_reader_free(reader);
+	if (buf)
+		evbuffer_free(buf);
+	if (buf2)
+		evbuffer_free(buf2);
+	if (seg)
+		evbuffer_file_segment_free(seg);
+	if (fd >= 0)
+		evutil_closesocket(fd);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+}
+
+static void
+test_evbuffer_add_file_segment_async_free(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct event_base *base = testdata->base;
+	struct evbuffer_file_reader *reader = NULL;
+	struct evbuffer_file_segment *seg = NULL;
+	struct evbuffer *buf = NULL;
+	struct bufferevent *under = NULL, *filter = NULL;
+	struct file_reader_test t;
+	char *tmpfilename = NULL;
+	char data[10000];
+	int fd;
+
+	memset(data, 'x', sizeof(data));
+	fd = regress_make_tmpfile(data, sizeof(data), &tmpfilename);
+	tt_int_op(fd, >=, 0);
+	seg = evbuffer_file_segment_new(fd, 0, -1, EVBUF_FS_CLOSE_ON_FREE);
+	tt_assert(seg);
+
+	memset(&t, 0, sizeof(t));
+	reader = evbuffer_file_reader_new(base, file_reader_test_submit, &t,
+	    1000, 2, 0);
+	tt_assert(reader);
+
+	/* Freeing the buffer while its windows are being read cancels the
+	 * operation; the reads finish with nowhere to go. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, -1,
+		file_reader_test_done, &t), ==, 0);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 2);
+	evbuffer_free(buf);
+	buf = NULL;
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_done, ==, 1);
+	tt_int_op(t.result, ==, -1);
+	tt_ptr_op(t.done_buf, ==, NULL);
+	file_reader_test_run_jobs(&t);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 2);
+	/* Nothing holds on to the segment but us. */
+	tt_int_op(seg->refcnt, ==, 1);
+
+	/* So does freeing it with as many windows as we allow sitting in it,
+	 * when nothing else would ever wake the reader up. */
+	memset(&t, 0, sizeof(t));
+	t.sync = 1;
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, -1,
+		file_reader_test_done, &t), ==, 0);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(buf), ==, 2000);
+	tt_int_op(t.n_done, ==, 0);
+	evbuffer_free(buf);
+	buf = NULL;
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_done, ==, 1);
+	tt_int_op(t.result, ==, -1);
+	tt_ptr_op(t.done_buf, ==, NULL);
+	tt_int_op(seg->refcnt, ==, 1);
+
+	/* Freeing a bufferevent whose output we are adding to must not
+	 * leave us calling into it once it is gone. */
+	memset(&t, 0, sizeof(t));
+	under = bufferevent_socket_new(base, -1, 0);
+	tt_assert(under);
+	filter = bufferevent_filter_new(under, NULL, NULL,
+	    BEV_OPT_CLOSE_ON_FREE, NULL, NULL);
+	tt_assert(filter);
+	under = NULL;
+	tt_int_op(evbuffer_add_file_segment_async(bufferevent_get_output(filter),
+		reader, seg, 0, -1, file_reader_test_done, &t), ==, 0);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_jobs, ==, 2);
+	bufferevent_free(filter);
+	filter = NULL;
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	file_reader_test_run_jobs(&t);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_done, ==, 1);
+	tt_int_op(t.result, ==, -1);
+	tt_ptr_op(t.done_buf, ==, NULL);
+	tt_int_op(seg->refcnt, ==, 1);
+
+end:
+	if (filter)
+		bufferevent_free(filter);
+	if (under)
+		bufferevent_free(under);
+	if (reader)
+		evbuffer_file_reader_free(reader);
+	if (buf)
+		evbuffer_free(buf);
+	if (seg)
+		evbuffer_file_segment_free(seg);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+}
+
+static void
+test_evbuffer_add_file_segment_async_error(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct evbuffer_file_reader *reader = NULL;
+	struct evbuffer_file_segment *seg = NULL;
+	struct evbuffer *buf = NULL;
+	struct file_reader_test t;
+	char *tmpfilename = NULL;
+	int fd;
+
+	fd = regress_make_tmpfile("0123456789", 10, &tmpfilename);
+	tt_int_op(fd, >=, 0);
+	/* The segment claims more data than the file has. */
+	seg = evbuffer_file_segment_new(fd, 0, 4096, EVBUF_FS_CLOSE_ON_FREE);
+	if (!seg) {
+		close(fd);
+		tt_skip();
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.sync = 1;
+	reader = evbuffer_file_reader_new(testdata->base,
+	    file_reader_test_submit, &t, 8, 0, 0);
+	tt_assert(reader);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	tt_int_op(evbuffer_add_file_segment_async(buf, reader, seg, 0, -1,
+		file_reader_test_done, &t), ==, 0);
+	while (!t.n_done)
+		event_base_loop(testdata->base, EVLOOP_NONBLOCK);
+	tt_int_op(t.result, ==, -1);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, 0);
+
+end:
+	if (reader)
+		evbuffer_file_reader_free(reader);
+	if (buf)
+		evbuffer_free(buf);
+	if (seg)
+		evbuffer_file_segment_free(seg);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+}
+
+#ifndef _WIN32
+static void
+test_evbuffer_cork_file(void *ptr)
+{
+	struct evbuffer *buf = NULL;
+	char *tmpfilename = NULL;
+	char out[32];
+	int fd = -1;
+
+	fd = regress_make_tmpfile("", 0, &tmpfilename);
+	tt_int_op(fd, >=, 0);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	/* There is nothing to cork on a file; it is written all the same. */
+	evbuffer_set_flags(buf, EVBUFFER_FLAG_CORK);
+	evbuffer_add(buf, "corked ", 7);
+	evbuffer_add_reference(buf, "output", 6, NULL, NULL);
+	tt_int_op(evbuffer_write(buf, fd), ==, 13);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+
+	tt_int_op(lseek(fd, 0, SEEK_SET), ==, 0);
+	tt_int_op(read(fd, out, sizeof(out)), ==, 13);
+	tt_mem_op(out, ==, "corked output", 13);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (fd >= 0)
+		close(fd);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+}
+
+static int
+segcache_test_write(const char *path, const char *data)
+{
+	FILE *f = fopen(path, "wb");
+	size_t len = strlen(data);
+
+	if (!f)
+		return -1;
+	if (fwrite(data, 1, len, f) != len) {
+		fclose(f);
+		return -1;
+	}
+	return fclose(f);
+}
+
+/* Return the contents of 'seg' as a string, in a static buffer. */
+static const char *
+segcache_test_contents(struct evbuffer_file_segment *seg)
+{
+	static char out[64];
+	struct evbuffer *buf = evbuffer_new();
+	int n;
+
+	if (!buf)
+		return "";
+	evbuffer_add_file_segment(buf, seg, 0, -1);
+	n = evbuffer_remove(buf, out, sizeof(out) - 1);
+	out[n < 0 ? 0 : n] = '\0';
+	evbuffer_free(buf);
+	return out;
+}
+
+static void
+test_evbuffer_file_segment_cache(void *ptr)
+{
+	struct evbuffer_file_segment_cache *cache = NULL;
+	struct evbuffer_file_segment *a = NULL, *a2 = NULL, *b = NULL;
+	struct evbuffer_file_segment *c = NULL, *big = NULL;
+	char path[5][32];
+	int i, fd;
+
+	for (i = 0; i < 5; ++i) {
+		strcpy(path[i], "/tmp/eventtmp.XXXXXX");
+		fd = mkstemp(path[i]);
+		tt_int_op(fd, >=, 0);
+		close(fd);
+	}
+	tt_int_op(segcache_test_write(path[0], "hello world"), ==, 0);
+	tt_int_op(segcache_test_write(path[1], "0123456789"), ==, 0);
+	tt_int_op(segcache_test_write(path[2], "abcdefghijkl"), ==, 0);
+	tt_int_op(segcache_test_write(path[3],
+		"this file is too large to be cached"), ==, 0);
+
+	cache = evbuffer_file_segment_cache_new(30, 0, 0);
+	tt_assert(cache);
+
+	/* A second lookup returns the same segment. */
+	a = evbuffer_file_segment_cache_get(cache, path[0]);
+	tt_assert(a);
+	a2 = evbuffer_file_segment_cache_get(cache, path[0]);
+	tt_ptr_op(a, ==, a2);
+	tt_str_op(segcache_test_contents(a), ==, "hello world");
+	evbuffer_file_segment_free(a2);
+
+	/* Replacing the file makes us open it again; the old segment still
+	 * works for whoever holds it. */
+	tt_int_op(segcache_test_write(path[4], "hello there, world"), ==, 0);
+	tt_int_op(rename(path[4], path[0]), ==, 0);
+	a2 = evbuffer_file_segment_cache_get(cache, path[0]);
+	tt_assert(a2);
+	tt_ptr_op(a, !=, a2);
+	tt_str_op(segcache_test_contents(a2), ==, "hello there, world");
+	tt_str_op(segcache_test_contents(a), ==, "hello world");
+
+	/* 18 + 10 bytes fit; adding 12 more evicts the least recently used
+	 * file. */
+	b = evbuffer_file_segment_cache_get(cache, path[1]);
+	tt_assert(b);
+	c = evbuffer_file_segment_cache_get(cache, path[2]);
+	tt_assert(c);
+	tt_int_op(evbuffer_file_segment_cache_remove(cache, path[0]), ==, -1);
+	tt_int_op(evbuffer_file_segment_cache_remove(cache, path[1]), ==, 0);
+	tt_int_op(evbuffer_file_segment_cache_remove(cache, path[1]), ==, -1);
+	tt_str_op(segcache_test_contents(a2), ==, "hello there, world");
+
+	/* Files that are too large are served, but not cached. */
+	big = evbuffer_file_segment_cache_get(cache, path[3]);
+	tt_assert(big);
+	tt_int_op(evbuffer_file_segment_cache_remove(cache, path[3]), ==, -1);
+
+	tt_ptr_op(evbuffer_file_segment_cache_get(cache,
+		"/tmp/this/file/does/not/exist"), ==, NULL);
+
+	/* Segments outlive the cache. */
+	evbuffer_file_segment_cache_free(cache);
+	cache = NULL;
+	tt_str_op(segcache_test_contents(c), ==, "abcdefghijkl");
+
+end:
+	if (cache)
+		evbuffer_file_segment_cache_free(cache);
+	if (a)
+		evbuffer_file_segment_free(a);
+	if (a2)
+		evbuffer_file_segment_free(a2);
+	if (b)
+		evbuffer_file_segment_free(b);
+	if (c)
+		evbuffer_file_segment_free(c);
+	if (big)
+		evbuffer_file_segment_free(big);
+	for (i = 0; i < 5; ++i)
+		unlink(path[i]);
+}
+#endif
+
 #ifndef EVENT__DISABLE_MM_REPLACEMENT
 static void *
 failing_malloc(size_t how_much)
@@ -1643,6 +2528,77 @@ end:
 		evbuffer_free(buf);
 }
 
+static void
+test_evbuffer_ptr_set_index(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_ptr pos;
+	char tmp[16];
+	int i;
+
+	tt_assert(buf);
+	evbuffer_set_flags(buf, EVBUFFER_FLAG_CHAIN_INDEX);
+
+	/* 2000 chains of 7 bytes each: "0000000", "1111111", ... */
+	for (i = 0; i < 2000; ++i) {
+		static const char digits[] = "0123456789";
+		evbuffer_add_reference(buf, digits + i % 10, 1, NULL, NULL);
+		evbuffer_add(buf, "xxxxxx", 6);
+		if (i % 3 == 0)
+			evbuffer_add_reference(buf, "", 0, NULL, NULL);
+	}
+	evbuffer_validate(buf);
+
+	for (i = 1999; i >= 0; i -= 7) {
+		tt_assert(evbuffer_ptr_set(buf, &pos, i * 7, EVBUFFER_PTR_SET) == 0);
+		tt_int_op(pos.pos, ==, i * 7);
+		tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 2), ==, 2);
+		tt_int_op(tmp[0], ==, '0' + i % 10);
+		tt_int_op(tmp[1], ==, 'x');
+	}
+	tt_assert(evbuffer_ptr_set(buf, &pos, 14000, EVBUFFER_PTR_SET) == 0);
+	tt_assert(pos.internal_.chain == NULL);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 14001, EVBUFFER_PTR_SET) == -1);
+
+	/* Long jumps forward use the index too. */
+	tt_assert(evbuffer_ptr_set(buf, &pos, 3, EVBUFFER_PTR_SET) == 0);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 7 * 1500 - 3, EVBUFFER_PTR_ADD) == 0);
+	tt_int_op(pos.pos, ==, 7 * 1500);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 1), ==, 1);
+	tt_int_op(tmp[0], ==, '0');
+
+	/* Appending extends the index; draining and prepending reset it. */
+	evbuffer_add(buf, "yy", 2);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 14001, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 1), ==, 1);
+	tt_int_op(tmp[0], ==, 'y');
+
+	evbuffer_drain(buf, 7 * 1000 + 1);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 7 * 500, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 2), ==, 2);
+	tt_assert(!memcmp(tmp, "xx", 2));
+	tt_assert(evbuffer_ptr_set(buf, &pos, 7 * 500 - 1, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 1), ==, 1);
+	tt_int_op(tmp[0], ==, '0' + 1500 % 10);
+
+	evbuffer_prepend(buf, "abc", 3);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 7 * 500 + 2, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 1), ==, 1);
+	tt_int_op(tmp[0], ==, '0' + 1500 % 10);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 1, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 3), ==, 3);
+	tt_assert(!memcmp(tmp, "bcx", 3));
+
+	evbuffer_clear_flags(buf, EVBUFFER_FLAG_CHAIN_INDEX);
+	tt_assert(evbuffer_ptr_set(buf, &pos, 7 * 500 + 2, EVBUFFER_PTR_SET) == 0);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, 1), ==, 1);
+	tt_int_op(tmp[0], ==, '0' + 1500 % 10);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
 static void
 test_evbuffer_search(void *ptr)
 {
@@ -1730,6 +2686,112 @@ end:
 		evbuffer_free(tmp);
 }
 
+static void
+test_evbuffer_search_long(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_ptr pos, end;
+	const char *boundary = "--aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab";
+	const size_t blen = strlen(boundary);
+	char tmp[64];
+	int i;
+
+	tt_assert(buf);
+
+	/* Lots of near-misses, spread over many small chains. */
+	for (i = 0; i < 500; ++i) {
+		evbuffer_add_reference(buf, "--aaaaaaaaaa", 12, NULL, NULL);
+		evbuffer_add_reference(buf, "aaaaaaaaaa", 10, NULL, NULL);
+	}
+	/* The match straddles three chains. */
+	evbuffer_add_reference(buf, boundary, 5, NULL, NULL);
+	evbuffer_add_reference(buf, boundary + 5, 30, NULL, NULL);
+	evbuffer_add_reference(buf, boundary + 35, blen - 35, NULL, NULL);
+	evbuffer_add_reference(buf, "xyz", 3, NULL, NULL);
+	evbuffer_validate(buf);
+
+	pos = evbuffer_search(buf, boundary, blen, NULL);
+	tt_int_op(pos.pos, ==, 500 * 22);
+	tt_int_op(evbuffer_copyout_from(buf, &pos, tmp, blen), ==, blen);
+	tt_assert(!memcmp(tmp, boundary, blen));
+
+	/* Searching from the match finds it again; from one past, not. */
+	pos = evbuffer_search(buf, boundary, blen, &pos);
+	tt_int_op(pos.pos, ==, 500 * 22);
+	evbuffer_ptr_set(buf, &pos, 1, EVBUFFER_PTR_ADD);
+	pos = evbuffer_search(buf, boundary, blen, &pos);
+	tt_int_op(pos.pos, ==, -1);
+
+	/* The match must end before 'end'. */
+	evbuffer_ptr_set(buf, &end, 500 * 22 + blen - 1, EVBUFFER_PTR_SET);
+	pos = evbuffer_search_range(buf, boundary, blen, NULL, &end);
+	tt_int_op(pos.pos, ==, -1);
+	evbuffer_ptr_set(buf, &end, 500 * 22 + blen, EVBUFFER_PTR_SET);
+	pos = evbuffer_search_range(buf, boundary, blen, NULL, &end);
+	tt_int_op(pos.pos, ==, 500 * 22);
+
+	pos = evbuffer_search(buf, "--aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+	    blen + 1, NULL);
+	tt_int_op(pos.pos, ==, -1);
+	pos = evbuffer_search(buf, "aaaaaaaaaa--aa", 14, NULL);
+	tt_int_op(pos.pos, ==, 12);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+test_evbuffer_search_incremental(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_search_state *state;
+	struct evbuffer_ptr pos;
+
+	state = evbuffer_search_state_new("abcabd", 6);
+	tt_assert(buf);
+	tt_assert(state);
+
+	evbuffer_add(buf, "xxabcab", 7);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, -1);
+	/* The partial match "abcab" must survive until more data arrives. */
+	evbuffer_add(buf, "cabd", 4);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, 5);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, -1);
+
+	/* Overlapping matches are reported one after another. */
+	evbuffer_search_state_free(state);
+	state = evbuffer_search_state_new("aa", 2);
+	tt_assert(state);
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	evbuffer_add(buf, "aaa", 3);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, 0);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, 1);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, -1);
+
+	/* Draining is accounted for. */
+	evbuffer_drain(buf, 1);
+	evbuffer_search_state_drained(state, 1);
+	evbuffer_add(buf, "ba", 2);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, -1);
+	evbuffer_add(buf, "a", 1);
+	pos = evbuffer_search_incremental(buf, state);
+	tt_int_op(pos.pos, ==, 3);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (state)
+		evbuffer_search_state_free(state);
+}
+
 static void
 log_change_callback(struct evbuffer *buffer,
     const struct evbuffer_cb_info *cbinfo,
@@ -2029,6 +3091,85 @@ end:
 		evbuffer_free(buf2);
 }
 
+static void
+test_evbuffer_slice(void *ptr)
+{
+	const char chunk1[] = "If you have found the answer to such a problem";
+	const char chunk2[] = "you ought to write it up for publication";
+			  /* -- Knuth's "Notes on the Exercises" from TAOCP */
+	size_t len1 = strlen(chunk1), len2 = strlen(chunk2);
+	struct evbuffer *buf = NULL, *slice1 = NULL, *slice2 = NULL;
+	struct evbuffer_ptr pos;
+	struct evbuffer_iovec v[4];
+	char tmp[64];
+
+	buf = evbuffer_new();
+	tt_assert(buf);
+	evbuffer_add_reference(buf, chunk1, len1, NULL, NULL);
+	evbuffer_add_reference(buf, ", ", 2, NULL, NULL);
+	evbuffer_add_reference(buf, chunk2, len2, NULL, NULL);
+
+	/* "problem, you ought", spanning all three chains. */
+	tt_int_op(evbuffer_ptr_set(buf, &pos, len1 - 7, EVBUFFER_PTR_SET), ==, 0);
+	slice1 = evbuffer_slice(buf, &pos, 18);
+	tt_assert(slice1);
+	evbuffer_validate(slice1);
+	tt_int_op(evbuffer_get_length(slice1), ==, 18);
+	tt_int_op(evbuffer_peek(slice1, -1, NULL, v, 4), ==, 3);
+	tt_assert(v[0].iov_base == chunk1 + len1 - 7);
+	tt_int_op(evbuffer_copyout(slice1, tmp, sizeof(tmp)), ==, 18);
+	tt_int_op(memcmp(tmp, "problem, you ought", 18), ==, 0);
+
+	/* A slice of a slice points at the original memory. */
+	tt_int_op(evbuffer_ptr_set(slice1, &pos, 9, EVBUFFER_PTR_SET), ==, 0);
+	slice2 = evbuffer_slice(slice1, &pos, 9);
+	tt_assert(slice2);
+	evbuffer_validate(slice2);
+	tt_int_op(evbuffer_peek(slice2, -1, NULL, v, 4), ==, 1);
+	tt_assert(v[0].iov_base == chunk2);
+	tt_int_op(v[0].iov_len, ==, 9);
+
+	/* Slices survive the buffers they were taken from. */
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	evbuffer_free(buf);
+	buf = NULL;
+	evbuffer_free(slice1);
+	slice1 = NULL;
+	tt_int_op(evbuffer_remove(slice2, tmp, 3), ==, 3);
+	tt_int_op(memcmp(tmp, "you", 3), ==, 0);
+
+	/* Appending to a slice never writes into the shared memory. */
+	tt_int_op(evbuffer_add(slice2, "!", 1), ==, 0);
+	evbuffer_validate(slice2);
+	tt_int_op(evbuffer_copyout(slice2, tmp, sizeof(tmp)), ==, 7);
+	tt_int_op(memcmp(tmp, " ought!", 7), ==, 0);
+	tt_int_op(memcmp(chunk2, "you ought to", 12), ==, 0);
+
+	/* Ranges past the end are rejected; empty ones are fine. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	evbuffer_add(buf, chunk1, len1);
+	tt_assert(!evbuffer_slice(buf, NULL, len1 + 1));
+	tt_int_op(evbuffer_ptr_set(buf, &pos, 10, EVBUFFER_PTR_SET), ==, 0);
+	tt_assert(!evbuffer_slice(buf, &pos, len1 - 9));
+	tt_int_op(evbuffer_add_buffer_reference_range(buf, buf, NULL, 1), ==, -1);
+	slice1 = evbuffer_slice(buf, &pos, 0);
+	tt_assert(slice1);
+	tt_int_op(evbuffer_get_length(slice1), ==, 0);
+	tt_int_op(evbuffer_add_buffer_reference_range(slice1, buf, &pos,
+		len1 - 10), ==, 0);
+	tt_int_op(evbuffer_get_length(slice1), ==, len1 - 10);
+	evbuffer_validate(slice1);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (slice1)
+		evbuffer_free(slice1);
+	if (slice2)
+		evbuffer_free(slice2);
+}
+
 static void
 check_prepend(struct evbuffer *buffer,
     const struct evbuffer_cb_info *cbinfo,
@@ -2117,6 +3258,70 @@ end:
 
 }
 
+static void
+test_evbuffer_add_number(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer *expect = evbuffer_new();
+	static const ev_int64_t ints[] = {
+		0, 1, -1, 9, 10, -10, 123456789, -987654321,
+		EV_INT64_MAX, EV_INT64_MIN
+	};
+	char tmp[64];
+	size_t i;
+
+	tt_assert(buf);
+	tt_assert(expect);
+
+	for (i = 0; i < sizeof(ints)/sizeof(ints[0]); ++i) {
+		evutil_snprintf(tmp, sizeof(tmp), "%lld", (long long)ints[i]);
+		tt_int_op(evbuffer_add_int(buf, ints[i]), ==, strlen(tmp));
+		evbuffer_add_printf(expect, "%s|", tmp);
+		evbuffer_add(buf, "|", 1);
+	}
+
+	tt_int_op(evbuffer_add_uint(buf, 42, 0, ' '), ==, 2);
+	tt_int_op(evbuffer_add_uint(buf, 42, 5, ' '), ==, 5);
+	tt_int_op(evbuffer_add_uint(buf, 42, 5, '0'), ==, 5);
+	tt_int_op(evbuffer_add_uint(buf, 123456, 3, '0'), ==, 6);
+	tt_int_op(evbuffer_add_uint(buf, EV_UINT64_MAX, 0, ' '), ==, 20);
+	evbuffer_add_printf(expect, "42   4200042123456%llu",
+	    (unsigned long long)EV_UINT64_MAX);
+
+	tt_int_op(evbuffer_add_hex(buf, 0, 0, 0), ==, 1);
+	tt_int_op(evbuffer_add_hex(buf, 0xbeef, 0, 0), ==, 4);
+	tt_int_op(evbuffer_add_hex(buf, 0xa, 2, 1), ==, 2);
+	tt_int_op(evbuffer_add_hex(buf, EV_UINT64_MAX, 0, 1), ==, 16);
+	evbuffer_add_printf(expect, "0beef0AFFFFFFFFFFFFFFFF");
+
+	tt_int_op(evbuffer_add_string(buf, "Content-Length: "), ==, 16);
+	tt_int_op(evbuffer_add_string(buf, ""), ==, 0);
+	evbuffer_add_printf(expect, "Content-Length: ");
+
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, evbuffer_get_length(expect));
+	tt_assert(!memcmp(evbuffer_pullup(buf, -1), evbuffer_pullup(expect, -1),
+		evbuffer_get_length(buf)));
+
+	/* Padding can spill into a new chain. */
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	tt_int_op(evbuffer_add_uint(buf, 7, 5000, '0'), ==, 5000);
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, 5000);
+	tt_int_op(evbuffer_pullup(buf, -1)[0], ==, '0');
+	tt_int_op(evbuffer_pullup(buf, -1)[4999], ==, '7');
+
+	evbuffer_freeze(buf, 0);
+	tt_int_op(evbuffer_add_int(buf, 1), ==, -1);
+	tt_int_op(evbuffer_get_length(buf), ==, 5000);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (expect)
+		evbuffer_free(expect);
+}
+
 static void
 test_evbuffer_peek_first_gt(void *info)
 {
@@ -2264,6 +3469,352 @@ end:
 		evbuffer_free(tmp_buf);
 }
 
+static void
+test_evbuffer_cursor(void *info)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_cursor cursor;
+	static const char s1[] = "GET / HTTP/1.0\r\nHo";
+	static const char s2[] = "st: exam";
+	static const char s3[] = "ple.com\r\n\r\nxyz";
+	char spill[64];
+	const char *line;
+	const unsigned char *p;
+	size_t len;
+
+	tt_assert(buf);
+	/* Add by reference so that each piece gets its own chain. */
+	evbuffer_add_reference(buf, s1, strlen(s1), NULL, NULL);
+	evbuffer_add_reference(buf, s2, strlen(s2), NULL, NULL);
+	evbuffer_add_reference(buf, s3, strlen(s3), NULL, NULL);
+	tt_int_op(evbuffer_cursor_init(&cursor, buf), ==, 0);
+	tt_int_op(evbuffer_cursor_get_length(&cursor), ==, 40);
+
+	/* A line inside one chain comes back in place. */
+	line = evbuffer_cursor_readln(&cursor, &len, EVBUFFER_EOL_CRLF,
+	    spill, sizeof(spill));
+	tt_ptr_op(line, ==, s1);
+	tt_int_op(len, ==, 14);
+
+	/* A line that straddles chains needs a big enough spill buffer... */
+	line = evbuffer_cursor_readln(&cursor, &len, EVBUFFER_EOL_CRLF,
+	    spill, 8);
+	tt_ptr_op(line, ==, NULL);
+	tt_int_op(len, ==, 0);
+	line = evbuffer_cursor_readln(&cursor, &len, EVBUFFER_EOL_CRLF,
+	    spill, sizeof(spill));
+	tt_ptr_op(line, ==, spill);
+	tt_int_op(len, ==, 17);
+	tt_int_op(memcmp(line, "Host: example.com", 17), ==, 0);
+
+	line = evbuffer_cursor_readln(&cursor, &len, EVBUFFER_EOL_CRLF,
+	    spill, sizeof(spill));
+	tt_ptr_op(line, ==, s3 + 9);
+	tt_int_op(len, ==, 0);
+
+	/* No complete line left. */
+	tt_ptr_op(evbuffer_cursor_readln(&cursor, &len, EVBUFFER_EOL_CRLF,
+		spill, sizeof(spill)), ==, NULL);
+	p = evbuffer_cursor_peek(&cursor, &len);
+	tt_ptr_op(p, ==, s3 + 11);
+	tt_int_op(len, ==, 3);
+	tt_int_op(evbuffer_cursor_advance(&cursor, 4), ==, -1);
+	tt_int_op(evbuffer_cursor_advance(&cursor, 3), ==, 0);
+	tt_ptr_op(evbuffer_cursor_peek(&cursor, &len), ==, NULL);
+	tt_int_op(len, ==, 0);
+	tt_int_op(evbuffer_cursor_get_length(&cursor), ==, 0);
+	tt_assert(evbuffer_cursor_read(&cursor, 0, NULL) != NULL);
+	tt_ptr_op(evbuffer_cursor_read(&cursor, 1, spill), ==, NULL);
+
+	/* Fixed-size reads. */
+	tt_int_op(evbuffer_cursor_init(&cursor, buf), ==, 0);
+	tt_int_op(evbuffer_cursor_advance(&cursor, 16), ==, 0);
+	p = evbuffer_cursor_read(&cursor, 2, spill);
+	tt_ptr_op(p, ==, s1 + 16);
+	p = evbuffer_cursor_read(&cursor, 10, spill);
+	tt_ptr_op(p, ==, spill);
+	tt_int_op(memcmp(p, "st: exampl", 10), ==, 0);
+	p = evbuffer_cursor_peek(&cursor, &len);
+	tt_ptr_op(p, ==, s3 + 2);
+	tt_int_op(len, ==, strlen(s3) - 2);
+
+	/* Nothing is removed until we drain. */
+	tt_int_op(evbuffer_get_length(buf), ==, 40);
+	tt_int_op(evbuffer_cursor_drain(&cursor), ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, 12);
+	tt_int_op(evbuffer_cursor_get_length(&cursor), ==, 12);
+	p = evbuffer_cursor_peek(&cursor, &len);
+	tt_ptr_op(p, ==, s3 + 2);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+test_evbuffer_binary_fields(void *info)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer *split = evbuffer_new();
+	struct evbuffer_writer writer;
+	struct evbuffer_cursor cursor, peek;
+	const ev_uint64_t big = (((ev_uint64_t)0x01234567UL) << 32) | 0x89abcdefUL;
+	const ev_uint64_t max64 = ~(ev_uint64_t)0;
+	static const unsigned char bad_varint[11] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+	unsigned char *flat = NULL;
+	const unsigned char *p;
+	char blob[300], spill[300];
+	ev_uint8_t u8;
+	ev_uint16_t u16;
+	ev_uint32_t u32;
+	ev_uint64_t u64;
+	size_t len, i, total;
+
+	tt_assert(buf);
+	tt_assert(split);
+	for (i = 0; i < sizeof(blob); ++i)
+		blob[i] = (char)i;
+
+	/* The whole batch fits in the first reservation. */
+	evbuffer_writer_init(&writer, buf, 4);
+	tt_int_op(evbuffer_writer_add_u8(&writer, 0xfe), ==, 0);
+	tt_int_op(evbuffer_writer_add_u16be(&writer, 0x1234), ==, 0);
+	tt_int_op(evbuffer_writer_add_u16le(&writer, 0x1234), ==, 0);
+	tt_int_op(evbuffer_writer_add_u32be(&writer, 0xdeadbeef), ==, 0);
+	tt_int_op(evbuffer_writer_add_u32le(&writer, 0xdeadbeef), ==, 0);
+	tt_int_op(evbuffer_writer_add_u64be(&writer, big), ==, 0);
+	tt_int_op(evbuffer_writer_add_u64le(&writer, big), ==, 0);
+	tt_int_op(evbuffer_writer_add_varint(&writer, 0), ==, 0);
+	tt_int_op(evbuffer_writer_add_varint(&writer, 300), ==, 0);
+	tt_int_op(evbuffer_writer_add_varint(&writer, max64), ==, 0);
+	tt_int_op(evbuffer_writer_add_blob(&writer, blob, sizeof(blob)), ==, 0);
+	tt_int_op(evbuffer_writer_add(&writer, "xyz", 3), ==, 0);
+	/* Nothing shows up until we finish. */
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+	tt_int_op(evbuffer_writer_finish(&writer), ==, 0);
+	total = 1 + 2*2 + 4*2 + 8*2 + 1 + 2 + 10 + 2 + sizeof(blob) + 3;
+	tt_int_op(evbuffer_get_length(buf), ==, total);
+
+	flat = evbuffer_pullup(buf, -1);
+	tt_int_op(flat[1], ==, 0x12);
+	tt_int_op(flat[3], ==, 0x34);
+	tt_int_op(flat[30], ==, 0xac);	/* 300 = 0xac 0x02 */
+	tt_int_op(flat[31], ==, 0x02);
+
+	/* Read it all back through 3-byte chains, so that most fields
+	 * straddle a chain boundary. */
+	for (i = 0; i < total; i += 3)
+		evbuffer_add_reference(split, flat + i,
+		    total - i < 3 ? total - i : 3, NULL, NULL);
+	tt_int_op(evbuffer_cursor_init(&cursor, split), ==, 0);
+	tt_int_op(evbuffer_cursor_read_u8(&cursor, &u8), ==, 0);
+	tt_int_op(u8, ==, 0xfe);
+	/* Peeking through a copy leaves the cursor alone. */
+	peek = cursor;
+	tt_int_op(evbuffer_cursor_read_u16be(&peek, &u16), ==, 0);
+	tt_int_op(u16, ==, 0x1234);
+	tt_int_op(evbuffer_cursor_read_u16be(&cursor, &u16), ==, 0);
+	tt_int_op(u16, ==, 0x1234);
+	tt_int_op(evbuffer_cursor_read_u16le(&cursor, &u16), ==, 0);
+	tt_int_op(u16, ==, 0x1234);
+	tt_int_op(evbuffer_cursor_read_u32be(&cursor, &u32), ==, 0);
+	tt_int_op(u32, ==, 0xdeadbeef);
+	tt_int_op(evbuffer_cursor_read_u32le(&cursor, &u32), ==, 0);
+	tt_int_op(u32, ==, 0xdeadbeef);
+	tt_int_op(evbuffer_cursor_read_u64be(&cursor, &u64), ==, 0);
+	tt_assert(u64 == big);
+	tt_int_op(evbuffer_cursor_read_u64le(&cursor, &u64), ==, 0);
+	tt_assert(u64 == big);
+	tt_int_op(evbuffer_cursor_read_varint(&cursor, &u64), ==, 0);
+	tt_assert(u64 == 0);
+	tt_int_op(evbuffer_cursor_read_varint(&cursor, &u64), ==, 0);
+	tt_assert(u64 == 300);
+	tt_int_op(evbuffer_cursor_read_varint(&cursor, &u64), ==, 0);
+	tt_assert(u64 == max64);
+
+	/* The blob has to be copied, and needs a big enough spill. */
+	tt_ptr_op(evbuffer_cursor_read_blob(&cursor, &len, spill, 10), ==,
+	    NULL);
+	tt_int_op(len, ==, 0);
+	p = evbuffer_cursor_read_blob(&cursor, &len, spill, sizeof(spill));
+	tt_ptr_op(p, ==, spill);
+	tt_int_op(len, ==, sizeof(blob));
+	tt_int_op(memcmp(p, blob, sizeof(blob)), ==, 0);
+
+	/* Short reads fail without moving the cursor. */
+	tt_int_op(evbuffer_cursor_read_u32be(&cursor, &u32), ==, -1);
+	tt_int_op(evbuffer_cursor_read_u16be(&cursor, &u16), ==, 0);
+	tt_int_op(u16, ==, ('x' << 8) | 'y');
+	tt_int_op(evbuffer_cursor_read_u8(&cursor, &u8), ==, 0);
+	tt_int_op(u8, ==, 'z');
+	tt_int_op(evbuffer_cursor_read_u8(&cursor, &u8), ==, -1);
+	tt_int_op(evbuffer_cursor_drain(&cursor), ==, 0);
+	tt_int_op(evbuffer_get_length(split), ==, 0);
+
+	/* Incomplete and malformed varints and blobs. */
+	evbuffer_add(split, bad_varint, 5);
+	tt_int_op(evbuffer_cursor_init(&cursor, split), ==, 0);
+	tt_int_op(evbuffer_cursor_read_varint(&cursor, &u64), ==, -1);
+	evbuffer_add(split, bad_varint + 5, 6);
+	tt_int_op(evbuffer_cursor_read_varint(&cursor, &u64), ==, -2);
+	tt_int_op(evbuffer_cursor_get_length(&cursor), ==, 11);
+	evbuffer_drain(split, 11);
+	evbuffer_add(split, "\005abc", 4);
+	tt_int_op(evbuffer_cursor_init(&cursor, split), ==, 0);
+	tt_ptr_op(evbuffer_cursor_read_blob(&cursor, &len, spill,
+		sizeof(spill)), ==, NULL);
+	tt_int_op(evbuffer_cursor_get_length(&cursor), ==, 4);
+	evbuffer_add(split, "de", 2);
+	p = evbuffer_cursor_read_blob(&cursor, &len, spill, sizeof(spill));
+	tt_assert(p);
+	tt_int_op(len, ==, 5);
+	tt_int_op(memcmp(p, "abcde", 5), ==, 0);
+
+	/* A batch that outgrows its reservation commits what it has written
+	 * each time it reserves more. */
+	evbuffer_drain(split, evbuffer_get_length(split));
+	evbuffer_writer_init(&writer, split, 4);
+	for (i = 0; i < 20; ++i)
+		tt_int_op(evbuffer_writer_add(&writer, blob, sizeof(blob)), ==,
+		    0);
+	tt_int_op(evbuffer_get_length(split), >, 0);
+	tt_int_op(evbuffer_get_length(split), <, 20 * sizeof(blob));
+	tt_int_op(evbuffer_get_length(split) % sizeof(blob), ==, 0);
+	tt_int_op(evbuffer_writer_finish(&writer), ==, 0);
+	tt_int_op(evbuffer_get_length(split), ==, 20 * sizeof(blob));
+
+	/* A writer on a frozen buffer fails, and keeps failing. */
+	evbuffer_freeze(buf, 0);
+	evbuffer_writer_init(&writer, buf, 0);
+	tt_int_op(evbuffer_writer_add_u8(&writer, 1), ==, -1);
+	tt_int_op(evbuffer_writer_finish(&writer), ==, -1);
+	evbuffer_unfreeze(buf, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, total);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (split)
+		evbuffer_free(split);
+}
+
+static void
+test_evbuffer_crc32c_hash(void *info)
+{
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_file_segment *seg = NULL;
+	struct evbuffer_ptr pos;
+	static const char check[] = "123456789";
+	unsigned char data[1031];
+	const ev_uint64_t check_hash =
+	    (((ev_uint64_t)0x06d55739UL) << 32) | 0x23c6cdfcUL;
+	char *tmpfilename = NULL;
+	ev_uint64_t hash;
+	ev_uint32_t crc;
+	size_t i, off;
+	int fd;
+
+	tt_assert(buf);
+
+	/* The standard check values, with the string split across chains. */
+	evbuffer_add_reference(buf, check, 2, NULL, NULL);
+	evbuffer_add_reference(buf, check + 2, 5, NULL, NULL);
+	evbuffer_add_reference(buf, check + 7, 2, NULL, NULL);
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, -1, &crc), ==, 0);
+	tt_int_op(crc, ==, 0xe3069283);
+	hash = EVBUFFER_HASH64_INIT;
+	tt_int_op(evbuffer_hash64(buf, NULL, -1, &hash), ==, 0);
+	tt_assert(hash == check_hash);
+	/* Lengths past the end are clamped. */
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, 100, &crc), ==, 0);
+	tt_int_op(crc, ==, 0xe3069283);
+
+	/* Updating range by range gives the same answer. */
+	tt_int_op(evbuffer_ptr_set(buf, &pos, 3, EVBUFFER_PTR_SET), ==, 0);
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, 3, &crc), ==, 0);
+	tt_int_op(evbuffer_crc32c(buf, &pos, -1, &crc), ==, 0);
+	tt_int_op(crc, ==, 0xe3069283);
+	hash = EVBUFFER_HASH64_INIT;
+	tt_int_op(evbuffer_hash64(buf, NULL, 3, &hash), ==, 0);
+	tt_int_op(evbuffer_hash64(buf, &pos, 4, &hash), ==, 0);
+	tt_int_op(evbuffer_ptr_set(buf, &pos, 4, EVBUFFER_PTR_ADD), ==, 0);
+	tt_int_op(evbuffer_hash64(buf, &pos, -1, &hash), ==, 0);
+	tt_assert(hash == check_hash);
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, -1, &crc), ==, 0);
+	tt_int_op(crc, ==, 0);
+
+	/* The crc32 instruction and the table agree at every alignment. */
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (unsigned char)(i * 7 + (i >> 3));
+	for (off = 0; off < 16; ++off) {
+		for (i = 0; i < 40; i += 3) {
+			tt_int_op(evbuffer_crc32c_update_(0, data + off, i), ==,
+			    evbuffer_crc32c_sw_(0, data + off, i));
+		}
+		tt_int_op(
+		    evbuffer_crc32c_update_(0, data + off, sizeof(data) - off),
+		    ==, evbuffer_crc32c_sw_(0, data + off, sizeof(data) - off));
+	}
+
+	/* Across many chains of odd sizes. */
+	for (i = 0; i < sizeof(data); i += 97) {
+		size_t n = sizeof(data) - i < 97 ? sizeof(data) - i : 97;
+		evbuffer_add_reference(buf, data + i, n, NULL, NULL);
+	}
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, -1, &crc), ==, 0);
+	tt_int_op(crc, ==, evbuffer_crc32c_sw_(0, data, sizeof(data)));
+	tt_int_op(evbuffer_ptr_set(buf, &pos, 500, EVBUFFER_PTR_SET), ==, 0);
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, &pos, 300, &crc), ==, 0);
+	tt_int_op(crc, ==, evbuffer_crc32c_sw_(0, data + 500, 300));
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+
+	/* Data that will go out with sendfile() is not there to read. */
+	fd = regress_make_tmpfile(check, 9, &tmpfilename);
+	tt_int_op(fd, >=, 0);
+	seg = evbuffer_file_segment_new(fd, 0, -1,
+	    EVBUF_FS_DISABLE_MMAP|EVBUF_FS_CLOSE_ON_FREE);
+	tt_assert(seg);
+	evbuffer_set_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
+	evbuffer_add(buf, check, 9);
+	tt_int_op(evbuffer_add_file_segment(buf, seg, 0, -1), ==, 0);
+	crc = 0;
+	tt_int_op(evbuffer_crc32c(buf, NULL, 9, &crc), ==, 0);
+	tt_int_op(crc, ==, 0xe3069283);
+	hash = EVBUFFER_HASH64_INIT;
+	if (buf->last->flags & EVBUFFER_SENDFILE) {
+		tt_int_op(evbuffer_crc32c(buf, NULL, -1, &crc), ==, -1);
+		tt_int_op(crc, ==, 0xe3069283);
+		tt_int_op(evbuffer_ptr_set(buf, &pos, 9, EVBUFFER_PTR_SET),
+		    ==, 0);
+		tt_int_op(evbuffer_hash64(buf, &pos, 1, &hash), ==, -1);
+		tt_assert(hash == EVBUFFER_HASH64_INIT);
+	} else {
+		/* Without sendfile(), the file was read into memory. */
+		tt_int_op(evbuffer_ptr_set(buf, &pos, 9, EVBUFFER_PTR_SET),
+		    ==, 0);
+		tt_int_op(evbuffer_hash64(buf, &pos, -1, &hash), ==, 0);
+		tt_assert(hash == check_hash);
+	}
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (seg)
+		evbuffer_file_segment_free(seg);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+}
+
 /* Check whether evbuffer freezing works right.  This is called twice,
    once with the argument "start" and once with the argument "end".
    When we test "start", we freeze the start of an evbuffer and make sure
@@ -2512,6 +4063,12 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "reserve_many3", test_evbuffer_reserve_many, 0, &nil_setup, (void*)"fill" },
 	{ "expand", test_evbuffer_expand, 0, NULL, NULL },
 	{ "expand_overflow", test_evbuffer_expand_overflow, 0, NULL, NULL },
+	{ "hugepages", test_evbuffer_hugepages, 0, NULL, NULL },
+	{ "memory_usage", test_evbuffer_memory_usage, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+	{ "compaction", test_evbuffer_compaction, 0, NULL, NULL },
+	{ "ring", test_evbuffer_ring, TT_FORK|TT_NEED_SOCKETPAIR,
+	  &basic_setup, NULL },
 	{ "add1", test_evbuffer_add1, 0, NULL, NULL },
 	{ "add2", test_evbuffer_add2, 0, NULL, NULL },
 	{ "reference", test_evbuffer_reference, 0, NULL, NULL },
@@ -2521,17 +4078,38 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "search_eol", test_evbuffer_search_eol, 0, NULL, NULL },
 	{ "find", test_evbuffer_find, 0, NULL, NULL },
 	{ "ptr_set", test_evbuffer_ptr_set, 0, NULL, NULL },
+	{ "ptr_set_index", test_evbuffer_ptr_set_index, 0, NULL, NULL },
 	{ "search", test_evbuffer_search, 0, NULL, NULL },
+	{ "search_long", test_evbuffer_search_long, 0, NULL, NULL },
+	{ "search_incremental", test_evbuffer_search_incremental, 0, NULL, NULL },
 	{ "callbacks", test_evbuffer_callbacks, 0, NULL, NULL },
 	{ "add_reference", test_evbuffer_add_reference, 0, NULL, NULL },
 	{ "multicast", test_evbuffer_multicast, 0, NULL, NULL },
 	{ "multicast_drain", test_evbuffer_multicast_drain, 0, NULL, NULL },
+	{ "slice", test_evbuffer_slice, 0, NULL, NULL },
+	{ "add_file_segment_async", test_evbuffer_add_file_segment_async,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "add_file_segment_async_error",
+	  test_evbuffer_add_file_segment_async_error,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "add_file_segment_async_free",
+	  test_evbuffer_add_file_segment_async_free,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+#ifndef _WIN32
+	{ "file_segment_cache", test_evbuffer_file_segment_cache, TT_FORK,
+	  NULL, NULL },
+	{ "cork_file", test_evbuffer_cork_file, 0, NULL, NULL },
+#endif
 	{ "prepend", test_evbuffer_prepend, TT_FORK, NULL, NULL },
 	{ "peek", test_evbuffer_peek, 0, NULL, NULL },
+	{ "cursor", test_evbuffer_cursor, 0, NULL, NULL },
+	{ "binary_fields", test_evbuffer_binary_fields, 0, NULL, NULL },
+	{ "crc32c_hash", test_evbuffer_crc32c_hash, 0, NULL, NULL },
 	{ "peek_first_gt", test_evbuffer_peek_first_gt, 0, NULL, NULL },
 	{ "freeze_start", test_evbuffer_freeze, 0, &nil_setup, (void*)"start" },
 	{ "freeze_end", test_evbuffer_freeze, 0, &nil_setup, (void*)"end" },
 	{ "add_iovec", test_evbuffer_add_iovec, 0, NULL, NULL},
+	{ "add_number", test_evbuffer_add_number, 0, NULL, NULL},
 	{ "copyout", test_evbuffer_copyout, 0, NULL, NULL},
 	{ "file_segment_add_cleanup_cb", test_evbuffer_file_segment_add_cleanup_cb, 0, NULL, NULL },
 
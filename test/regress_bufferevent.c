@@ -944,7 +944,7 @@ test_bufferevent_timeouts(void *arg)
 	/* "arg" is a string containing "pair" and/or "filter". */
 	struct bufferevent *bev1 = NULL, *bev2 = NULL;
 	struct basic_test_data *data = arg;
-	int use_pair = 0, use_filter = 0;
+	int use_pair = 0, use_filter = 0, options = 0;
 	struct timeval tv_w, tv_r, started_at;
 	struct timeout_cb_result res1, res2;
 	char buf[1024];
@@ -956,6 +956,8 @@ test_bufferevent_timeouts(void *arg)
 		use_pair = 1;
 	if (strstr((char*)data->setup_data, "filter"))
 		use_filter = 1;
+	if (strstr((char*)data->setup_data, "lazy"))
+		options = BEV_OPT_LAZY_TIMEOUTS;
 
 	if (use_pair) {
 		struct bufferevent *p[2];
@@ -963,8 +965,10 @@ test_bufferevent_timeouts(void *arg)
 		bev1 = p[0];
 		bev2 = p[1];
 	} else {
-		bev1 = bufferevent_socket_new(data->base, data->pair[0], 0);
-		bev2 = bufferevent_socket_new(data->base, data->pair[1], 0);
+		bev1 = bufferevent_socket_new(data->base, data->pair[0],
+		    options);
+		bev2 = bufferevent_socket_new(data->base, data->pair[1],
+		    options);
 	}
 
 	tt_assert(bev1);
@@ -1046,6 +1050,94 @@ end:
 		bufferevent_free(bev2);
 }
 
+struct lazy_timeout_info {
+	struct timeout_cb_result res;
+	struct timeval last_sent_at;
+	evutil_socket_t fd;
+	struct event *ev;
+	int n_sent;
+	size_t got;
+};
+
+static void
+lazy_timeout_send_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct lazy_timeout_info *info = arg;
+
+	if (send(info->fd, "x", 1, 0) == 1)
+		++info->n_sent;
+	evutil_gettimeofday(&info->last_sent_at, NULL);
+	if (info->n_sent == 8)
+		event_del(info->ev);
+}
+
+static void
+lazy_timeout_readcb(struct bufferevent *bev, void *arg)
+{
+	struct lazy_timeout_info *info = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	info->got += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+}
+
+static void
+lazy_timeout_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct lazy_timeout_info *info = arg;
+
+	bev_timeout_event_cb(bev, what, &info->res);
+}
+
+static void
+test_bufferevent_lazy_timeout_reset(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	struct event *ev = NULL;
+	struct lazy_timeout_info info;
+	struct timeval tv_r = { 0, 200*1000 };
+	struct timeval tv_send = { 0, 50*1000 };
+	struct timeval tv_exit = { 0, 900*1000 };
+
+	memset(&info, 0, sizeof(info));
+	info.fd = data->pair[1];
+
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_LAZY_TIMEOUTS);
+	tt_assert(bev);
+	bufferevent_setcb(bev, lazy_timeout_readcb, NULL,
+	    lazy_timeout_eventcb, &info);
+	tt_assert(!bufferevent_set_timeouts(bev, &tv_r, NULL));
+	tt_assert(!bufferevent_enable(bev, EV_READ));
+	/* The read event itself carries no timeout. */
+	tt_assert(event_pending(&bev->ev_read, EV_READ, NULL));
+	tt_assert(!event_pending(&bev->ev_read, EV_TIMEOUT, NULL));
+
+	/* A byte every 50 msec for 400 msec keeps a 200 msec timeout from
+	 * going off until 200 msec after the last one. */
+	ev = event_new(data->base, -1, EV_PERSIST, lazy_timeout_send_cb,
+	    &info);
+	tt_assert(ev);
+	info.ev = ev;
+	tt_assert(!event_add(ev, &tv_send));
+	event_base_loopexit(data->base, &tv_exit);
+	event_base_dispatch(data->base);
+
+	tt_int_op(info.n_sent, ==, 8);
+	tt_int_op(info.got, ==, 8);
+	tt_int_op(info.res.n_read_timeouts, ==, 1);
+	tt_int_op(info.res.total_calls, ==, 1);
+	test_timeval_diff_eq(&info.last_sent_at, &info.res.read_timeout_at,
+	    200);
+
+end:
+	if (ev)
+		event_free(ev);
+	if (bev)
+		bufferevent_free(bev);
+}
+
 static void
 trigger_failure_cb(evutil_socket_t fd, short what, void *ctx)
 {
@@ -1227,6 +1319,264 @@ end:
 		bufferevent_free(bev2);
 }
 
+static void
+test_bufferevent_cork(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	char buf[64];
+	ev_ssize_t n;
+	size_t got = 0;
+	int i;
+
+	bev = bufferevent_socket_new(data->base, data->pair[0], 0);
+	tt_assert(bev);
+	tt_assert(!bufferevent_enable(bev, EV_WRITE));
+
+	/* Corked output is still written, one piece per loop iteration. */
+	tt_int_op(bufferevent_socket_cork(bev), ==, 0);
+	tt_int_op(bufferevent_socket_cork(bev), ==, 0);
+	for (i = 0; i < 3; ++i) {
+		tt_assert(!bufferevent_write(bev, "abc" + i, 1));
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+		tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)),
+		    ==, 0);
+	}
+
+	/* Flushing uncorks; uncorking twice is harmless. */
+	tt_assert(!bufferevent_write(bev, "def", 3));
+	tt_int_op(bufferevent_flush(bev, EV_WRITE, BEV_FLUSH), ==, 0);
+	tt_int_op(bufferevent_socket_uncork(bev), ==, 0);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+
+	while (got < 6) {
+		n = recv(data->pair[1], buf + got, sizeof(buf) - got, 0);
+		tt_int_op(n, >, 0);
+		got += n;
+	}
+	tt_int_op(got, ==, 6);
+	tt_mem_op(buf, ==, "abcdef", 6);
+
+	/* Only socket bufferevents can be corked. */
+	tt_assert(!bufferevent_pair_new(data->base, 0, pair));
+	tt_int_op(bufferevent_socket_cork(pair[0]), ==, -1);
+	tt_int_op(bufferevent_socket_uncork(pair[0]), ==, -1);
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+}
+
+static void
+cork_tcp_accept_cb(struct evconnlistener *lev, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *arg)
+{
+	evutil_socket_t *fdp = arg;
+
+	*fdp = fd;
+}
+
+/* Read what arrives on 'fd' into 'out' until we have 'len' bytes or 100
+ * msec have passed, which is well before the kernel would send corked
+ * data on its own.  Return how much we got. */
+static size_t
+cork_tcp_recv(struct event_base *base, evutil_socket_t fd, char *out,
+    size_t len)
+{
+	struct timeval start, now, tick = { 0, 5*1000 };
+	size_t got = 0;
+	ev_ssize_t n;
+
+	evutil_gettimeofday(&start, NULL);
+	for (;;) {
+		n = recv(fd, out + got, len - got, 0);
+		if (n > 0)
+			got += n;
+		else if (n == 0 ||
+		    !EVUTIL_ERR_RW_RETRIABLE(EVUTIL_SOCKET_ERROR()))
+			break;
+		evutil_gettimeofday(&now, NULL);
+		if (got == len || timeval_msec_diff(&start, &now) >= 100)
+			break;
+		event_base_loopexit(base, &tick);
+		event_base_dispatch(base);
+	}
+	return got;
+}
+
+static void
+test_bufferevent_cork_tcp(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evconnlistener *lev = NULL;
+	struct bufferevent *bev = NULL;
+	struct sockaddr_in localhost;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	evutil_socket_t fd = -1;
+	char buf[64];
+
+	memset(&localhost, 0, sizeof(localhost));
+	localhost.sin_addr.s_addr = htonl(0x7f000001L);
+	localhost.sin_family = AF_INET;
+	lev = evconnlistener_new_bind(data->base, cork_tcp_accept_cb, &fd,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, 16,
+	    (struct sockaddr *)&localhost, sizeof(localhost));
+	tt_assert(lev);
+	if (regress_get_listener_addr(lev, (struct sockaddr *)&ss, &slen) < 0)
+		tt_abort_perror("getsockname");
+
+	bev = bufferevent_socket_new(data->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev);
+	tt_assert(!bufferevent_socket_connect(bev, (struct sockaddr *)&ss,
+		slen));
+	while (fd < 0)
+		event_base_loop(data->base, EVLOOP_ONCE);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+
+	/* Small corked writes go out, but the kernel holds them back. */
+	tt_int_op(bufferevent_socket_cork(bev), ==, 0);
+	tt_assert(!bufferevent_write(bev, "abc", 3));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(!bufferevent_write(bev, "def", 3));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+#ifdef MSG_MORE
+	tt_int_op(recv(fd, buf, sizeof(buf), 0), ==, -1);
+#endif
+
+	/* Uncorking with nothing left to write sends the tail at once. */
+	tt_int_op(bufferevent_socket_uncork(bev), ==, 0);
+	tt_int_op(cork_tcp_recv(data->base, fd, buf, 6), ==, 6);
+	tt_mem_op(buf, ==, "abcdef", 6);
+
+	/* So does flushing with more output still queued. */
+	tt_int_op(bufferevent_socket_cork(bev), ==, 0);
+	tt_assert(!bufferevent_write(bev, "ghi", 3));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(!bufferevent_write(bev, "jkl", 3));
+	tt_int_op(bufferevent_flush(bev, EV_WRITE, BEV_FINISHED), ==, 0);
+	tt_int_op(cork_tcp_recv(data->base, fd, buf, 6), ==, 6);
+	tt_mem_op(buf, ==, "ghijkl", 6);
+
+	/* ...even if what is still queued never goes out after it. */
+	tt_int_op(bufferevent_socket_cork(bev), ==, 0);
+	tt_assert(!bufferevent_write(bev, "mno", 3));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(!bufferevent_write(bev, "pqr", 3));
+	tt_int_op(bufferevent_socket_uncork(bev), ==, 0);
+	tt_assert(!bufferevent_disable(bev, EV_WRITE));
+	tt_int_op(cork_tcp_recv(data->base, fd, buf, 3), ==, 3);
+	tt_mem_op(buf, ==, "mno", 3);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 3);
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	if (fd >= 0)
+		evutil_closesocket(fd);
+	if (lev)
+		evconnlistener_free(lev);
+}
+
+static int budget_n_reports;
+static int budget_last_over;
+
+static void
+budget_report_cb(struct event_base *base, size_t allocated, int over,
+    void *arg)
+{
+	++budget_n_reports;
+	budget_last_over = over;
+}
+
+static void
+budget_loop(struct event_base *base)
+{
+	struct timeval tv = { 0, 200*1000 };
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+}
+
+static void
+test_bufferevent_budget(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *writer = NULL, *reader = NULL;
+	struct evbuffer *input;
+	char buf[10000];
+	struct evbuffer_memory_usage totals;
+	size_t n_buffers, n_read;
+	int options = 0;
+
+	if (data->setup_data && strstr((char *)data->setup_data, "ts"))
+		options |= BEV_OPT_THREADSAFE;
+	writer = bufferevent_socket_new(data->base, data->pair[0], options);
+	reader = bufferevent_socket_new(data->base, data->pair[1], options);
+	tt_assert(writer && reader);
+	input = bufferevent_get_input(reader);
+	event_base_get_evbuffer_totals(data->base, &totals, &n_buffers);
+	tt_int_op(totals.payload, ==, 0);
+	tt_int_op(n_buffers, ==, 4);
+
+	tt_int_op(event_base_set_evbuffer_budget(data->base, 4096,
+		EVBUFFER_BUDGET_SUSPEND_READ, budget_report_cb, NULL), ==, 0);
+	tt_int_op(bufferevent_set_max_single_read(reader, 500), ==, 0);
+	memset(buf, 'x', sizeof(buf));
+	tt_assert(!bufferevent_write(writer, buf, sizeof(buf)));
+	event_base_get_evbuffer_totals(data->base, &totals, NULL);
+	tt_int_op(totals.payload, ==, sizeof(buf));
+	tt_int_op(totals.allocated, >, sizeof(buf));
+	bufferevent_enable(reader, EV_READ);
+
+	/* Once the writer has flushed its output, the reader reads until the
+	 * budget is exceeded again.  The budget counts the whole of each
+	 * chain it reads into, so it stops short of 4096 bytes of data. */
+	budget_loop(data->base);
+	n_read = evbuffer_get_length(input);
+	tt_int_op(n_read, >, 0);
+	tt_int_op(n_read, <, 4096);
+	tt_int_op(budget_last_over, ==, 1);
+	event_base_get_evbuffer_totals(data->base, &totals, NULL);
+	tt_int_op(totals.payload, ==, n_read);
+	tt_int_op(totals.allocated, >, 4096);
+
+	/* Draining the input lets the reader continue. */
+	evbuffer_drain(input, n_read);
+	budget_loop(data->base);
+	tt_int_op(evbuffer_get_length(input), >, 0);
+	tt_int_op(evbuffer_get_length(input), <, sizeof(buf) - n_read);
+
+	/* Removing the budget lets it read the rest. */
+	tt_int_op(event_base_set_evbuffer_budget(data->base, 0, 0, NULL, NULL),
+	    ==, 0);
+	budget_loop(data->base);
+	tt_int_op(evbuffer_get_length(input), ==, sizeof(buf) - n_read);
+	tt_int_op(budget_n_reports, >=, 2);
+
+	bufferevent_free(reader);
+	reader = NULL;
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	event_base_get_evbuffer_totals(data->base, &totals, &n_buffers);
+	tt_int_op(totals.payload, ==, 0);
+	tt_int_op(totals.allocated, ==, 0);
+	tt_int_op(totals.n_chains, ==, 0);
+	tt_int_op(n_buffers, ==, 2);
+
+end:
+	if (writer)
+		bufferevent_free(writer);
+	if (reader)
+		bufferevent_free(reader);
+}
+
 struct bufferevent_filter_data_stuck {
 	size_t header_size;
 	size_t total_read;
@@ -1327,6 +1677,713 @@ end:
 		bufferevent_free(filter);
 }
 
+static int write_through_n_writecb;
+
+static void
+write_through_writecb(struct bufferevent *bev, void *arg)
+{
+	++write_through_n_writecb;
+}
+
+static void
+test_bufferevent_write_through(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	char *big = NULL;
+	char buf[4096];
+	const size_t big_len = 8 << 20;
+	size_t got = 0;
+	ev_ssize_t n;
+
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_WRITE_THROUGH);
+	tt_assert(bev);
+	bufferevent_setcb(bev, NULL, write_through_writecb, NULL, NULL);
+	/* Socket bufferevents start out with writing enabled. */
+	tt_assert(bufferevent_get_enabled(bev) & EV_WRITE);
+
+	/* Writes made together go out together, without EV_WRITE. */
+	tt_assert(!bufferevent_write(bev, "abc", 3));
+	tt_assert(!bufferevent_write(bev, "def", 3));
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+	tt_int_op(write_through_n_writecb, ==, 1);
+	while (got < 6) {
+		n = recv(data->pair[1], buf + got, sizeof(buf) - got, 0);
+		tt_int_op(n, >, 0);
+		got += n;
+	}
+	tt_int_op(got, ==, 6);
+	tt_mem_op(buf, ==, "abcdef", 6);
+
+	/* What the kernel won't take waits for EV_WRITE. */
+	big = calloc(1, big_len);
+	tt_assert(big);
+	tt_assert(!bufferevent_write(bev, big, big_len));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), >, 0);
+	tt_assert(event_pending(&bev->ev_write, EV_WRITE, NULL));
+	got = 0;
+	while (got < big_len) {
+		n = recv(data->pair[1], buf, sizeof(buf), 0);
+		if (n > 0) {
+			got += n;
+			continue;
+		}
+		tt_assert(n < 0 &&
+		    EVUTIL_ERR_RW_RETRIABLE(evutil_socket_geterror(data->pair[1])));
+		event_base_loop(data->base, EVLOOP_ONCE);
+	}
+	tt_int_op(got, ==, big_len);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+
+	/* Nothing is written while writing is disabled. */
+	tt_assert(!bufferevent_disable(bev, EV_WRITE));
+	tt_assert(!bufferevent_write(bev, "ghi", 3));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 3);
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	free(big);
+}
+
+struct read_budget_info {
+	size_t got;
+	size_t most;
+	int n_readcb;
+	int eof;
+};
+
+static void
+read_budget_readcb(struct bufferevent *bev, void *arg)
+{
+	struct read_budget_info *info = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	size_t len = evbuffer_get_length(input);
+
+	++info->n_readcb;
+	info->got += len;
+	if (len > info->most)
+		info->most = len;
+	evbuffer_drain(input, len);
+}
+
+static void
+read_budget_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct read_budget_info *info = arg;
+
+	if (what & BEV_EVENT_EOF) {
+		info->eof = 1;
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+	}
+}
+
+static void
+test_bufferevent_read_budget(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	struct read_budget_info info;
+	struct timeval tv = { 10, 0 };
+	char buf[4096];
+	size_t sent = 0;
+	ev_ssize_t n;
+
+	memset(&info, 0, sizeof(info));
+	memset(buf, 'x', sizeof(buf));
+
+	/* Queue up as much as the socket will hold, then hang up. */
+	evutil_make_socket_nonblocking(data->pair[1]);
+	while ((n = send(data->pair[1], buf, sizeof(buf), 0)) > 0)
+		sent += n;
+	tt_assert(sent > 32768);
+	evutil_closesocket(data->pair[1]);
+	data->pair[1] = -1;
+
+	/* Edge-triggered, we are told about all of that once.  Everything
+	 * still has to arrive, a budget's worth per callback. */
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_EDGE_TRIGGERED);
+	tt_assert(bev);
+	tt_assert(!bufferevent_set_max_single_read(bev, 1024));
+	tt_assert(!bufferevent_set_read_budget(bev, 8192, 100));
+	bufferevent_setcb(bev, read_budget_readcb, NULL, read_budget_eventcb,
+	    &info);
+	tt_assert(!bufferevent_enable(bev, EV_READ));
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_assert(info.eof);
+	tt_int_op(info.got, ==, sent);
+	tt_int_op(info.most, <=, 8192);
+	tt_int_op(info.n_readcb, >=, (int)(sent / 8192));
+	/* ...and several reads go to each of them. */
+	tt_int_op(info.n_readcb, <, (int)(sent / 1024));
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+}
+
+struct pool_test_info {
+	evutil_socket_t accepted[8];
+	int n_accepted;
+	int n_connected;
+	int want_connected;
+};
+
+static void
+pool_test_accept_cb(struct evconnlistener *lev, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *arg)
+{
+	struct pool_test_info *info = arg;
+
+	if (info->n_accepted < (int)(sizeof(info->accepted) / sizeof(info->accepted[0])))
+		info->accepted[info->n_accepted++] = fd;
+	else
+		evutil_closesocket(fd);
+}
+
+static void
+pool_test_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct pool_test_info *info = arg;
+
+	if ((what & BEV_EVENT_CONNECTED) &&
+	    ++info->n_connected == info->want_connected)
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+}
+
+/* Run the loop until the pool has no idle connections, or for at most
+ * five seconds. */
+static void
+pool_test_wait_idle_gone(struct event_base *base,
+    struct bufferevent_pool *pool)
+{
+	struct bufferevent_pool_stats stats;
+	struct timeval tv = { 5, 0 };
+
+	event_base_loopexit(base, &tv);
+	do {
+		event_base_loop(base, EVLOOP_ONCE);
+		bufferevent_pool_get_stats(pool, &stats);
+	} while (stats.n_idle && !event_base_got_exit(base));
+}
+
+static void
+test_bufferevent_pool(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evconnlistener *lev = NULL;
+	struct bufferevent_pool *pool = NULL;
+	struct bufferevent *bev1 = NULL, *bev2 = NULL, *bev3 = NULL;
+	struct bufferevent_pool_stats stats;
+	struct pool_test_info info;
+	struct sockaddr_in localhost;
+	struct sockaddr_storage ss;
+	struct sockaddr *sa;
+	struct timeval tv = { 5, 0 }, idle = { 0, 50*1000 };
+	ev_socklen_t slen;
+	int tag, i;
+
+	memset(&info, 0, sizeof(info));
+	memset(&localhost, 0, sizeof(localhost));
+	localhost.sin_addr.s_addr = htonl(0x7f000001L);
+	localhost.sin_family = AF_INET;
+	lev = evconnlistener_new_bind(data->base, pool_test_accept_cb, &info,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, 16,
+	    (struct sockaddr *)&localhost, sizeof(localhost));
+	tt_assert(lev);
+	sa = (struct sockaddr *)&ss;
+	slen = sizeof(ss);
+	if (regress_get_listener_addr(lev, sa, &slen) < 0)
+		tt_abort_perror("getsockname");
+
+	pool = bufferevent_pool_new(data->base, 2, NULL, NULL, NULL);
+	tt_assert(pool);
+
+	/* Two connections to one destination, and no more. */
+	bev1 = bufferevent_pool_get(pool, sa, slen, NULL);
+	bev2 = bufferevent_pool_get(pool, sa, slen, NULL);
+	tt_assert(bev1);
+	tt_assert(bev2);
+	tt_assert(bev1 != bev2);
+	tt_ptr_op(bufferevent_pool_get(pool, sa, slen, NULL), ==, NULL);
+	/* A different tag is a different destination. */
+	bev3 = bufferevent_pool_get(pool, sa, slen, &tag);
+	tt_assert(bev3);
+
+	info.want_connected = 3;
+	bufferevent_setcb(bev1, NULL, NULL, pool_test_eventcb, &info);
+	bufferevent_setcb(bev2, NULL, NULL, pool_test_eventcb, &info);
+	bufferevent_setcb(bev3, NULL, NULL, pool_test_eventcb, &info);
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(info.n_connected, ==, 3);
+
+	/* A connection with data left over can't be reused. */
+	bufferevent_write(bev3, "x", 1);
+	tt_int_op(bufferevent_pool_put(pool, bev3), ==, -1);
+	bev3 = NULL;
+
+	tt_int_op(bufferevent_pool_put(pool, bev1), ==, 0);
+	tt_int_op(bufferevent_pool_put(pool, bev2), ==, 0);
+	tt_int_op(bufferevent_pool_put(pool, bev2), ==, -1);
+	bufferevent_pool_get_stats(pool, &stats);
+	tt_int_op(stats.n_idle, ==, 2);
+	tt_int_op(stats.n_active, ==, 0);
+
+	/* The connection that came back last goes out first. */
+	tt_ptr_op(bufferevent_pool_get(pool, sa, slen, NULL), ==, bev2);
+	tt_int_op(bufferevent_pool_put(pool, bev2), ==, 0);
+	bev1 = bev2 = NULL;
+
+	bufferevent_pool_get_stats(pool, &stats);
+	tt_int_op(stats.hits, ==, 1);
+	tt_int_op(stats.misses, ==, 3);
+	tt_int_op(stats.limited, ==, 1);
+	tt_int_op(stats.closed, ==, 0);
+
+	/* The peer hangs up on both idle connections. */
+	tt_int_op(info.n_accepted, ==, 3);
+	for (i = 0; i < info.n_accepted; ++i)
+		evutil_closesocket(info.accepted[i]);
+	info.n_accepted = 0;
+	pool_test_wait_idle_gone(data->base, pool);
+	bufferevent_pool_get_stats(pool, &stats);
+	tt_int_op(stats.n_idle, ==, 0);
+	tt_int_op(stats.closed, ==, 2);
+	bufferevent_pool_free(pool);
+
+	/* Idle connections expire. */
+	pool = bufferevent_pool_new(data->base, 0, &idle, NULL, NULL);
+	tt_assert(pool);
+	bev1 = bufferevent_pool_get(pool, sa, slen, NULL);
+	tt_assert(bev1);
+	info.n_connected = 0;
+	info.want_connected = 1;
+	bufferevent_setcb(bev1, NULL, NULL, pool_test_eventcb, &info);
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(info.n_connected, ==, 1);
+	tt_int_op(bufferevent_pool_put(pool, bev1), ==, 0);
+	bev1 = NULL;
+	pool_test_wait_idle_gone(data->base, pool);
+	bufferevent_pool_get_stats(pool, &stats);
+	tt_int_op(stats.expired, ==, 1);
+	tt_int_op(stats.closed, ==, 0);
+
+end:
+	for (i = 0; i < info.n_accepted; ++i)
+		evutil_closesocket(info.accepted[i]);
+	if (bev1)
+		bufferevent_free(bev1);
+	if (bev2)
+		bufferevent_free(bev2);
+	if (bev3)
+		bufferevent_free(bev3);
+	if (pool)
+		bufferevent_pool_free(pool);
+	if (lev)
+		evconnlistener_free(lev);
+}
+
+#define PROXY_TEST_BYTES (1024*1024)
+
+struct proxy_test_info;
+
+struct proxy_test_end {
+	struct proxy_test_info *info;
+	struct bufferevent *bev;
+	size_t got;
+	int bad;
+	int shut;
+	int eof;
+};
+
+struct proxy_test_info {
+	struct proxy_test_end end[2];
+	short proxy_what;
+};
+
+static void
+proxy_test_check_done(struct proxy_test_info *info)
+{
+	if (info->proxy_what && info->end[0].eof && info->end[1].eof)
+		event_base_loopexit(bufferevent_get_base(info->end[0].bev),
+		    NULL);
+}
+
+static void
+proxy_test_readcb(struct bufferevent *bev, void *arg)
+{
+	struct proxy_test_end *end = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	unsigned char buf[4096];
+	size_t n, i;
+
+	while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; ++i)
+			if (buf[i] != (unsigned char)((end->got + i) % 251))
+				end->bad = 1;
+		end->got += n;
+	}
+}
+
+static void
+proxy_test_writecb(struct bufferevent *bev, void *arg)
+{
+	struct proxy_test_end *end = arg;
+
+	/* Everything has gone out: hang up our half of the connection. */
+	if (!end->shut) {
+		end->shut = 1;
+		shutdown(bufferevent_getfd(bev), EVUTIL_SHUT_WR);
+	}
+}
+
+static void
+proxy_test_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct proxy_test_end *end = arg;
+
+	if (what & BEV_EVENT_EOF)
+		end->eof = 1;
+	else
+		TT_FAIL(("Unexpected event 0x%x", what));
+	proxy_test_check_done(end->info);
+}
+
+static void
+proxy_test_proxy_cb(struct bufferevent_proxy *proxy, short what, void *arg)
+{
+	struct proxy_test_info *info = arg;
+
+	info->proxy_what = what;
+	proxy_test_check_done(info);
+}
+
+static void
+test_bufferevent_proxy(void *arg)
+{
+	struct basic_test_data *data = arg;
+	const char *mode = data->setup_data;
+	struct bufferevent_proxy *proxy = NULL;
+	struct bufferevent *a = NULL, *b = NULL;
+	struct proxy_test_info info;
+	evutil_socket_t pair[2] = { -1, -1 };
+	struct timeval tv = { 10, 0 };
+	ev_uint64_t a_to_b, b_to_a;
+	unsigned char *payload = NULL;
+	int i;
+
+	memset(&info, 0, sizeof(info));
+	tt_assert(!evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	/* end[0] -- data->pair -- a <proxy> b -- pair -- end[1] */
+	info.end[0].bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_CLOSE_ON_FREE);
+	info.end[1].bev = bufferevent_socket_new(data->base, pair[1],
+	    BEV_OPT_CLOSE_ON_FREE);
+	a = bufferevent_socket_new(data->base, data->pair[1],
+	    BEV_OPT_CLOSE_ON_FREE);
+	b = bufferevent_socket_new(data->base, pair[0],
+	    BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(info.end[0].bev && info.end[1].bev && a && b);
+	data->pair[0] = data->pair[1] = pair[0] = pair[1] = -1;
+	if (!strcmp(mode, "filter")) {
+		/* A filter keeps the proxy from splicing. */
+		a = bufferevent_filter_new(a, NULL, NULL,
+		    BEV_OPT_CLOSE_ON_FREE, NULL, NULL);
+		tt_assert(a);
+	}
+
+	/* Something is already waiting to go out on one side: the first byte
+	 * of what end[1] gets. */
+	tt_assert(!bufferevent_write(b, "", 1));
+
+	proxy = bufferevent_proxy_new(a, b, BEV_OPT_CLOSE_ON_FREE,
+	    proxy_test_proxy_cb, &info);
+	tt_assert(proxy);
+	a = b = NULL;
+#ifdef EVENT__HAVE_SPLICE
+	tt_int_op(bufferevent_proxy_is_splicing(proxy), ==,
+	    !strcmp(mode, "splice"));
+#else
+	tt_assert(!bufferevent_proxy_is_splicing(proxy));
+#endif
+
+	payload = malloc(PROXY_TEST_BYTES);
+	tt_assert(payload);
+	for (i = 0; i < PROXY_TEST_BYTES; ++i)
+		payload[i] = (unsigned char)(i % 251);
+	for (i = 0; i < 2; ++i) {
+		info.end[i].info = &info;
+		bufferevent_setcb(info.end[i].bev, proxy_test_readcb,
+		    proxy_test_writecb, proxy_test_eventcb, &info.end[i]);
+		bufferevent_enable(info.end[i].bev, EV_READ|EV_WRITE);
+	}
+	/* A lot one way, a little the other. */
+	bufferevent_write(info.end[0].bev, payload + 1, PROXY_TEST_BYTES - 1);
+	bufferevent_write(info.end[1].bev, payload, 1000);
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(info.proxy_what, ==, BEV_EVENT_EOF);
+	tt_assert(info.end[0].eof);
+	tt_assert(info.end[1].eof);
+	tt_int_op(info.end[1].got, ==, PROXY_TEST_BYTES);
+	tt_int_op(info.end[0].got, ==, 1000);
+	tt_assert(!info.end[0].bad);
+	tt_assert(!info.end[1].bad);
+	bufferevent_proxy_get_totals(proxy, &a_to_b, &b_to_a);
+	tt_assert(a_to_b == PROXY_TEST_BYTES - 1);
+	tt_assert(b_to_a == 1000);
+
+end:
+	if (proxy)
+		bufferevent_proxy_free(proxy);
+	if (a)
+		bufferevent_free(a);
+	if (b)
+		bufferevent_free(b);
+	for (i = 0; i < 2; ++i) {
+		if (info.end[i].bev)
+			bufferevent_free(info.end[i].bev);
+	}
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	free(payload);
+}
+
+struct migrate_test_state {
+	struct event_base *read_base;
+	int n_reads;
+	int timed_out;
+	size_t received;
+};
+
+#define MIGRATE_TEST_SIZE (1024*1024)
+
+static void
+migrate_check_done(struct migrate_test_state *st, struct event_base *base)
+{
+	if (st->timed_out && st->received == MIGRATE_TEST_SIZE)
+		event_base_loopbreak(base);
+}
+
+static void
+migrate_readcb(struct bufferevent *bev, void *arg)
+{
+	struct migrate_test_state *st = arg;
+
+	st->read_base = bufferevent_get_base(bev);
+	++st->n_reads;
+}
+
+static void
+migrate_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct migrate_test_state *st = arg;
+
+	if (what == (BEV_EVENT_READING|BEV_EVENT_TIMEOUT))
+		st->timed_out = 1;
+	migrate_check_done(st, bufferevent_get_base(bev));
+}
+
+static void
+migrate_peer_readcb(struct bufferevent *bev, void *arg)
+{
+	struct migrate_test_state *st = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	st->received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	migrate_check_done(st, bufferevent_get_base(bev));
+}
+
+static void
+test_bufferevent_migrate(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base2 = NULL, *base3 = NULL;
+	struct bufferevent *bev = NULL, *peer = NULL;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct migrate_test_state st;
+	struct timeval tv_read = { 0, 200*1000 };
+	struct timeval tv_limit = { 10, 0 };
+	char *buf = NULL;
+
+	memset(&st, 0, sizeof(st));
+	base2 = event_base_new();
+	base3 = event_base_new();
+	tt_assert(base2 && base3);
+	buf = calloc(1, MIGRATE_TEST_SIZE);
+	tt_assert(buf);
+
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_DEFER_CALLBACKS);
+	peer = bufferevent_socket_new(base2, data->pair[1], 0);
+	tt_assert(bev && peer);
+	bufferevent_setcb(bev, migrate_readcb, NULL, migrate_eventcb, &st);
+	bufferevent_setcb(peer, migrate_peer_readcb, NULL, NULL, &st);
+
+	/* Leave the bufferevent with a write pending, a read pending with a
+	 * timeout, and a deferred read callback queued on its old base. */
+	tt_assert(!bufferevent_write(bev, buf, MIGRATE_TEST_SIZE));
+	tt_int_op(send(data->pair[1], "hello", 5, 0), ==, 5);
+	bufferevent_set_timeouts(bev, &tv_read, NULL);
+	bufferevent_enable(bev, EV_READ);
+	bufferevent_trigger(bev, EV_READ,
+	    BEV_TRIG_IGNORE_WATERMARKS|BEV_TRIG_DEFER_CALLBACKS);
+
+	tt_int_op(bufferevent_migrate(bev, base2), ==, 0);
+	tt_ptr_op(bufferevent_get_base(bev), ==, base2);
+
+	/* The old base has nothing left to do for it. */
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(st.n_reads, ==, 0);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==,
+	    MIGRATE_TEST_SIZE);
+
+	/* The new one picks up where it left off. */
+	bufferevent_enable(peer, EV_READ);
+	event_base_loopexit(base2, &tv_limit);
+	event_base_dispatch(base2);
+	tt_int_op(st.received, ==, MIGRATE_TEST_SIZE);
+	tt_int_op(st.timed_out, ==, 1);
+	tt_int_op(st.n_reads, >=, 1);
+	tt_ptr_op(st.read_base, ==, base2);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev)), ==, 5);
+
+	/* It keeps its priority, as far as the new base allows. */
+	tt_int_op(event_base_priority_init(data->base, 4), ==, 0);
+	tt_int_op(event_base_priority_init(base3, 3), ==, 0);
+	tt_int_op(bufferevent_migrate(bev, base3), ==, 0);
+	tt_int_op(bufferevent_priority_set(bev, 0), ==, 0);
+	tt_int_op(bufferevent_migrate(bev, data->base), ==, 0);
+	tt_int_op(bufferevent_get_priority(bev), ==, 0);
+	tt_int_op(bufferevent_priority_set(bev, 3), ==, 0);
+	tt_int_op(bufferevent_migrate(bev, base3), ==, 0);
+	tt_int_op(bufferevent_get_priority(bev), ==, 2);
+
+	/* Only socket bufferevents can move. */
+	tt_int_op(bufferevent_pair_new(data->base, 0, pair), ==, 0);
+	tt_int_op(bufferevent_migrate(pair[0], base2), ==, -1);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (bev)
+		bufferevent_free(bev);
+	if (peer)
+		bufferevent_free(peer);
+	if (base2)
+		event_base_free(base2);
+	if (base3)
+		event_base_free(base3);
+	if (buf)
+		free(buf);
+}
+
+#define STATS_TEST_SIZE 100000
+
+static void
+stats_readcb(struct bufferevent *bev, void *arg)
+{
+	size_t *received = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	*received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	if (*received == STATS_TEST_SIZE)
+		event_base_loopbreak(bufferevent_get_base(bev));
+}
+
+static void
+test_bufferevent_stats(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *writer = NULL, *reader = NULL, *plain = NULL;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct bufferevent_stats st;
+	struct timeval tv = { 5, 0 };
+	size_t received = 0;
+	char *buf = NULL;
+
+	buf = calloc(1, STATS_TEST_SIZE);
+	tt_assert(buf);
+	writer = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_STATS);
+	reader = bufferevent_socket_new(data->base, data->pair[1],
+	    BEV_OPT_STATS);
+	plain = bufferevent_socket_new(data->base, -1, 0);
+	tt_assert(writer && reader && plain);
+	tt_int_op(bufferevent_get_stats(plain, &st), ==, -1);
+
+	bufferevent_setcb(reader, stats_readcb, NULL, NULL, &received);
+	bufferevent_setwatermark(reader, EV_READ, 0, 4096);
+	bufferevent_enable(reader, EV_READ);
+	tt_assert(!bufferevent_write(writer, buf, STATS_TEST_SIZE));
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(received, ==, STATS_TEST_SIZE);
+
+	tt_int_op(bufferevent_get_stats(writer, &st), ==, 0);
+	tt_int_op(st.bytes_written, ==, STATS_TEST_SIZE);
+	tt_int_op(st.n_writes, >=, 1);
+	tt_int_op(st.bytes_read, ==, 0);
+	tt_int_op(st.max_output, ==, STATS_TEST_SIZE);
+	tt_int_op(st.output_busy.tv_sec, >=, 0);
+
+	tt_int_op(bufferevent_get_stats(reader, &st), ==, 0);
+	tt_int_op(st.bytes_read, ==, STATS_TEST_SIZE);
+	tt_int_op(st.n_reads, >=, STATS_TEST_SIZE / 4096);
+	tt_int_op(st.bytes_written, ==, 0);
+	tt_int_op(st.max_input, ==, 4096);
+	tt_int_op(st.n_read_suspended_wm, >=, 1);
+	tt_int_op(st.n_read_suspended_rate, ==, 0);
+
+	/* Pairs count what they hand each other. */
+	tt_int_op(bufferevent_pair_new(data->base, BEV_OPT_STATS, pair), ==, 0);
+	bufferevent_enable(pair[1], EV_READ);
+	tt_assert(!bufferevent_write(pair[0], "hello", 5));
+	tt_int_op(bufferevent_get_stats(pair[0], &st), ==, 0);
+	tt_int_op(st.bytes_written, ==, 5);
+	tt_int_op(st.n_writes, ==, 1);
+	tt_int_op(bufferevent_get_stats(pair[1], &st), ==, 0);
+	tt_int_op(st.bytes_read, ==, 5);
+	tt_int_op(st.max_input, ==, 5);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (writer)
+		bufferevent_free(writer);
+	if (reader)
+		bufferevent_free(reader);
+	if (plain)
+		bufferevent_free(plain);
+	if (buf)
+		free(buf);
+}
+
 struct testcase_t bufferevent_testcases[] = {
 
 	LEGACY(bufferevent, TT_ISOLATED),
@@ -1370,6 +2427,11 @@ struct testcase_t bufferevent_testcases[] = {
 	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"filter" },
 	{ "bufferevent_timeout_filter_pair", test_bufferevent_timeouts,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"filter pair" },
+	{ "bufferevent_timeout_lazy", test_bufferevent_timeouts,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup,
+	  (void*)"lazy" },
+	{ "bufferevent_lazy_timeout_reset", test_bufferevent_lazy_timeout_reset,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
 	{ "bufferevent_trigger", test_bufferevent_trigger, TT_FORK|TT_NEED_BASE,
 	  &basic_setup, (void*)"" },
 	{ "bufferevent_trigger_defer", test_bufferevent_trigger,
@@ -1402,6 +2464,31 @@ struct testcase_t bufferevent_testcases[] = {
 	{ "bufferevent_filter_data_stuck",
 	  test_bufferevent_filter_data_stuck,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_cork", test_bufferevent_cork,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_cork_tcp", test_bufferevent_cork_tcp,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_budget", test_bufferevent_budget,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_budget_ts", test_bufferevent_budget,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR|TT_NEED_THREADS,
+	  &basic_setup, (void*)"ts" },
+	{ "bufferevent_write_through", test_bufferevent_write_through,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_read_budget", test_bufferevent_read_budget,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_pool", test_bufferevent_pool,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_migrate", test_bufferevent_migrate,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_stats", test_bufferevent_stats,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_proxy_splice", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup,
+	  (void*)"splice" },
+	{ "bufferevent_proxy_filter", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup,
+	  (void*)"filter" },
 
 	END_OF_TESTCASES,
 };
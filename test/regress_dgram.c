@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util-internal.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+# ifdef _XOPEN_SOURCE_EXTENDED
+#  include <arpa/inet.h>
+# endif
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include "event2/dgram.h"
+#include "event2/event.h"
+#include "event2/util.h"
+
+#include "regress.h"
+#include "tinytest.h"
+#include "tinytest_macros.h"
+
+#define N_ECHO 100
+
+/* Bind an evdgram to a free port on localhost, and say which. */
+static struct evdgram *
+dgram_bind_localhost(struct event_base *base, unsigned flags,
+    size_t max_packet, struct sockaddr_in *sin)
+{
+	struct evdgram *dg;
+	ev_socklen_t socklen = sizeof(*sin);
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x7f000001);
+	dg = evdgram_new_bind(base, flags, max_packet,
+	    (struct sockaddr *)sin, sizeof(*sin));
+	if (!dg)
+		return NULL;
+	if (getsockname(evdgram_get_fd(dg), (struct sockaddr *)sin,
+		&socklen) < 0) {
+		evdgram_free(dg);
+		return NULL;
+	}
+	return dg;
+}
+
+/* Send every packet straight back where it came from. */
+static void
+echo_server_readcb(struct evdgram *dg, void *arg)
+{
+	struct evdgram_packet *pkt;
+
+	while ((pkt = evdgram_recv_packet(dg)))
+		evdgram_send_packet(dg, pkt, evdgram_packet_length(pkt),
+		    NULL, 0);
+}
+
+struct echo_client_state {
+	struct sockaddr_in server;
+	int n_got;
+	int n_bad;
+};
+
+static void
+echo_client_readcb(struct evdgram *dg, void *arg)
+{
+	struct echo_client_state *st = arg;
+	unsigned char buf[256];
+	struct sockaddr_in from;
+	ev_socklen_t fromlen;
+	ev_ssize_t len;
+	ev_ssize_t i;
+
+	for (;;) {
+		fromlen = sizeof(from);
+		len = evdgram_recv(dg, buf, sizeof(buf),
+		    (struct sockaddr *)&from, &fromlen);
+		if (len < 0)
+			break;
+		/* Packet n is n+1 bytes of n. */
+		if (len < 1 || len > N_ECHO ||
+		    fromlen != sizeof(from) ||
+		    from.sin_port != st->server.sin_port)
+			++st->n_bad;
+		for (i = 0; i < len; ++i)
+			if (buf[i] != buf[0] || buf[0] != len - 1)
+				++st->n_bad;
+		if (++st->n_got == N_ECHO)
+			event_base_loopbreak(evdgram_get_base(dg));
+	}
+}
+
+static void
+test_dgram_echo(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evdgram *server = NULL, *client = NULL;
+	struct echo_client_state st;
+	struct sockaddr_in client_sin;
+	struct timeval tv = { 5, 0 };
+	unsigned flags = 0;
+	unsigned char buf[N_ECHO];
+	int i;
+
+	if (strstr((char *)data->setup_data, "ts"))
+		flags |= EVDGRAM_OPT_THREADSAFE;
+	memset(&st, 0, sizeof(st));
+
+	server = dgram_bind_localhost(data->base, flags, 0, &st.server);
+	client = dgram_bind_localhost(data->base, flags, 0, &client_sin);
+	tt_assert(server && client);
+	/* Small batches, to be sure we take more than one. */
+	tt_int_op(evdgram_set_batch(server, 8, 0), ==, 0);
+	evdgram_setcb(server, echo_server_readcb, NULL, NULL, NULL);
+	evdgram_setcb(client, echo_client_readcb, NULL, NULL, &st);
+	tt_int_op(evdgram_enable(server, EV_READ), ==, 0);
+	tt_int_op(evdgram_enable(client, EV_READ), ==, 0);
+
+	for (i = 0; i < N_ECHO; ++i) {
+		memset(buf, i, i + 1);
+		tt_int_op(evdgram_send(client, buf, i + 1,
+			(struct sockaddr *)&st.server, sizeof(st.server)), ==, 0);
+	}
+	tt_int_op(evdgram_get_output_count(client), ==, N_ECHO);
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(st.n_got, ==, N_ECHO);
+	tt_int_op(st.n_bad, ==, 0);
+	tt_int_op(evdgram_get_output_count(client), ==, 0);
+	tt_int_op(evdgram_get_output_count(server), ==, 0);
+
+end:
+	if (server)
+		evdgram_free(server);
+	if (client)
+		evdgram_free(client);
+}
+
+static int n_writecb;
+
+static void
+count_writecb(struct evdgram *dg, void *arg)
+{
+	++n_writecb;
+}
+
+static void
+dgram_loop_briefly(struct event_base *base)
+{
+	struct timeval tv = { 0, 100*1000 };
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+}
+
+static void
+test_dgram_watermarks(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evdgram *server = NULL, *client = NULL;
+	struct evdgram_packet *pkt = NULL;
+	struct sockaddr_in server_sin, client_sin;
+	char buf[32];
+	int i;
+
+	server = dgram_bind_localhost(data->base, 0, 16, &server_sin);
+	client = dgram_bind_localhost(data->base, 0, 0, &client_sin);
+	tt_assert(server && client);
+	evdgram_setwatermark(server, EV_READ, 0, 4);
+	tt_int_op(evdgram_enable(server, EV_READ), ==, 0);
+
+	/* The sender's queue is full at its high watermark. */
+	evdgram_setcb(client, NULL, count_writecb, NULL, NULL);
+	evdgram_setwatermark(client, EV_WRITE, 0, 10);
+	tt_int_op(evdgram_disable(client, EV_WRITE), ==, 0);
+	memset(buf, 'x', sizeof(buf));
+	for (i = 0; i < 10; ++i)
+		tt_int_op(evdgram_send(client, buf, i == 0 ? 32 : 8,
+			(struct sockaddr *)&server_sin, sizeof(server_sin)),
+		    ==, 0);
+	tt_int_op(evdgram_send(client, buf, 8,
+		(struct sockaddr *)&server_sin, sizeof(server_sin)), ==, -1);
+	/* ... and never takes more than max_packet. */
+	tt_int_op(evdgram_send(server, buf, 17,
+		(struct sockaddr *)&client_sin, sizeof(client_sin)), ==, -1);
+	dgram_loop_briefly(data->base);
+	tt_int_op(evdgram_get_output_count(client), ==, 10);
+	tt_int_op(n_writecb, ==, 0);
+
+	tt_int_op(evdgram_enable(client, EV_WRITE), ==, 0);
+	dgram_loop_briefly(data->base);
+	tt_int_op(evdgram_get_output_count(client), ==, 0);
+	tt_int_op(n_writecb, ==, 1);
+
+	/* The receiver stops at its high watermark... */
+	tt_int_op(evdgram_get_input_count(server), ==, 4);
+	pkt = evdgram_recv_packet(server);
+	tt_assert(pkt);
+	tt_int_op(evdgram_packet_length(pkt), ==, 16);
+	tt_assert(evdgram_packet_truncated(pkt));
+	tt_assert(evdgram_packet_addr(pkt, NULL));
+	evdgram_packet_free(server, pkt);
+	pkt = NULL;
+	dgram_loop_briefly(data->base);
+	tt_int_op(evdgram_get_input_count(server), ==, 4);
+
+	/* ... and goes on once there is room. */
+	for (i = 0; i < 4; ++i) {
+		tt_int_op(evdgram_recv(server, buf, sizeof(buf), NULL, NULL),
+		    ==, 8);
+	}
+	dgram_loop_briefly(data->base);
+	tt_int_op(evdgram_get_input_count(server), ==, 4);
+	for (i = 0; i < 4; ++i) {
+		tt_int_op(evdgram_recv(server, buf, sizeof(buf), NULL, NULL),
+		    ==, 8);
+	}
+	dgram_loop_briefly(data->base);
+	tt_int_op(evdgram_get_input_count(server), ==, 1);
+	tt_int_op(evdgram_recv(server, buf, sizeof(buf), NULL, NULL), ==, 8);
+	tt_int_op(evdgram_recv(server, buf, sizeof(buf), NULL, NULL), ==, -1);
+
+end:
+	if (pkt)
+		evdgram_packet_free(server, pkt);
+	if (server)
+		evdgram_free(server);
+	if (client)
+		evdgram_free(client);
+}
+
+struct testcase_t dgram_testcases[] = {
+	{ "echo", test_dgram_echo, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, (char*)"" },
+	{ "echo_ts", test_dgram_echo, TT_FORK|TT_NEED_BASE|TT_NEED_THREADS,
+	  &basic_setup, (char*)"ts" },
+	{ "watermarks", test_dgram_watermarks, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+
+	END_OF_TESTCASES,
+};
@@ -1122,6 +1122,43 @@ be_getaddrinfo_server_cb(struct evdns_server_request *req, void *data)
 				evdns_server_request_drop(req);
 				return;
 			}
+		} else if (!evutil_ascii_strcasecmp(qname,
+			"he-v6refused.example.com") ||
+		    !evutil_ascii_strcasecmp(qname, "he-v6lost.example.com")) {
+			/* 127.0.0.1 works; ::1 refuses, or never gets
+			 * an answer at all. */
+			if (qtype == EVDNS_TYPE_A) {
+				ans.s_addr = htonl(0x7f000001);
+				evdns_server_request_add_a_reply(req, qname,
+				    1, &ans.s_addr, 2000);
+				added_any = 1;
+			} else if (qtype == EVDNS_TYPE_AAAA &&
+			    !evutil_ascii_strcasecmp(qname,
+				"he-v6refused.example.com")) {
+				ans6.s6_addr[15] = 1;
+				evdns_server_request_add_aaaa_reply(req, qname,
+				    1, &ans6.s6_addr, 2000);
+				added_any = 1;
+			} else if (qtype == EVDNS_TYPE_AAAA) {
+				evdns_server_request_drop(req);
+				return;
+			}
+		} else if (!evutil_ascii_strcasecmp(qname,
+			"he-unreachable.example.com")) {
+			/* Multicast addresses, which we can't connect to. */
+			if (qtype == EVDNS_TYPE_A) {
+				ans.s_addr = htonl(0xe0000001); /* 224.0.0.1 */
+				evdns_server_request_add_a_reply(req, qname,
+				    1, &ans.s_addr, 2000);
+				added_any = 1;
+			} else if (qtype == EVDNS_TYPE_AAAA) {
+				ans6.s6_addr[0] = 0xff; /* ff02::1 */
+				ans6.s6_addr[1] = 0x02;
+				ans6.s6_addr[15] = 1;
+				evdns_server_request_add_aaaa_reply(req, qname,
+				    1, &ans6.s6_addr, 2000);
+				added_any = 1;
+			}
 		} else if (!evutil_ascii_strcasecmp(qname,
 			"all-timeout.example.com")) {
 			/* drop all requests */
@@ -1317,6 +1354,143 @@ end:
 }
 
 
+struct be_connect_race_result {
+	int what;
+	int family;
+	int dnserr;
+	int sockerr;
+	struct timeval at;
+};
+
+static int be_connect_race_n_done = 0;
+
+static void
+be_connect_race_accept_cb(struct evconnlistener *l, evutil_socket_t fd,
+    struct sockaddr *s, int socklen, void *arg)
+{
+	int *p = arg;
+	++*p;
+	evutil_closesocket(fd);
+}
+
+static void
+be_connect_race_event_cb(struct bufferevent *bev, short what, void *ctx)
+{
+	struct be_connect_race_result *res = ctx;
+	struct sockaddr_storage ss;
+	ev_socklen_t socklen = sizeof(ss);
+
+	if (res->what)
+		return;
+	res->what = what;
+	res->sockerr = EVUTIL_SOCKET_ERROR();
+	res->dnserr = bufferevent_socket_get_dns_error(bev);
+	evutil_gettimeofday(&res->at, NULL);
+	if ((what & BEV_EVENT_CONNECTED) &&
+	    !getpeername(bufferevent_getfd(bev), (struct sockaddr *)&ss,
+		&socklen))
+		res->family = ss.ss_family;
+	if (++be_connect_race_n_done == 3)
+		event_base_loopexit(be_connect_hostname_base, NULL);
+}
+
+static void
+test_bufferevent_connect_hostname_race(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evconnlistener *listener = NULL;
+	struct bufferevent *be1 = NULL, *be2 = NULL, *be3 = NULL;
+	struct be_connect_race_result res1, res2, res3;
+	struct evdns_base *dns = NULL;
+	struct evdns_server_port *port = NULL;
+	struct sockaddr_in sin;
+	struct timeval started_at, tv = { 5, 0 };
+	int listener_port = -1;
+	ev_uint16_t dns_port = 0;
+	int n_accept = 0, n_dns = 0;
+	char buf[128];
+
+	memset(&res1, 0, sizeof(res1));
+	memset(&res2, 0, sizeof(res2));
+	memset(&res3, 0, sizeof(res3));
+	be_connect_hostname_base = data->base;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
+	listener = evconnlistener_new_bind(data->base, be_connect_race_accept_cb,
+	    &n_accept, LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_EXEC,
+	    -1, (struct sockaddr *)&sin, sizeof(sin));
+	tt_assert(listener);
+	listener_port = regress_get_socket_port(
+		evconnlistener_get_fd(listener));
+
+	port = regress_get_dnsserver(data->base, &dns_port, NULL,
+	    be_getaddrinfo_server_cb, &n_dns);
+	tt_assert(port);
+	dns = evdns_base_new(data->base, 0);
+	tt_assert(dns);
+	evutil_snprintf(buf, sizeof(buf), "127.0.0.1:%d", (int)dns_port);
+	tt_assert(!evdns_base_nameserver_ip_add(dns, buf));
+	/* Far longer than a connect should take. */
+	tt_assert(!evdns_base_set_option(dns, "timeout", "3"));
+
+	be1 = bufferevent_socket_new(data->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	be2 = bufferevent_socket_new(data->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(be1);
+	tt_assert(be2);
+	bufferevent_setcb(be1, NULL, NULL, be_connect_race_event_cb, &res1);
+	bufferevent_setcb(be2, NULL, NULL, be_connect_race_event_cb, &res2);
+	be3 = bufferevent_socket_new(data->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(be3);
+	bufferevent_setcb(be3, NULL, NULL, be_connect_race_event_cb, &res3);
+
+	evutil_gettimeofday(&started_at, NULL);
+	/* ::1 is tried first and refuses; 127.0.0.1 takes over. */
+	tt_assert(!bufferevent_socket_connect_hostname(be1, dns, AF_UNSPEC,
+		"he-v6refused.example.com", listener_port));
+	/* No IPv6 answer ever comes; we must not wait for it. */
+	tt_assert(!bufferevent_socket_connect_hostname(be2, dns, AF_UNSPEC,
+		"he-v6lost.example.com", listener_port));
+	/* We can't even start connecting to any of the addresses; that is
+	 * not a DNS error. */
+	tt_assert(!bufferevent_socket_connect_hostname(be3, dns, AF_UNSPEC,
+		"he-unreachable.example.com", listener_port));
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(res1.what, ==, BEV_EVENT_CONNECTED);
+	tt_int_op(res1.family, ==, AF_INET);
+	tt_int_op(res1.dnserr, ==, 0);
+	tt_int_op(res2.what, ==, BEV_EVENT_CONNECTED);
+	tt_int_op(res2.family, ==, AF_INET);
+	tt_int_op(res2.dnserr, ==, 0);
+	tt_int_op(timeval_msec_diff(&started_at, &res2.at), <, 1000);
+	tt_int_op(res3.what, ==, BEV_EVENT_ERROR);
+	tt_int_op(res3.dnserr, ==, 0);
+	tt_int_op(res3.sockerr, !=, 0);
+	tt_int_op(n_accept, ==, 2);
+	tt_int_op(n_dns, ==, 6);
+
+end:
+	if (be1)
+		bufferevent_free(be1);
+	if (be2)
+		bufferevent_free(be2);
+	if (be3)
+		bufferevent_free(be3);
+	/* Let the lookup we gave up on say so. */
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	if (listener)
+		evconnlistener_free(listener);
+	if (port)
+		evdns_close_server_port(port);
+	if (dns)
+		evdns_base_free(dns, 0);
+}
+
+
 struct gai_outcome {
 	int err;
 	struct evutil_addrinfo *ai;
@@ -2138,6 +2312,9 @@ struct testcase_t dns_testcases[] = {
 	{ "inflight", dns_inflight_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "bufferevent_connect_hostname", test_bufferevent_connect_hostname,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_connect_hostname_race",
+	  test_bufferevent_connect_hostname_race,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "disable_when_inactive", dns_disable_when_inactive_test,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "disable_when_inactive_no_ns", dns_disable_when_inactive_no_ns_test,
@@ -56,6 +56,8 @@
 
 #include "event2/event.h"
 #include "event2/event_struct.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
 #include "event2/thread.h"
 #include "event2/util.h"
 #include "evthread-internal.h"
@@ -564,6 +566,241 @@ end:
 	;
 }
 
+#define SPSC_N_RECORDS 20000
+
+struct spsc_test {
+	struct event_base *base;
+	struct evbuffer_spsc *spsc;
+	ev_uint32_t next;
+	int n_publish;
+	int n_cb;
+	int bad;
+};
+
+static THREAD_FN
+spsc_producer(void *arg)
+{
+	struct spsc_test *st = arg;
+	struct evbuffer *buf = evbuffer_spsc_get_producer_buffer(st->spsc);
+	ev_uint32_t i;
+
+	for (i = 0; i < SPSC_N_RECORDS; ++i) {
+		evbuffer_add(buf, &i, sizeof(i));
+		if (i % 7 == 0) {
+			/* Reserve some space, which must survive publishing */
+			evbuffer_expand(buf, 1024);
+			if (evbuffer_spsc_publish(st->spsc) < 0)
+				st->bad = 1;
+			++st->n_publish;
+		}
+		if (i % 1000 == 0)
+			SLEEP_MS(1);
+	}
+	if (evbuffer_spsc_publish(st->spsc) < 0)
+		st->bad = 1;
+	++st->n_publish;
+
+	THREAD_RETURN();
+}
+
+static void
+spsc_consumer_cb(struct evbuffer_spsc *spsc, struct evbuffer *buf, void *arg)
+{
+	struct spsc_test *st = arg;
+	ev_uint32_t v;
+
+	++st->n_cb;
+	while (evbuffer_remove(buf, &v, sizeof(v)) == sizeof(v)) {
+		if (v != st->next++)
+			st->bad = 1;
+	}
+	if (evbuffer_get_length(buf) != 0)
+		st->bad = 1;
+	if (st->next == SPSC_N_RECORDS)
+		event_base_loopbreak(st->base);
+}
+
+static void
+thread_spsc_buffer(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct spsc_test st;
+	struct timeval tv = { 10, 0 };
+	THREAD_T thread;
+
+	memset(&st, 0, sizeof(st));
+	st.base = data->base;
+	st.spsc = evbuffer_spsc_new(data->base, spsc_consumer_cb, &st);
+	tt_assert(st.spsc);
+
+	event_base_loopexit(data->base, &tv);
+	THREAD_START(thread, spsc_producer, &st);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	THREAD_JOIN(thread);
+
+	tt_assert(event_base_got_break(data->base));
+	tt_assert(!st.bad);
+	tt_int_op(st.next, ==, SPSC_N_RECORDS);
+	/* We are woken at most once per publish, usually far less often. */
+	tt_int_op(st.n_cb, >=, 1);
+	tt_int_op(st.n_cb, <=, st.n_publish);
+	TT_BLATHER(("%d publishes, %d wakeups", st.n_publish, st.n_cb));
+
+	/* The producer's reserved space stayed behind, and nothing is left
+	 * to collect. */
+	tt_int_op(evbuffer_get_length(
+	    evbuffer_spsc_get_producer_buffer(st.spsc)), ==, 0);
+	tt_int_op(evbuffer_spsc_collect(st.spsc), ==, 0);
+
+	/* Data published while the consumer buffer is frozen waits. */
+	evbuffer_add(evbuffer_spsc_get_producer_buffer(st.spsc), "abc", 3);
+	tt_int_op(evbuffer_spsc_publish(st.spsc), ==, 0);
+	evbuffer_freeze(evbuffer_spsc_get_consumer_buffer(st.spsc), 0);
+	tt_int_op(evbuffer_spsc_collect(st.spsc), ==, -1);
+	evbuffer_unfreeze(evbuffer_spsc_get_consumer_buffer(st.spsc), 0);
+	evbuffer_add(evbuffer_spsc_get_producer_buffer(st.spsc), "def", 3);
+	tt_int_op(evbuffer_spsc_publish(st.spsc), ==, 0);
+	tt_int_op(evbuffer_spsc_collect(st.spsc), ==, 6);
+	tt_int_op(evbuffer_get_length(
+	    evbuffer_spsc_get_consumer_buffer(st.spsc)), ==, 6);
+	tt_assert(!memcmp(evbuffer_pullup(
+	    evbuffer_spsc_get_consumer_buffer(st.spsc), 6), "abcdef", 6));
+
+	/* Uncollected data is freed with the spsc. */
+	evbuffer_add(evbuffer_spsc_get_producer_buffer(st.spsc), "ghi", 3);
+	tt_int_op(evbuffer_spsc_publish(st.spsc), ==, 0);
+
+end:
+	if (st.spsc)
+		evbuffer_spsc_free(st.spsc);
+}
+
+#define PAIR_CROSS_N_RECORDS 100000
+
+struct pair_cross_test {
+	struct event_base *worker_base;
+	struct bufferevent *worker;
+	ev_uint32_t sent;
+	ev_uint32_t next;
+	int eof;
+	int bad;
+};
+
+/* The worker echoes everything back, and hangs up when we do. */
+static void
+pair_cross_worker_readcb(struct bufferevent *bev, void *arg)
+{
+	bufferevent_write_buffer(bev, bufferevent_get_input(bev));
+}
+
+static void
+pair_cross_worker_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct pair_cross_test *pt = arg;
+
+	if (what != (BEV_EVENT_EOF|BEV_EVENT_READING))
+		pt->bad = 1;
+	bufferevent_free(bev);
+	pt->worker = NULL;
+	event_base_loopexit(pt->worker_base, NULL);
+}
+
+static THREAD_FN
+pair_cross_worker(void *arg)
+{
+	struct pair_cross_test *pt = arg;
+
+	event_base_loop(pt->worker_base, EVLOOP_NO_EXIT_ON_EMPTY);
+	THREAD_RETURN();
+}
+
+/* Keep a few records in flight, to make the worker's base go idle and be
+ * woken up again. */
+static void
+pair_cross_send(struct bufferevent *bev, struct pair_cross_test *pt)
+{
+	while (pt->sent < PAIR_CROSS_N_RECORDS && pt->sent - pt->next < 500) {
+		bufferevent_write(bev, &pt->sent, sizeof(pt->sent));
+		++pt->sent;
+	}
+}
+
+static void
+pair_cross_readcb(struct bufferevent *bev, void *arg)
+{
+	struct pair_cross_test *pt = arg;
+	ev_uint32_t v;
+
+	while (bufferevent_read(bev, &v, sizeof(v)) == sizeof(v)) {
+		if (v != pt->next++)
+			pt->bad = 1;
+	}
+	if (pt->next == PAIR_CROSS_N_RECORDS)
+		bufferevent_flush(bev, EV_WRITE, BEV_FINISHED);
+	else
+		pair_cross_send(bev, pt);
+}
+
+static void
+pair_cross_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct pair_cross_test *pt = arg;
+
+	if (what == (BEV_EVENT_EOF|BEV_EVENT_READING))
+		pt->eof = 1;
+	else
+		pt->bad = 1;
+	event_base_loopbreak(bufferevent_get_base(bev));
+}
+
+static void
+thread_pair_cross(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct pair_cross_test pt;
+	struct timeval tv = { 10, 0 };
+	THREAD_T thread;
+
+	memset(&pt, 0, sizeof(pt));
+	pt.worker_base = event_base_new();
+	tt_assert(pt.worker_base);
+	tt_assert(!bufferevent_pair_new_cross(data->base, pt.worker_base,
+		    BEV_OPT_THREADSAFE, pair));
+	pt.worker = pair[1];
+	bufferevent_setcb(pair[1], pair_cross_worker_readcb, NULL,
+	    pair_cross_worker_eventcb, &pt);
+	bufferevent_enable(pair[1], EV_READ);
+	bufferevent_setcb(pair[0], pair_cross_readcb, NULL,
+	    pair_cross_eventcb, &pt);
+	bufferevent_enable(pair[0], EV_READ);
+	tt_ptr_op(bufferevent_pair_get_partner(pair[0]), ==, NULL);
+
+	THREAD_START(thread, pair_cross_worker, &pt);
+	pair_cross_send(pair[0], &pt);
+	event_base_loopexit(data->base, &tv);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	THREAD_JOIN(thread);
+
+	tt_assert(!pt.bad);
+	tt_int_op(pt.next, ==, PAIR_CROSS_N_RECORDS);
+	/* The worker freed its end when we hung up, which we saw as EOF. */
+	tt_assert(pt.eof);
+	tt_ptr_op(pt.worker, ==, NULL);
+
+end:
+	if (pt.worker)
+		bufferevent_free(pt.worker);
+	if (pt.worker_base) {
+		/* Let the worker's end finish being freed, then free its base
+		 * before we free our end, which must not need it. */
+		event_base_loop(pt.worker_base, EVLOOP_NONBLOCK);
+		event_base_free(pt.worker_base);
+	}
+	if (pair[0])
+		bufferevent_free(pair[0]);
+}
+
 #define TEST(name)							\
 	{ #name, thread_##name, TT_FORK|TT_NEED_THREADS|TT_NEED_BASE,	\
 	  &basic_setup, NULL }
@@ -585,6 +822,8 @@ struct testcase_t thread_testcases[] = {
 	 ******/
 	TEST(no_events),
 #endif
+	TEST(spsc_buffer),
+	TEST(pair_cross),
 	END_OF_TESTCASES
 };
 
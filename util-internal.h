@@ -394,6 +394,7 @@ int evutil_hex_char_to_int_(char c);
 
 void evutil_free_secure_rng_globals_(void);
 void evutil_free_globals_(void);
+void evbuffer_free_globals_(void);
 
 #ifdef _WIN32
 HMODULE evutil_load_windows_system_library_(const TCHAR *library_name);